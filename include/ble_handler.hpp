@@ -2,8 +2,17 @@
 
 #include "ble/BLE.h"
 #include "ble/Gap.h"
+#include "ble/GattServer.h"
 #include "events/mbed_events.h"
 #include "globals.hpp"
+#include "telemetry.hpp"
+#include "stream_packer.hpp"
+#include "notify_policy.hpp"
+#include "symptom_log.hpp"
+#include "episodes.hpp"
+#include "symptom_stats.hpp"
+
+#include <atomic>
 
 // UUIDs for the Service and Characteristics
 // You can generate your own UUIDs, these are placeholders
@@ -11,8 +20,31 @@ inline constexpr const char* PARKINSON_SERVICE_UUID = "4fafc201-1fb5-459e-8fcc-c
 inline constexpr const char* TREMOR_CHAR_UUID       = "beb5483e-36e1-4688-b7f5-ea07361b26a8";
 inline constexpr const char* DYSKINESIA_CHAR_UUID   = "825eef3b-e10c-4a60-9b9c-f929c1e997b9";
 inline constexpr const char* FOG_CHAR_UUID          = "c7333083-b830-4542-97c3-07027f51f404";
-
-class ParkinsonBLE : private mbed::NonCopyable<ParkinsonBLE>, public ble::Gap::EventHandler {
+// Packed TelemetryFrame per window (see telemetry.hpp); the only characteristic that notifies
+inline constexpr const char* TELEMETRY_CHAR_UUID    = "5b1e7a9c-3f0d-4c52-9a61-2d8e4f7b1c03";
+// Raw or spectral packets (see stream_packer.hpp) while a streaming mode is on
+inline constexpr const char* STREAM_CHAR_UUID       = "5b1e7a9c-3f0d-4c52-9a61-2d8e4f7b1c04";
+// Write one byte (StreamMode) to pick a mode; read for the StreamStatus counters.
+// STREAM_HISTORY may be followed by a u32 page sequence to start the download from (default: oldest)
+inline constexpr const char* STREAM_CONTROL_CHAR_UUID = "5b1e7a9c-3f0d-4c52-9a61-2d8e4f7b1c05";
+// NotifyPolicyConfig (see notify_policy.hpp) deciding which windows the telemetry characteristic notifies
+inline constexpr const char* NOTIFY_POLICY_CHAR_UUID = "5b1e7a9c-3f0d-4c52-9a61-2d8e4f7b1c06";
+// EpisodeEvent (see episodes.hpp) whenever a symptom episode starts or ends. Centrals that only want
+// episodes can quiet per-window telemetry with a notify policy of large deadbands and no staleness limit.
+inline constexpr const char* EPISODE_CHAR_UUID = "5b1e7a9c-3f0d-4c52-9a61-2d8e4f7b1c07";
+// StatsSummary (see symptom_stats.hpp): percentiles and time above threshold since the last reset.
+// Write STATS_COMMAND_RESET to start over.
+inline constexpr const char* STATS_CHAR_UUID = "5b1e7a9c-3f0d-4c52-9a61-2d8e4f7b1c08";
+// One symptom's serialized quantile sketch, for merging days on a host. Write a symptom number to pick which.
+inline constexpr const char* SKETCH_CHAR_UUID = "5b1e7a9c-3f0d-4c52-9a61-2d8e4f7b1c09";
+
+#define STATS_COMMAND_RESET 1
+
+// How often queued stream packets are offered to the stack while a stream is on, besides whenever it
+// reports some sent
+#define STREAM_PUMP_INTERVAL 20ms
+
+class ParkinsonBLE : private mbed::NonCopyable<ParkinsonBLE>, public ble::Gap::EventHandler, public ble::GattServer::EventHandler {
 public:
     ParkinsonBLE(events::EventQueue &event_queue) :
         _event_queue(event_queue),
@@ -22,22 +54,80 @@ public:
             (uint8_t *)&_tremor_value,
             sizeof(float),
             sizeof(float),
-            GattCharacteristic::BLE_GATT_CHAR_PROPERTIES_NOTIFY | GattCharacteristic::BLE_GATT_CHAR_PROPERTIES_READ
+            GattCharacteristic::BLE_GATT_CHAR_PROPERTIES_READ
         ),
         _dyskinesia_char(
             UUID(DYSKINESIA_CHAR_UUID),
             (uint8_t *)&_dyskinesia_value,
             sizeof(float),
             sizeof(float),
-            GattCharacteristic::BLE_GATT_CHAR_PROPERTIES_NOTIFY | GattCharacteristic::BLE_GATT_CHAR_PROPERTIES_READ
+            GattCharacteristic::BLE_GATT_CHAR_PROPERTIES_READ
         ),
         _fog_char(
             UUID(FOG_CHAR_UUID),
             (uint8_t *)&_fog_value,
             sizeof(float),
             sizeof(float),
+            GattCharacteristic::BLE_GATT_CHAR_PROPERTIES_READ
+        ),
+        _telemetry_char(
+            UUID(TELEMETRY_CHAR_UUID),
+            _telemetry_value,
+            0,
+            TELEMETRY_MAX_SIZE,
+            GattCharacteristic::BLE_GATT_CHAR_PROPERTIES_NOTIFY | GattCharacteristic::BLE_GATT_CHAR_PROPERTIES_READ,
+            nullptr,
+            0,
+            true // Frames grow with the MTU
+        ),
+        _stream_char(
+            UUID(STREAM_CHAR_UUID),
+            _stream_value,
+            0,
+            STREAM_PACKET_MAX,
+            GattCharacteristic::BLE_GATT_CHAR_PROPERTIES_NOTIFY,
+            nullptr,
+            0,
+            true
+        ),
+        _stream_control_char(
+            UUID(STREAM_CONTROL_CHAR_UUID),
+            _stream_control_value,
+            STREAM_STATUS_SIZE,
+            STREAM_STATUS_SIZE,
+            GattCharacteristic::BLE_GATT_CHAR_PROPERTIES_READ | GattCharacteristic::BLE_GATT_CHAR_PROPERTIES_WRITE,
+            nullptr,
+            0,
+            true // Writes are a single byte
+        ),
+        _notify_policy_char(
+            UUID(NOTIFY_POLICY_CHAR_UUID),
+            _notify_policy_value,
+            NOTIFY_POLICY_SIZE,
+            NOTIFY_POLICY_SIZE,
+            GattCharacteristic::BLE_GATT_CHAR_PROPERTIES_READ | GattCharacteristic::BLE_GATT_CHAR_PROPERTIES_WRITE
+        ),
+        _episode_char(
+            UUID(EPISODE_CHAR_UUID),
+            _episode_value,
+            EPISODE_EVENT_SIZE,
+            EPISODE_EVENT_SIZE,
             GattCharacteristic::BLE_GATT_CHAR_PROPERTIES_NOTIFY | GattCharacteristic::BLE_GATT_CHAR_PROPERTIES_READ
         ),
+        _stats_char(
+            UUID(STATS_CHAR_UUID),
+            _stats_value,
+            STATS_SUMMARY_SIZE,
+            STATS_SUMMARY_SIZE,
+            GattCharacteristic::BLE_GATT_CHAR_PROPERTIES_READ | GattCharacteristic::BLE_GATT_CHAR_PROPERTIES_WRITE
+        ),
+        _sketch_char(
+            UUID(SKETCH_CHAR_UUID),
+            _sketch_value,
+            0,
+            STATS_SKETCH_MAX_SIZE,
+            GattCharacteristic::BLE_GATT_CHAR_PROPERTIES_READ | GattCharacteristic::BLE_GATT_CHAR_PROPERTIES_WRITE
+        ),
         _adv_data_builder(_adv_buffer, sizeof(_adv_buffer))
     {
     }
@@ -46,11 +136,26 @@ public:
 
     void init();
 
-    void updateTremor(float value);
+    // The update functions are called from the output thread. Cordio's GattServer isn't thread safe, so
+    // they post the actual writes to the BLE event queue; every GATT write happens on the BLE thread.
 
-    void updateDyskinesia(float value);
+    /** Send one window's results as a single notification, packed to fit the connection's MTU,
+     * if the notify policy thinks it's worth it. The separate tremor/dyskinesia/FOG characteristics
+     * are always updated, for reading only.
+     */
+    void updateTelemetry(const TelemetryFrame &frame);
 
-    void updateFreezingGait(float value);
+    /** Notify an episode event. Stays readable as the latest one. */
+    void updateEpisode(const EpisodeEvent &event);
+
+    /** Refresh the statistics characteristic and the selected symptom's sketch. Output thread. */
+    void updateStatistics(const StatsSummary &summary, SymptomStats &stats);
+
+    /** True once after a central wrote STATS_COMMAND_RESET */
+    bool takeStatisticsReset() { return _stats_reset_requested.exchange(false); }
+
+    /** Where STREAM_HISTORY downloads come from; null (the default) disables them */
+    void setHistory(SymptomLog *history) { _history = history; }
 
 private:
 
@@ -64,6 +169,27 @@ private:
     
     void onDisconnectionComplete(const ble::DisconnectionCompleteEvent &event) override;
 
+    void onAttMtuChange(ble::connection_handle_t connectionHandle, uint16_t attMtuSize) override;
+
+    void onDataWritten(const GattWriteCallbackParams &params) override;
+
+    void onDataSent(const GattDataSentCallbackParams &params) override;
+
+    void onUpdatesDisabled(const GattUpdatesDisabledCallbackParams &params) override;
+
+    /** Send queued stream packets until the stack runs out of buffers, and refresh the stream status if it
+     * changed. Stops its own periodic event once the stream is back to summary. BLE thread only.
+     */
+    void pump_stream();
+
+    /** Queue as much of the history download as fits in the stream ring */
+    void fill_history();
+
+    // What the update functions post; BLE thread
+    void send_telemetry(TelemetryFrame frame);
+    void send_episode(EpisodeEvent event);
+    void send_statistics();
+
 private:
     events::EventQueue &_event_queue;
     ble::BLE &_ble;
@@ -71,10 +197,47 @@ private:
     float _tremor_value = 0.0f;
     float _dyskinesia_value = 0.0f;
     float _fog_value = 0.0f;
+    uint8_t _telemetry_value[TELEMETRY_MAX_SIZE] = {};
+    uint8_t _stream_value[STREAM_PACKET_MAX] = {};
+    uint8_t _stream_control_value[STREAM_STATUS_SIZE] = {};
+    uint8_t _notify_policy_value[NOTIFY_POLICY_SIZE] = {};
+    uint8_t _episode_value[EPISODE_EVENT_SIZE] = {};
+    uint8_t _stats_value[STATS_SUMMARY_SIZE] = {};
+    uint8_t _sketch_value[STATS_SKETCH_MAX_SIZE] = {};
+
+    // Requested from the BLE thread, acted on from the output thread
+    std::atomic<bool> _stats_reset_requested{false};
+    std::atomic<uint8_t> _sketch_symptom{0};
+    // Encoded on the output thread (which owns the statistics), sent from the BLE thread
+    rtos::Mutex _stats_mutex;
+    uint8_t _stats_pending[STATS_SUMMARY_SIZE] = {};
+    uint8_t _sketch_pending[STATS_SKETCH_MAX_SIZE] = {};
+    int _stats_pending_size = 0, _sketch_pending_size = 0;
+
+    // Configured and applied on the BLE thread; the mutex keeps it safe to touch from elsewhere
+    NotifyPolicy _notify_policy;
+    rtos::Mutex _notify_policy_mutex;
+    uint16_t _telemetry_sequence = 0;
+
+    // The periodic pump_stream() event while a stream is on, or 0
+    int _pump_event = 0;
+
+    // History download; BLE thread only
+    SymptomLog *_history = nullptr;
+    uint32_t _history_cursor = 0;
+    // BLE event thread
+    volatile uint16_t _att_mtu = TELEMETRY_DEFAULT_ATT_MTU;
 
     GattCharacteristic _tremor_char;
     GattCharacteristic _dyskinesia_char;
     GattCharacteristic _fog_char;
+    GattCharacteristic _telemetry_char;
+    GattCharacteristic _stream_char;
+    GattCharacteristic _stream_control_char;
+    GattCharacteristic _notify_policy_char;
+    GattCharacteristic _episode_char;
+    GattCharacteristic _stats_char;
+    GattCharacteristic _sketch_char;
 
     uint8_t _adv_buffer[ble::LEGACY_ADVERTISING_MAX_SIZE];
     ble::AdvertisingDataBuilder _adv_data_builder;
@@ -82,4 +245,11 @@ private:
     GattAttribute::Handle_t _tremor_handle = 0;
     GattAttribute::Handle_t _dyskinesia_handle = 0;
     GattAttribute::Handle_t _fog_handle = 0;
+    GattAttribute::Handle_t _telemetry_handle = 0;
+    GattAttribute::Handle_t _stream_handle = 0;
+    GattAttribute::Handle_t _stream_control_handle = 0;
+    GattAttribute::Handle_t _notify_policy_handle = 0;
+    GattAttribute::Handle_t _episode_handle = 0;
+    GattAttribute::Handle_t _stats_handle = 0;
+    GattAttribute::Handle_t _sketch_handle = 0;
 };
@@ -0,0 +1,53 @@
+#pragma once
+
+//! Little-endian field access for the BLE wire formats and the trace files.
+//! Byte by byte, so it works on any host and at any alignment.
+
+#include <stdint.h>
+#include <string.h>
+
+static inline uint8_t *put_u16(uint8_t *dest, uint16_t value) {
+    dest[0] = (uint8_t)value;
+    dest[1] = (uint8_t)(value >> 8);
+    return dest + 2;
+}
+
+static inline uint8_t *put_u32(uint8_t *dest, uint32_t value) {
+    dest[0] = (uint8_t)value;
+    dest[1] = (uint8_t)(value >> 8);
+    dest[2] = (uint8_t)(value >> 16);
+    dest[3] = (uint8_t)(value >> 24);
+    return dest + 4;
+}
+
+static inline uint8_t *put_f32(uint8_t *dest, float value) {
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return put_u32(dest, bits);
+}
+
+static inline uint16_t get_u16(const uint8_t *src) {
+    return (uint16_t)(src[0] | (src[1] << 8));
+}
+
+static inline uint32_t get_u32(const uint8_t *src) {
+    return (uint32_t)src[0] | ((uint32_t)src[1] << 8) | ((uint32_t)src[2] << 16) | ((uint32_t)src[3] << 24);
+}
+
+static inline float get_f32(const uint8_t *src) {
+    uint32_t bits = get_u32(src);
+    float value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+/** Unsigned fixed point: value * scale, rounded and clamped to [0, 65535] (NaN gives 0) */
+static inline uint8_t *put_ufixed16(uint8_t *dest, float value, float scale) {
+    float scaled = value * scale + 0.5f;
+    uint16_t fixed = !(scaled > 0.f) ? 0 : scaled >= 65535.f ? 65535 : (uint16_t)scaled;
+    return put_u16(dest, fixed);
+}
+
+static inline float get_ufixed16(const uint8_t *src, float scale) {
+    return get_u16(src) / scale;
+}
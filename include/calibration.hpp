@@ -0,0 +1,125 @@
+#pragma once
+
+//! Sensor calibration learned while the device is worn: gyro bias and accelerometer offset and scale.
+//!
+//! The Calibrator watches the raw stream in blocks of CALIBRATION_BLOCK_SAMPLES. A block where neither
+//! sensor moves more than its noise is a rest:
+//!   - its mean angular rate is the gyro bias, which is averaged in over rests (unless it's too fast for a
+//!     bias, which means the sensor is turning steadily);
+//!   - its mean acceleration is gravity as the sensor sees it. Rests in different orientations are kept,
+//!     and once they span every axis, an axis-aligned ellipsoid through them gives offset and scale.
+//! Results are kept in a KVStore (internal flash on the device), so the next boot starts calibrated.
+//!
+//! Stored value (CALIBRATION_SIZE bytes, little-endian):
+//!   u8  version       CALIBRATION_VERSION
+//!   u8  flags         CALIBRATION_GYRO | CALIBRATION_ACCEL: which parts have been estimated
+//!   f32 gyro_bias[3], accel_offset[3], accel_scale[3]
+
+#include <stdint.h>
+
+#include "globals.hpp"
+
+#ifdef __MBED__
+#include "KVStore.h"
+#else
+#include "host_kv_store.hpp"
+#endif
+
+#define CALIBRATION_VERSION 1
+#define CALIBRATION_SIZE (2 + 9 * 4)
+#define CALIBRATION_KEY "calibration"
+
+#define CALIBRATION_GYRO  (1 << 0)
+#define CALIBRATION_ACCEL (1 << 1)
+
+// A rest has to last a whole block (2 s)
+#define CALIBRATION_BLOCK_SAMPLES (2 * POLL_RATE)
+// Within a block, no axis may vary more than this (standard deviation) for it to count as a rest
+#define CALIBRATION_STILL_GYRO_DPS 2.f
+#define CALIBRATION_STILL_ACCEL_G 0.015f
+// A still block turning faster than this on any axis is a slow, steady turn rather than a rest. The
+// LSM6DSL's zero-rate level is +-3 dps typical; this leaves room for parts off typical.
+#define CALIBRATION_MAX_GYRO_BIAS_DPS 5.f
+// How much each rest moves the gyro bias, the first one included, so no single rest sets it
+#define CALIBRATION_GYRO_RATE 0.1f
+// Orientations remembered for the accelerometer fit; rests closer than 10 degrees share one
+#define CALIBRATION_RESTS 16
+#define CALIBRATION_REST_MERGE_COS 0.985f
+// The fit needs this many orientations, covering this much of every axis
+#define CALIBRATION_MIN_RESTS 9
+#define CALIBRATION_MIN_SPAN_G 1.f
+// Fits outside these are rejected as the sensor having moved during a rest
+#define CALIBRATION_MAX_OFFSET_G 0.15f
+#define CALIBRATION_MAX_SCALE_ERROR 0.1f
+#define CALIBRATION_MAX_RESIDUAL_G 0.01f
+// Changes worth writing to flash, and at most one write per 10 minutes
+#define CALIBRATION_SAVE_GYRO_DPS 0.1f
+#define CALIBRATION_SAVE_ACCEL_G 0.002f
+#define CALIBRATION_SAVE_SAMPLES (10 * 60 * POLL_RATE)
+
+typedef struct {
+    uint8_t flags;
+    float gyro_bias[3];    // dps, subtracted
+    float accel_offset[3]; // g, subtracted before scaling
+    float accel_scale[3];
+} Calibration;
+
+/** No correction at all */
+Calibration calibration_identity();
+
+int calibration_encode(const Calibration &calibration, uint8_t dest[CALIBRATION_SIZE]);
+bool calibration_decode(const uint8_t *data, int size, Calibration &calibration);
+
+/** Correct one sample in place
+ * @param acc Acceleration in g
+ * @param gyro Angular rate in degrees per second
+ */
+void calibration_apply(const Calibration &calibration, float acc[3], float gyro[3]);
+
+/** Read the stored calibration. On any error, calibration is left as the identity.
+ * @return MBED_SUCCESS, or a KVStore error (MBED_ERROR_ITEM_NOT_FOUND on first boot)
+ */
+int calibration_load(mbed::KVStore *store, Calibration &calibration);
+
+int calibration_save(mbed::KVStore *store, const Calibration &calibration);
+
+class Calibrator {
+public:
+    explicit Calibrator(const Calibration &initial);
+
+    /** Learn from one raw sample (in g and dps, before calibration_apply()) */
+    void update(const float acc[3], const float gyro[3]);
+
+    void apply(float acc[3], float gyro[3]) const { calibration_apply(_calibration, acc, gyro); }
+
+    const Calibration &calibration() const { return _calibration; }
+
+    /** True, at most once per CALIBRATION_SAVE_SAMPLES, when the calibration has changed enough
+     * since the last time to be worth saving
+     */
+    bool take_changed();
+
+    /** Rests seen, and distinct orientations kept for the accelerometer fit */
+    uint32_t rests() const { return _rests; }
+    int orientations() const { return _orientation_count; }
+
+private:
+    void finish_block();
+    void add_orientation(const float mean[3]);
+    bool fit_accel();
+
+    Calibration _calibration;
+    Calibration _saved; // As of the last take_changed()
+    uint32_t _samples_since_save = 0;
+
+    // Current block, relative to its first sample so the sums keep their precision
+    float _acc_first[3], _gyro_first[3];
+    float _acc_sum[3], _acc_sum_sq[3], _gyro_sum[3], _gyro_sum_sq[3];
+    int _block_samples = 0;
+    uint32_t _rests = 0;
+
+    // Mean raw acceleration of each distinct resting orientation, and how many rests went into it
+    float _orientations[CALIBRATION_RESTS][3];
+    int _orientation_weights[CALIBRATION_RESTS];
+    int _orientation_count = 0;
+};
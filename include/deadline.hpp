@@ -0,0 +1,104 @@
+#pragma once
+
+//! Watches the real-time contract between acquisition_task() and the analysis of its batches:
+//! a batch released by the producer should be processed within one batch period, before the next
+//! one is released.
+//!
+//! The producer stamps every sample (to notice dropped or late ones) and every batch release;
+//! the release time travels with the batch and the consumer stamps completion. Times come from a
+//! DeadlineClock so that tests on a host can drive a SimulatedClock and inject processing delays.
+
+#include <atomic>
+#include <stdint.h>
+
+#include "globals.hpp"
+
+#ifdef __MBED__
+#include <mbed.h>
+#endif
+
+// Time from one batch release to the next
+#define BATCH_PERIOD_US ((uint64_t)(BATCH_SIZE_FILLED + 1) * 1000000 / POLL_RATE)
+#define SAMPLE_PERIOD_US (1000000 / POLL_RATE)
+// Number of recent batches the rolling statistics cover
+#define DEADLINE_WINDOW 16
+
+class DeadlineClock {
+public:
+    virtual ~DeadlineClock() {}
+    virtual uint64_t now_us() = 0;
+};
+
+/** A clock that only moves when told to */
+class SimulatedClock : public DeadlineClock {
+public:
+    uint64_t now_us() override { return _now; }
+    void set(uint64_t us) { _now = us; }
+    void advance(uint64_t us) { _now += us; }
+
+private:
+    uint64_t _now = 0;
+};
+
+#ifdef __MBED__
+/** Microsecond clock that runs from construction */
+class TimerClock : public DeadlineClock {
+public:
+    TimerClock() { _timer.start(); }
+    uint64_t now_us() override { return _timer.elapsed_time().count(); }
+
+private:
+    Timer _timer;
+};
+#endif
+
+typedef struct {
+    uint32_t batches;          // Batches completed
+    uint32_t misses;           // Batches completed after their deadline
+    int32_t worst_slack_us;    // Smallest (deadline - completion) seen; negative means a miss
+    int32_t window_min_slack_us;  // Over the last DEADLINE_WINDOW batches
+    int32_t window_mean_slack_us;
+    uint32_t window_misses;
+    uint32_t late_samples;     // Samples that arrived noticeably after their slot
+    uint32_t dropped_samples;  // Sample slots that never got a sample
+} DeadlineStats;
+
+class DeadlineMonitor {
+public:
+    explicit DeadlineMonitor(DeadlineClock &clock) : _clock(clock) {}
+
+    /** Producer: n samples were just read together (more than one from a FIFO).
+     * Gaps longer than n sample periods count as late or dropped samples.
+     */
+    void sample(int n = 1);
+
+    /** Producer: a batch was handed over.
+     * @return The release time, to be passed to complete() along with the batch
+     */
+    uint64_t release();
+
+    /** Consumer: the batch released at release_us is fully processed */
+    void complete(uint64_t release_us);
+
+    /** Consumer: current statistics. Call from the thread that calls complete(). */
+    DeadlineStats stats() const;
+
+    void reset();
+
+private:
+    DeadlineClock &_clock;
+
+    // Producer side
+    uint64_t _last_sample_us = 0;
+    bool _have_sample = false;
+    std::atomic<uint32_t> _late_samples{0};
+    std::atomic<uint32_t> _dropped_samples{0};
+
+    // Consumer side
+    uint32_t _batches = 0;
+    uint32_t _misses = 0;
+    int32_t _worst_slack_us = 0;
+    int32_t _window[DEADLINE_WINDOW];
+    int _window_fill = 0;
+    int _window_next = 0;
+};
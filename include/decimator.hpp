@@ -0,0 +1,93 @@
+#pragma once
+
+//! Anti-aliasing decimation of an oversampled IMU stream down to POLL_RATE.
+//!
+//! Sampled at POLL_RATE directly, anything above POLL_RATE / 2 (heel strikes, impacts) folds into the
+//! analysis bands. Instead the sensor runs IMU_OVERSAMPLING times faster and each FIFO block goes through
+//! a polyphase FIR low pass (arm_fir_decimate_f32, one instance per axis) that keeps only every factor'th
+//! output. What matters is what would fold into 0-DECIMATOR_PASS_HZ, i.e. within DECIMATOR_PASS_HZ of a
+//! multiple of POLL_RATE; the band in between ends up removed by the conditioner's low pass anyway,
+//! which is what lets the filter be this short.
+//!
+//! The other way round, ImuInterpolator brings a sensor running slower than POLL_RATE (to save power while
+//! the patient is still, see rate_control.hpp) up to it, with the same kind of filter
+//! (arm_fir_interpolate_f32). Either way analysis always sees POLL_RATE, so its bands stay in Hz.
+//! Both can be primed with a sample when the sensor changes rate, so the output carries on from where the
+//! previous converter left it instead of ringing up from zero.
+
+#include "arm_math.h"
+#include "globals.hpp"
+#include "imu_source.hpp"
+
+// Flat up to here, which covers the conditioner's 7 Hz low pass
+#define DECIMATOR_PASS_HZ 8.f
+// Taps per output sample: the filter has DECIMATOR_TAPS_PER_PHASE * factor taps
+#define DECIMATOR_TAPS_PER_PHASE 8
+#define DECIMATOR_MAX_FACTOR 8
+#define DECIMATOR_MAX_TAPS (DECIMATOR_TAPS_PER_PHASE * DECIMATOR_MAX_FACTOR)
+// Most input samples one process() call takes
+#define DECIMATOR_MAX_BLOCK 64
+
+class ImuDecimator {
+public:
+    /** @param factor Input samples per output sample, 1 (pass through) to DECIMATOR_MAX_FACTOR */
+    explicit ImuDecimator(int factor);
+
+    int factor() const { return _factor; }
+
+    /** Decimate a block of samples.
+     * @param n Input samples: a multiple of factor(), at most DECIMATOR_MAX_BLOCK
+     * @param out Room for n / factor() samples
+     * @return Samples written to out
+     */
+    int process(const RawImuSample *in, int n, RawImuSample *out);
+
+    /** Forget the filter history, e.g. after a gap in the input */
+    void reset();
+
+    /** Fill the filter history with one sample, as if the input had been holding it */
+    void prime(const RawImuSample &sample);
+
+    /** Low pass for a given factor: windowed sinc (Blackman) with its cutoff at POLL_RATE / 2, unity gain at DC
+     * @param coefficients Room for DECIMATOR_TAPS_PER_PHASE * factor taps
+     */
+    static void design(int factor, float *coefficients);
+
+private:
+    int _factor;
+    float _coefficients[DECIMATOR_MAX_TAPS];
+    arm_fir_decimate_instance_f32 _fir[6]; // accel x, y, z, gyro x, y, z
+    float _state[6][DECIMATOR_MAX_TAPS + DECIMATOR_MAX_BLOCK - 1];
+    // One axis at a time; here rather than on the caller's stack
+    float _channel_in[DECIMATOR_MAX_BLOCK], _channel_out[DECIMATOR_MAX_BLOCK];
+};
+
+// Most output samples one ImuInterpolator::process() call produces
+#define INTERPOLATOR_MAX_BLOCK 64
+
+class ImuInterpolator {
+public:
+    /** @param factor Output samples per input sample, 1 (pass through) to DECIMATOR_MAX_FACTOR */
+    explicit ImuInterpolator(int factor);
+
+    int factor() const { return _factor; }
+
+    /** Interpolate a block of samples.
+     * @param n Input samples, at most INTERPOLATOR_MAX_BLOCK / factor()
+     * @param out Room for n * factor() samples
+     * @return Samples written to out
+     */
+    int process(const RawImuSample *in, int n, RawImuSample *out);
+
+    void reset();
+
+    /** Fill the filter history with one sample, as if the input had been holding it */
+    void prime(const RawImuSample &sample);
+
+private:
+    int _factor;
+    float _coefficients[DECIMATOR_MAX_TAPS];
+    arm_fir_interpolate_instance_f32 _fir[6]; // accel x, y, z, gyro x, y, z
+    float _state[6][INTERPOLATOR_MAX_BLOCK + DECIMATOR_TAPS_PER_PHASE - 1];
+    float _channel_in[INTERPOLATOR_MAX_BLOCK], _channel_out[INTERPOLATOR_MAX_BLOCK];
+};
@@ -0,0 +1,123 @@
+#pragma once
+
+//! Deferred, binary logging for the real-time threads.
+//! A log call only copies a format ID and its raw arguments into a lock-free ring; the slow part
+//! (float formatting and the blocking UART write) happens later, when a low-priority thread calls
+//! DeferredLog::drain().
+//!
+//! Every message has to be listed in DEFERRED_LOG_FORMATS. Arguments are stored as 32-bit words, so
+//! conversions are limited to %d/%i/%u/%x/%c (with an optional l or h), %f/%e/%g, and %%.
+//! The ring takes any number of producer threads and one drainer. When it's full, messages are
+//! dropped and counted rather than waited for.
+
+#include <atomic>
+#include <stdint.h>
+#include <string.h>
+
+#include "globals.hpp"
+
+// Messages that fit in the ring at once; must be a power of 2
+#define DEFERRED_LOG_CAPACITY 64
+#define DEFERRED_LOG_MAX_ARGS 6
+// Longest message DeferredLog::drain() formats; longer ones get cut short
+#define DEFERRED_LOG_LINE_SIZE 160
+
+// X(id, format)
+#define DEFERRED_LOG_FORMATS(X) \
+    X(LOG_TREMOR, ">Tremor:%.3f\n") \
+    X(LOG_DYSKINESIA, ">Dyskinesia:%.3f\n") \
+    X(LOG_FREEZING_GAIT, ">FOG:%.3f\n") \
+    X(LOG_DEADLINE_STATS, ">slack_min_ms:%.1f\n>slack_mean_ms:%.1f\n>deadline_misses:%lu\n>dropped_samples:%lu\n>late_samples:%lu\n") \
+    X(LOG_TELEPLOT_ACCEL, ">acc_x:%3f\n>acc_y:%3f\n>acc_z:%3f\n") \
+    X(LOG_TELEPLOT_INTENSITIES, ">tremor_intensity:%.3f\n>dyskinesia_intensity:%.3f\n>fog_intensity:%.3f\n") \
+    X(LOG_IMU_OVERFLOW, "\nIMU BUFFER OVERFLOW! Processing is taking too long!\n\n") \
+    X(LOG_IMU_GAP, "\nIMU gap too long to fill (%lu so far), batch restarted\n\n") \
+    X(LOG_PIPELINE_BEHIND, "\nPipeline behind: %lu batches and %lu reports dropped so far\n\n") \
+    X(LOG_DROPPED, "\n%lu log messages dropped\n\n") \
+    X(LOG_EPISODE_START, "Episode start: kind %u at %lu ms, peak %.3f\n") \
+    X(LOG_EPISODE_END, "Episode end: kind %u at %lu ms, %lu ms long, peak %.3f, mean %.3f, %.2f Hz\n") \
+    X(LOG_STATISTICS, "Stats %u: p50 %.3f, p90 %.3f, p99 %.3f, %.1f min above %.2f\n")
+
+#define DEFERRED_LOG_ENUM(id, format) id,
+typedef enum {
+    DEFERRED_LOG_FORMATS(DEFERRED_LOG_ENUM)
+    LOG_FORMAT_COUNT
+} LogFormat;
+#undef DEFERRED_LOG_ENUM
+
+typedef struct {
+    uint16_t format;
+    uint16_t argc;
+    uint32_t args[DEFERRED_LOG_MAX_ARGS];
+} LogRecord;
+
+const char *deferred_log_format(LogFormat format);
+
+/** Format a record the way printf would have, into at most size bytes (always terminated).
+ * @return The length of the formatted text
+ */
+int deferred_log_format_record(const LogRecord &record, char *dest, int size);
+
+//MARK: Argument packing
+
+static inline uint32_t log_word(float value) {
+    uint32_t word;
+    memcpy(&word, &value, sizeof(word));
+    return word;
+}
+// Doubles are narrowed to float; the formats only print a few decimals anyway
+static inline uint32_t log_word(double value) { return log_word((float)value); }
+static inline uint32_t log_word(int value) { return (uint32_t)value; }
+static inline uint32_t log_word(unsigned value) { return value; }
+static inline uint32_t log_word(long value) { return (uint32_t)value; }
+static inline uint32_t log_word(unsigned long value) { return (uint32_t)value; }
+
+//MARK: Ring
+
+/** Bounded multi-producer, single-consumer queue of log records.
+ * Each slot carries a sequence number saying whether it's free for the producer that claimed its
+ * position or holds a finished record for the drainer, so neither side ever takes a lock.
+ */
+class DeferredLog {
+public:
+    DeferredLog();
+
+    /** Queue one message. Safe from any thread. Returns false (and counts a drop) if the ring is full. */
+    template <typename... Args>
+    bool log(LogFormat format, Args... args) {
+        static_assert(sizeof...(Args) <= DEFERRED_LOG_MAX_ARGS, "Too many log arguments");
+        uint32_t words[sizeof...(Args) + 1] = { log_word(args)... };
+        return push(format, words, sizeof...(Args));
+    }
+
+    bool push(LogFormat format, const uint32_t *args, int argc);
+
+    /** Take the oldest message, if any. Only call from the one drain thread. */
+    bool pop(LogRecord &record);
+
+    /** Format and hand every queued message to write(), oldest first, then report any new drops.
+     * Only call from the one drain thread.
+     * @return The number of messages written
+     */
+    int drain(void (*write)(const char *text, int length));
+
+    /** Messages dropped because the ring was full */
+    uint32_t dropped() const { return _dropped.load(std::memory_order_relaxed); }
+
+private:
+    struct Slot {
+        std::atomic<uint32_t> sequence;
+        LogRecord record;
+    };
+
+    Slot _slots[DEFERRED_LOG_CAPACITY];
+    std::atomic<uint32_t> _head;      // Next position a producer will claim
+    uint32_t _tail = 0;               // Next position the drainer reads; drainer only
+    std::atomic<uint32_t> _dropped;
+    uint32_t _reported_dropped = 0;   // Drainer only
+};
+
+extern DeferredLog deferred_log;
+
+/** Queue a message on the shared ring, e.g. DLOG(LOG_TREMOR, value) */
+#define DLOG(format, ...) deferred_log.log(format, ##__VA_ARGS__)
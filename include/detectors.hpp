@@ -0,0 +1,244 @@
+#pragma once
+
+//! Parkinson's symptom detectors.
+//! Each detector owns whatever state it carries between batches, so any number of
+//! independent streams can be analyzed side by side (e.g. on a host, one per patient).
+
+#include "globals.hpp"
+#include "conditioning.hpp"
+
+// Symptom bands, Hz
+#define TREMOR_LOW_HZ 3.0f
+#define TREMOR_HIGH_HZ 5.0f
+#define DYSKINESIA_LOW_HZ 5.0f
+#define DYSKINESIA_HIGH_HZ 7.0f
+#define WALKING_LOW_HZ 1.0f
+#define WALKING_HIGH_HZ 3.0f
+// Below this much dynamic acceleration (g) a sample counts as still, for freezing of gait
+#define FOG_STILL_G 0.05f
+
+/** Common interface for all detectors. Called once per batch. */
+class SymptomDetector {
+public:
+    virtual ~SymptomDetector() {}
+
+    /** Consume one batch and return the symptom intensity for it.
+     * @param accel_time 3xBATCH_SIZE array of filtered accel samples (gravity removed)
+     * @param accel_freq_mags Frequency magnitudes of accel_time, one array per axis
+     */
+    virtual float update(const float accel_time[3][BATCH_SIZE], const float accel_freq_mags[3][BATCH_SIZE / 2 + 1]) = 0;
+
+    /** Forget any state carried between batches. */
+    virtual void reset() {}
+};
+
+/** Sum of the accelerometer frequency magnitudes within [low_hz, high_hz] across all 3 axes */
+static inline float band_power(const float accel_freq_mags[3][BATCH_SIZE / 2 + 1], float low_hz, float high_hz) {
+    int bin_low = (int)(low_hz / FREQUENCY_BIN_SIZE);
+    int bin_high = (int)(high_hz / FREQUENCY_BIN_SIZE);
+
+    float power = 0.0f;
+    for (int axis = 0; axis < 3; axis++) {
+        for (int bin = bin_low; bin <= bin_high; bin++) {
+            power += accel_freq_mags[axis][bin];
+        }
+    }
+    return power;
+}
+
+/** band_power() over float16 magnitudes */
+static inline float band_power(const half_t accel_freq_mags[3][BATCH_SIZE / 2 + 1], float low_hz, float high_hz) {
+    int bin_low = (int)(low_hz / FREQUENCY_BIN_SIZE);
+    int bin_high = (int)(high_hz / FREQUENCY_BIN_SIZE);
+
+    float power = 0.0f;
+    for (int axis = 0; axis < 3; axis++) {
+        for (int bin = bin_low; bin <= bin_high; bin++) {
+            power += half_to_float(accel_freq_mags[axis][bin]);
+        }
+    }
+    return power;
+}
+
+//MARK: Band detectors
+
+/** Tremor intensity in the 3-5 Hz frequency range from accelerometer data.
+ * Sums frequency magnitudes across all 3 axes in the tremor band.
+ * 0.0 = no tremor, higher values = more intense
+ */
+class TremorDetector : public SymptomDetector {
+public:
+    float update(const float /*accel_time*/[3][BATCH_SIZE], const float accel_freq_mags[3][BATCH_SIZE / 2 + 1]) override {
+        // Frequency bin calculation: bin_size = POLL_RATE / BATCH_SIZE = 52/256 ≈ 0.203 Hz/bin
+        // 3 Hz → bin ~15, 5 Hz → bin ~25
+        return band_power(accel_freq_mags, TREMOR_LOW_HZ, TREMOR_HIGH_HZ);
+    }
+};
+
+/** Dyskinesia intensity in the 5-7 Hz frequency range from accelerometer data.
+ * Dyskinesia manifests as dance-like rhythmic movements in this frequency band.
+ * 0.0 = none, higher values = more intense
+ */
+class DyskinesiaDetector : public SymptomDetector {
+public:
+    float update(const float /*accel_time*/[3][BATCH_SIZE], const float accel_freq_mags[3][BATCH_SIZE / 2 + 1]) override {
+        // 5 Hz → bin ~25, 7 Hz → bin ~34
+        return band_power(accel_freq_mags, DYSKINESIA_LOW_HZ, DYSKINESIA_HIGH_HZ);
+    }
+};
+
+//MARK: Freezing of gait
+
+/**
+ * Freezing-of-Gait detection (time-domain + state tracking).
+ * Looks for the characteristic pattern:
+ * 1. Walking detected (rhythmic movement in 1-3 Hz range, typically ~2 Hz for steps)
+ * 2. Sudden cessation of movement (low dynamic acceleration)
+ *
+ * A simple state machine across batches tracks walking -> freeze transitions.
+ * Returns FOG intensity [0.0, 1.0] where higher means more confident freeze after walking.
+ */
+class FreezingDetector : public SymptomDetector {
+public:
+    float update(const float accel_time[3][BATCH_SIZE], const float accel_freq_mags[3][BATCH_SIZE / 2 + 1]) override;
+
+    /** The state machine alone, for callers that measure the batch themselves (e.g. in fixed point)
+     * @param walking_intensity Mean accelerometer magnitude per bin in the walking band
+     * @param stillness_ratio Fraction of the batch's samples below FOG_STILL_G
+     */
+    float update(float walking_intensity, float stillness_ratio);
+
+    /** Mean accelerometer magnitude per bin in the walking band */
+    static float walking_intensity(const float accel_freq_mags[3][BATCH_SIZE / 2 + 1]);
+
+    /** Fraction of the batch's samples below FOG_STILL_G. Needs the time domain, so call it before the FFT. */
+    static float stillness_ratio(const float accel_time[3][BATCH_SIZE]);
+
+    void reset() override {
+        _state = IDLE;
+        _walking_batch_count = 0;
+        _frozen_batch_count = 0;
+    }
+
+private:
+    enum { IDLE, WALKING, FROZEN } _state = IDLE;
+    int _walking_batch_count = 0;
+    int _frozen_batch_count = 0;
+};
+
+//MARK: Per-stream analysis
+
+/** Symptom intensities computed for a single batch */
+typedef struct {
+    float tremor;
+    float dyskinesia;
+    float fog;
+} SymptomIntensities;
+
+/** Everything needed to turn batches of one IMU stream into symptom intensities.
+ * Instances share nothing but the (read-only) FFT tables, so separate streams can run on separate threads.
+ * init_fft() must have been called before the first analyze().
+ */
+class SymptomAnalyzer {
+public:
+    /** Analyze one batch. The batch's contents are used as FFT scratch space and get overwritten. */
+    SymptomIntensities analyze(float accelerometer[3][BATCH_SIZE], float gyroscope[3][BATCH_SIZE]);
+
+    void reset() {
+        _tremor.reset();
+        _dyskinesia.reset();
+        _freezing.reset();
+    }
+
+    // Holds an array of frequencies per axis [0, 26/128, ... , 26]Hz from the last analyzed batch
+    float accelerometer_frequency_magnitudes[3][BATCH_SIZE / 2 + 1];
+    float gyroscope_frequency_magnitudes[3][BATCH_SIZE / 2 + 1];
+    // Total accelerometer spectral energy of the last analyzed batch; tremor and dyskinesia are relative to it
+    float total_energy = 0.f;
+
+private:
+    TremorDetector _tremor;
+    DyskinesiaDetector _dyskinesia;
+    FreezingDetector _freezing;
+
+    float _fft_scratch[FFT_SCRATCH_SIZE];
+};
+
+/** Sum of Q15 magnitudes within [low_hz, high_hz] across all 3 axes, as band_power() would have it.
+ * Sums are integer within an axis; each axis then gets its own block scale.
+ * @param scale What one count of each axis's magnitudes is worth
+ */
+static inline float band_power_q15(const q15_t accel_freq_mags[3][BATCH_SIZE / 2 + 1], const float scale[3],
+        float low_hz, float high_hz) {
+    int bin_low = (int)(low_hz / FREQUENCY_BIN_SIZE);
+    int bin_high = (int)(high_hz / FREQUENCY_BIN_SIZE);
+
+    float power = 0.0f;
+    for (int axis = 0; axis < 3; axis++) {
+        int32_t sum = 0;
+        for (int bin = bin_low; bin <= bin_high; bin++) sum += accel_freq_mags[axis][bin];
+        power += sum * scale[axis];
+    }
+    return power;
+}
+
+/** SymptomAnalyzer for Q15 batches (ANALYSIS_Q15): arm_rfft_q15 with block scaling, arm_cmplx_mag_q15, and
+ * fixed-point band sums and stillness counts. Results are in the same units as SymptomAnalyzer's, but not
+ * the same values: see ANALYSIS_PRECISION for how far they drift.
+ */
+class SymptomAnalyzerQ15 {
+public:
+    /** Analyze one batch. The batch's contents are used as FFT scratch space and get overwritten. */
+    SymptomIntensities analyze(q15_t accelerometer[3][BATCH_SIZE], q15_t gyroscope[3][BATCH_SIZE]);
+
+    void reset() { _freezing.reset(); }
+
+    /** The last batch's spectra, widened to float in SymptomAnalyzer's units, for consumers that take those */
+    void widen_spectra(float accelerometer[3][BATCH_SIZE / 2 + 1], float gyroscope[3][BATCH_SIZE / 2 + 1]) const;
+
+    // The last analyzed batch's spectra; one count of each axis is worth *_scale[axis]
+    q15_t accelerometer_frequency_magnitudes[3][BATCH_SIZE / 2 + 1];
+    q15_t gyroscope_frequency_magnitudes[3][BATCH_SIZE / 2 + 1];
+    float accelerometer_scale[3], gyroscope_scale[3];
+    float total_energy = 0.f;
+
+private:
+    FreezingDetector _freezing;
+
+    q15_t _fft_scratch[FFT_Q15_SCRATCH_SIZE];
+};
+
+/** SymptomAnalyzer for float16 batches (ANALYSIS_F16). Each axis is widened into a float buffer, goes through
+ * the same float FFT, and its magnitudes are narrowed back, so only one axis is ever held as floats.
+ */
+class SymptomAnalyzerF16 {
+public:
+    /** Analyze one batch. Unlike the other analyzers', the batch is left as it was. */
+    SymptomIntensities analyze(const half_t accelerometer[3][BATCH_SIZE], const half_t gyroscope[3][BATCH_SIZE]);
+
+    void reset() { _freezing.reset(); }
+
+    // The last analyzed batch's spectra, as SymptomAnalyzer's but in float16
+    half_t accelerometer_frequency_magnitudes[3][BATCH_SIZE / 2 + 1];
+    half_t gyroscope_frequency_magnitudes[3][BATCH_SIZE / 2 + 1];
+    float total_energy = 0.f;
+
+private:
+    /** FFT of one axis, magnitudes narrowed into mags */
+    void spectrum(const half_t data[BATCH_SIZE], half_t mags[BATCH_SIZE / 2 + 1]);
+
+    FreezingDetector _freezing;
+
+    // The axis being transformed; the FFT uses it as scratch space, then the magnitudes go in it
+    float _axis[BATCH_SIZE];
+    float _fft_scratch[FFT_SCRATCH_SIZE];
+};
+
+// What analysis_task() runs
+#if ANALYSIS_PRECISION == ANALYSIS_Q15
+typedef SymptomAnalyzerQ15 PipelineAnalyzer;
+#elif ANALYSIS_PRECISION == ANALYSIS_F16
+typedef SymptomAnalyzerF16 PipelineAnalyzer;
+#else
+typedef SymptomAnalyzer PipelineAnalyzer;
+#endif
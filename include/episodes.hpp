@@ -0,0 +1,122 @@
+#pragma once
+
+//! Turns the per-window intensity streams into symptom episodes: tremor started, peaked, ended.
+//! Quiet periods produce nothing at all, so this is what a central wants when it doesn't need
+//! every window.
+//!
+//! Each symptom runs its own hysteresis: an episode starts once the intensity has stayed at or above
+//! onset for onset_windows windows in a row, and ends once it has stayed below offset for
+//! offset_windows in a row. Both counts are taken back out of the episode, so it starts at the first
+//! window over onset and ends after the last window over offset.
+//!
+//! Event wire format (EPISODE_EVENT_SIZE bytes, little-endian), fits the default 23 byte ATT MTU:
+//!   u8  type          EpisodeEventType
+//!   u8  kind          EpisodeKind
+//!   u16 sequence      Event counter; gaps mean events were lost
+//!   u32 onset_ms      Start of the first window of the episode, in ms since boot
+//!   u32 duration_ms   0 in EPISODE_START
+//!   u16 peak          Largest intensity so far, 1/10000 units (saturates at 6.5535)
+//!   u16 mean          Mean intensity of the episode's windows at or above offset, same units
+//!   u16 dominant_hz   Intensity-weighted mean of each window's peak frequency in the symptom's band, 1/100 Hz
+
+#include <stdint.h>
+
+#include "globals.hpp"
+#include "detectors.hpp"
+
+#define EPISODE_EVENT_SIZE 18
+// A window can start or end an episode of each symptom, never both
+#define EPISODE_MAX_EVENTS EPISODE_KIND_COUNT
+// Length of the window update() is given the start of
+#define EPISODE_WINDOW_MS ((BATCH_SIZE_FILLED + 1) * 1000 / POLL_RATE)
+
+typedef enum {
+    EPISODE_TREMOR,
+    EPISODE_DYSKINESIA,
+    EPISODE_FOG,
+    EPISODE_KIND_COUNT
+} EpisodeKind;
+
+typedef enum {
+    EPISODE_START = 1,
+    EPISODE_END = 2
+} EpisodeEventType;
+
+typedef struct {
+    uint8_t type;  // EpisodeEventType
+    uint8_t kind;  // EpisodeKind
+    uint16_t sequence;
+    uint32_t onset_ms;
+    uint32_t duration_ms;
+    float peak;
+    float mean;
+    float dominant_hz;
+} EpisodeEvent;
+
+typedef struct {
+    float onset;
+    float offset;      // Below onset, so noise around a threshold doesn't split an episode
+    int onset_windows;
+    int offset_windows;
+    float low_hz;      // Band the dominant frequency is looked for in
+    float high_hz;
+} EpisodeRule;
+
+typedef struct {
+    EpisodeRule rules[EPISODE_KIND_COUNT];
+} EpisodeConfig;
+
+/** Thresholds picked on the synthetic data (`bench accuracy`), where symptom-free windows average
+ * 0.36 tremor and 0.31 dyskinesia and windows with them 0.86 and 1.0
+ */
+EpisodeConfig episode_default_config();
+
+/** Per symptom, the frequency with the most accelerometer power in its band, for one window.
+ * Analysis thread: the spectrum isn't kept past the next batch.
+ */
+void episode_window_frequencies(const EpisodeConfig &config, const float accel_freq_mags[3][BATCH_SIZE / 2 + 1],
+    float dominant_hz[EPISODE_KIND_COUNT]);
+void episode_window_frequencies(const EpisodeConfig &config, const half_t accel_freq_mags[3][BATCH_SIZE / 2 + 1],
+    float dominant_hz[EPISODE_KIND_COUNT]);
+
+int episode_encode(const EpisodeEvent &event, uint8_t dest[EPISODE_EVENT_SIZE]);
+bool episode_decode(const uint8_t *data, int size, EpisodeEvent &event);
+
+class EpisodeExtractor {
+public:
+    explicit EpisodeExtractor(const EpisodeConfig &config = episode_default_config());
+
+    /** Take one window's results.
+     * @param time_ms Start of the window
+     * @param dominant_hz From episode_window_frequencies() on the same window
+     * @param events Filled with what this window started or ended
+     * @return The number of events
+     */
+    int update(uint32_t time_ms, const SymptomIntensities &intensities, const float dominant_hz[EPISODE_KIND_COUNT],
+        EpisodeEvent events[EPISODE_MAX_EVENTS]);
+
+    /** End every open episode after its last window over offset, e.g. before stopping
+     * @return The number of events
+     */
+    int flush(EpisodeEvent events[EPISODE_MAX_EVENTS]);
+
+    void reset();
+
+private:
+    struct Track {
+        bool active;
+        int run;             // Windows in a row past the threshold that would change state
+        uint32_t onset_ms;   // Of the first window of the run (or episode, once active)
+        uint32_t last_ms;    // End of the last window over offset
+        float peak;
+        float sum;           // Of intensities, for the mean
+        float weighted_hz;   // Sum of intensity * dominant frequency
+        int windows;
+    };
+
+    EpisodeEvent make_event(EpisodeEventType type, int kind);
+
+    EpisodeConfig _config;
+    Track _tracks[EPISODE_KIND_COUNT];
+    uint16_t _sequence = 0;
+};
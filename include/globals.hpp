@@ -3,10 +3,20 @@
 // Global variables that should be useful throughout the whole program
 
 #define POLL_RATE 52
+// The IMU runs this many times faster and its FIFO is decimated down to POLL_RATE (1, 2, 4 or 8; 1 reads
+// every sample as it's ready, without anti-aliasing). The FIFO path hasn't run on a board yet, so it's opt-in.
+#define IMU_OVERSAMPLING 1
+// Drop the IMU to a low rate while the patient is still (see rate_control.hpp); needs IMU_OVERSAMPLING > 1.
+// Opt-in until the rate switching has been checked on a board.
+#define IMU_ADAPTIVE_RATE 0
 #define BATCH_SIZE_FILLED (3 * POLL_RATE) // 156
 #define BATCH_SIZE 256 // Next highest power of 2
 #define FREQUENCY_BIN_SIZE ((float)POLL_RATE / BATCH_SIZE)
 
+#define DEADLINE_REPORT_BATCHES 10 // Send deadline statistics every this many batches (30 s)
+
 #define DEBUG // Enables sanity checks and extra print statements
 
-// #define TELEPLOT // Enable print statements for Teleplot
\ No newline at end of file
+// #define TELEPLOT // Enable print statements for Teleplot
+
+// #define PROFILE // Time each processing stage; send 'p' over serial to print the table, 'r' to reset it
\ No newline at end of file
@@ -0,0 +1,96 @@
+#pragma once
+
+//! IEEE 754 half precision (binary16) storage: 1 sign bit, 5 exponent bits, 10 mantissa bits, so about
+//! 3 significant digits from 6e-5 (6e-8 with subnormals) to 65504. Values are only stored this way;
+//! anything that computes widens them to float first and narrows the result.
+//!
+//! The vendored CMSIS-DSP has f16 kernels but no conversion routines, and its float16_t only exists where
+//! the compiler has __fp16. Here conversions are plain integer code that runs anywhere, rounding to
+//! nearest even like the hardware does. Built with -mfp16-format=ieee for an FPU with the half precision
+//! extension (the M4's has it), they become single VCVTB instructions instead.
+
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__ARM_FP16_FORMAT_IEEE)
+#define HALF_HARDWARE 1
+#else
+#define HALF_HARDWARE 0
+#endif
+
+// A struct rather than a bare uint16_t, so a half can't be mistaken for an integer
+typedef struct {
+    uint16_t bits;
+} half_t;
+
+static inline half_t half_from_float(float value) {
+    half_t half;
+#if HALF_HARDWARE
+    __fp16 h = (__fp16)value;
+    memcpy(&half.bits, &h, sizeof(half.bits));
+#else
+    uint32_t x;
+    memcpy(&x, &value, sizeof(x));
+    uint16_t sign = (x >> 16) & 0x8000;
+    uint32_t abs = x & 0x7FFFFFFF;
+    if (abs >= 0x7F800000) {
+        // Infinity stays infinity; NaN stays a (quiet) NaN
+        half.bits = sign | 0x7C00 | (abs > 0x7F800000 ? 0x200 : 0);
+    } else if (abs >= 0x477FF000) {
+        // 65520 and up round past the largest half
+        half.bits = sign | 0x7C00;
+    } else if (abs < 0x38800000) {
+        // Below the smallest normal half (2^-14): a subnormal, in steps of 2^-24
+        int exponent = abs >> 23;
+        if (exponent < 102) {
+            half.bits = sign; // Under half a step
+        } else {
+            uint32_t mantissa = (abs & 0x7FFFFF) | 0x800000;
+            int shift = 126 - exponent;
+            uint32_t q = mantissa >> shift, rest = mantissa & ((1u << shift) - 1), halfway = 1u << (shift - 1);
+            if (rest > halfway || (rest == halfway && (q & 1))) q++;
+            half.bits = sign | (uint16_t)q;
+        }
+    } else {
+        // Rebias the exponent and drop 13 mantissa bits; a carry out of the mantissa bumps the exponent
+        uint32_t h = (abs >> 13) - ((127 - 15) << 10), rest = abs & 0x1FFF;
+        if (rest > 0x1000 || (rest == 0x1000 && (h & 1))) h++;
+        half.bits = sign | (uint16_t)h;
+    }
+#endif
+    return half;
+}
+
+static inline float half_to_float(half_t half) {
+#if HALF_HARDWARE
+    __fp16 h;
+    memcpy(&h, &half.bits, sizeof(h));
+    return (float)h;
+#else
+    uint32_t sign = (uint32_t)(half.bits & 0x8000) << 16;
+    uint32_t exponent = (half.bits >> 10) & 0x1F, mantissa = half.bits & 0x3FF;
+    uint32_t x;
+    if (exponent == 0x1F) {
+        x = sign | 0x7F800000 | (mantissa << 13);
+    } else if (exponent == 0) {
+        // Zero or subnormal: exact in float
+        float value = mantissa * (1.f / 16777216.f);
+        return sign ? -value : value;
+    } else {
+        x = sign | ((exponent + 127 - 15) << 23) | (mantissa << 13);
+    }
+    float value;
+    memcpy(&value, &x, sizeof(value));
+    return value;
+#endif
+}
+
+/** Widen n halves into floats */
+static inline void half_widen(const half_t *src, float *dest, int n) {
+    for (int i = 0; i < n; i++) dest[i] = half_to_float(src[i]);
+}
+
+/** Narrow n floats into halves, rounding to nearest even */
+static inline void half_narrow(const float *src, half_t *dest, int n) {
+    for (int i = 0; i < n; i++) dest[i] = half_from_float(src[i]);
+}
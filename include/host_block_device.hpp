@@ -0,0 +1,78 @@
+#pragma once
+
+//! Host stand-in for mbed's BlockDevice, so code written against it (e.g. SymptomLog) runs on a PC.
+//! Only the part of the interface the firmware uses is declared, with the same names and semantics.
+//!
+//! FileBlockDevice behaves like NOR flash: erasing sets bytes to 0xFF, programming can only clear
+//! bits, and erases are counted per erase block for endurance tests. It lives in memory and, given
+//! a path, is loaded from and written through to that file.
+
+#ifndef __MBED__
+
+#include <stdint.h>
+#include <stdio.h>
+#include <vector>
+
+#define BD_ERROR_OK 0
+#define BD_ERROR_DEVICE_ERROR -4001
+
+namespace mbed {
+
+typedef uint64_t bd_addr_t;
+typedef uint64_t bd_size_t;
+
+class BlockDevice {
+public:
+    virtual ~BlockDevice() {}
+
+    virtual int init() = 0;
+    virtual int deinit() = 0;
+    virtual int read(void *buffer, bd_addr_t addr, bd_size_t size) = 0;
+    virtual int program(const void *buffer, bd_addr_t addr, bd_size_t size) = 0;
+    virtual int erase(bd_addr_t addr, bd_size_t size) = 0;
+    virtual bd_size_t get_read_size() const = 0;
+    virtual bd_size_t get_program_size() const = 0;
+    virtual bd_size_t get_erase_size() const = 0;
+    virtual bd_size_t size() const = 0;
+    virtual int get_erase_value() const { return 0xFF; }
+};
+
+} // namespace mbed
+
+class FileBlockDevice : public mbed::BlockDevice {
+public:
+    /** @param path Backing file, or null to keep everything in memory */
+    FileBlockDevice(const char *path, mbed::bd_size_t size, mbed::bd_size_t erase_size = 4096, mbed::bd_size_t program_size = 256);
+    ~FileBlockDevice();
+
+    FileBlockDevice(const FileBlockDevice &) = delete;
+    FileBlockDevice &operator=(const FileBlockDevice &) = delete;
+
+    int init() override;
+    int deinit() override;
+    int read(void *buffer, mbed::bd_addr_t addr, mbed::bd_size_t size) override;
+    int program(const void *buffer, mbed::bd_addr_t addr, mbed::bd_size_t size) override;
+    int erase(mbed::bd_addr_t addr, mbed::bd_size_t size) override;
+    mbed::bd_size_t get_read_size() const override { return 1; }
+    mbed::bd_size_t get_program_size() const override { return _program_size; }
+    mbed::bd_size_t get_erase_size() const override { return _erase_size; }
+    mbed::bd_size_t size() const override { return _data.size(); }
+
+    /** Erase count of every erase block since construction */
+    const std::vector<uint32_t> &erase_counts() const { return _erase_counts; }
+    uint64_t bytes_programmed() const { return _bytes_programmed; }
+
+    /** Programming a bit from 0 back to 1 without an erase; NOR flash can't, so this is a bug in the caller */
+    uint64_t program_violations() const { return _program_violations; }
+
+private:
+    const char *_path;
+    FILE *_file = nullptr;
+    mbed::bd_size_t _erase_size, _program_size;
+    std::vector<uint8_t> _data;
+    std::vector<uint32_t> _erase_counts;
+    uint64_t _bytes_programmed = 0;
+    uint64_t _program_violations = 0;
+};
+
+#endif
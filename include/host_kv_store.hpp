@@ -0,0 +1,61 @@
+#pragma once
+
+//! Host stand-in for mbed's KVStore, so code written against it (e.g. calibration) runs on a PC.
+//! Only the part of the interface the firmware uses is declared, with the same names and semantics.
+//!
+//! FileKVStore keeps its keys in memory and, given a path, is loaded from and written through to that
+//! file on every set(), so values survive a "reboot" of the host tool. It counts writes, since on the
+//! device each one is a record appended to internal flash.
+
+#ifndef __MBED__
+
+#include <map>
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#define MBED_SUCCESS 0
+#define MBED_ERROR_ITEM_NOT_FOUND -1
+#define MBED_ERROR_WRITE_FAILED -2
+
+namespace mbed {
+
+class KVStore {
+public:
+    virtual ~KVStore() {}
+
+    virtual int init() = 0;
+    virtual int deinit() = 0;
+    virtual int reset() = 0;
+    virtual int set(const char *key, const void *buffer, size_t size, uint32_t create_flags) = 0;
+    virtual int get(const char *key, void *buffer, size_t buffer_size, size_t *actual_size = nullptr, size_t offset = 0) = 0;
+    virtual int remove(const char *key) = 0;
+};
+
+} // namespace mbed
+
+class FileKVStore : public mbed::KVStore {
+public:
+    /** @param path Backing file, or null to keep everything in memory */
+    explicit FileKVStore(const char *path = nullptr) : _path(path) {}
+
+    int init() override;
+    int deinit() override { return MBED_SUCCESS; }
+    int reset() override;
+    int set(const char *key, const void *buffer, size_t size, uint32_t create_flags) override;
+    int get(const char *key, void *buffer, size_t buffer_size, size_t *actual_size = nullptr, size_t offset = 0) override;
+    int remove(const char *key) override;
+
+    /** set() and remove() calls since construction */
+    uint32_t writes() const { return _writes; }
+
+private:
+    int write_file();
+
+    const char *_path;
+    std::map<std::string, std::vector<uint8_t>> _values;
+    uint32_t _writes = 0;
+};
+
+#endif
@@ -0,0 +1,100 @@
+#pragma once
+
+//! Lossless compression of raw 6-axis IMU samples, for keeping or sending raw data where 12 bytes per
+//! sample is too much.
+//!
+//! Samples are coded in blocks of up to IMU_CODEC_BLOCK_SAMPLES that decode on their own, so a reader
+//! can start at any block. In each block every axis uses one of the fixed polynomial predictors
+//! (order 0: the value, 1: the delta, 2 and 3: higher differences); the encoder picks, per axis, the
+//! order that did best over the previous block. Residuals are zigzagged and Rice coded, with the Rice
+//! parameter adapting per axis from a running mean of recent residuals (as in LOCO-I), so no side
+//! information is needed for it. Residuals too big for that are escaped and stored verbatim.
+//!
+//! The encoder takes one sample at a time in constant time and memory, so it could run inline in
+//! acquisition_task(). No firmware path uses it yet: it's built for the host tools only, until raw data
+//! is stored or sent in bulk.
+//!
+//! Block layout, little-endian:
+//!   u8  version       IMU_CODEC_VERSION
+//!   u8  count         Samples in the block
+//!   u16 size          Bytes in the block, header included
+//!   u32 first_sample  Index of the first sample in the stream
+//!   u16 orders        Predictor order of axis i in bits 2i..2i+1 (accel x, y, z, gyro x, y, z)
+//!   bits              MSB first: the residuals, sample by sample, axis by axis, padded to a byte
+
+#include <stdint.h>
+
+#include "imu_source.hpp"
+
+#define IMU_CODEC_VERSION 1
+#define IMU_CODEC_AXES 6
+// ~2.5 s at 52 Hz. Longer blocks spend less on headers and restarts, but are coarser to seek in.
+#define IMU_CODEC_BLOCK_SAMPLES 128
+#define IMU_CODEC_HEADER_SIZE 10
+#define IMU_CODEC_MAX_ORDER 3
+
+// Quotients from here on are escaped: this many 1 bits, then the zigzagged residual in full.
+// An order 3 residual of 16 bit samples needs 20 bits.
+#define IMU_CODEC_ESCAPE 16
+#define IMU_CODEC_ESCAPE_BITS 20
+// Largest a block can get, when everything is escaped
+#define IMU_CODEC_MAX_BLOCK_SIZE \
+    (IMU_CODEC_HEADER_SIZE + (IMU_CODEC_BLOCK_SAMPLES * IMU_CODEC_AXES * (IMU_CODEC_ESCAPE + IMU_CODEC_ESCAPE_BITS) + 7) / 8)
+
+/** Per-axis Rice parameter state. Encoder and decoder update it the same way. */
+typedef struct {
+    uint32_t sum;   // Of recent zigzagged residuals
+    uint32_t count;
+} RiceState;
+
+class ImuEncoder {
+public:
+    explicit ImuEncoder(uint32_t first_sample = 0);
+
+    /** Code one sample.
+     * @return The size of the block this sample completed, or 0 if the block isn't full yet.
+     *   A completed block is in block() until the next call.
+     */
+    int add(const RawImuSample &sample);
+
+    /** Close the block being filled early, e.g. before a shutdown.
+     * @return Its size (it's in block() until the next add()), or 0 if it was empty
+     */
+    int finish();
+
+    const uint8_t *block() const { return _block; }
+
+    /** Index the next sample will have */
+    uint32_t next_sample() const { return _first_sample + _count; }
+
+private:
+    void start_block();
+    int end_block();
+    void put_bits(uint32_t value, int bits);
+    void put_residual(int axis, int32_t residual);
+
+    uint8_t _block[IMU_CODEC_MAX_BLOCK_SIZE];
+    uint32_t _first_sample;
+    int _count = 0;
+    bool _finished = false; // _block holds a completed block; start a new one on the next add()
+
+    uint64_t _bits = 0;     // Pending output bits, right-aligned
+    int _bit_count = 0;
+    int _size = 0;
+
+    uint8_t _orders[IMU_CODEC_AXES];
+    int32_t _history[IMU_CODEC_AXES][IMU_CODEC_MAX_ORDER]; // Last samples of each axis, newest first
+    RiceState _rice[IMU_CODEC_AXES];
+    // Cost of each predictor order over the current block, for picking the next block's orders
+    uint32_t _costs[IMU_CODEC_AXES][IMU_CODEC_MAX_ORDER + 1];
+};
+
+/** Samples in a block, and its size, from the header alone (e.g. to skip over it)
+ * @return false if it isn't a block this version can read
+ */
+bool imu_codec_block_info(const uint8_t *data, int size, int &count, int &block_size, uint32_t &first_sample);
+
+/** Decode a whole block into at most IMU_CODEC_BLOCK_SAMPLES samples.
+ * @return The number of samples, or -1 if the block is truncated or corrupt
+ */
+int imu_codec_decode_block(const uint8_t *data, int size, RawImuSample *samples);
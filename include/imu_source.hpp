@@ -0,0 +1,40 @@
+#pragma once
+
+//! Where IMU samples come from: the real sensor on the board, or a recorded trace on a host.
+
+#include <stdint.h>
+
+#include "globals.hpp"
+
+/** One raw 6-axis reading in sensor counts (±2 g, ±250 dps full scale) */
+typedef struct {
+    int16_t accel[3];
+    int16_t gyro[3];
+} RawImuSample;
+
+class ImuSource {
+public:
+    virtual ~ImuSource() {}
+
+    /** Wait for the next sample.
+     * @return false if there will be no more samples (end of a trace, sensor error)
+     */
+    virtual bool read(RawImuSample &sample) = 0;
+
+    /** Wait for the next samples: at least one, at most max, e.g. whatever a FIFO read produced.
+     * @return Samples read; 0 if there will be no more
+     */
+    virtual int read_block(RawImuSample *samples, int max) { return max > 0 && read(samples[0]) ? 1 : 0; }
+
+    /** Like read_block(), plus when each sample was taken, in microseconds on the source's own clock
+     * (see resampler.hpp). Without a clock, samples are stamped as if none were ever missed.
+     */
+    virtual int read_timed(RawImuSample *samples, uint64_t *times_us, int max) {
+        int n = read_block(samples, max);
+        for (int i = 0; i < n; i++) times_us[i] = _untimed_samples++ * 1000000 / POLL_RATE;
+        return n;
+    }
+
+private:
+    uint64_t _untimed_samples = 0;
+};
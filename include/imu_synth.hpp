@@ -0,0 +1,127 @@
+#pragma once
+
+//! Synthetic 6-axis IMU streams with known ground truth, for benchmarking the pipeline and the detectors.
+//! The patient moves between activities (rest, tremor, dyskinesia, walking, freezing) following a simple
+//! random schedule, occasionally changes how the sensor is oriented, and everything goes through
+//! sensor noise and the ±2 g / ±250 dps full scale of the LSM6DSL.
+
+#include <stdint.h>
+
+#include "imu_source.hpp"
+
+// Ground truth, one set of flags per sample
+#define SYNTH_LABEL_TREMOR      (1 << 0)
+#define SYNTH_LABEL_DYSKINESIA  (1 << 1)
+#define SYNTH_LABEL_WALKING     (1 << 2)
+#define SYNTH_LABEL_FREEZE      (1 << 3)
+#define SYNTH_LABEL_TURNING     (1 << 4) // Orientation is changing
+
+typedef struct {
+    float sample_rate;          // Hz
+
+    // Rest tremor: a steady oscillation along a random direction
+    float tremor_hz;
+    float tremor_g;
+    float tremor_dps;           // Matching rotational tremor
+    // Dyskinesia: irregular bursts made of a few oscillators within [dyskinesia_low_hz, dyskinesia_high_hz]
+    float dyskinesia_low_hz;
+    float dyskinesia_high_hz;
+    float dyskinesia_g;
+    // Gait: vertical bounce at the step cadence plus its first harmonic
+    float cadence_hz;
+    float gait_g;
+
+    // Mean durations of each activity in seconds
+    float rest_s;
+    float tremor_s;
+    float dyskinesia_s;
+    float walking_s;
+    float freeze_s;
+    // How the next activity is picked after rest, and how often walking ends in a freeze
+    float p_tremor;
+    float p_dyskinesia;
+    float p_walking;
+    float p_freeze;
+
+    // Orientation changes: mean time between them, and how long each one takes
+    float orientation_change_s;
+    float turn_s;
+
+    // Sensor noise (standard deviation)
+    float accel_noise_g;
+    float gyro_noise_dps;
+    // Sensor errors, for calibration: readings are true * gain + offset (accelerometer) or true + bias (gyro)
+    float accel_offset_g[3];
+    float accel_gain[3];
+    float gyro_bias_dps[3];
+
+    uint32_t seed;
+} SynthConfig;
+
+/** Sensible defaults for a 52 Hz stream with a bit of everything */
+SynthConfig synth_default_config();
+
+/** Sinusoid generated by rotating a phasor: two multiplies and two adds per sample, no trig */
+typedef struct {
+    float re, im;
+    float step_re, step_im;
+} SynthOscillator;
+
+class ImuSynth {
+public:
+    explicit ImuSynth(const SynthConfig &config);
+
+    /** Generate the next n samples. labels may be null. */
+    void generate(RawImuSample *samples, uint8_t *labels, long n);
+
+    /** Samples generated so far */
+    long position() const { return _position; }
+
+    /** Ground truth for orientation: down in the sensor's frame (unit length) for the next sample */
+    const float *gravity() const { return _gravity; }
+
+private:
+    enum Activity { REST, TREMOR, DYSKINESIA, WALKING, FREEZE };
+
+    void start_activity(Activity activity);
+    void start_turn();
+    long random_duration(float mean_s);
+    uint32_t next_random();
+    float uniform();
+    void random_direction(float dest[3]);
+
+    SynthConfig _config;
+    uint32_t _rng;
+    long _position = 0;
+
+    Activity _activity = REST;
+    long _activity_left = 0;
+    long _turn_left = 0, _next_turn = 0;
+
+    float _gravity[3] = { 0.f, 0.f, 1.f }; // Down in the sensor's frame, in g
+    float _turn_rate[3] = { 0.f, 0.f, 0.f }; // rad/sample while turning
+
+    SynthOscillator _tremor, _dyskinesia[3], _gait;
+    float _tremor_dir[3], _dyskinesia_dir[3][3];
+
+    // Envelopes ease each motion in and out instead of switching it on in a single sample
+    float _tremor_env = 0.f, _dyskinesia_env = 0.f, _gait_env = 0.f;
+    float _env_step;
+};
+
+/** ImuSource over a synthetic stream, so generated data can be fed anywhere a trace can */
+class SynthSource : public ImuSource {
+public:
+    SynthSource(const SynthConfig &config, long samples) : _synth(config), _left(samples) {}
+
+    bool read(RawImuSample &sample) override {
+        if (_left <= 0) return false;
+        _synth.generate(&sample, nullptr, 1);
+        _left--;
+        return true;
+    }
+
+private:
+    ImuSynth _synth;
+    long _left;
+};
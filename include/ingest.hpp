@@ -3,25 +3,40 @@
 #include <mbed.h>
 
 #include "globals.hpp"
+#include "conditioning.hpp"
+#include "imu_source.hpp"
+#include "deadline.hpp"
+#include "calibration.hpp"
+#include "ingest_pipeline.hpp"
 
-extern I2C i2c;
+// Batches that can be waiting for (or going through) analysis while the next one fills
+#define INGEST_QUEUE_DEPTH 2
 
-extern Mutex ingest_batch_mutex;
-// Use this in the main function to wait for batches of data.
-// Waiting requires you to have locked the ingest_batch_mutex!
-extern ConditionVariable ingest_batch_condition;
+typedef struct {
+    AnalysisBatch imu;
+    uint32_t sequence;   // Counts every batch acquired, so gaps show where batches were dropped
+    uint64_t release_us; // When acquisition handed it over, for deadline_monitor.complete()
+} IngestBatch;
 
-/// @brief Attempt to set up the IMU
-/// @return true if setup completed successfully
-bool init_imu();
+// Stamps samples and batch releases from acquisition_task().
+// Call deadline_monitor.complete() once a batch is processed, from the analysis thread.
+extern DeadlineMonitor deadline_monitor;
 
-/// @brief Main loop to gather data from the IMU
-void acquisition_task();
+/// @brief Main loop to gather data from the IMU. Never blocks on the consumers:
+/// if analysis falls INGEST_QUEUE_DEPTH batches behind, new batches are dropped instead.
+/// @param source Where samples come from. Returns when the source runs out.
+void acquisition_task(ImuSource *source);
 
-typedef struct {
-    float accelerometer[3][BATCH_SIZE];
-    float gyroscope[3][BATCH_SIZE];
-} IMUBatch;
+/** Calibration to start from, e.g. the stored one. Call before starting acquisition_task(). */
+void set_calibration(const Calibration &calibration);
+
+/** True when acquisition has learned a calibration worth saving since the last call; it's copied to dest */
+bool take_calibration(Calibration &dest);
+
+/** Wait for the next full batch of IMU data. Hand it back with free_batch() when done. */
+IngestBatch *wait_batch();
+
+void free_batch(IngestBatch *batch);
 
-/** Retrieve the currently readable batch of IMU data. */
-IMUBatch* get_batch();
+/** Batches acquisition had to throw away because analysis was behind */
+uint32_t dropped_batches();
@@ -0,0 +1,88 @@
+#pragma once
+
+//! The path from raw IMU samples to full analysis windows, shared by acquisition_task() and the host tools.
+//!
+//! Samples go through the ImuResampler back onto the POLL_RATE grid, are scaled and corrected by the
+//! Calibrator, and are conditioned a run at a time into windows of BATCH_SIZE_FILLED + 1 samples. Where the
+//! batches come from and where full ones go is up to a BatchSink: on the device they go to the analysis
+//! thread, in the tools they're analyzed on the spot. Nothing here needs mbed, so a replayed recording takes
+//! exactly the path a live one does.
+
+#include <stdint.h>
+
+#include "globals.hpp"
+#include "conditioning.hpp"
+#include "imu_source.hpp"
+#include "calibration.hpp"
+#include "resampler.hpp"
+
+// Most samples taken from the source at once: a whole converted FIFO block, which is largest at the low
+// adaptive rate (INTERPOLATOR_MAX_BLOCK)
+#define IMU_READ_BLOCK 64
+
+/** What an IngestPipeline fills and where it delivers. Every call comes from the thread pushing samples. */
+class BatchSink {
+public:
+    virtual ~BatchSink() {}
+
+    /** A batch for the next window, called just before its first sample is conditioned */
+    virtual AnalysisBatch *fill_batch() = 0;
+
+    /** The batch from fill_batch() holds a whole window */
+    virtual void batch_full(AnalysisBatch *batch) = 0;
+
+    /** run() read count samples from the source, and is about to push them */
+    virtual void samples_read(int /*count*/) {}
+
+    /** A sample on the POLL_RATE grid, as it came from the sensor. index counts them from 0. */
+    virtual void resampled(const RawImuSample & /*sample*/, uint32_t /*index*/) {}
+
+    /** The Calibrator learned a calibration worth saving.
+     * @return false if it can't be taken now; it's offered again with the next sample
+     */
+    virtual bool calibration_changed(const Calibration & /*calibration*/) { return true; }
+};
+
+class IngestPipeline {
+public:
+    IngestPipeline(BatchSink &sink, const Calibration &calibration = calibration_identity())
+        : _sink(sink), _calibrator(calibration) {}
+
+    /** Push everything source has into the sink.
+     * @return Samples read
+     */
+    long run(ImuSource &source);
+
+    /** Take the next samples, in order.
+     * @param times_us When each was taken, as from ImuSource::read_timed()
+     */
+    void push(const RawImuSample *samples, const uint64_t *times_us, int count);
+
+    /** Take the next samples, stamped as if none were ever missed */
+    void push(const RawImuSample *samples, int count);
+
+    const ImuResampler &resampler() const { return _resampler; }
+    const Calibrator &calibrator() const { return _calibrator; }
+
+private:
+    void condition_run();
+
+    BatchSink &_sink;
+    ImuResampler _resampler; // Back onto the POLL_RATE grid, over missed samples
+    Calibrator _calibrator;
+    SampleConditioner _conditioner; // Orientation and low pass state
+    bool _calibration_pending = false;
+    uint32_t _sample_index = 0;
+    uint64_t _untimed_samples = 0;
+
+    AnalysisBatch *_filling = nullptr;
+    int _i_time = 0; // Next slot of _filling
+
+    // Calibrated samples gathered for the conditioner, which takes them a block at a time
+    float _run_acc[IMU_READ_BLOCK][3], _run_gyro[IMU_READ_BLOCK][3];
+    int _run = 0;
+
+    // For run() and the untimed push()
+    RawImuSample _samples[IMU_READ_BLOCK];
+    uint64_t _times_us[IMU_READ_BLOCK];
+};
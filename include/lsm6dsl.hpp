@@ -0,0 +1,113 @@
+#pragma once
+
+#include <mbed.h>
+
+#include "globals.hpp"
+#include "imu_source.hpp"
+#include "decimator.hpp"
+#include "rate_control.hpp"
+
+// Where the LSM6DSL sits on the B-L475E-IOT01A
+#define LSM6DSL_SDA_PIN     PB_11
+#define LSM6DSL_SCL_PIN     PB_10
+#define LSM6DSL_INT1_PIN    PD_11
+
+// Input samples per FIFO read when oversampling: one decimator block, so the FIFO threshold is this many
+#define LSM6DSL_FIFO_SAMPLES (DECIMATOR_MAX_BLOCK - DECIMATOR_MAX_BLOCK % IMU_OVERSAMPLING)
+// At the low adaptive rate: one interpolator block
+#define LSM6DSL_LOW_FIFO_SAMPLES (INTERPOLATOR_MAX_BLOCK / RATE_LOW_INTERPOLATION)
+// POLL_RATE samples one FIFO read can turn into
+#if IMU_ADAPTIVE_RATE
+#define LSM6DSL_OUTPUT_SAMPLES INTERPOLATOR_MAX_BLOCK
+#else
+#define LSM6DSL_OUTPUT_SAMPLES (LSM6DSL_FIFO_SAMPLES / IMU_OVERSAMPLING)
+#endif
+
+/** LSM6DSL accelerometer + gyroscope on I2C.
+ * With IMU_OVERSAMPLING 1 it's paced by the data-ready interrupt and read a sample at a time. Otherwise it
+ * runs IMU_OVERSAMPLING times faster into its FIFO, is paced by the FIFO threshold interrupt, and each
+ * FIFO block is decimated to POLL_RATE (see decimator.hpp).
+ * With IMU_ADAPTIVE_RATE as well, it drops to RATE_LOW_HZ while the patient is still and its FIFO blocks
+ * are interpolated up to POLL_RATE instead (see rate_control.hpp).
+ */
+class Lsm6dslSource : public ImuSource, private mbed::NonCopyable<Lsm6dslSource> {
+public:
+    Lsm6dslSource(PinName sda = LSM6DSL_SDA_PIN, PinName scl = LSM6DSL_SCL_PIN, PinName int1 = LSM6DSL_INT1_PIN) :
+        _i2c(sda, scl),
+        _int1(int1, PullDown)
+    #if IMU_OVERSAMPLING > 1
+    , _decimator(IMU_OVERSAMPLING)
+    #endif
+    #if IMU_OVERSAMPLING > 1 && IMU_ADAPTIVE_RATE
+    , _interpolator(RATE_LOW_INTERPOLATION)
+    #endif
+    {
+    }
+
+    /// @brief Attempt to set up the IMU
+    /// @return true if setup completed successfully
+    bool init();
+
+    /** Block until the sensor signals data-ready, then read all 6 axes */
+    bool read(RawImuSample &sample) override;
+
+    /** Oversampling: the rest of the last decimated FIFO block, or wait for the next one */
+    int read_block(RawImuSample *samples, int max) override;
+
+    /** Stamped from the MCU's microsecond timer: when data-ready fired, or (from a FIFO) by the FIFO level */
+    int read_timed(RawImuSample *samples, uint64_t *times_us, int max) override;
+
+    #if IMU_OVERSAMPLING > 1 && IMU_ADAPTIVE_RATE
+    ImuRate rate() const { return _rate; }
+    uint32_t rate_switches() const { return _rate_control.switches(); }
+    #endif
+
+private:
+    bool read_reg(uint8_t reg, uint8_t &value);
+    bool write_reg(uint8_t reg, uint8_t val);
+    bool read_int16(uint8_t reg_low, int16_t &val);
+    bool read_regs(uint8_t reg, uint8_t *dest, int size);
+
+    #if IMU_OVERSAMPLING > 1
+    /** Whole samples waiting in the FIFO; negative on a bus error */
+    int fifo_samples();
+    /** FIFO threshold at the current rate */
+    int fifo_block() const;
+    /** Read n samples from the FIFO and convert them to POLL_RATE, after what's already in _decimated */
+    bool read_fifo(int n);
+    /** Set the ODR and FIFO up for the current rate */
+    void configure();
+    #endif
+    #if IMU_OVERSAMPLING > 1 && IMU_ADAPTIVE_RATE
+    /** Change the sensor's rate without a gap or a step in the output */
+    void switch_rate(ImuRate rate);
+    #endif
+
+    void data_ready_isr();
+
+    I2C _i2c;
+    InterruptIn _int1;
+    EventFlags _events;
+    Timer _clock; // Timestamps
+    volatile uint64_t _ready_us = 0; // Last data-ready interrupt
+    uint64_t _sample_us = 0; // When the last sample read() returned was ready
+
+    #if IMU_OVERSAMPLING > 1
+    ImuDecimator _decimator;
+    uint8_t _fifo[LSM6DSL_FIFO_SAMPLES][12]; // As read: gyro x, y, z, then accel x, y, z, little-endian
+    RawImuSample _raw[LSM6DSL_FIFO_SAMPLES];
+    RawImuSample _decimated[LSM6DSL_OUTPUT_SAMPLES];
+    uint64_t _decimated_us[LSM6DSL_OUTPUT_SAMPLES];
+    int _decimated_count = 0, _decimated_next = 0;
+    // FIFO level as of the last fifo_samples(), and when it was read
+    int _level = 0;
+    uint64_t _level_us = 0;
+    uint64_t _last_output_us = 0; // Timestamp of the last output sample
+    bool _stamped = false;
+    #endif
+    #if IMU_OVERSAMPLING > 1 && IMU_ADAPTIVE_RATE
+    ImuInterpolator _interpolator;
+    RateController _rate_control;
+    ImuRate _rate = IMU_RATE_HIGH; // What the sensor is set to
+    #endif
+};
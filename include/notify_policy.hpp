@@ -0,0 +1,59 @@
+#pragma once
+
+//! Decides which analysis windows are worth a BLE notification.
+//! Intensities are noisy, so sending every window mostly spends radio time on changes nobody cares about.
+//! Each value (tremor, dyskinesia, FOG) has its own rule:
+//!  - deadband: a change smaller than this since the last notification doesn't count
+//!  - min_interval_ms: changes count at most this often
+//!  - max_staleness_ms: notify anyway once the last notification is this old (0: never)
+//! A notification always carries the latest value of every field, so updates that were held back
+//! go out together with the next one that's sent.
+
+#include <stdint.h>
+
+#include "telemetry.hpp"
+
+#define NOTIFY_FIELD_COUNT 3 // tremor, dyskinesia, fog
+#define NOTIFY_POLICY_SIZE (NOTIFY_FIELD_COUNT * 12)
+
+// Defaults; a central can change them through the notify policy characteristic
+#define NOTIFY_DEFAULT_DEADBAND 0.02f        // Tremor and dyskinesia are fractions of the total energy
+#define NOTIFY_DEFAULT_FOG_DEADBAND 0.1f     // FOG moves in steps of 1/3
+#define NOTIFY_DEFAULT_MIN_INTERVAL_MS 0
+#define NOTIFY_DEFAULT_MAX_STALENESS_MS 30000
+
+typedef struct {
+    float deadband;
+    uint32_t min_interval_ms;
+    uint32_t max_staleness_ms;
+} NotifyRule;
+
+typedef struct {
+    NotifyRule rules[NOTIFY_FIELD_COUNT]; // tremor, dyskinesia, fog
+} NotifyPolicyConfig;
+
+NotifyPolicyConfig notify_default_config();
+
+/** Wire format for the characteristic: per field, f32 deadband, u32 min_interval_ms, u32 max_staleness_ms */
+int notify_config_encode(const NotifyPolicyConfig &config, uint8_t dest[NOTIFY_POLICY_SIZE]);
+bool notify_config_decode(const uint8_t *data, int size, NotifyPolicyConfig &config);
+
+class NotifyPolicy {
+public:
+    NotifyPolicy() : _config(notify_default_config()) {}
+
+    void configure(const NotifyPolicyConfig &config) { _config = config; }
+    const NotifyPolicyConfig &config() const { return _config; }
+
+    /** Offer the latest window. Returns true if it should be sent now; the sent values become the new reference. */
+    bool should_send(const TelemetryFrame &frame);
+
+    /** Forget what was sent, e.g. for a new connection. The next frame is always sent. */
+    void reset() { _have_sent = false; }
+
+private:
+    NotifyPolicyConfig _config;
+    bool _have_sent = false;
+    float _sent_value[NOTIFY_FIELD_COUNT];
+    uint32_t _sent_ms = 0;
+};
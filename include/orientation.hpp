@@ -0,0 +1,89 @@
+#pragma once
+
+//! Quaternion math for tracking which way is down.
+//! Quaternions are stored [w, x, y, z] and convert the imu-relative frame of reference to a "global" frame of reference.
+
+#include "globals.hpp"
+
+/** Produce rotational derivatives that move the quaternion's local axis towards the given vector.
+ * Assumes acceleration and rot are both normalized.
+ */
+void accel_right(float accel_norm[3], float rot[4], float dest[3]);
+
+/** Approximately apply a rotational derivative to a quaternion. Dest may be rot. */
+void rotate_quaternion(float deriv[3], float rot[4], float dest[4]);
+
+/** Rotate a vector using a quaternion. Dest may be vec. */
+void rotate_vector(const float vec[3], float rot[4], float dest[3]);
+
+/** Rotate n vectors, each by its own quaternion, with t = 2 (u x v), v' = v + w t + u x t (u being the
+ * quaternion's vector part): 15 multiplies and 15 adds each. Dest may be vecs.
+ */
+void rotate_vectors(const float (*rots)[4], const float (*vecs)[3], float (*dest)[3], int n);
+
+/** rotate_vectors() with the vectors' x, y and z in separate arrays. The outputs may be the inputs. */
+void rotate_vectors_soa(const float (*rots)[4], const float *x, const float *y, const float *z,
+    float *dest_x, float *dest_y, float *dest_z, int n);
+
+/** Rotate n accelerations into the global frame and subtract gravity ([0, 0, gravity] there) in the same
+ * pass. Dest may be accel.
+ */
+void rotate_minus_gravity(const float (*rots)[4], const float (*accel)[3], float gravity, float (*dest)[3], int n);
+
+/** rotate_minus_gravity() with the accelerations' x, y and z in separate arrays. The outputs may be the inputs. */
+void rotate_minus_gravity_soa(const float (*rots)[4], const float *x, const float *y, const float *z, float gravity,
+    float *dest_x, float *dest_y, float *dest_z, int n);
+
+/** Solve the orientation that turns the given acceleration straight down, directly: the shortest rotation
+ * from it to the global z axis, so no yaw. Acceleration needn't be normalized.
+ */
+void tilt_quaternion(const float accel[3], float rot[4]);
+
+/** Update the orientation with one sample.
+ * @param accel Acceleration in g
+ * @param gyro Angular rate in degrees per second
+ */
+void update_rot(float accel[3], float gyro[3], float rot[4]);
+
+// Mahony filter gains, in rad/s per unit of tilt error. The proportional one matches update_rot()'s
+// GRAVITY_UPDATE_RATE per sample; the integral one settles the gyro bias over about half a minute.
+#define MAHONY_KP (0.05f * POLL_RATE)
+#define MAHONY_KI 0.02f
+// Largest gyro bias it will estimate, rad/s (10 dps)
+#define MAHONY_MAX_BIAS 0.1745f
+
+/** Mahony's complementary filter on SO(3): like update_rot(), accelerometer tilt error steers the gyro
+ * integration, but its integral also tracks the gyro bias.
+ * Samples can be given a block at a time (e.g. a FIFO read); each one still updates the orientation in
+ * turn. Per sample it needs one square root and one division, for the acceleration's length.
+ */
+class MahonyFilter {
+public:
+    MahonyFilter() { reset(); }
+
+    void reset();
+
+    /** Start from an orientation, e.g. tilt_quaternion()'s */
+    void set_orientation(const float rot[4]);
+
+    /** Update with n samples.
+     * @param accel Acceleration in g
+     * @param gyro Angular rate in degrees per second
+     * @param rots Where to put the orientation after each sample, or null
+     */
+    void update(const float (*accel)[3], const float (*gyro)[3], int n, float (*rots)[4] = nullptr);
+
+    /** Update with one sample */
+    void update(const float accel[3], const float gyro[3]) {
+        update(reinterpret_cast<const float (*)[3]>(accel), reinterpret_cast<const float (*)[3]>(gyro), 1);
+    }
+
+    const float *orientation() const { return _rot; }
+
+    /** Estimated gyro bias in degrees per second */
+    void gyro_bias(float dest[3]) const;
+
+private:
+    float _rot[4];
+    float _bias[3]; // rad/s, subtracted from the gyro
+};
@@ -0,0 +1,60 @@
+#pragma once
+
+//! Extended Kalman filter for orientation and gyro bias, an alternative to update_rot() and MahonyFilter.
+//!
+//! Error-state form: the orientation itself is a quaternion (same convention as orientation.hpp), and the
+//! filter's 6-element state is the small rotation error in the sensor frame plus the gyro bias error,
+//! with a 6x6 covariance. The gyro drives the prediction; the accelerometer, taken as gravity, is the
+//! measurement. Its noise grows with how far the acceleration is from 1 g, so motion counts for less,
+//! as in update_rot(). All matrix math is fixed-size (small_matrix.hpp): no heap, no run-time sizes.
+
+#include "globals.hpp"
+
+// Gyro white noise, rad/s per sample (0.5 dps)
+#define EKF_GYRO_NOISE 0.0087f
+// Gyro bias random walk, rad/s per sqrt(s)
+#define EKF_BIAS_WALK 0.0002f
+// Accelerometer noise at rest, as a fraction of gravity; and how fast it grows with |a| - 1 g
+#define EKF_ACCEL_NOISE 0.05f
+#define EKF_ACCEL_MOTION_NOISE 4.f
+// Starting uncertainty: tilt in rad, bias in rad/s (3 dps)
+#define EKF_INITIAL_TILT 0.1f
+#define EKF_INITIAL_BIAS 0.05f
+
+class OrientationEkf {
+public:
+    OrientationEkf() { reset(); }
+
+    void reset();
+
+    /** Start from an orientation, e.g. tilt_quaternion()'s */
+    void set_orientation(const float rot[4]);
+
+    /** Update with n samples, in order.
+     * @param accel Acceleration in g
+     * @param gyro Angular rate in degrees per second
+     * @param rots Where to put the orientation after each sample, or null
+     */
+    void update(const float (*accel)[3], const float (*gyro)[3], int n, float (*rots)[4] = nullptr);
+
+    /** Update with one sample */
+    void update(const float accel[3], const float gyro[3]) {
+        update(reinterpret_cast<const float (*)[3]>(accel), reinterpret_cast<const float (*)[3]>(gyro), 1);
+    }
+
+    const float *orientation() const { return _rot; }
+
+    /** Estimated gyro bias in degrees per second */
+    void gyro_bias(float dest[3]) const;
+
+    /** Standard deviation of the tilt error about either horizontal axis, in degrees */
+    float tilt_sigma() const;
+
+private:
+    void predict(const float gyro[3]);
+    void correct(const float accel[3]);
+
+    float _rot[4];
+    float _bias[3]; // rad/s, subtracted from the gyro
+    float _p[6 * 6]; // Covariance of [rotation error, bias error]
+};
@@ -2,6 +2,13 @@
 
 #include "mbed.h"
 
+#include "deadline.hpp"
+#include "deferred_log.hpp"
+#include "telemetry.hpp"
+#include "symptom_log.hpp"
+#include "episodes.hpp"
+#include "symptom_stats.hpp"
+
 // Configuration: Choose your output method
 // Set to 1 for BLE, 0 for Serial only
 #ifndef USE_BLE_OUTPUT
@@ -34,26 +41,68 @@ public:
 #endif
     }
 
-    void sendTremor(float value) {
+    /** Make a symptom log available for download over BLE */
+    void setHistory(SymptomLog *history) {
+#if USE_BLE_OUTPUT
+        _ble_handler.setHistory(history);
+#endif
+    }
+
+    /** Send one window's results: a single packed notification over BLE, one line per value over serial */
+    void sendTelemetry(const TelemetryFrame &frame) {
+#if USE_BLE_OUTPUT
+        _ble_handler.updateTelemetry(frame);
+#endif
+        // Always send via serial for debugging; the drain thread does the printing
+        DLOG(LOG_TREMOR, frame.tremor);
+        DLOG(LOG_DYSKINESIA, frame.dyskinesia);
+        DLOG(LOG_FREEZING_GAIT, frame.fog);
+    }
+
+    /** Send an episode starting or ending: one notification over BLE, one line over serial */
+    void sendEpisode(const EpisodeEvent &event) {
 #if USE_BLE_OUTPUT
-        _ble_handler.updateTremor(value);
+        _ble_handler.updateEpisode(event);
 #endif
-        // Always send via serial for debugging
-        printf(">Tremor:%.3f\n", value);
+        if (event.type == EPISODE_START) {
+            DLOG(LOG_EPISODE_START, (unsigned)event.kind, (unsigned long)event.onset_ms, event.peak);
+        } else {
+            DLOG(LOG_EPISODE_END, (unsigned)event.kind, (unsigned long)event.onset_ms, (unsigned long)event.duration_ms,
+                event.peak, event.mean, event.dominant_hz);
+        }
     }
 
-    void sendDyskinesia(float value) {
+    /** Publish percentiles and times above threshold: readable over BLE (with the sketches behind them),
+     * one line per symptom over serial
+     */
+    void sendStatistics(SymptomStats &stats) {
+        StatsSummary summary = stats.summary();
 #if USE_BLE_OUTPUT
-        _ble_handler.updateDyskinesia(value);
+        _ble_handler.updateStatistics(summary, stats);
 #endif
-        printf(">Dyskinesia:%.3f\n", value);
+        for (int symptom = 0; symptom < STATS_SYMPTOMS; symptom++) {
+            const SymptomSummary &s = summary.symptoms[symptom];
+            DLOG(LOG_STATISTICS, (unsigned)symptom, s.p50, s.p90, s.p99, s.above_ms / 60000.f, s.threshold);
+        }
     }
 
-    void sendFreezingGait(float value) {
+    /** True once after a central asked for the statistics to start over */
+    bool takeStatisticsReset() {
 #if USE_BLE_OUTPUT
-        _ble_handler.updateFreezingGait(value);
+        return _ble_handler.takeStatisticsReset();
+#else
+        return false;
 #endif
-        printf(">FOG:%.3f\n", value);
+    }
+
+    void sendDeadlineStats(const DeadlineStats &stats) {
+        DLOG(LOG_DEADLINE_STATS,
+            stats.window_min_slack_us / 1000.f,
+            stats.window_mean_slack_us / 1000.f,
+            (unsigned long)stats.misses,
+            (unsigned long)stats.dropped_samples,
+            (unsigned long)stats.late_samples
+        );
     }
 
 private:
@@ -0,0 +1,92 @@
+#pragma once
+
+//! Per-stage timing of the processing loop.
+//! Enable with `#define PROFILE` in globals.hpp; otherwise PROFILE_SCOPE() compiles to nothing.
+//!
+//! Time is measured in ticks: DWT cycles on the board, the TSC (or steady_clock nanoseconds) on a host.
+//! Each stage keeps count/min/max/sum and a log-scale histogram for percentiles, in a fixed table.
+//! A stage must only be recorded from one thread. That single writer updates the stage under a sequence
+//! counter, so readers on any thread get a consistent snapshot without ever blocking it.
+
+#include <stdint.h>
+
+#include "globals.hpp"
+
+typedef enum {
+    PROFILE_ACQUISITION,  // Reading a sample (or a FIFO block) from the IMU
+    PROFILE_ORIENTATION,  // Orientation tracking and gravity removal
+    PROFILE_FILTER,       // Low pass of one sample (or one block of them)
+    PROFILE_FFT_ACCEL_X,  // FFT stages include their magnitude step
+    PROFILE_FFT_ACCEL_Y,
+    PROFILE_FFT_ACCEL_Z,
+    PROFILE_FFT_GYRO_X,
+    PROFILE_FFT_GYRO_Y,
+    PROFILE_FFT_GYRO_Z,
+    PROFILE_MAGNITUDE,    // arm_cmplx_mag_f32 of one FFT
+    PROFILE_TREMOR,
+    PROFILE_DYSKINESIA,
+    PROFILE_FREEZING,
+    PROFILE_OUTPUT,       // Everything OutputHandler does for one batch
+    PROFILE_BATCH,        // The whole analysis of one batch, on the analysis thread
+    PROFILE_STAGE_COUNT
+} ProfileStage;
+
+// Two histogram buckets per power of two, from 1 tick up to 2^24 ticks (~200 ms at 80 MHz)
+#define PROFILE_HISTOGRAM_OCTAVES 24
+#define PROFILE_HISTOGRAM_BUCKETS (2 * PROFILE_HISTOGRAM_OCTAVES)
+
+/** A consistent copy of one stage's statistics */
+typedef struct {
+    uint32_t count;
+    uint32_t min;
+    uint32_t max;
+    uint64_t sum;
+    uint32_t histogram[PROFILE_HISTOGRAM_BUCKETS];
+} ProfileStats;
+
+/** Start the tick counter. Call once before anything is recorded. */
+void profile_init();
+
+/** Current tick count. Wraps around; only differences are meaningful. */
+uint32_t profile_ticks();
+
+/** Ticks per microsecond of the counter profile_ticks() reads */
+float profile_ticks_per_us();
+
+/** Add one measurement to a stage. Only call this from the thread that owns the stage. */
+void profile_record(ProfileStage stage, uint32_t ticks);
+
+/** Copy a stage's statistics. Safe from any thread. */
+void profile_snapshot(ProfileStage stage, ProfileStats &stats);
+
+/** Upper bound of the bucket holding the given percentile [0, 100] of a snapshot, in ticks */
+uint32_t profile_percentile(const ProfileStats &stats, float percentile);
+
+/** Ask every stage to start over. Each stage clears itself the next time it records, on its own thread. */
+void profile_reset();
+
+/** Print the table (count, min/mean/max/p99 in microseconds) with printf */
+void profile_dump();
+
+const char *profile_stage_name(ProfileStage stage);
+
+/** Records the time between its construction and destruction against a stage */
+class ProfileScope {
+public:
+    explicit ProfileScope(ProfileStage stage) : _stage(stage), _start(profile_ticks()) {}
+    ~ProfileScope() { profile_record(_stage, profile_ticks() - _start); }
+
+private:
+    ProfileStage _stage;
+    uint32_t _start;
+};
+
+#define PROFILE_CONCAT_(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_(a, b)
+
+#ifdef PROFILE
+// Time the rest of the enclosing scope
+#define PROFILE_SCOPE(stage) ProfileScope PROFILE_CONCAT(_profile_scope_, __LINE__)((ProfileStage)(stage))
+#else
+#define PROFILE_SCOPE(stage) do {} while (0)
+#endif
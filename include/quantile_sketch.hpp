@@ -0,0 +1,102 @@
+#pragma once
+
+//! Fixed-memory, mergeable quantile sketch (KLL: Karnin, Lang and Liberty, "Optimal Quantile
+//! Approximation in Streams").
+//!
+//! Items live in levels; an item in level h stands for 2^h of the values seen. When the sketch is full,
+//! the lowest level that is over its capacity gets sorted and every other item of it (starting at a
+//! random one of the first two) moves up a level. Capacities shrink by 2/3 per level below the top, so
+//! the sketch holds about 3k items however many values went in, and quantiles come out within a
+//! rank error of a couple of percent.
+//!
+//! All levels share one flat array, packed against its end: level 0 is lowest, free space is at the
+//! front, and level h occupies [_levels[h], _levels[h + 1]). Levels above 0 are kept sorted.
+
+#include <stdint.h>
+
+// Capacity of the top level; accuracy grows with it
+#define QUANTILE_SKETCH_K 48
+// No level gets smaller than this
+#define QUANTILE_SKETCH_MIN_WIDTH 8
+// With k = 48 that's 48 * 2^15 values (about 50 days of windows) before the top level has nowhere to go.
+// Past that it's halved in place, so the oldest data starts to count for less.
+#define QUANTILE_SKETCH_MAX_LEVELS 16
+
+/** Capacity of level h when the sketch has the given number of levels */
+static constexpr int quantile_sketch_level_capacity(int h, int levels) {
+    int capacity = QUANTILE_SKETCH_K;
+    for (int depth = levels - 1 - h; depth > 0; depth--) capacity = (capacity * 2 + 2) / 3; // Rounded up
+    return capacity > QUANTILE_SKETCH_MIN_WIDTH ? capacity : QUANTILE_SKETCH_MIN_WIDTH;
+}
+
+static constexpr int quantile_sketch_capacity(int levels) {
+    int total = 0;
+    for (int h = 0; h < levels; h++) total += quantile_sketch_level_capacity(h, levels);
+    return total;
+}
+
+// Items the sketch can hold at its largest
+#define QUANTILE_SKETCH_ITEMS quantile_sketch_capacity(QUANTILE_SKETCH_MAX_LEVELS)
+
+class QuantileSketch {
+public:
+    QuantileSketch() { reset(); }
+
+    void reset();
+
+    /** Add one value. NaNs are ignored. */
+    void update(float value);
+
+    /** Add everything other has seen, as if it had all gone into this sketch */
+    void merge(const QuantileSketch &other);
+
+    /** Values seen since the last reset() */
+    uint32_t count() const { return _count; }
+    float min() const { return _min; }
+    float max() const { return _max; }
+
+    /** Approximate values at fractions q of the values seen (0: min, 0.5: median, 1: max); 0 if empty.
+     * qs must be ascending. One pass over the sketch for all of them, with no scratch memory; that's
+     * why it isn't const: level 0 gets sorted in place, which doesn't change what the sketch holds.
+     */
+    void quantiles(const float *qs, int n, float *values);
+
+    float quantile(float q) {
+        float value;
+        quantiles(&q, 1, &value);
+        return value;
+    }
+
+    /** Approximate fraction of the values seen that are <= value */
+    float rank(float value) const;
+
+    // Raw access, for serializing
+    int levels() const { return _level_count; }
+    int level_size(int h) const { return _levels[h + 1] - _levels[h]; }
+    const float *level_items(int h) const { return &_items[_levels[h]]; }
+
+    /** Put items back into level h, e.g. when deserializing. Levels above 0 must go in sorted order. */
+    void insert(float value, int h);
+
+    /** Set the exact count, min and max after insert()ing a serialized sketch back */
+    void set_summary(uint32_t count, float min, float max) {
+        _count = count;
+        _min = min;
+        _max = max;
+    }
+
+private:
+    int size() const { return QUANTILE_SKETCH_ITEMS - _levels[0]; }
+    void add_level();
+    void compress();
+    void compact_level(int h);
+    bool coin();
+
+    float _items[QUANTILE_SKETCH_ITEMS];
+    int _levels[QUANTILE_SKETCH_MAX_LEVELS + 1];
+    int _level_count;
+    int _capacity; // Of all current levels together; compress() once the sketch holds this many
+    uint32_t _count;
+    float _min, _max;
+    uint32_t _random = 1;
+};
@@ -0,0 +1,61 @@
+#pragma once
+
+//! Picks the IMU output data rate from how much the patient is moving.
+//!
+//! Sitting or lying still, nothing the detectors look for is happening, yet the sensor and the bus cost
+//! the same as during a tremor. The RateController watches the POLL_RATE stream in one-second blocks; a
+//! block where any axis varies more than its threshold (standard deviation) is active. Activity switches
+//! to IMU_RATE_HIGH at once, and IMU_RATE_LOW only comes back after RATE_LOW_AFTER_S still seconds, so a
+//! short pause in a tremor doesn't make the rate flap. The thresholds sit well below the weakest symptom
+//! the detectors report, and the first active second, read at the low rate, still reaches analysis
+//! (interpolated up to POLL_RATE; see decimator.hpp).
+
+#include <stdint.h>
+
+#include "globals.hpp"
+#include "imu_source.hpp"
+
+typedef enum {
+    IMU_RATE_LOW,  // RATE_LOW_HZ, interpolated up to POLL_RATE
+    IMU_RATE_HIGH, // IMU_OVERSAMPLING x POLL_RATE, decimated down to it
+} ImuRate;
+
+// The low rate is POLL_RATE / RATE_LOW_INTERPOLATION (26 Hz); the sensor's rates are all 13 Hz x 2^k
+#define RATE_LOW_INTERPOLATION 2
+#define RATE_LOW_HZ (POLL_RATE / RATE_LOW_INTERPOLATION)
+// Activity is judged a second at a time
+#define RATE_BLOCK_SAMPLES POLL_RATE
+// Any axis moving more than this (standard deviation within a block) means activity
+#define RATE_ACTIVE_ACCEL_G 0.02f
+#define RATE_ACTIVE_GYRO_DPS 3.f
+// Still this long before dropping to the low rate
+#define RATE_LOW_AFTER_S 10
+
+class RateController {
+public:
+    /** Starts at IMU_RATE_HIGH, so nothing is missed before the first blocks are in */
+    RateController() {}
+
+    /** Watch POLL_RATE samples, in any block size.
+     * @return The rate the sensor should be at from now on
+     */
+    ImuRate update(const RawImuSample *samples, int n);
+
+    ImuRate rate() const { return _rate; }
+
+    /** Rate changes so far */
+    uint32_t switches() const { return _switches; }
+
+private:
+    void finish_block();
+
+    ImuRate _rate = IMU_RATE_HIGH;
+    uint32_t _switches = 0;
+    int _still_blocks = 0;
+
+    // Current block in counts, relative to its first sample so the sums stay exact in 32 bits
+    int16_t _first[6];
+    int32_t _sum[6];
+    int64_t _sum_sq[6];
+    int _block_samples = 0;
+};
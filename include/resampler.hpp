@@ -0,0 +1,61 @@
+#pragma once
+
+//! Puts timestamped IMU samples back on an exact POLL_RATE grid before they're batched.
+//!
+//! Analysis assumes sample k was taken at k / POLL_RATE: that's what FREQUENCY_BIN_SIZE means. A missed
+//! data-ready interrupt, a FIFO overrun or a sensor clock a little off that rate all break it, silently:
+//! everything after a lost sample is one slot early. Given when each sample was actually taken (see
+//! ImuSource::read_timed()), the ImuResampler emits a sample for every grid time instead, interpolated
+//! linearly between the two samples around it:
+//!   - a gap of up to RESAMPLER_MAX_FILL missing samples is filled in;
+//!   - a sample less than a quarter period after the one before is a repeat, and dropped;
+//!   - a longer gap isn't filled (that would be made-up data); the grid restarts at the next sample and
+//!     take_break() tells the caller to start its window over.
+//! The grid runs on the timestamps' clock, so a sensor that's slightly fast or slow is stretched onto it.
+
+#include <stdint.h>
+
+#include "globals.hpp"
+#include "imu_source.hpp"
+
+// Longest gap, in missing samples, that's interpolated over (~250 ms)
+#define RESAMPLER_MAX_FILL 13
+// Most samples one push() can emit: the filled gap, then the sample itself
+#define RESAMPLER_MAX_OUTPUT (RESAMPLER_MAX_FILL + 1)
+
+typedef struct {
+    uint32_t filled;     // Samples interpolated into gaps
+    uint32_t duplicates; // Samples dropped as repeats of the one before
+    uint32_t breaks;     // Gaps too long to fill; the grid restarted after each
+} ResamplerStats;
+
+class ImuResampler {
+public:
+    ImuResampler() {}
+
+    /** Take the next sample, and emit the grid samples up to it.
+     * @param time_us When it was taken, in microseconds; any clock, as long as it's always the same one
+     * @param out Room for RESAMPLER_MAX_OUTPUT samples
+     * @return Samples written to out: usually 1, 0 for a repeat, more after a gap
+     */
+    int push(const RawImuSample &sample, uint64_t time_us, RawImuSample *out);
+
+    /** True once after a gap too long to fill: what was emitted before it doesn't join up with what came after */
+    bool take_break();
+
+    const ResamplerStats &stats() const { return _stats; }
+
+    /** Start over with the next sample, as at construction */
+    void reset() { _started = false; }
+
+private:
+    uint64_t grid_us(uint64_t k) const { return _origin_us + k * 1000000 / POLL_RATE; }
+
+    bool _started = false;
+    bool _break = false;
+    uint64_t _origin_us = 0; // Time of grid sample 0
+    uint64_t _next = 0;      // Next grid sample to emit
+    RawImuSample _previous;
+    uint64_t _previous_us = 0;
+    ResamplerStats _stats = { 0, 0, 0 };
+};
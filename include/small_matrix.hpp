@@ -0,0 +1,145 @@
+#pragma once
+
+//! Fixed-size matrix kernels for small filters (3x3, 4x4, 6x6 and the shapes in between).
+//! The vendored CMSIS-DSP has no MatrixFunctions sources, and its arm_matrix_instance_f32 routines take
+//! sizes at run time anyway. Here sizes are template parameters, so every loop has a constant trip count
+//! and is unrolled completely; there's no heap and no size checking at run time.
+//!
+//! Matrices are plain row-major float arrays: element (i, j) of an R x C matrix is m[i * C + j].
+//! Unless noted, dest must not overlap the inputs.
+
+#include <math.h>
+
+#if defined(__GNUC__) && !defined(__clang__)
+#define SMALL_MATRIX_UNROLL _Pragma("GCC unroll 36")
+#else
+#define SMALL_MATRIX_UNROLL
+#endif
+
+/** dest (R x C) = a (R x K) * b (K x C) */
+template <int R, int K, int C>
+static inline void mat_mul(const float *a, const float *b, float *dest) {
+    SMALL_MATRIX_UNROLL
+    for (int i = 0; i < R; i++) {
+        SMALL_MATRIX_UNROLL
+        for (int j = 0; j < C; j++) {
+            float sum = 0.f;
+            SMALL_MATRIX_UNROLL
+            for (int k = 0; k < K; k++) sum += a[i * K + k] * b[k * C + j];
+            dest[i * C + j] = sum;
+        }
+    }
+}
+
+/** dest (R x C) = a (R x K) * b^T, where b is C x K */
+template <int R, int K, int C>
+static inline void mat_mul_transposed(const float *a, const float *b, float *dest) {
+    SMALL_MATRIX_UNROLL
+    for (int i = 0; i < R; i++) {
+        SMALL_MATRIX_UNROLL
+        for (int j = 0; j < C; j++) {
+            float sum = 0.f;
+            SMALL_MATRIX_UNROLL
+            for (int k = 0; k < K; k++) sum += a[i * K + k] * b[j * K + k];
+            dest[i * C + j] = sum;
+        }
+    }
+}
+
+/** dest (C x R) = a^T, where a is R x C */
+template <int R, int C>
+static inline void mat_transpose(const float *a, float *dest) {
+    SMALL_MATRIX_UNROLL
+    for (int i = 0; i < R; i++) {
+        SMALL_MATRIX_UNROLL
+        for (int j = 0; j < C; j++) dest[j * R + i] = a[i * C + j];
+    }
+}
+
+/** dest = a + b, element by element. dest may be a or b. */
+template <int R, int C>
+static inline void mat_add(const float *a, const float *b, float *dest) {
+    SMALL_MATRIX_UNROLL
+    for (int i = 0; i < R * C; i++) dest[i] = a[i] + b[i];
+}
+
+/** dest = a - b, element by element. dest may be a or b. */
+template <int R, int C>
+static inline void mat_sub(const float *a, const float *b, float *dest) {
+    SMALL_MATRIX_UNROLL
+    for (int i = 0; i < R * C; i++) dest[i] = a[i] - b[i];
+}
+
+/** Make a square matrix exactly symmetric by averaging it with its transpose, in place */
+template <int N>
+static inline void mat_symmetrize(float *a) {
+    SMALL_MATRIX_UNROLL
+    for (int i = 0; i < N; i++) {
+        SMALL_MATRIX_UNROLL
+        for (int j = i + 1; j < N; j++) a[i * N + j] = a[j * N + i] = 0.5f * (a[i * N + j] + a[j * N + i]);
+    }
+}
+
+/** Cholesky factor of a symmetric positive definite a: the lower triangular l with l * l^T = a.
+ * The upper triangle of l is zeroed.
+ * @return false if a isn't positive definite (l is then unusable)
+ */
+template <int N>
+static inline bool mat_cholesky(const float *a, float *l) {
+    SMALL_MATRIX_UNROLL
+    for (int j = 0; j < N; j++) {
+        float diagonal = a[j * N + j];
+        SMALL_MATRIX_UNROLL
+        for (int k = 0; k < j; k++) diagonal -= l[j * N + k] * l[j * N + k];
+        if (!(diagonal > 0.f)) return false;
+        float root = sqrtf(diagonal), inverse = 1.f / root;
+        l[j * N + j] = root;
+        SMALL_MATRIX_UNROLL
+        for (int i = j + 1; i < N; i++) {
+            float sum = a[i * N + j];
+            SMALL_MATRIX_UNROLL
+            for (int k = 0; k < j; k++) sum -= l[i * N + k] * l[j * N + k];
+            l[i * N + j] = sum * inverse;
+        }
+        SMALL_MATRIX_UNROLL
+        for (int i = 0; i < j; i++) l[i * N + j] = 0.f;
+    }
+    return true;
+}
+
+/** Solve a * x = b for x (N x C), given a's Cholesky factor l. x may be b. */
+template <int N, int C>
+static inline void mat_cholesky_solve(const float *l, const float *b, float *x) {
+    SMALL_MATRIX_UNROLL
+    for (int c = 0; c < C; c++) {
+        // Forward: l * y = b
+        SMALL_MATRIX_UNROLL
+        for (int i = 0; i < N; i++) {
+            float sum = b[i * C + c];
+            SMALL_MATRIX_UNROLL
+            for (int k = 0; k < i; k++) sum -= l[i * N + k] * x[k * C + c];
+            x[i * C + c] = sum / l[i * N + i];
+        }
+        // Back: l^T * x = y
+        SMALL_MATRIX_UNROLL
+        for (int i = N - 1; i >= 0; i--) {
+            float sum = x[i * C + c];
+            SMALL_MATRIX_UNROLL
+            for (int k = i + 1; k < N; k++) sum -= l[k * N + i] * x[k * C + c];
+            x[i * C + c] = sum / l[i * N + i];
+        }
+    }
+}
+
+/** Inverse of a symmetric positive definite matrix, through its Cholesky factor.
+ * @return false if a isn't positive definite
+ */
+template <int N>
+static inline bool mat_inverse_spd(const float *a, float *dest) {
+    float l[N * N];
+    if (!mat_cholesky<N>(a, l)) return false;
+    SMALL_MATRIX_UNROLL
+    for (int i = 0; i < N * N; i++) dest[i] = (i / N == i % N) ? 1.f : 0.f;
+    mat_cholesky_solve<N, N>(l, dest, dest);
+    return true;
+}
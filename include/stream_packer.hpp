@@ -0,0 +1,150 @@
+#pragma once
+
+//! Streaming of raw samples or spectra to a BLE central, packed into MTU-sized packets.
+//!
+//! Producers (acquisition for raw samples, analysis for spectra) build packets and queue them in a
+//! bounded ring; the BLE thread takes them out as fast as the link accepts notifications. When the
+//! link can't keep up and the ring is full, new packets are dropped (and counted) so that what is
+//! already queued goes out intact. Every packet carries a sequence number and the position of its
+//! first value, so the central can tell exactly what went missing.
+//!
+//! A spectral window can take more packets than the ring holds (198 at the default 23 byte MTU), so it's
+//! staged whole and packed into the ring as the consumer drains it. A window that arrives while the last
+//! one is still going out is dropped.
+//!
+//! Packet format, little-endian:
+//!   u8  type      STREAM_PACKET_RAW, STREAM_PACKET_SPECTRAL or STREAM_PACKET_HISTORY
+//!   u8  count     Values that follow
+//!   u16 sequence  Counts every packet built, dropped ones included
+//!   u32 position  Raw: index of the first sample since boot
+//!                 Spectral: window << 11 | axis << 8 | first bin (axes 0-2 accel x/y/z, 3-5 gyro x/y/z)
+//!                 History: page sequence << 8 | byte offset into the page
+//! Raw: count x (ax, ay, az, gx, gy, gz) as i16 raw counts
+//! Spectral: f32 scale, then count x u16 magnitudes; each bin is value * scale / 65535
+//! History: count bytes of a SymptomLog page (see symptom_log.hpp). A packet with count 0 ends the
+//! download; its position holds the sequence the log will write next.
+
+#include <atomic>
+#include <stdint.h>
+
+#include "globals.hpp"
+#include "imu_source.hpp"
+#include "half.hpp"
+
+// Largest packet: a 247 byte ATT MTU minus the 3 byte notification header
+#define STREAM_PACKET_MAX 244
+#define STREAM_HEADER_SIZE 8
+// The smallest packet has to hold the header plus one raw sample
+#define STREAM_PACKET_MIN (STREAM_HEADER_SIZE + 12)
+// Packets the ring holds; must be a power of 2
+#define STREAM_RING_PACKETS 32
+
+#define STREAM_PACKET_RAW 1
+#define STREAM_PACKET_SPECTRAL 2
+#define STREAM_PACKET_HISTORY 3
+
+#define STREAM_SPECTRUM_BINS (BATCH_SIZE / 2 + 1)
+
+typedef enum {
+    STREAM_SUMMARY,  // Telemetry only, nothing streamed
+    STREAM_SPECTRAL, // Accel and gyro magnitude spectra of every window
+    STREAM_RAW,      // Every sample as read from the IMU
+    STREAM_HISTORY,  // Download the symptom log from flash, then back to summary
+    STREAM_MODE_COUNT
+} StreamMode;
+
+/** Counters a central can read to judge the link */
+typedef struct {
+    uint8_t mode;
+    uint32_t packets_sent;
+    uint32_t packets_dropped; // Built but thrown away because the ring was full
+    uint32_t values_dropped;  // Samples or bins in those packets (whole spectral windows count every bin)
+} StreamStatus;
+
+#define STREAM_STATUS_SIZE 13
+
+/** Pack a StreamStatus for the control characteristic: u8 mode, u32 sent, u32 dropped packets, u32 dropped values */
+int stream_status_encode(const StreamStatus &status, uint8_t dest[STREAM_STATUS_SIZE]);
+
+class StreamPacker {
+public:
+    StreamPacker();
+
+    StreamMode mode() const { return (StreamMode)_mode.load(std::memory_order_relaxed); }
+    void set_mode(StreamMode mode);
+
+    /** Largest packet the link takes (ATT MTU - 3). Applies from the next packet on. */
+    void set_packet_size(int size);
+
+    /** Raw mode producer: add one sample.
+     * @param index Position of the sample since boot; a jump flushes the samples gathered so far
+     */
+    void add_raw(const RawImuSample &sample, uint32_t index);
+
+    /** Spectral mode producer: stage one window's spectra, to be packed as the ring drains. If the last
+     * window hasn't all been packed yet, this one is dropped.
+     */
+    void add_spectra(uint32_t window, const float accel_mags[3][STREAM_SPECTRUM_BINS], const float gyro_mags[3][STREAM_SPECTRUM_BINS]);
+    /** The same from float16 spectra (ANALYSIS_F16), widened one axis at a time */
+    void add_spectra(uint32_t window, const half_t accel_mags[3][STREAM_SPECTRUM_BINS], const half_t gyro_mags[3][STREAM_SPECTRUM_BINS]);
+
+    /** History producer: queue one stored page, split over as many packets as it takes.
+     * @return false (and nothing queued) if the ring doesn't have room for all of it
+     */
+    bool add_history_page(uint32_t page_sequence, const uint8_t *page, int size);
+
+    /** History producer: mark the end of the download */
+    bool add_history_end(uint32_t next_page);
+
+    /** Consumer: the oldest queued packet, or null. It stays queued until pop(), so a refused notification can be retried.
+     * Packs more of a staged spectral window first, if the ring has room.
+     */
+    const uint8_t *peek(int &size);
+    void pop();
+
+    StreamStatus status() const;
+
+private:
+    struct Slot {
+        std::atomic<uint32_t> sequence;
+        uint16_t size;
+        uint8_t data[STREAM_PACKET_MAX];
+    };
+
+    /** Queue a finished packet, or count it as dropped */
+    bool push(const uint8_t *data, int size, int values);
+    uint32_t free_slots() const;
+    /** Claim the staging area for a window's spectra. If it's still busy, count the window as dropped. */
+    bool stage_spectra(uint32_t window);
+    /** Queue as many packets of the staged window as the ring has room for. Consumer only. */
+    void pack_spectra();
+    void flush_raw();
+
+    Slot _slots[STREAM_RING_PACKETS];
+    std::atomic<uint32_t> _head;
+    std::atomic<uint32_t> _tail; // Written by the consumer only; producers read it to estimate free space
+
+    std::atomic<uint8_t> _mode;
+    std::atomic<int> _packet_size;
+    std::atomic<uint16_t> _packet_sequence;
+    std::atomic<uint32_t> _packets_sent, _packets_dropped, _values_dropped;
+
+    // Spectral window being staged (by the producer, while SPECTRA_FILLING) or packed (by the consumer,
+    // while SPECTRA_READY)
+    enum { SPECTRA_EMPTY, SPECTRA_FILLING, SPECTRA_READY };
+    std::atomic<uint8_t> _spectra_state;
+    float _spectra[6][STREAM_SPECTRUM_BINS]; // Axes 0-2 accelerometer, 3-5 gyroscope
+    uint32_t _spectra_window = 0;
+    int _spectra_bins_per_packet = 0;
+    int _spectra_packets = 0; // In the whole window
+    int _spectra_next = 0;    // Next packet to pack
+
+    // Raw packet being filled; acquisition thread only
+    uint8_t _raw[STREAM_PACKET_MAX];
+    int _raw_count = 0;
+    int _raw_capacity = 0;
+    uint32_t _raw_next_index = 0;
+};
+
+// Shared by the producers in the firmware and the BLE thread that sends the packets
+extern StreamPacker stream_packer;
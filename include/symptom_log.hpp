@@ -0,0 +1,102 @@
+#pragma once
+
+//! Symptom history kept in flash, so windows computed while no phone is connected aren't lost.
+//!
+//! The log is circular over the whole block device: pages are written strictly in order and each erase
+//! block is erased just before the log wraps into it again, so every block wears at the same rate.
+//! Entries are buffered in RAM and programmed a full page at a time (30 entries, ~90 s of windows).
+//!
+//! Page layout (LOG_PAGE_SIZE bytes, little-endian):
+//!   u32 sequence      Counts pages since the log was created; page n lives at n % page count
+//!   u32 base_time_ms  Time the first entry's delta is relative to
+//!   u16 boot          Incremented on every mount, so sessions can be told apart
+//!   u16 crc           CRC-16/CCITT of the rest of the page
+//!   records[30]       u16 delta (0.1 s, since the previous entry), u16 tremor, u16 dyskinesia,
+//!                     u8 fog, u8 flags. Intensities are fractions of [0, 1] (full scale 65535 or 255).
+//!                     Records with flags 0xFF are padding.
+
+#include <atomic>
+#include <stdint.h>
+
+#ifdef __MBED__
+#include "BlockDevice.h"
+#else
+#include "host_block_device.hpp"
+#endif
+
+#define LOG_PAGE_SIZE 256
+#define LOG_PAGE_HEADER_SIZE 12
+#define LOG_RECORD_SIZE 8
+#define LOG_RECORDS_PER_PAGE ((LOG_PAGE_SIZE - LOG_PAGE_HEADER_SIZE) / LOG_RECORD_SIZE)
+
+#define LOG_FLAG_DEADLINE_MISS   (1 << 0) // The window was processed late
+#define LOG_FLAG_DROPPED_SAMPLES (1 << 1) // Samples went missing during the window
+#define LOG_FLAG_GAP             (1 << 2) // Windows were lost right before this one
+#define LOG_FLAG_PADDING 0xFF
+
+#define SYMPTOM_LOG_ERROR_NOT_FOUND -1
+#define SYMPTOM_LOG_ERROR_GEOMETRY -2 // Erase blocks aren't a whole number of pages
+#define SYMPTOM_LOG_ERROR_NO_DEVICE -3 // The board has no (default) block device
+
+typedef struct {
+    uint32_t time_ms; // Start of the window, since boot
+    float tremor;
+    float dyskinesia;
+    float fog;
+    uint8_t flags;
+} SymptomLogEntry;
+
+typedef struct {
+    uint32_t sequence;
+    uint16_t boot;
+    int count;
+    SymptomLogEntry entries[LOG_RECORDS_PER_PAGE];
+} SymptomLogPage;
+
+/** Check and unpack a page, e.g. one reassembled from a BLE download */
+bool symptom_log_decode_page(const uint8_t page[LOG_PAGE_SIZE], SymptomLogPage &decoded);
+
+class SymptomLog {
+public:
+    explicit SymptomLog(mbed::BlockDevice *bd) : _bd(bd), _next(0), _oldest(0) {}
+
+    /** Initialise the device and find where the log left off.
+     * @return 0, or a BlockDevice or SYMPTOM_LOG_ERROR_* code
+     */
+    int mount();
+
+    /** Add an entry. Writes to flash only when a page fills up. Writer thread only. */
+    int append(const SymptomLogEntry &entry);
+
+    /** Write out a partly filled page (the rest is padding). Writer thread only. */
+    int flush();
+
+    /** Pages on flash are [oldest_page(), next_page()). Safe from any thread. */
+    uint32_t oldest_page() const { return _oldest.load(std::memory_order_acquire); }
+    uint32_t next_page() const { return _next.load(std::memory_order_acquire); }
+
+    /** Read one page as stored. Safe from any thread while the writer appends.
+     * @return 0, SYMPTOM_LOG_ERROR_NOT_FOUND if it's not (or no longer) on flash, or a BlockDevice error
+     */
+    int read_page(uint32_t sequence, uint8_t page[LOG_PAGE_SIZE]);
+
+    uint16_t boot() const { return _boot; }
+    uint32_t entries_buffered() const { return _count; }
+
+private:
+    int write_page();
+    mbed::bd_addr_t page_address(uint32_t sequence) const { return (mbed::bd_addr_t)(sequence % _pages) * LOG_PAGE_SIZE; }
+
+    mbed::BlockDevice *_bd;
+    uint32_t _pages = 0;
+    uint32_t _pages_per_block = 0;
+    std::atomic<uint32_t> _next;
+    std::atomic<uint32_t> _oldest;
+    uint16_t _boot = 0;
+
+    // Page being filled
+    uint8_t _page[LOG_PAGE_SIZE];
+    int _count = 0;
+    uint32_t _base_time_ms = 0;
+    uint32_t _last_time_ms = 0;
+};
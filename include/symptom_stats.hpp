@@ -0,0 +1,86 @@
+#pragma once
+
+//! Long-term distribution of each symptom's intensity, in fixed memory: a QuantileSketch per symptom
+//! plus how long it spent at or above a threshold. Meant to cover a day (or whatever a clinician
+//! resets it to), and to be merged across days on a host.
+//!
+//! Summary wire format (STATS_SUMMARY_SIZE bytes, little-endian):
+//!   u8  version       STATS_VERSION
+//!   u8  reserved
+//!   u32 since_ms      When the statistics were last reset, in ms since boot
+//!   u32 windows       Windows counted since then
+//!   per symptom (tremor, dyskinesia, fog):
+//!     u16 threshold, p50, p90, p99, max   Intensities, 1/10000 units
+//!     u32 above_ms                        Time at or above threshold
+//!
+//! Sketch wire format (at most STATS_SKETCH_MAX_SIZE bytes), one symptom's QuantileSketch:
+//!   u8  version, u8 kind, u8 levels, u8 reserved
+//!   u32 count
+//!   u16 min, u16 max
+//!   u8  sizes[levels]
+//!   u16 items[]       Level 0 first, 1/10000 units
+
+#include <stdint.h>
+
+#include "detectors.hpp"
+#include "quantile_sketch.hpp"
+
+#define STATS_VERSION 1
+#define STATS_SYMPTOMS 3 // tremor, dyskinesia, fog
+#define STATS_SUMMARY_SIZE (10 + STATS_SYMPTOMS * 14)
+#define STATS_SKETCH_HEADER_SIZE 12
+#define STATS_SKETCH_MAX_SIZE (STATS_SKETCH_HEADER_SIZE + QUANTILE_SKETCH_MAX_LEVELS + 2 * QUANTILE_SKETCH_ITEMS)
+
+typedef struct {
+    float threshold;
+    float p50, p90, p99, max;
+    uint32_t above_ms;
+} SymptomSummary;
+
+typedef struct {
+    uint32_t since_ms;
+    uint32_t windows;
+    SymptomSummary symptoms[STATS_SYMPTOMS];
+} StatsSummary;
+
+int stats_summary_encode(const StatsSummary &summary, uint8_t dest[STATS_SUMMARY_SIZE]);
+bool stats_summary_decode(const uint8_t *data, int size, StatsSummary &summary);
+
+class SymptomStats {
+public:
+    /** @param thresholds Per symptom, for the time above threshold, e.g. the episode onsets */
+    explicit SymptomStats(const float thresholds[STATS_SYMPTOMS]);
+
+    /** Count one window */
+    void update(const SymptomIntensities &intensities, uint32_t window_ms);
+
+    /** Start over, e.g. at the start of a day */
+    void reset(uint32_t now_ms);
+
+    /** Add another period's statistics, as if its windows had been counted here too */
+    void merge(const SymptomStats &other);
+
+    /** Percentiles and times above threshold. Not const: see QuantileSketch::quantiles(). */
+    StatsSummary summary();
+
+    QuantileSketch &sketch(int symptom) { return _sketches[symptom]; }
+
+    /** Serialize one symptom's sketch. Intensities are stored in 1/10000 units, so up to 6.5535.
+     * @return The number of bytes written
+     */
+    int encode_sketch(int symptom, uint8_t dest[STATS_SKETCH_MAX_SIZE]);
+
+    /** Replace one symptom's sketch with a serialized one (e.g. read from a device). The times
+     * above threshold and the window count aren't part of it; see set_counts().
+     */
+    bool decode_sketch(const uint8_t *data, int size);
+
+    void set_counts(uint32_t since_ms, uint32_t windows, const uint32_t above_ms[STATS_SYMPTOMS]);
+
+private:
+    float _thresholds[STATS_SYMPTOMS];
+    QuantileSketch _sketches[STATS_SYMPTOMS];
+    uint32_t _above_ms[STATS_SYMPTOMS];
+    uint32_t _since_ms = 0;
+    uint32_t _windows = 0;
+};
@@ -0,0 +1,64 @@
+#pragma once
+
+//! Packed telemetry: everything known about one analysis window in a single BLE notification.
+//!
+//! Wire format, little-endian:
+//!   u8  version       TELEMETRY_VERSION
+//!   u8  extras_mask   Bit i set: extra feature i follows, in bit order
+//!   u16 sequence      Notification counter; gaps mean notifications were lost. Windows the notify
+//!                     policy held back show up as jumps in timestamp_ms instead
+//!   u32 timestamp_ms  Start of the window, in ms since boot
+//!   f32 tremor, dyskinesia, fog
+//!   f32 extras[]      One per set bit of extras_mask
+//!
+//! The core is 20 bytes, so a frame always fits the default 23 byte ATT MTU. Extras are added in bit
+//! order while they fit the payload size the connection allows, and dropped (bit cleared) after that.
+//! Decoders skip extras they don't know about, so new ones can be added without a version bump.
+
+#include <stdint.h>
+
+#define TELEMETRY_VERSION 1
+#define TELEMETRY_CORE_SIZE 20
+// ATT notifications carry MTU - 3 bytes of value
+#define TELEMETRY_ATT_OVERHEAD 3
+#define TELEMETRY_DEFAULT_ATT_MTU 23
+
+typedef enum {
+    TELEMETRY_EXTRA_ENERGY,          // Total accelerometer spectral energy the intensities are normalised by
+    TELEMETRY_EXTRA_SLACK_MS,        // Smallest deadline slack over the last DEADLINE_WINDOW batches
+    TELEMETRY_EXTRA_DROPPED_SAMPLES, // Samples lost since boot
+    TELEMETRY_EXTRA_COUNT
+} TelemetryExtra;
+
+#define TELEMETRY_MAX_SIZE (TELEMETRY_CORE_SIZE + 4 * TELEMETRY_EXTRA_COUNT)
+
+typedef struct {
+    uint16_t sequence;
+    uint32_t timestamp_ms;
+    float tremor;
+    float dyskinesia;
+    float fog;
+    uint8_t extras_mask;                 // Which of extras[] are valid
+    float extras[TELEMETRY_EXTRA_COUNT]; // Indexed by TelemetryExtra
+} TelemetryFrame;
+
+/** Largest frame that fits one notification on a connection with the given ATT MTU */
+static inline int telemetry_payload_size(int att_mtu) {
+    int size = att_mtu - TELEMETRY_ATT_OVERHEAD;
+    return size < TELEMETRY_MAX_SIZE ? size : TELEMETRY_MAX_SIZE;
+}
+
+/** Notifications lost between two received sequence numbers */
+static inline uint16_t telemetry_lost(uint16_t previous, uint16_t next) {
+    return (uint16_t)(next - previous - 1);
+}
+
+/** Pack a frame into at most max_size bytes, leaving out the extras that don't fit.
+ * @return The number of bytes written, or 0 if even the core doesn't fit
+ */
+int telemetry_encode(const TelemetryFrame &frame, uint8_t *dest, int max_size);
+
+/** Unpack a frame. Extras beyond TELEMETRY_EXTRA_COUNT are skipped.
+ * @return false if the data is truncated or from a newer TELEMETRY_VERSION
+ */
+bool telemetry_decode(const uint8_t *data, int size, TelemetryFrame &frame);
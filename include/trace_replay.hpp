@@ -0,0 +1,88 @@
+#pragma once
+
+//! Replays recorded IMU traces as fast as the consumer reads them.
+//! Two formats are understood, picked by looking at the start of the file:
+//!  - CSV: one sample per line, "ax,ay,az,gx,gy,gz" in raw counts. Lines that don't hold 6 numbers are skipped.
+//!  - Binary: a TraceHeader followed by packed little-endian RawImuSample records (12 bytes each).
+
+#include <stdint.h>
+#include <stdio.h>
+#include <vector>
+
+#include "globals.hpp"
+#include "imu_source.hpp"
+
+#define TRACE_MAGIC "IMUT"
+#define TRACE_VERSION 1
+
+/** Header of a binary trace, stored little-endian */
+typedef struct {
+    char magic[4];         // TRACE_MAGIC
+    uint16_t version;      // TRACE_VERSION
+    uint16_t sample_rate;  // Hz
+    uint32_t sample_count; // 0 if unknown (the file was not closed cleanly); use the file size instead
+    uint32_t reserved;
+} TraceHeader;
+
+class TraceReplaySource : public ImuSource {
+public:
+    TraceReplaySource() {}
+    ~TraceReplaySource() { close(); }
+
+    TraceReplaySource(const TraceReplaySource &) = delete;
+    TraceReplaySource &operator=(const TraceReplaySource &) = delete;
+
+    /** Open a trace. Any previously open trace is closed. */
+    bool open(const char *path);
+    void close();
+
+    bool read(RawImuSample &sample) override;
+
+    /** Jump to a sample number. CSV traces need index() first to do this quickly. */
+    bool seek(long sample);
+
+    /** Number of samples in the trace, or -1 if not known yet (CSV before index()) */
+    long count() const { return _count; }
+
+    bool is_binary() const { return _binary; }
+
+    /** Sample rate recorded in a binary trace's header, or POLL_RATE for CSV */
+    int sample_rate() const { return _sample_rate; }
+
+    /** Scan a CSV trace once, remembering the file offset of every stride'th sample. Binary traces need no index. */
+    bool index(long stride);
+
+private:
+    bool read_csv(RawImuSample &sample);
+
+    FILE *_file = nullptr;
+    bool _binary = false;
+    int _sample_rate = 0;
+    long _count = -1;
+    long _position = 0; // Next sample to be read
+    long _data_start = 0;
+
+    long _index_stride = 0;
+    std::vector<long> _index; // File offsets of samples 0, stride, 2 * stride...
+};
+
+/** Writes binary traces that TraceReplaySource can read back */
+class TraceWriter {
+public:
+    TraceWriter() {}
+    ~TraceWriter() { close(); }
+
+    TraceWriter(const TraceWriter &) = delete;
+    TraceWriter &operator=(const TraceWriter &) = delete;
+
+    bool open(const char *path, int sample_rate = POLL_RATE);
+    bool write(const RawImuSample &sample);
+    bool write(const RawImuSample *samples, long n);
+
+    /** Fill in the sample count and close the file */
+    bool close();
+
+private:
+    FILE *_file = nullptr;
+    long _count = 0;
+};
@@ -1,6 +1,7 @@
 #include "ble_handler.hpp"
 #include "mbed.h"
 #include "globals.hpp"
+#include "byte_order.hpp"
 
 void ParkinsonBLE::init() {
     _ble.onEventsToProcess(makeFunctionPointer(this, &ParkinsonBLE::schedule_ble_events));
@@ -22,8 +23,12 @@ void ParkinsonBLE::on_init_complete(ble::BLE::InitializationCompleteCallbackCont
 
     ble::BLE &ble = params->ble;
     ble.gap().setEventHandler(this);
+    ble.gattServer().setEventHandler(this);
 
-    GattCharacteristic *charTable[] = {&_tremor_char, &_dyskinesia_char, &_fog_char};
+    GattCharacteristic *charTable[] = {
+        &_tremor_char, &_dyskinesia_char, &_fog_char, &_telemetry_char, &_stream_char, &_stream_control_char,
+        &_notify_policy_char, &_episode_char, &_stats_char, &_sketch_char
+    };
     GattService parkinsonService(
         UUID(PARKINSON_SERVICE_UUID),
         charTable,
@@ -35,6 +40,16 @@ void ParkinsonBLE::on_init_complete(ble::BLE::InitializationCompleteCallbackCont
     _tremor_handle = _tremor_char.getValueHandle();
     _dyskinesia_handle = _dyskinesia_char.getValueHandle();
     _fog_handle = _fog_char.getValueHandle();
+    _telemetry_handle = _telemetry_char.getValueHandle();
+    _stream_handle = _stream_char.getValueHandle();
+    _stream_control_handle = _stream_control_char.getValueHandle();
+    _notify_policy_handle = _notify_policy_char.getValueHandle();
+    _episode_handle = _episode_char.getValueHandle();
+    _stats_handle = _stats_char.getValueHandle();
+    _sketch_handle = _sketch_char.getValueHandle();
+
+    int policy_size = notify_config_encode(_notify_policy.config(), _notify_policy_value);
+    ble.gattServer().write(_notify_policy_handle, _notify_policy_value, policy_size, true);
 
     start_advertising();
 }
@@ -108,38 +123,158 @@ void ParkinsonBLE::onDisconnectionComplete(const ble::DisconnectionCompleteEvent
     #ifdef DEBUG
     printf("BLE: Disconnected. Reason: %u\n", event.getReason().value());
     #endif
+    _att_mtu = TELEMETRY_DEFAULT_ATT_MTU;
+    stream_packer.set_mode(STREAM_SUMMARY);
+    stream_packer.set_packet_size(TELEMETRY_DEFAULT_ATT_MTU - TELEMETRY_ATT_OVERHEAD);
+    // Whoever connects next gets the current values straight away
+    _notify_policy_mutex.lock();
+    _notify_policy.reset();
+    _notify_policy_mutex.unlock();
     start_advertising();
 }
 
-void ParkinsonBLE::updateTremor(float value) {
-    if (_tremor_value != value) {
-        _tremor_value = value;
-        _ble.gattServer().write(
-            _tremor_handle,
-            (uint8_t *)&_tremor_value,
-            sizeof(_tremor_value)
-        );
+void ParkinsonBLE::onAttMtuChange(ble::connection_handle_t connectionHandle, uint16_t attMtuSize) {
+    #ifdef DEBUG
+    printf("BLE: ATT MTU is now %u\n", attMtuSize);
+    #endif
+    _att_mtu = attMtuSize;
+    stream_packer.set_packet_size(attMtuSize - TELEMETRY_ATT_OVERHEAD);
+}
+
+void ParkinsonBLE::onDataWritten(const GattWriteCallbackParams &params) {
+    if (params.handle == _stream_control_handle && params.len >= 1) {
+        StreamMode mode = (StreamMode)params.data[0];
+        if (mode == STREAM_HISTORY) {
+            if (!_history) return;
+            _history_cursor = params.len >= 5 ? get_u32(params.data + 1) : _history->oldest_page();
+        }
+        stream_packer.set_mode(mode);
+        #ifdef DEBUG
+        printf("BLE: Stream mode %u\n", stream_packer.mode());
+        #endif
+        // The pump stops itself once the stream is back to summary and drained
+        if (stream_packer.mode() != STREAM_SUMMARY && !_pump_event) {
+            _pump_event = _event_queue.call_every(STREAM_PUMP_INTERVAL, mbed::callback(this, &ParkinsonBLE::pump_stream));
+        }
+    } else if (params.handle == _notify_policy_handle) {
+        NotifyPolicyConfig config;
+        _notify_policy_mutex.lock();
+        if (notify_config_decode(params.data, params.len, config)) _notify_policy.configure(config);
+        config = _notify_policy.config();
+        _notify_policy_mutex.unlock();
+        // Read back what's in effect, which is the old policy if the write was invalid
+        int policy_size = notify_config_encode(config, _notify_policy_value);
+        _ble.gattServer().write(_notify_policy_handle, _notify_policy_value, policy_size, true);
+    } else if (params.handle == _stats_handle && params.len >= 1) {
+        if (params.data[0] == STATS_COMMAND_RESET) _stats_reset_requested = true;
+    } else if (params.handle == _sketch_handle && params.len >= 1) {
+        // Served from the next statistics update
+        if (params.data[0] < STATS_SYMPTOMS) _sketch_symptom = params.data[0];
     }
 }
 
-void ParkinsonBLE::updateDyskinesia(float value) {
-    if (_dyskinesia_value != value) {
-        _dyskinesia_value = value;
-        _ble.gattServer().write(
-            _dyskinesia_handle,
-            (uint8_t *)&_dyskinesia_value,
-            sizeof(_dyskinesia_value)
-        );
+void ParkinsonBLE::onDataSent(const GattDataSentCallbackParams &params) {
+    // Buffers just freed up
+    pump_stream();
+}
+
+void ParkinsonBLE::onUpdatesDisabled(const GattUpdatesDisabledCallbackParams &params) {
+    if (params.attHandle == _stream_handle) stream_packer.set_mode(STREAM_SUMMARY);
+}
+
+void ParkinsonBLE::pump_stream() {
+    int size;
+    const uint8_t *packet;
+    bool subscribed = false;
+    _ble.gattServer().areUpdatesEnabled(_stream_char, &subscribed);
+    if (subscribed && stream_packer.mode() == STREAM_HISTORY) fill_history();
+    while (subscribed && (packet = stream_packer.peek(size)) != nullptr) {
+        // Out of buffers: leave the packet queued and try again once some are sent
+        if (_ble.gattServer().write(_stream_handle, packet, size) != BLE_ERROR_NONE) break;
+        stream_packer.pop();
+    }
+
+    // Only written when it changes, so an idle stream costs nothing
+    uint8_t status[STREAM_STATUS_SIZE];
+    int status_size = stream_status_encode(stream_packer.status(), status);
+    if (memcmp(status, _stream_control_value, status_size) != 0) {
+        memcpy(_stream_control_value, status, status_size);
+        _ble.gattServer().write(_stream_control_handle, _stream_control_value, status_size, true);
+    }
+
+    if (_pump_event && stream_packer.mode() == STREAM_SUMMARY && (!subscribed || !stream_packer.peek(size))) {
+        _event_queue.cancel(_pump_event);
+        _pump_event = 0;
     }
 }
 
-void ParkinsonBLE::updateFreezingGait(float value) {
-    if (_fog_value != value) {
-        _fog_value = value;
-        _ble.gattServer().write(
-            _fog_handle,
-            (uint8_t *)&_fog_value,
-            sizeof(_fog_value)
-        );
+void ParkinsonBLE::fill_history() {
+    uint8_t page[LOG_PAGE_SIZE];
+    while (_history_cursor < _history->next_page()) {
+        // Pages the log has wrapped over since the download started are skipped
+        if (_history_cursor < _history->oldest_page()) _history_cursor = _history->oldest_page();
+        int err = _history->read_page(_history_cursor, page);
+        if (err == SYMPTOM_LOG_ERROR_NOT_FOUND) {
+            // Skipped after a reset, or erased just now
+            _history_cursor++;
+            continue;
+        }
+        if (err) break;
+        if (!stream_packer.add_history_page(_history_cursor, page, LOG_PAGE_SIZE)) return; // Ring full; more next time
+        _history_cursor++;
     }
+    if (stream_packer.add_history_end(_history->next_page())) stream_packer.set_mode(STREAM_SUMMARY);
+}
+
+void ParkinsonBLE::updateTelemetry(const TelemetryFrame &frame) {
+    _event_queue.call(mbed::callback(this, &ParkinsonBLE::send_telemetry), frame);
+}
+
+void ParkinsonBLE::send_telemetry(TelemetryFrame frame) {
+    // The per-value characteristics stay readable; written locally so they never notify
+    _tremor_value = frame.tremor;
+    _dyskinesia_value = frame.dyskinesia;
+    _fog_value = frame.fog;
+    _ble.gattServer().write(_tremor_handle, (uint8_t *)&_tremor_value, sizeof(_tremor_value), true);
+    _ble.gattServer().write(_dyskinesia_handle, (uint8_t *)&_dyskinesia_value, sizeof(_dyskinesia_value), true);
+    _ble.gattServer().write(_fog_handle, (uint8_t *)&_fog_value, sizeof(_fog_value), true);
+
+    _notify_policy_mutex.lock();
+    bool send = _notify_policy.should_send(frame);
+    _notify_policy_mutex.unlock();
+    if (!send) return;
+
+    // One notification for the whole window
+    frame.sequence = _telemetry_sequence++;
+    int size = telemetry_encode(frame, _telemetry_value, telemetry_payload_size(_att_mtu));
+    _ble.gattServer().write(_telemetry_handle, _telemetry_value, size);
+}
+
+void ParkinsonBLE::updateEpisode(const EpisodeEvent &event) {
+    _event_queue.call(mbed::callback(this, &ParkinsonBLE::send_episode), event);
+}
+
+void ParkinsonBLE::send_episode(EpisodeEvent event) {
+    // Events are rare and small, so they go straight out; the sequence number shows any that were lost
+    int size = episode_encode(event, _episode_value);
+    _ble.gattServer().write(_episode_handle, _episode_value, size);
+}
+
+void ParkinsonBLE::updateStatistics(const StatsSummary &summary, SymptomStats &stats) {
+    // Encoded here, where stats isn't changing underneath; only the bytes cross over
+    _stats_mutex.lock();
+    _stats_pending_size = stats_summary_encode(summary, _stats_pending);
+    _sketch_pending_size = stats.encode_sketch(_sketch_symptom, _sketch_pending);
+    _stats_mutex.unlock();
+    _event_queue.call(mbed::callback(this, &ParkinsonBLE::send_statistics));
+}
+
+void ParkinsonBLE::send_statistics() {
+    _stats_mutex.lock();
+    int stats_size = _stats_pending_size, sketch_size = _sketch_pending_size;
+    memcpy(_stats_value, _stats_pending, stats_size);
+    memcpy(_sketch_value, _sketch_pending, sketch_size);
+    _stats_mutex.unlock();
+    _ble.gattServer().write(_stats_handle, _stats_value, stats_size, true);
+    _ble.gattServer().write(_sketch_handle, _sketch_value, sketch_size, true);
 }
@@ -0,0 +1,256 @@
+#include "calibration.hpp"
+#include "byte_order.hpp"
+
+#include <math.h>
+
+Calibration calibration_identity() {
+    Calibration calibration;
+    calibration.flags = 0;
+    for (int axis = 0; axis < 3; axis++) {
+        calibration.gyro_bias[axis] = 0.f;
+        calibration.accel_offset[axis] = 0.f;
+        calibration.accel_scale[axis] = 1.f;
+    }
+    return calibration;
+}
+
+void calibration_apply(const Calibration &calibration, float acc[3], float gyro[3]) {
+    for (int axis = 0; axis < 3; axis++) {
+        acc[axis] = (acc[axis] - calibration.accel_offset[axis]) * calibration.accel_scale[axis];
+        gyro[axis] -= calibration.gyro_bias[axis];
+    }
+}
+
+//MARK: Storage
+
+int calibration_encode(const Calibration &calibration, uint8_t dest[CALIBRATION_SIZE]) {
+    uint8_t *p = dest;
+    *p++ = CALIBRATION_VERSION;
+    *p++ = calibration.flags;
+    for (int axis = 0; axis < 3; axis++) p = put_f32(p, calibration.gyro_bias[axis]);
+    for (int axis = 0; axis < 3; axis++) p = put_f32(p, calibration.accel_offset[axis]);
+    for (int axis = 0; axis < 3; axis++) p = put_f32(p, calibration.accel_scale[axis]);
+    return (int)(p - dest);
+}
+
+bool calibration_decode(const uint8_t *data, int size, Calibration &calibration) {
+    if (size < CALIBRATION_SIZE || data[0] != CALIBRATION_VERSION) return false;
+    Calibration decoded;
+    decoded.flags = data[1];
+    const uint8_t *p = data + 2;
+    for (int axis = 0; axis < 3; axis++, p += 4) decoded.gyro_bias[axis] = get_f32(p);
+    for (int axis = 0; axis < 3; axis++, p += 4) decoded.accel_offset[axis] = get_f32(p);
+    for (int axis = 0; axis < 3; axis++, p += 4) decoded.accel_scale[axis] = get_f32(p);
+    // Anything non-finite or far out means a bad record; better no correction than a wrong one
+    for (int axis = 0; axis < 3; axis++) {
+        if (!(fabsf(decoded.gyro_bias[axis]) <= CALIBRATION_MAX_GYRO_BIAS_DPS)) return false;
+        if (!(fabsf(decoded.accel_offset[axis]) <= CALIBRATION_MAX_OFFSET_G)) return false;
+        if (!(fabsf(decoded.accel_scale[axis] - 1.f) <= CALIBRATION_MAX_SCALE_ERROR)) return false;
+    }
+    calibration = decoded;
+    return true;
+}
+
+int calibration_load(mbed::KVStore *store, Calibration &calibration) {
+    calibration = calibration_identity();
+    uint8_t value[CALIBRATION_SIZE];
+    size_t size = 0;
+    int err = store->get(CALIBRATION_KEY, value, sizeof(value), &size);
+    if (err != MBED_SUCCESS) return err;
+    if (!calibration_decode(value, (int)size, calibration)) return MBED_ERROR_ITEM_NOT_FOUND;
+    return MBED_SUCCESS;
+}
+
+int calibration_save(mbed::KVStore *store, const Calibration &calibration) {
+    uint8_t value[CALIBRATION_SIZE];
+    int size = calibration_encode(calibration, value);
+    return store->set(CALIBRATION_KEY, value, size, 0);
+}
+
+//MARK: Learning
+
+Calibrator::Calibrator(const Calibration &initial) : _calibration(initial), _saved(initial) {
+}
+
+void Calibrator::update(const float acc[3], const float gyro[3]) {
+    _samples_since_save++;
+    if (_block_samples == 0) {
+        for (int axis = 0; axis < 3; axis++) {
+            _acc_first[axis] = acc[axis];
+            _gyro_first[axis] = gyro[axis];
+            _acc_sum[axis] = _acc_sum_sq[axis] = _gyro_sum[axis] = _gyro_sum_sq[axis] = 0.f;
+        }
+    }
+    for (int axis = 0; axis < 3; axis++) {
+        float a = acc[axis] - _acc_first[axis];
+        float g = gyro[axis] - _gyro_first[axis];
+        _acc_sum[axis] += a;
+        _acc_sum_sq[axis] += a * a;
+        _gyro_sum[axis] += g;
+        _gyro_sum_sq[axis] += g * g;
+    }
+    if (++_block_samples == CALIBRATION_BLOCK_SAMPLES) {
+        finish_block();
+        _block_samples = 0;
+    }
+}
+
+void Calibrator::finish_block() {
+    const float n = CALIBRATION_BLOCK_SAMPLES;
+    const float max_acc_var = CALIBRATION_STILL_ACCEL_G * CALIBRATION_STILL_ACCEL_G;
+    const float max_gyro_var = CALIBRATION_STILL_GYRO_DPS * CALIBRATION_STILL_GYRO_DPS;
+    float acc_mean[3], gyro_mean[3];
+    for (int axis = 0; axis < 3; axis++) {
+        float acc_var = _acc_sum_sq[axis] / n - (_acc_sum[axis] / n) * (_acc_sum[axis] / n);
+        float gyro_var = _gyro_sum_sq[axis] / n - (_gyro_sum[axis] / n) * (_gyro_sum[axis] / n);
+        if (acc_var > max_acc_var || gyro_var > max_gyro_var) return;
+        acc_mean[axis] = _acc_first[axis] + _acc_sum[axis] / n;
+        gyro_mean[axis] = _gyro_first[axis] + _gyro_sum[axis] / n;
+    }
+    for (int axis = 0; axis < 3; axis++) {
+        if (fabsf(gyro_mean[axis]) > CALIBRATION_MAX_GYRO_BIAS_DPS) return;
+    }
+    _rests++;
+
+    for (int axis = 0; axis < 3; axis++) {
+        _calibration.gyro_bias[axis] += CALIBRATION_GYRO_RATE * (gyro_mean[axis] - _calibration.gyro_bias[axis]);
+    }
+    _calibration.flags |= CALIBRATION_GYRO;
+
+    add_orientation(acc_mean);
+}
+
+void Calibrator::add_orientation(const float mean[3]) {
+    float len = sqrtf(mean[0] * mean[0] + mean[1] * mean[1] + mean[2] * mean[2]);
+    if (len < 0.5f) return; // Free fall? Not gravity, anyway
+
+    // Same orientation as one already kept: average it in (a bounded weight, so it can still drift)
+    int nearest = -1;
+    float nearest_cos = -2.f;
+    for (int i = 0; i < _orientation_count; i++) {
+        const float *kept = _orientations[i];
+        float kept_len = sqrtf(kept[0] * kept[0] + kept[1] * kept[1] + kept[2] * kept[2]);
+        float cos = (mean[0] * kept[0] + mean[1] * kept[1] + mean[2] * kept[2]) / (len * kept_len);
+        if (cos > nearest_cos) {
+            nearest_cos = cos;
+            nearest = i;
+        }
+    }
+    if (nearest >= 0 && nearest_cos >= CALIBRATION_REST_MERGE_COS) {
+        int weight = _orientation_weights[nearest];
+        for (int axis = 0; axis < 3; axis++) {
+            _orientations[nearest][axis] += (mean[axis] - _orientations[nearest][axis]) / (weight + 1);
+        }
+        if (weight < 8) _orientation_weights[nearest] = weight + 1;
+    } else {
+        // A new orientation. When they're all taken, it replaces the one closest to it, so they stay spread out.
+        int slot = _orientation_count < CALIBRATION_RESTS ? _orientation_count++ : nearest;
+        for (int axis = 0; axis < 3; axis++) _orientations[slot][axis] = mean[axis];
+        _orientation_weights[slot] = 1;
+    }
+    fit_accel();
+}
+
+/** Solve a 6x6 system in place by Gaussian elimination; the solution ends up in b. False if singular. */
+static bool solve(float a[6][6], float b[6]) {
+    for (int col = 0; col < 6; col++) {
+        int pivot = col;
+        for (int row = col + 1; row < 6; row++) {
+            if (fabsf(a[row][col]) > fabsf(a[pivot][col])) pivot = row;
+        }
+        if (fabsf(a[pivot][col]) < 1e-9f) return false;
+        if (pivot != col) {
+            for (int k = 0; k < 6; k++) {
+                float t = a[col][k];
+                a[col][k] = a[pivot][k];
+                a[pivot][k] = t;
+            }
+            float t = b[col];
+            b[col] = b[pivot];
+            b[pivot] = t;
+        }
+        for (int row = col + 1; row < 6; row++) {
+            float f = a[row][col] / a[col][col];
+            for (int k = col; k < 6; k++) a[row][k] -= f * a[col][k];
+            b[row] -= f * b[col];
+        }
+    }
+    for (int row = 5; row >= 0; row--) {
+        for (int k = row + 1; k < 6; k++) b[row] -= a[row][k] * b[k];
+        b[row] /= a[row][row];
+    }
+    return true;
+}
+
+bool Calibrator::fit_accel() {
+    if (_orientation_count < CALIBRATION_MIN_RESTS) return false;
+    for (int axis = 0; axis < 3; axis++) {
+        float low = _orientations[0][axis], high = low;
+        for (int i = 1; i < _orientation_count; i++) {
+            if (_orientations[i][axis] < low) low = _orientations[i][axis];
+            if (_orientations[i][axis] > high) high = _orientations[i][axis];
+        }
+        if (high - low < CALIBRATION_MIN_SPAN_G) return false;
+    }
+
+    // Axis-aligned ellipsoid through the rests, with x's coefficient fixed at 1 so it's linear:
+    //   x^2 + a1 y^2 + a2 z^2 + b0 x + b1 y + b2 z + c = 0
+    // Least squares over the rests, by the normal equations
+    float normal[6][6] = {}, rhs[6] = {};
+    for (int i = 0; i < _orientation_count; i++) {
+        const float *m = _orientations[i];
+        float row[6] = { m[1] * m[1], m[2] * m[2], m[0], m[1], m[2], 1.f };
+        for (int j = 0; j < 6; j++) {
+            for (int k = 0; k < 6; k++) normal[j][k] += row[j] * row[k];
+            rhs[j] -= row[j] * m[0] * m[0];
+        }
+    }
+    if (!solve(normal, rhs)) return false;
+
+    // Complete the squares: (x - o0)^2 + a1 (y - o1)^2 + a2 (z - o2)^2 = g, and g is 1 g squared
+    float a[3] = { 1.f, rhs[0], rhs[1] };
+    if (a[1] <= 0.f || a[2] <= 0.f) return false;
+    Calibration fit = _calibration;
+    float g = -rhs[5];
+    for (int axis = 0; axis < 3; axis++) {
+        fit.accel_offset[axis] = -rhs[2 + axis] / (2.f * a[axis]);
+        g += a[axis] * fit.accel_offset[axis] * fit.accel_offset[axis];
+    }
+    if (g <= 0.f) return false;
+    for (int axis = 0; axis < 3; axis++) {
+        fit.accel_scale[axis] = sqrtf(a[axis] / g);
+        if (fabsf(fit.accel_offset[axis]) > CALIBRATION_MAX_OFFSET_G) return false;
+        if (fabsf(fit.accel_scale[axis] - 1.f) > CALIBRATION_MAX_SCALE_ERROR) return false;
+    }
+
+    // Every rest should come out at 1 g
+    float residual = 0.f;
+    for (int i = 0; i < _orientation_count; i++) {
+        float len_sq = 0.f;
+        for (int axis = 0; axis < 3; axis++) {
+            float corrected = (_orientations[i][axis] - fit.accel_offset[axis]) * fit.accel_scale[axis];
+            len_sq += corrected * corrected;
+        }
+        float error = sqrtf(len_sq) - 1.f;
+        residual += error * error;
+    }
+    if (sqrtf(residual / _orientation_count) > CALIBRATION_MAX_RESIDUAL_G) return false;
+
+    fit.flags |= CALIBRATION_ACCEL;
+    _calibration = fit;
+    return true;
+}
+
+bool Calibrator::take_changed() {
+    if (_samples_since_save < CALIBRATION_SAVE_SAMPLES) return false;
+    bool changed = _calibration.flags != _saved.flags;
+    for (int axis = 0; axis < 3; axis++) {
+        changed = changed || fabsf(_calibration.gyro_bias[axis] - _saved.gyro_bias[axis]) >= CALIBRATION_SAVE_GYRO_DPS;
+        changed = changed || fabsf(_calibration.accel_offset[axis] - _saved.accel_offset[axis]) >= CALIBRATION_SAVE_ACCEL_G;
+        changed = changed || fabsf(_calibration.accel_scale[axis] - _saved.accel_scale[axis]) >= CALIBRATION_SAVE_ACCEL_G;
+    }
+    if (!changed) return false;
+    _saved = _calibration;
+    _samples_since_save = 0;
+    return true;
+}
@@ -1,14 +1,18 @@
 #include "arm_math.h"
 #include "conditioning.hpp"
 #include "globals.hpp"
+#include "orientation.hpp"
+#include "profiling.hpp"
 
 // MARK: FFT
 
 arm_rfft_fast_instance_f32 fft_instance;
 float32_t complex_fft_coefficients[BATCH_SIZE * 2];
+arm_rfft_instance_q15 fft_instance_q15;
 
 void init_fft() {
     arm_rfft_fast_init_f32(&fft_instance, BATCH_SIZE);
+    arm_rfft_init_q15(&fft_instance_q15, BATCH_SIZE, 0, 1);
 }
 
 void do_fft(float data[BATCH_SIZE], float frequency_magnitudes[BATCH_SIZE / 2 + 1]) {
@@ -18,4 +22,189 @@ void do_fft(float data[BATCH_SIZE], float frequency_magnitudes[BATCH_SIZE / 2 +
     frequency_magnitudes,
     BATCH_SIZE / 2 + 1
   );
-}
\ No newline at end of file
+}
+
+void do_fft(float data[BATCH_SIZE], float frequency_magnitudes[BATCH_SIZE / 2 + 1], float scratch[FFT_SCRATCH_SIZE]) {
+  // The instance is only read after init_fft(), so it can be shared between threads
+  arm_rfft_fast_f32(&fft_instance, data, scratch, 0);
+  scratch[BATCH_SIZE] = 0.f;
+  scratch[BATCH_SIZE + 1] = 0.f;
+  PROFILE_SCOPE(PROFILE_MAGNITUDE);
+  arm_cmplx_mag_f32(
+    scratch,
+    frequency_magnitudes,
+    BATCH_SIZE / 2 + 1
+  );
+}
+
+int do_fft_q15(q15_t data[BATCH_SIZE], q15_t frequency_magnitudes[BATCH_SIZE / 2 + 1], q15_t scratch[FFT_Q15_SCRATCH_SIZE]) {
+  // Block scaling: as many bits up as the largest sample leaves room for
+  q15_t largest;
+  uint32_t index;
+  arm_absmax_q15(data, BATCH_SIZE, &largest, &index);
+  int shift = 0;
+  while (shift < 15 && largest != 0 && largest < (q15_t)(0x4000 >> shift)) shift++;
+  if (shift) arm_shift_q15(data, shift, data, BATCH_SIZE);
+
+  arm_rfft_q15(&fft_instance_q15, data, scratch);
+  PROFILE_SCOPE(PROFILE_MAGNITUDE);
+  arm_cmplx_mag_q15(scratch, frequency_magnitudes, BATCH_SIZE / 2 + 1);
+  return shift;
+}
+
+// MARK: Per-sample conditioning
+
+// lowpass() as a Q15 biquad: {b0, 0, b1, b2, a1, a2} in Q14 (a1 is over 1), and a post shift of 1 to match
+static const q15_t lowpass_q15_coefficients[6] = { 1419, 0, 2839, 1419, 17863, -8628 };
+
+/** lowpass() on Q15 samples in place, with arm_biquad_cascade_df1_fast_q15 */
+static void lowpass_q15(q15_t *data, q15_t state[4], int n) {
+    // Set up in place rather than with arm_biquad_cascade_df1_init_q15(), which would clear the state
+    arm_biquad_casd_df1_inst_q15 filter;
+    filter.numStages = 1;
+    filter.pState = state;
+    filter.pCoeffs = lowpass_q15_coefficients;
+    filter.postShift = 1;
+    arm_biquad_cascade_df1_fast_q15(&filter, data, data, n);
+}
+
+static inline q15_t to_q15(float value, float full_scale) {
+    float scaled = value * (32768.f / full_scale);
+    if (scaled > 32767.f) return 32767;
+    if (scaled < -32768.f) return -32768;
+    return (q15_t)lrintf(scaled);
+}
+
+void SampleConditioner::track(const float (*acc)[3], const float (*gyro)[3], int n, float (*rots)[4]) {
+    int i = 0;
+    for (; i < n && _init_samples < ORIENTATION_INIT_SAMPLES; i++) {
+        // Starting from the identity, update_rot() would take many windows to find down, and gravity
+        // leaks into the output as low frequency energy meanwhile. Solve it from the samples so far.
+        for (int axis = 0; axis < 3; axis++) _init_accel[axis] += acc[i][axis];
+        _init_samples++;
+        tilt_quaternion(_init_accel, _rot);
+        #if ORIENTATION_FILTER != ORIENTATION_UPDATE_ROT
+        _filter.set_orientation(_rot);
+        #endif
+        memcpy(rots[i], _rot, sizeof(_rot));
+    }
+    if (i == n) return;
+
+    #if ORIENTATION_FILTER != ORIENTATION_UPDATE_ROT
+    _filter.update(&acc[i], &gyro[i], n - i, &rots[i]);
+    memcpy(_rot, _filter.orientation(), sizeof(_rot));
+    #else
+    for (; i < n; i++) {
+        float a[3] = { acc[i][0], acc[i][1], acc[i][2] }, g[3] = { gyro[i][0], gyro[i][1], gyro[i][2] };
+        update_rot(a, g, _rot);
+        memcpy(rots[i], _rot, sizeof(_rot));
+    }
+    #endif
+}
+
+void SampleConditioner::remove_gravity(float (*acc)[3], const float (*gyro)[3], int n) {
+    float rots[CONDITION_BLOCK_SAMPLES][4];
+    PROFILE_SCOPE(PROFILE_ORIENTATION);
+    track(acc, gyro, n, rots);
+    rotate_minus_gravity(rots, acc, 1.f, acc, n);
+}
+
+void SampleConditioner::condition(float (*acc)[3], const float (*gyro)[3], int n, IMUBatch *batch, int t) {
+    for (int start = 0; start < n; start += CONDITION_BLOCK_SAMPLES) {
+        int count = n - start < CONDITION_BLOCK_SAMPLES ? n - start : CONDITION_BLOCK_SAMPLES;
+        float (*block_acc)[3] = &acc[start];
+        const float (*block_gyro)[3] = &gyro[start];
+        remove_gravity(block_acc, block_gyro, count);
+
+        PROFILE_SCOPE(PROFILE_FILTER);
+        int slot = t + start;
+        for (int axis = 0; axis < 3; axis++) {
+            float *acc_out = &batch->accelerometer[axis][slot], *gyro_out = &batch->gyroscope[axis][slot];
+            for (int i = 0; i < count; i++) {
+                acc_out[i] = block_acc[i][axis];
+                gyro_out[i] = block_gyro[i][axis];
+            }
+            lowpass(acc_out, &_acc_hist[axis], count, slot & 1, acc_out);
+            lowpass(gyro_out, &_gyro_hist[axis], count, slot & 1, gyro_out);
+        }
+    }
+}
+
+void SampleConditioner::condition(float (*acc)[3], const float (*gyro)[3], int n, IMUBatchQ15 *batch, int t) {
+    for (int start = 0; start < n; start += CONDITION_BLOCK_SAMPLES) {
+        int count = n - start < CONDITION_BLOCK_SAMPLES ? n - start : CONDITION_BLOCK_SAMPLES;
+        float (*block_acc)[3] = &acc[start];
+        const float (*block_gyro)[3] = &gyro[start];
+        remove_gravity(block_acc, block_gyro, count);
+
+        PROFILE_SCOPE(PROFILE_FILTER);
+        int slot = t + start;
+        for (int axis = 0; axis < 3; axis++) {
+            q15_t *acc_out = &batch->accelerometer[axis][slot], *gyro_out = &batch->gyroscope[axis][slot];
+            for (int i = 0; i < count; i++) {
+                acc_out[i] = to_q15(block_acc[i][axis], Q15_ACCEL_G);
+                gyro_out[i] = to_q15(block_gyro[i][axis], Q15_GYRO_DPS);
+            }
+            lowpass_q15(acc_out, _acc_state_q15[axis], count);
+            lowpass_q15(gyro_out, _gyro_state_q15[axis], count);
+        }
+    }
+}
+
+void SampleConditioner::condition(float (*acc)[3], const float (*gyro)[3], int n, IMUBatchF16 *batch, int t) {
+    for (int start = 0; start < n; start += CONDITION_BLOCK_SAMPLES) {
+        int count = n - start < CONDITION_BLOCK_SAMPLES ? n - start : CONDITION_BLOCK_SAMPLES;
+        float (*block_acc)[3] = &acc[start];
+        const float (*block_gyro)[3] = &gyro[start];
+        remove_gravity(block_acc, block_gyro, count);
+
+        PROFILE_SCOPE(PROFILE_FILTER);
+        int slot = t + start;
+        float acc_out[CONDITION_BLOCK_SAMPLES], gyro_out[CONDITION_BLOCK_SAMPLES];
+        for (int axis = 0; axis < 3; axis++) {
+            for (int i = 0; i < count; i++) {
+                acc_out[i] = block_acc[i][axis];
+                gyro_out[i] = block_gyro[i][axis];
+            }
+            lowpass(acc_out, &_acc_hist[axis], count, slot & 1, acc_out);
+            lowpass(gyro_out, &_gyro_hist[axis], count, slot & 1, gyro_out);
+            half_narrow(acc_out, &batch->accelerometer[axis][slot], count);
+            half_narrow(gyro_out, &batch->gyroscope[axis][slot], count);
+        }
+    }
+}
+
+void SampleConditioner::finish_batch(IMUBatchF16 *batch) {
+    for (int axis = 0; axis < 3; axis++) {
+        memset(&batch->accelerometer[axis][BATCH_SIZE_FILLED], 0, (BATCH_SIZE - BATCH_SIZE_FILLED) * sizeof(half_t));
+        memset(&batch->gyroscope[axis][BATCH_SIZE_FILLED], 0, (BATCH_SIZE - BATCH_SIZE_FILLED) * sizeof(half_t));
+    }
+}
+
+void SampleConditioner::finish_batch(IMUBatchQ15 *batch) {
+    for (int axis = 0; axis < 3; axis++) {
+        memset(&batch->accelerometer[axis][BATCH_SIZE_FILLED], 0, (BATCH_SIZE - BATCH_SIZE_FILLED) * sizeof(q15_t));
+        memset(&batch->gyroscope[axis][BATCH_SIZE_FILLED], 0, (BATCH_SIZE - BATCH_SIZE_FILLED) * sizeof(q15_t));
+    }
+}
+
+void SampleConditioner::finish_batch(IMUBatch *batch) {
+    for (int axis = 0; axis < 3; axis++) {
+        memset(&batch->accelerometer[axis][BATCH_SIZE_FILLED], 0, (BATCH_SIZE - BATCH_SIZE_FILLED) * sizeof(float));
+        memset(&batch->gyroscope[axis][BATCH_SIZE_FILLED], 0, (BATCH_SIZE - BATCH_SIZE_FILLED) * sizeof(float));
+    }
+}
+
+void SampleConditioner::reset() {
+    _rot[0] = 1;
+    _rot[1] = _rot[2] = _rot[3] = 0;
+    #if ORIENTATION_FILTER != ORIENTATION_UPDATE_ROT
+    _filter.reset();
+    #endif
+    memset(_init_accel, 0, sizeof(_init_accel));
+    _init_samples = 0;
+    memset(_acc_hist, 0, sizeof(_acc_hist));
+    memset(_gyro_hist, 0, sizeof(_gyro_hist));
+    memset(_acc_state_q15, 0, sizeof(_acc_state_q15));
+    memset(_gyro_state_q15, 0, sizeof(_gyro_state_q15));
+}
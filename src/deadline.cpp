@@ -0,0 +1,73 @@
+#include "deadline.hpp"
+
+// A sample this far past its slot is late; a whole extra period means one was dropped
+#define LATE_THRESHOLD_US (SAMPLE_PERIOD_US / 4)
+
+//MARK: Producer
+
+void DeadlineMonitor::sample(int n) {
+    uint64_t now = _clock.now_us();
+    if (_have_sample) {
+        uint64_t gap = now - _last_sample_us;
+        if (gap > (uint64_t)n * SAMPLE_PERIOD_US + LATE_THRESHOLD_US) {
+            // Round to the nearest number of periods; every slot past the first n went missing
+            uint32_t periods = (uint32_t)((gap + SAMPLE_PERIOD_US / 2) / SAMPLE_PERIOD_US);
+            if (periods > (uint32_t)n) {
+                _dropped_samples.fetch_add(periods - n, std::memory_order_relaxed);
+            } else {
+                _late_samples.fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+    }
+    _last_sample_us = now;
+    _have_sample = true;
+}
+
+uint64_t DeadlineMonitor::release() {
+    return _clock.now_us();
+}
+
+//MARK: Consumer
+
+void DeadlineMonitor::complete(uint64_t release_us) {
+    int64_t slack = (int64_t)(release_us + BATCH_PERIOD_US) - (int64_t)_clock.now_us();
+    int32_t slack_us = slack < INT32_MIN ? INT32_MIN : (int32_t)slack;
+
+    if (_batches == 0 || slack_us < _worst_slack_us) _worst_slack_us = slack_us;
+    if (slack_us < 0) _misses++;
+    _batches++;
+
+    _window[_window_next] = slack_us;
+    _window_next = (_window_next + 1) % DEADLINE_WINDOW;
+    if (_window_fill < DEADLINE_WINDOW) _window_fill++;
+}
+
+DeadlineStats DeadlineMonitor::stats() const {
+    DeadlineStats stats;
+    stats.batches = _batches;
+    stats.misses = _misses;
+    stats.worst_slack_us = _worst_slack_us;
+    stats.late_samples = _late_samples.load(std::memory_order_relaxed);
+    stats.dropped_samples = _dropped_samples.load(std::memory_order_relaxed);
+
+    int64_t sum = 0;
+    stats.window_min_slack_us = 0;
+    stats.window_misses = 0;
+    for (int i = 0; i < _window_fill; i++) {
+        if (i == 0 || _window[i] < stats.window_min_slack_us) stats.window_min_slack_us = _window[i];
+        if (_window[i] < 0) stats.window_misses++;
+        sum += _window[i];
+    }
+    stats.window_mean_slack_us = _window_fill ? (int32_t)(sum / _window_fill) : 0;
+    return stats;
+}
+
+void DeadlineMonitor::reset() {
+    _batches = 0;
+    _misses = 0;
+    _worst_slack_us = 0;
+    _window_fill = 0;
+    _window_next = 0;
+    _late_samples.store(0, std::memory_order_relaxed);
+    _dropped_samples.store(0, std::memory_order_relaxed);
+}
@@ -0,0 +1,116 @@
+#include "decimator.hpp"
+
+#include <math.h>
+#include <string.h>
+
+/** One axis of a sample, by channel: accel x, y, z, then gyro x, y, z */
+static inline int16_t channel_value(const RawImuSample &sample, int channel) {
+    return channel < 3 ? sample.accel[channel] : sample.gyro[channel - 3];
+}
+
+static inline int16_t &channel_ref(RawImuSample &sample, int channel) {
+    return channel < 3 ? sample.accel[channel] : sample.gyro[channel - 3];
+}
+
+static inline int16_t to_count(float value) {
+    float y = roundf(value);
+    return y > 32767.f ? 32767 : y < -32768.f ? -32768 : (int16_t)y;
+}
+
+void ImuDecimator::design(int factor, float *coefficients) {
+    const int taps = DECIMATOR_TAPS_PER_PHASE * factor;
+    // Cutoff as a fraction of the input rate
+    const float cutoff = 0.5f / factor;
+    float sum = 0.f;
+    for (int i = 0; i < taps; i++) {
+        float x = i - (taps - 1) / 2.f;
+        float sinc = x == 0.f ? 2.f * cutoff : sinf(2.f * PI * cutoff * x) / (PI * x);
+        float phase = 2.f * PI * i / (taps - 1);
+        float window = 0.42f - 0.5f * cosf(phase) + 0.08f * cosf(2.f * phase);
+        coefficients[i] = sinc * window;
+        sum += coefficients[i];
+    }
+    for (int i = 0; i < taps; i++) coefficients[i] /= sum;
+}
+
+ImuDecimator::ImuDecimator(int factor) : _factor(factor < 1 ? 1 : factor > DECIMATOR_MAX_FACTOR ? DECIMATOR_MAX_FACTOR : factor) {
+    if (_factor > 1) design(_factor, _coefficients);
+    reset();
+}
+
+void ImuDecimator::reset() {
+    if (_factor == 1) return;
+    // The coefficients are symmetric, so CMSIS's time-reversed order is the same order
+    for (int channel = 0; channel < 6; channel++) {
+        arm_fir_decimate_init_f32(&_fir[channel], DECIMATOR_TAPS_PER_PHASE * _factor, _factor, _coefficients,
+            _state[channel], DECIMATOR_MAX_BLOCK);
+    }
+}
+
+int ImuDecimator::process(const RawImuSample *in, int n, RawImuSample *out) {
+    if (_factor == 1) {
+        memcpy(out, in, n * sizeof(RawImuSample));
+        return n;
+    }
+    n -= n % _factor;
+    if (n > DECIMATOR_MAX_BLOCK) n = DECIMATOR_MAX_BLOCK;
+    const int outputs = n / _factor;
+
+    for (int channel = 0; channel < 6; channel++) {
+        for (int i = 0; i < n; i++) _channel_in[i] = channel_value(in[i], channel);
+        arm_fir_decimate_f32(&_fir[channel], _channel_in, _channel_out, n);
+        for (int i = 0; i < outputs; i++) channel_ref(out[i], channel) = to_count(_channel_out[i]);
+    }
+    return outputs;
+}
+
+void ImuDecimator::prime(const RawImuSample &sample) {
+    if (_factor == 1) return;
+    for (int channel = 0; channel < 6; channel++) {
+        float value = channel_value(sample, channel);
+        for (float &state : _state[channel]) state = value;
+    }
+}
+
+//MARK: Interpolation
+
+ImuInterpolator::ImuInterpolator(int factor) : _factor(factor < 1 ? 1 : factor > DECIMATOR_MAX_FACTOR ? DECIMATOR_MAX_FACTOR : factor) {
+    if (_factor > 1) {
+        // Same low pass, cutoff at the input's Nyquist; each output phase sees every factor'th tap, so the
+        // taps sum to factor for unity gain
+        ImuDecimator::design(_factor, _coefficients);
+        for (int i = 0; i < DECIMATOR_TAPS_PER_PHASE * _factor; i++) _coefficients[i] *= _factor;
+    }
+    reset();
+}
+
+void ImuInterpolator::reset() {
+    if (_factor == 1) return;
+    for (int channel = 0; channel < 6; channel++) {
+        arm_fir_interpolate_init_f32(&_fir[channel], _factor, DECIMATOR_TAPS_PER_PHASE * _factor, _coefficients,
+            _state[channel], INTERPOLATOR_MAX_BLOCK / _factor);
+    }
+}
+
+int ImuInterpolator::process(const RawImuSample *in, int n, RawImuSample *out) {
+    if (_factor == 1) {
+        memcpy(out, in, n * sizeof(RawImuSample));
+        return n;
+    }
+    if (n > INTERPOLATOR_MAX_BLOCK / _factor) n = INTERPOLATOR_MAX_BLOCK / _factor;
+    const int outputs = n * _factor;
+    for (int channel = 0; channel < 6; channel++) {
+        for (int i = 0; i < n; i++) _channel_in[i] = channel_value(in[i], channel);
+        arm_fir_interpolate_f32(&_fir[channel], _channel_in, _channel_out, n);
+        for (int i = 0; i < outputs; i++) channel_ref(out[i], channel) = to_count(_channel_out[i]);
+    }
+    return outputs;
+}
+
+void ImuInterpolator::prime(const RawImuSample &sample) {
+    if (_factor == 1) return;
+    for (int channel = 0; channel < 6; channel++) {
+        float value = channel_value(sample, channel);
+        for (float &state : _state[channel]) state = value;
+    }
+}
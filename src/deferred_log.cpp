@@ -0,0 +1,132 @@
+#include "deferred_log.hpp"
+
+#include <stdio.h>
+
+DeferredLog deferred_log;
+
+#define DEFERRED_LOG_STRING(id, format) format,
+static const char *const formats[LOG_FORMAT_COUNT] = {
+    DEFERRED_LOG_FORMATS(DEFERRED_LOG_STRING)
+};
+#undef DEFERRED_LOG_STRING
+
+const char *deferred_log_format(LogFormat format) {
+    return format < LOG_FORMAT_COUNT ? formats[format] : "?\n";
+}
+
+//MARK: Ring
+
+DeferredLog::DeferredLog() : _head(0), _dropped(0) {
+    // Slot i is free for whoever claims position i
+    for (uint32_t i = 0; i < DEFERRED_LOG_CAPACITY; i++) {
+        _slots[i].sequence.store(i, std::memory_order_relaxed);
+    }
+}
+
+bool DeferredLog::push(LogFormat format, const uint32_t *args, int argc) {
+    uint32_t position = _head.load(std::memory_order_relaxed);
+    Slot *slot;
+    while (1) {
+        slot = &_slots[position & (DEFERRED_LOG_CAPACITY - 1)];
+        int32_t lag = (int32_t)(slot->sequence.load(std::memory_order_acquire) - position);
+        if (lag == 0) {
+            // Free; try to claim it (on failure position is reloaded and we go again)
+            if (_head.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) break;
+        } else if (lag < 0) {
+            // Still holds a record from the previous lap: the ring is full
+            _dropped.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        } else {
+            // Another producer claimed it first
+            position = _head.load(std::memory_order_relaxed);
+        }
+    }
+
+    slot->record.format = (uint16_t)format;
+    slot->record.argc = (uint16_t)argc;
+    for (int i = 0; i < argc; i++) slot->record.args[i] = args[i];
+    slot->sequence.store(position + 1, std::memory_order_release);
+    return true;
+}
+
+bool DeferredLog::pop(LogRecord &record) {
+    Slot &slot = _slots[_tail & (DEFERRED_LOG_CAPACITY - 1)];
+    if (slot.sequence.load(std::memory_order_acquire) != _tail + 1) return false;
+    record = slot.record;
+    // Free for the producer that claims this slot on the next lap
+    slot.sequence.store(_tail + DEFERRED_LOG_CAPACITY, std::memory_order_release);
+    _tail++;
+    return true;
+}
+
+int DeferredLog::drain(void (*write)(const char *text, int length)) {
+    char line[DEFERRED_LOG_LINE_SIZE];
+    LogRecord record;
+    int count = 0;
+    while (pop(record)) {
+        write(line, deferred_log_format_record(record, line, sizeof(line)));
+        count++;
+    }
+
+    uint32_t dropped = _dropped.load(std::memory_order_relaxed);
+    if (dropped != _reported_dropped) {
+        record.format = LOG_DROPPED;
+        record.argc = 1;
+        record.args[0] = dropped - _reported_dropped;
+        _reported_dropped = dropped;
+        write(line, deferred_log_format_record(record, line, sizeof(line)));
+    }
+    return count;
+}
+
+//MARK: Formatting
+
+int deferred_log_format_record(const LogRecord &record, char *dest, int size) {
+    const char *format = deferred_log_format((LogFormat)record.format);
+    int length = 0;
+    int arg = 0;
+    dest[0] = '\0';
+
+    while (*format && length < size - 1) {
+        if (*format != '%') {
+            dest[length++] = *format++;
+            continue;
+        }
+        if (format[1] == '%') {
+            dest[length++] = '%';
+            format += 2;
+            continue;
+        }
+
+        // Copy one conversion (flags, width, precision, type) without its length modifiers,
+        // since every argument was stored as a 32-bit word
+        char spec[16];
+        int spec_length = 0;
+        spec[spec_length++] = *format++;
+        while (*format && !strchr("diuxXcfFeEgG", *format)) {
+            if (*format != 'l' && *format != 'h' && spec_length < (int)sizeof(spec) - 2) spec[spec_length++] = *format;
+            format++;
+        }
+        if (!*format) break;
+        char type = *format++;
+        spec[spec_length++] = type;
+        spec[spec_length] = '\0';
+
+        uint32_t word = arg < record.argc ? record.args[arg] : 0;
+        arg++;
+        int written;
+        if (strchr("fFeEgG", type)) {
+            float value;
+            memcpy(&value, &word, sizeof(value));
+            written = snprintf(dest + length, size - length, spec, (double)value);
+        } else if (type == 'd' || type == 'i' || type == 'c') {
+            written = snprintf(dest + length, size - length, spec, (int)(int32_t)word);
+        } else {
+            written = snprintf(dest + length, size - length, spec, (unsigned)word);
+        }
+        if (written < 0) break;
+        length += written < size - length ? written : size - length - 1;
+    }
+    dest[length] = '\0';
+    return length;
+}
@@ -0,0 +1,158 @@
+#include "episodes.hpp"
+#include "byte_order.hpp"
+
+EpisodeConfig episode_default_config() {
+    EpisodeConfig config;
+    // Onset about halfway between the absent and present means, two windows (~6 s) to start or end
+    config.rules[EPISODE_TREMOR] = { 0.65f, 0.5f, 2, 2, 3.0f, 5.0f };
+    config.rules[EPISODE_DYSKINESIA] = { 0.7f, 0.5f, 2, 2, 5.0f, 7.0f };
+    // FOG moves in steps of 1/3 and the detector already waits for walking to stop, so any step up
+    // starts an episode and a drop back to 0 ends it (waiting for 2/3 loses short freezes and gains no
+    // precision). Its band is the 3-8 Hz trembling of a freeze.
+    config.rules[EPISODE_FOG] = { 0.3f, 0.1f, 1, 1, 3.0f, 8.0f };
+    return config;
+}
+
+static inline float magnitude(float value) { return value; }
+static inline float magnitude(half_t value) { return half_to_float(value); }
+
+template <typename T>
+static void window_frequencies(const EpisodeConfig &config, const T accel_freq_mags[3][BATCH_SIZE / 2 + 1],
+    float dominant_hz[EPISODE_KIND_COUNT]) {
+    for (int kind = 0; kind < EPISODE_KIND_COUNT; kind++) {
+        int bin_low = (int)(config.rules[kind].low_hz / FREQUENCY_BIN_SIZE);
+        int bin_high = (int)(config.rules[kind].high_hz / FREQUENCY_BIN_SIZE);
+        int best_bin = bin_low;
+        float best_power = -1.f;
+        for (int bin = bin_low; bin <= bin_high && bin <= BATCH_SIZE / 2; bin++) {
+            float power = magnitude(accel_freq_mags[0][bin]) + magnitude(accel_freq_mags[1][bin]) +
+                magnitude(accel_freq_mags[2][bin]);
+            if (power > best_power) {
+                best_power = power;
+                best_bin = bin;
+            }
+        }
+        dominant_hz[kind] = best_bin * FREQUENCY_BIN_SIZE;
+    }
+}
+
+void episode_window_frequencies(const EpisodeConfig &config, const float accel_freq_mags[3][BATCH_SIZE / 2 + 1],
+    float dominant_hz[EPISODE_KIND_COUNT]) {
+    window_frequencies(config, accel_freq_mags, dominant_hz);
+}
+
+void episode_window_frequencies(const EpisodeConfig &config, const half_t accel_freq_mags[3][BATCH_SIZE / 2 + 1],
+    float dominant_hz[EPISODE_KIND_COUNT]) {
+    window_frequencies(config, accel_freq_mags, dominant_hz);
+}
+
+//MARK: Wire format
+
+int episode_encode(const EpisodeEvent &event, uint8_t dest[EPISODE_EVENT_SIZE]) {
+    uint8_t *p = dest;
+    *p++ = event.type;
+    *p++ = event.kind;
+    p = put_u16(p, event.sequence);
+    p = put_u32(p, event.onset_ms);
+    p = put_u32(p, event.duration_ms);
+    p = put_ufixed16(p, event.peak, 10000.f);
+    p = put_ufixed16(p, event.mean, 10000.f);
+    p = put_ufixed16(p, event.dominant_hz, 100.f);
+    return (int)(p - dest);
+}
+
+bool episode_decode(const uint8_t *data, int size, EpisodeEvent &event) {
+    if (size < EPISODE_EVENT_SIZE) return false;
+    event.type = data[0];
+    event.kind = data[1];
+    event.sequence = get_u16(data + 2);
+    event.onset_ms = get_u32(data + 4);
+    event.duration_ms = get_u32(data + 8);
+    event.peak = get_ufixed16(data + 12, 10000.f);
+    event.mean = get_ufixed16(data + 14, 10000.f);
+    event.dominant_hz = get_ufixed16(data + 16, 100.f);
+    return true;
+}
+
+//MARK: Extraction
+
+EpisodeExtractor::EpisodeExtractor(const EpisodeConfig &config) : _config(config) {
+    reset();
+}
+
+void EpisodeExtractor::reset() {
+    for (int kind = 0; kind < EPISODE_KIND_COUNT; kind++) {
+        _tracks[kind] = Track();
+    }
+}
+
+EpisodeEvent EpisodeExtractor::make_event(EpisodeEventType type, int kind) {
+    const Track &track = _tracks[kind];
+    EpisodeEvent event;
+    event.type = type;
+    event.kind = (uint8_t)kind;
+    event.sequence = _sequence++;
+    event.onset_ms = track.onset_ms;
+    event.duration_ms = type == EPISODE_END ? track.last_ms - track.onset_ms : 0;
+    event.peak = track.peak;
+    event.mean = track.windows ? track.sum / track.windows : 0.f;
+    event.dominant_hz = track.sum > 0.f ? track.weighted_hz / track.sum : 0.f;
+    return event;
+}
+
+int EpisodeExtractor::update(uint32_t time_ms, const SymptomIntensities &intensities,
+    const float dominant_hz[EPISODE_KIND_COUNT], EpisodeEvent events[EPISODE_MAX_EVENTS]) {
+    const float values[EPISODE_KIND_COUNT] = { intensities.tremor, intensities.dyskinesia, intensities.fog };
+    int count = 0;
+
+    for (int kind = 0; kind < EPISODE_KIND_COUNT; kind++) {
+        const EpisodeRule &rule = _config.rules[kind];
+        Track &track = _tracks[kind];
+        float value = values[kind];
+        // While inactive, the stats collect the onset run, so a started episode already includes it
+        bool counts = track.active ? value >= rule.offset : value >= rule.onset;
+
+        if (counts) {
+            if (!track.active && track.run == 0) {
+                track.onset_ms = time_ms;
+                track.peak = 0.f;
+                track.sum = 0.f;
+                track.weighted_hz = 0.f;
+                track.windows = 0;
+            }
+            track.last_ms = time_ms + EPISODE_WINDOW_MS;
+            if (value > track.peak) track.peak = value;
+            track.sum += value;
+            track.weighted_hz += value * dominant_hz[kind];
+            track.windows++;
+        }
+
+        if (!track.active) {
+            track.run = counts ? track.run + 1 : 0;
+            if (track.run >= rule.onset_windows) {
+                track.active = true;
+                track.run = 0;
+                events[count++] = make_event(EPISODE_START, kind);
+            }
+        } else {
+            track.run = counts ? 0 : track.run + 1;
+            if (track.run >= rule.offset_windows) {
+                track.active = false;
+                track.run = 0;
+                events[count++] = make_event(EPISODE_END, kind);
+            }
+        }
+    }
+    return count;
+}
+
+int EpisodeExtractor::flush(EpisodeEvent events[EPISODE_MAX_EVENTS]) {
+    int count = 0;
+    for (int kind = 0; kind < EPISODE_KIND_COUNT; kind++) {
+        if (!_tracks[kind].active) continue;
+        events[count++] = make_event(EPISODE_END, kind);
+        _tracks[kind].active = false;
+        _tracks[kind].run = 0;
+    }
+    return count;
+}
@@ -0,0 +1,75 @@
+#ifndef __MBED__
+
+#include "host_block_device.hpp"
+
+#include <string.h>
+
+FileBlockDevice::FileBlockDevice(const char *path, mbed::bd_size_t size, mbed::bd_size_t erase_size, mbed::bd_size_t program_size) :
+    _path(path), _erase_size(erase_size), _program_size(program_size),
+    _data(size, 0xFF), _erase_counts(size / erase_size, 0)
+{
+}
+
+FileBlockDevice::~FileBlockDevice() {
+    deinit();
+}
+
+int FileBlockDevice::init() {
+    if (!_path || _file) return BD_ERROR_OK;
+    // Keep what's already there, so a log survives a "reboot" of the host tool
+    _file = fopen(_path, "r+b");
+    if (_file) {
+        if (fread(_data.data(), 1, _data.size(), _file) != _data.size()) {
+            memset(_data.data(), 0xFF, _data.size());
+        }
+    } else {
+        _file = fopen(_path, "w+b");
+        if (!_file) return BD_ERROR_DEVICE_ERROR;
+    }
+    fseek(_file, 0, SEEK_SET);
+    if (fwrite(_data.data(), 1, _data.size(), _file) != _data.size()) return BD_ERROR_DEVICE_ERROR;
+    fflush(_file);
+    return BD_ERROR_OK;
+}
+
+int FileBlockDevice::deinit() {
+    if (_file) fclose(_file);
+    _file = nullptr;
+    return BD_ERROR_OK;
+}
+
+int FileBlockDevice::read(void *buffer, mbed::bd_addr_t addr, mbed::bd_size_t size) {
+    if (addr + size > _data.size()) return BD_ERROR_DEVICE_ERROR;
+    memcpy(buffer, &_data[addr], size);
+    return BD_ERROR_OK;
+}
+
+int FileBlockDevice::program(const void *buffer, mbed::bd_addr_t addr, mbed::bd_size_t size) {
+    if (addr % _program_size || size % _program_size || addr + size > _data.size()) return BD_ERROR_DEVICE_ERROR;
+    const uint8_t *bytes = (const uint8_t *)buffer;
+    for (mbed::bd_size_t i = 0; i < size; i++) {
+        if (bytes[i] & ~_data[addr + i]) _program_violations++;
+        _data[addr + i] &= bytes[i];
+    }
+    _bytes_programmed += size;
+    if (_file) {
+        fseek(_file, (long)addr, SEEK_SET);
+        if (fwrite(&_data[addr], 1, size, _file) != size) return BD_ERROR_DEVICE_ERROR;
+    }
+    return BD_ERROR_OK;
+}
+
+int FileBlockDevice::erase(mbed::bd_addr_t addr, mbed::bd_size_t size) {
+    if (addr % _erase_size || size % _erase_size || addr + size > _data.size()) return BD_ERROR_DEVICE_ERROR;
+    memset(&_data[addr], 0xFF, size);
+    for (mbed::bd_addr_t block = addr / _erase_size; block < (addr + size) / _erase_size; block++) {
+        _erase_counts[block]++;
+    }
+    if (_file) {
+        fseek(_file, (long)addr, SEEK_SET);
+        if (fwrite(&_data[addr], 1, size, _file) != size) return BD_ERROR_DEVICE_ERROR;
+    }
+    return BD_ERROR_OK;
+}
+
+#endif
@@ -0,0 +1,76 @@
+#ifndef __MBED__
+
+#include "host_kv_store.hpp"
+#include "byte_order.hpp"
+
+#include <stdio.h>
+#include <string.h>
+
+// Backing file: per key, u16 key length, key, u32 value size, value
+
+int FileKVStore::init() {
+    _values.clear();
+    if (!_path) return MBED_SUCCESS;
+    FILE *file = fopen(_path, "rb");
+    if (!file) return MBED_SUCCESS; // Nothing stored yet
+    uint8_t header[4];
+    while (fread(header, 1, 2, file) == 2) {
+        std::string key(get_u16(header), '\0');
+        if (fread(&key[0], 1, key.size(), file) != key.size() || fread(header, 1, 4, file) != 4) break;
+        std::vector<uint8_t> value(get_u32(header));
+        if (fread(value.data(), 1, value.size(), file) != value.size()) break;
+        _values[key] = value;
+    }
+    fclose(file);
+    return MBED_SUCCESS;
+}
+
+int FileKVStore::reset() {
+    _values.clear();
+    _writes++;
+    return write_file();
+}
+
+int FileKVStore::set(const char *key, const void *buffer, size_t size, uint32_t /*create_flags*/) {
+    const uint8_t *bytes = (const uint8_t *)buffer;
+    _values[key] = std::vector<uint8_t>(bytes, bytes + size);
+    _writes++;
+    return write_file();
+}
+
+int FileKVStore::get(const char *key, void *buffer, size_t buffer_size, size_t *actual_size, size_t offset) {
+    auto found = _values.find(key);
+    if (found == _values.end()) return MBED_ERROR_ITEM_NOT_FOUND;
+    const std::vector<uint8_t> &value = found->second;
+    size_t size = offset < value.size() ? value.size() - offset : 0;
+    if (size > buffer_size) size = buffer_size;
+    if (size) memcpy(buffer, value.data() + offset, size);
+    if (actual_size) *actual_size = size;
+    return MBED_SUCCESS;
+}
+
+int FileKVStore::remove(const char *key) {
+    if (_values.erase(key) == 0) return MBED_ERROR_ITEM_NOT_FOUND;
+    _writes++;
+    return write_file();
+}
+
+int FileKVStore::write_file() {
+    if (!_path) return MBED_SUCCESS;
+    FILE *file = fopen(_path, "wb");
+    if (!file) return MBED_ERROR_WRITE_FAILED;
+    bool ok = true;
+    for (const auto &entry : _values) {
+        uint8_t header[4];
+        put_u16(header, (uint16_t)entry.first.size());
+        ok = ok && fwrite(header, 1, 2, file) == 2;
+        ok = ok && fwrite(entry.first.data(), 1, entry.first.size(), file) == entry.first.size();
+        put_u32(header, (uint32_t)entry.second.size());
+        ok = ok && fwrite(header, 1, 4, file) == 4;
+        ok = ok && fwrite(entry.second.data(), 1, entry.second.size(), file) == entry.second.size();
+    }
+    fclose(file);
+    return ok ? MBED_SUCCESS : MBED_ERROR_WRITE_FAILED;
+}
+
+#endif
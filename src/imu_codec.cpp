@@ -0,0 +1,244 @@
+#include "imu_codec.hpp"
+#include "byte_order.hpp"
+
+// Rice state a block starts from: mean residual 16, so k = 4
+#define RICE_INITIAL_SUM 16
+// The running mean halves its weight every this many residuals
+#define RICE_WINDOW 32
+// The order every axis uses in the first block, before there's anything to choose by
+#define INITIAL_ORDER 1
+
+//MARK: Shared by encoder and decoder
+
+static inline uint32_t zigzag(int32_t value) {
+    return ((uint32_t)value << 1) ^ (uint32_t)(value >> 31);
+}
+
+static inline int32_t unzigzag(uint32_t value) {
+    return (int32_t)(value >> 1) ^ -(int32_t)(value & 1);
+}
+
+static inline void rice_reset(RiceState &state) {
+    state.sum = RICE_INITIAL_SUM;
+    state.count = 1;
+}
+
+/** Smallest k with count * 2^k >= sum, i.e. about log2 of the mean residual */
+static inline int rice_parameter(const RiceState &state) {
+    int k = 0;
+    while ((state.count << k) < state.sum && k < IMU_CODEC_ESCAPE_BITS) k++;
+    return k;
+}
+
+static inline void rice_update(RiceState &state, uint32_t value) {
+    state.sum += value;
+    if (++state.count == RICE_WINDOW) {
+        state.sum >>= 1;
+        state.count >>= 1;
+    }
+}
+
+/** Fixed polynomial prediction from the previous samples, newest first. Only the first available samples
+ * of the block are used, so the first few samples fall back to lower orders.
+ */
+static inline int32_t predict(int order, const int32_t history[IMU_CODEC_MAX_ORDER], int available) {
+    switch (order < available ? order : available) {
+        case 0: return 0;
+        case 1: return history[0];
+        case 2: return 2 * history[0] - history[1];
+        default: return 3 * history[0] - 3 * history[1] + history[2];
+    }
+}
+
+static inline int16_t sample_axis(const RawImuSample &sample, int axis) {
+    return axis < 3 ? sample.accel[axis] : sample.gyro[axis - 3];
+}
+
+//MARK: Encoder
+
+ImuEncoder::ImuEncoder(uint32_t first_sample) : _first_sample(first_sample) {
+    for (int axis = 0; axis < IMU_CODEC_AXES; axis++) _orders[axis] = INITIAL_ORDER;
+    start_block();
+}
+
+void ImuEncoder::start_block() {
+    _first_sample += _count;
+    _count = 0;
+    _finished = false;
+    _bits = 0;
+    _bit_count = 0;
+    _size = IMU_CODEC_HEADER_SIZE;
+    for (int axis = 0; axis < IMU_CODEC_AXES; axis++) {
+        rice_reset(_rice[axis]);
+        for (int order = 0; order <= IMU_CODEC_MAX_ORDER; order++) _costs[axis][order] = 0;
+    }
+}
+
+void ImuEncoder::put_bits(uint32_t value, int bits) {
+    _bits = (_bits << bits) | value;
+    _bit_count += bits;
+    if (_bit_count >= 32) {
+        _bit_count -= 32;
+        uint32_t word = (uint32_t)(_bits >> _bit_count);
+        _block[_size++] = (uint8_t)(word >> 24);
+        _block[_size++] = (uint8_t)(word >> 16);
+        _block[_size++] = (uint8_t)(word >> 8);
+        _block[_size++] = (uint8_t)word;
+    }
+}
+
+void ImuEncoder::put_residual(int axis, int32_t residual) {
+    uint32_t value = zigzag(residual);
+    int k = rice_parameter(_rice[axis]);
+    uint32_t quotient = value >> k;
+    if (quotient < IMU_CODEC_ESCAPE) {
+        // quotient 1 bits and a 0, then the low k bits
+        put_bits(((1u << quotient) - 1) << 1, quotient + 1);
+        if (k) put_bits(value & ((1u << k) - 1), k);
+    } else {
+        put_bits((1u << IMU_CODEC_ESCAPE) - 1, IMU_CODEC_ESCAPE);
+        put_bits(value, IMU_CODEC_ESCAPE_BITS);
+    }
+    rice_update(_rice[axis], value);
+}
+
+int ImuEncoder::add(const RawImuSample &sample) {
+    if (_finished) start_block();
+
+    int available = _count < IMU_CODEC_MAX_ORDER ? _count : IMU_CODEC_MAX_ORDER;
+    for (int axis = 0; axis < IMU_CODEC_AXES; axis++) {
+        int32_t value = sample_axis(sample, axis);
+        int32_t *history = _history[axis];
+        // Try every order on the way, so the next block can use whichever did best here
+        for (int order = 0; order <= IMU_CODEC_MAX_ORDER; order++) {
+            _costs[axis][order] += zigzag(value - predict(order, history, available));
+        }
+        put_residual(axis, value - predict(_orders[axis], history, available));
+        history[2] = history[1];
+        history[1] = history[0];
+        history[0] = value;
+    }
+
+    _count++;
+    return _count == IMU_CODEC_BLOCK_SAMPLES ? end_block() : 0;
+}
+
+int ImuEncoder::finish() {
+    if (_finished || _count == 0) return 0;
+    return end_block();
+}
+
+int ImuEncoder::end_block() {
+    // Flush whole bytes, then the last partial one padded with 0 bits
+    while (_bit_count >= 8) {
+        _bit_count -= 8;
+        _block[_size++] = (uint8_t)(_bits >> _bit_count);
+    }
+    if (_bit_count) _block[_size++] = (uint8_t)(_bits << (8 - _bit_count));
+
+    uint16_t orders = 0;
+    for (int axis = 0; axis < IMU_CODEC_AXES; axis++) orders |= _orders[axis] << (2 * axis);
+    uint8_t *header = _block;
+    *header++ = IMU_CODEC_VERSION;
+    *header++ = (uint8_t)_count;
+    header = put_u16(header, (uint16_t)_size);
+    header = put_u32(header, _first_sample);
+    put_u16(header, orders);
+
+    // The next block uses each axis's best order from this one
+    for (int axis = 0; axis < IMU_CODEC_AXES; axis++) {
+        int best = 0;
+        for (int order = 1; order <= IMU_CODEC_MAX_ORDER; order++) {
+            if (_costs[axis][order] < _costs[axis][best]) best = order;
+        }
+        _orders[axis] = (uint8_t)best;
+    }
+    _finished = true;
+    return _size;
+}
+
+//MARK: Decoder
+
+/** MSB-first bit reader. Reading past the end yields 0 bits; check overrun() at the end. */
+class BitReader {
+public:
+    BitReader(const uint8_t *data, int size) : _data(data), _size(size) {}
+
+    uint32_t get(int bits) {
+        if (bits == 0) return 0;
+        refill();
+        _available -= bits;
+        _consumed += bits;
+        return (uint32_t)(_bits >> _available) & (uint32_t)((1ull << bits) - 1);
+    }
+
+    /** Count (and consume) leading 1 bits, up to limit. The 0 after them is consumed too. */
+    int unary(int limit) {
+        refill();
+        uint32_t top = (uint32_t)(_bits >> (_available - 32));
+        int ones = ~top ? __builtin_clz(~top) : 32;
+        int used = ones < limit ? ones + 1 : limit;
+        _available -= used;
+        _consumed += used;
+        return ones < limit ? ones : limit;
+    }
+
+    bool overrun() const { return _consumed > (long)_size * 8; }
+
+private:
+    void refill() {
+        while (_available <= 56) {
+            _bits = (_bits << 8) | (_next < _size ? _data[_next] : 0);
+            _next++;
+            _available += 8;
+        }
+    }
+
+    const uint8_t *_data;
+    int _size;
+    int _next = 0;
+    uint64_t _bits = 0;
+    int _available = 0;
+    long _consumed = 0;
+};
+
+bool imu_codec_block_info(const uint8_t *data, int size, int &count, int &block_size, uint32_t &first_sample) {
+    if (size < IMU_CODEC_HEADER_SIZE || data[0] != IMU_CODEC_VERSION) return false;
+    count = data[1];
+    block_size = get_u16(data + 2);
+    first_sample = get_u32(data + 4);
+    return count <= IMU_CODEC_BLOCK_SAMPLES && block_size >= IMU_CODEC_HEADER_SIZE;
+}
+
+int imu_codec_decode_block(const uint8_t *data, int size, RawImuSample *samples) {
+    int count, block_size;
+    uint32_t first_sample;
+    if (!imu_codec_block_info(data, size, count, block_size, first_sample) || block_size > size) return -1;
+
+    uint16_t orders = get_u16(data + 8);
+    int32_t history[IMU_CODEC_AXES][IMU_CODEC_MAX_ORDER] = {};
+    RiceState rice[IMU_CODEC_AXES];
+    for (int axis = 0; axis < IMU_CODEC_AXES; axis++) rice_reset(rice[axis]);
+
+    BitReader reader(data + IMU_CODEC_HEADER_SIZE, block_size - IMU_CODEC_HEADER_SIZE);
+    for (int i = 0; i < count; i++) {
+        int available = i < IMU_CODEC_MAX_ORDER ? i : IMU_CODEC_MAX_ORDER;
+        for (int axis = 0; axis < IMU_CODEC_AXES; axis++) {
+            int k = rice_parameter(rice[axis]);
+            int quotient = reader.unary(IMU_CODEC_ESCAPE);
+            uint32_t value = quotient < IMU_CODEC_ESCAPE ? ((uint32_t)quotient << k) | reader.get(k)
+                                                         : reader.get(IMU_CODEC_ESCAPE_BITS);
+            rice_update(rice[axis], value);
+
+            int32_t *h = history[axis];
+            int32_t sample = predict((orders >> (2 * axis)) & 3, h, available) + unzigzag(value);
+            if (sample < INT16_MIN || sample > INT16_MAX) return -1;
+            h[2] = h[1];
+            h[1] = h[0];
+            h[0] = sample;
+            if (axis < 3) samples[i].accel[axis] = (int16_t)sample;
+            else samples[i].gyro[axis - 3] = (int16_t)sample;
+        }
+    }
+    return reader.overrun() ? -1 : count;
+}
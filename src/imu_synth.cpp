@@ -0,0 +1,281 @@
+#include "imu_synth.hpp"
+
+#include "arm_math.h"
+#include "conditioning.hpp"
+
+// Oscillators drift off the unit circle slowly; pull them back this often
+#define SYNTH_RENORMALIZE_SAMPLES 256
+// Time for a motion to fade in or out
+#define SYNTH_ENVELOPE_S 0.5f
+
+SynthConfig synth_default_config() {
+    SynthConfig config;
+    config.sample_rate = POLL_RATE;
+
+    config.tremor_hz = 4.5f;
+    config.tremor_g = 0.15f;
+    config.tremor_dps = 20.f;
+    config.dyskinesia_low_hz = 5.f;
+    config.dyskinesia_high_hz = 7.f;
+    config.dyskinesia_g = 0.25f;
+    config.cadence_hz = 1.8f;
+    config.gait_g = 0.3f;
+
+    config.rest_s = 60.f;
+    config.tremor_s = 30.f;
+    config.dyskinesia_s = 20.f;
+    config.walking_s = 30.f;
+    config.freeze_s = 10.f;
+    config.p_tremor = 0.3f;
+    config.p_dyskinesia = 0.2f;
+    config.p_walking = 0.3f;
+    config.p_freeze = 0.4f;
+
+    config.orientation_change_s = 120.f;
+    config.turn_s = 1.f;
+
+    config.accel_noise_g = 0.005f;
+    config.gyro_noise_dps = 0.5f;
+    for (int axis = 0; axis < 3; axis++) {
+        config.accel_offset_g[axis] = 0.f;
+        config.accel_gain[axis] = 1.f;
+        config.gyro_bias_dps[axis] = 0.f;
+    }
+
+    config.seed = 1;
+    return config;
+}
+
+//MARK: Oscillators
+
+static void oscillator_init(SynthOscillator &osc, float hz, float sample_rate, float phase_deg) {
+    float step_deg = 360.f * hz / sample_rate;
+    arm_sin_cos_f32(phase_deg, &osc.im, &osc.re);
+    arm_sin_cos_f32(step_deg, &osc.step_im, &osc.step_re);
+}
+
+/** Advance one sample and return the sine */
+static inline float oscillator_next(SynthOscillator &osc) {
+    float re = osc.re * osc.step_re - osc.im * osc.step_im;
+    osc.im = osc.re * osc.step_im + osc.im * osc.step_re;
+    osc.re = re;
+    return osc.im;
+}
+
+/** One Newton step of 1/sqrt is plenty this close to the unit circle */
+static inline void oscillator_renormalize(SynthOscillator &osc) {
+    float k = 1.5f - 0.5f * (osc.re * osc.re + osc.im * osc.im);
+    osc.re *= k;
+    osc.im *= k;
+}
+
+/** Move toward target by at most step */
+static inline float ease(float value, float target, float step) {
+    float next = value < target ? value + step : value - step;
+    return fabsf(target - value) <= step ? target : next;
+}
+
+static inline int16_t saturate_i16(float counts) {
+    if (counts > 32767.f) return 32767;
+    if (counts < -32768.f) return -32768;
+    return (int16_t)counts;
+}
+
+//MARK: Randomness
+
+/** xorshift32 */
+inline uint32_t ImuSynth::next_random() {
+    _rng ^= _rng << 13;
+    _rng ^= _rng >> 17;
+    _rng ^= _rng << 5;
+    return _rng;
+}
+
+/** Uniform in [0, 1) */
+float ImuSynth::uniform() {
+    return (next_random() >> 8) * (1.f / 16777216.f);
+}
+
+long ImuSynth::random_duration(float mean_s) {
+    // Uniform between half and one and a half times the mean
+    return (long)(mean_s * (0.5f + uniform()) * _config.sample_rate) + 1;
+}
+
+void ImuSynth::random_direction(float dest[3]) {
+    float len;
+    do {
+        for (int axis = 0; axis < 3; axis++) dest[axis] = 2.f * uniform() - 1.f;
+        len = dest[0] * dest[0] + dest[1] * dest[1] + dest[2] * dest[2];
+    } while (len > 1.f || len < 1e-4f);
+    arm_sqrt_f32(len, &len);
+    for (int axis = 0; axis < 3; axis++) dest[axis] /= len;
+}
+
+//MARK: Schedule
+
+ImuSynth::ImuSynth(const SynthConfig &config) : _config(config), _rng(config.seed ? config.seed : 1) {
+    _env_step = 1.f / (SYNTH_ENVELOPE_S * config.sample_rate);
+    oscillator_init(_gait, config.cadence_hz, config.sample_rate, 0.f);
+    oscillator_init(_tremor, config.tremor_hz, config.sample_rate, 0.f);
+    random_direction(_tremor_dir);
+    for (int i = 0; i < 3; i++) {
+        oscillator_init(_dyskinesia[i], config.dyskinesia_low_hz, config.sample_rate, 0.f);
+        random_direction(_dyskinesia_dir[i]);
+    }
+    start_activity(REST);
+    _next_turn = random_duration(config.orientation_change_s);
+}
+
+void ImuSynth::start_activity(Activity activity) {
+    _activity = activity;
+    switch (activity) {
+        case REST:
+            _activity_left = random_duration(_config.rest_s);
+            break;
+        case TREMOR:
+            _activity_left = random_duration(_config.tremor_s);
+            // Each episode wanders a little around the configured frequency
+            oscillator_init(_tremor, _config.tremor_hz + 0.6f * (uniform() - 0.5f), _config.sample_rate, 360.f * uniform());
+            random_direction(_tremor_dir);
+            break;
+        case DYSKINESIA:
+            _activity_left = random_duration(_config.dyskinesia_s);
+            for (int i = 0; i < 3; i++) {
+                float hz = _config.dyskinesia_low_hz + (_config.dyskinesia_high_hz - _config.dyskinesia_low_hz) * uniform();
+                oscillator_init(_dyskinesia[i], hz, _config.sample_rate, 360.f * uniform());
+                random_direction(_dyskinesia_dir[i]);
+            }
+            break;
+        case WALKING:
+            _activity_left = random_duration(_config.walking_s);
+            break;
+        case FREEZE:
+            _activity_left = random_duration(_config.freeze_s);
+            break;
+    }
+}
+
+void ImuSynth::start_turn() {
+    // Rotate about a random axis by up to 90 degrees over turn_s
+    float axis[3];
+    random_direction(axis);
+    _turn_left = (long)(_config.turn_s * _config.sample_rate) + 1;
+    float rate = (PI / 2.f) * uniform() / _turn_left;
+    for (int i = 0; i < 3; i++) _turn_rate[i] = axis[i] * rate;
+    _next_turn = random_duration(_config.orientation_change_s);
+}
+
+//MARK: Generation
+
+void ImuSynth::generate(RawImuSample *samples, uint8_t *labels, long n) {
+    const float accel_counts = 1.f / ACCEL_SCALE;
+    const float gyro_counts = 1.f / GYRO_SCALE;
+    const float rad_per_sample_to_dps = _config.sample_rate * 180.f / PI;
+    // A sum of two uniforms in [0, 65536) has a standard deviation of 65536/sqrt(6)
+    const float accel_noise = _config.accel_noise_g * 2.449f / 65536.f;
+    const float gyro_noise = _config.gyro_noise_dps * 2.449f / 65536.f;
+
+    while (n > 0) {
+        // Run until the schedule or the oscillators need attention
+        long span = n;
+        if (span > _activity_left) span = _activity_left;
+        if (_turn_left > 0 && span > _turn_left) span = _turn_left;
+        if (_turn_left == 0 && span > _next_turn) span = _next_turn;
+        long to_renormalize = SYNTH_RENORMALIZE_SAMPLES - _position % SYNTH_RENORMALIZE_SAMPLES;
+        if (span > to_renormalize) span = to_renormalize;
+
+        float tremor_target = _activity == TREMOR ? 1.f : 0.f;
+        float dyskinesia_target = _activity == DYSKINESIA ? 1.f : 0.f;
+        float gait_target = _activity == WALKING ? 1.f : 0.f;
+        uint8_t label =
+            (_activity == TREMOR ? SYNTH_LABEL_TREMOR : 0) |
+            (_activity == DYSKINESIA ? SYNTH_LABEL_DYSKINESIA : 0) |
+            (_activity == WALKING ? SYNTH_LABEL_WALKING : 0) |
+            (_activity == FREEZE ? SYNTH_LABEL_FREEZE : 0);
+
+        for (long i = 0; i < span; i++) {
+            float acc[3] = { _gravity[0], _gravity[1], _gravity[2] };
+            float gyro[3] = { 0.f, 0.f, 0.f };
+            uint8_t sample_label = label;
+
+            if (_turn_left > 0) {
+                // A world-fixed vector seen from a sensor rotating at w changes by g x w
+                float turned[3];
+                cross(_gravity, _turn_rate, turned);
+                for (int axis = 0; axis < 3; axis++) {
+                    _gravity[axis] += turned[axis];
+                    gyro[axis] = _turn_rate[axis] * rad_per_sample_to_dps;
+                }
+                float k = 1.5f - 0.5f * (_gravity[0] * _gravity[0] + _gravity[1] * _gravity[1] + _gravity[2] * _gravity[2]);
+                for (int axis = 0; axis < 3; axis++) _gravity[axis] *= k;
+                _turn_left--;
+                sample_label |= SYNTH_LABEL_TURNING;
+            } else {
+                _next_turn--;
+            }
+
+            // Ease the motions in and out
+            _tremor_env = ease(_tremor_env, tremor_target, _env_step);
+            _dyskinesia_env = ease(_dyskinesia_env, dyskinesia_target, _env_step);
+            _gait_env = ease(_gait_env, gait_target, _env_step);
+
+            float tremor = oscillator_next(_tremor) * _tremor_env;
+            float step = oscillator_next(_gait);
+            float gait = (step + _gait.re * step) * _gait_env * _config.gait_g; // sin + sin(2x) / 2
+            for (int axis = 0; axis < 3; axis++) {
+                acc[axis] += tremor * _config.tremor_g * _tremor_dir[axis] + gait * _gravity[axis];
+                gyro[axis] += tremor * _config.tremor_dps * _tremor_dir[(axis + 1) % 3];
+            }
+            if (_dyskinesia_env > 0.f) {
+                for (int osc = 0; osc < 3; osc++) {
+                    float value = oscillator_next(_dyskinesia[osc]) * _dyskinesia_env * _config.dyskinesia_g;
+                    for (int axis = 0; axis < 3; axis++) acc[axis] += value * _dyskinesia_dir[osc][axis];
+                }
+            }
+
+            for (int axis = 0; axis < 3; axis++) {
+                // Triangular noise from the two halves of one random word per reading
+                uint32_t bits = next_random();
+                acc[axis] += ((int32_t)(bits & 0xFFFF) - (int32_t)(bits >> 16)) * accel_noise;
+                bits = next_random();
+                gyro[axis] += ((int32_t)(bits & 0xFFFF) - (int32_t)(bits >> 16)) * gyro_noise;
+                acc[axis] = acc[axis] * _config.accel_gain[axis] + _config.accel_offset_g[axis];
+                gyro[axis] += _config.gyro_bias_dps[axis];
+                samples->accel[axis] = saturate_i16(acc[axis] * accel_counts);
+                samples->gyro[axis] = saturate_i16(gyro[axis] * gyro_counts);
+            }
+            samples++;
+            if (labels) *labels++ = sample_label;
+        }
+
+        _position += span;
+        _activity_left -= span;
+        n -= span;
+
+        if (_position % SYNTH_RENORMALIZE_SAMPLES == 0) {
+            oscillator_renormalize(_tremor);
+            oscillator_renormalize(_gait);
+            for (int osc = 0; osc < 3; osc++) oscillator_renormalize(_dyskinesia[osc]);
+        }
+        if (_turn_left == 0 && _next_turn == 0) start_turn();
+        if (_activity_left == 0) {
+            // Freezes happen to people who were walking, and end with them walking again
+            float pick = uniform();
+            if (_activity == WALKING && pick < _config.p_freeze) {
+                start_activity(FREEZE);
+            } else if (_activity == FREEZE) {
+                start_activity(WALKING);
+            } else if (_activity != REST) {
+                start_activity(REST);
+            } else if (pick < _config.p_tremor) {
+                start_activity(TREMOR);
+            } else if (pick < _config.p_tremor + _config.p_dyskinesia) {
+                start_activity(DYSKINESIA);
+            } else if (pick < _config.p_tremor + _config.p_dyskinesia + _config.p_walking) {
+                start_activity(WALKING);
+            } else {
+                start_activity(REST);
+            }
+        }
+    }
+}
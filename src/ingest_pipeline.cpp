@@ -0,0 +1,86 @@
+#include "ingest_pipeline.hpp"
+#include "deferred_log.hpp"
+
+long IngestPipeline::run(ImuSource &source) {
+    long total = 0;
+    int count;
+    while ((count = source.read_timed(_samples, _times_us, IMU_READ_BLOCK)) > 0) {
+        _sink.samples_read(count);
+        push(_samples, _times_us, count);
+        total += count;
+    }
+    return total;
+}
+
+void IngestPipeline::push(const RawImuSample *samples, int count) {
+    for (int i = 0; i < count; i += IMU_READ_BLOCK) {
+        int n = count - i < IMU_READ_BLOCK ? count - i : IMU_READ_BLOCK;
+        for (int j = 0; j < n; j++) _times_us[j] = _untimed_samples++ * 1000000 / POLL_RATE;
+        push(&samples[i], _times_us, n);
+    }
+}
+
+void IngestPipeline::push(const RawImuSample *samples, const uint64_t *times_us, int count) {
+    RawImuSample resampled[RESAMPLER_MAX_OUTPUT];
+    for (int i = 0; i < count; i++) {
+        int emitted = _resampler.push(samples[i], times_us[i], resampled);
+        if (_resampler.take_break()) {
+            // Too long without samples to fill in: the batch so far doesn't join up with what comes next
+            condition_run();
+            _i_time = 0;
+            DLOG(LOG_IMU_GAP, _resampler.stats().breaks);
+        }
+        for (int j = 0; j < emitted; j++) {
+            const RawImuSample &sample = resampled[j];
+            _sink.resampled(sample, _sample_index++);
+            float *acc_f = _run_acc[_run], *gyro_f = _run_gyro[_run];
+            for (int axis = 0; axis < 3; axis++) {
+                acc_f[axis]  = sample.accel[axis] * ACCEL_SCALE;
+                gyro_f[axis] = sample.gyro[axis] * GYRO_SCALE;
+            }
+            _calibrator.update(acc_f, gyro_f);
+            _calibrator.apply(acc_f, gyro_f);
+            // Saving is slow (a flash write) and up to the sink; if it can't take the last calibration yet,
+            // offer this one again on the next sample
+            if (_calibrator.take_changed()) _calibration_pending = true;
+            if (_calibration_pending && _sink.calibration_changed(_calibrator.calibration())) {
+                _calibration_pending = false;
+            }
+            if (++_run == IMU_READ_BLOCK) condition_run();
+        }
+    }
+    // The rest goes into the batch now, so batches are released as soon as they fill
+    condition_run();
+}
+
+// Condition the gathered run into batches, split where a batch fills up
+void IngestPipeline::condition_run() {
+    for (int done = 0; done < _run;) {
+        if (!_filling) _filling = _sink.fill_batch();
+        int room = BATCH_SIZE_FILLED + 1 - _i_time;
+        int n = _run - done < room ? _run - done : room;
+        _conditioner.condition(&_run_acc[done], &_run_gyro[done], n, _filling, _i_time);
+
+        #ifdef TELEPLOT
+        // Print in Teleplot format (>name:value)
+        for (int t = _i_time; t < _i_time + n; t++) {
+            DLOG(LOG_TELEPLOT_ACCEL,
+                batch_accel_g(_filling, 0, t),
+                batch_accel_g(_filling, 1, t),
+                batch_accel_g(_filling, 2, t)
+            );
+        }
+        #endif
+
+        done += n;
+        _i_time += n;
+        if (_i_time > BATCH_SIZE_FILLED) {
+            // Ensure the rest of the batch is clear
+            SampleConditioner::finish_batch(_filling);
+            _i_time = 0;
+            _sink.batch_full(_filling);
+            _filling = nullptr;
+        }
+    }
+    _run = 0;
+}
@@ -0,0 +1,290 @@
+#include "lsm6dsl.hpp"
+#include "profiling.hpp"
+#include "byte_order.hpp"
+
+#include <string.h>
+
+// Address info for the IMU chip
+#define LSM6DSL_ADDR        (0x6A << 1)
+
+#define EVT_FRAME_READY (1UL << 0)
+
+//MARK: Communication utilities
+
+// Read a single-byte register
+bool Lsm6dslSource::read_reg(uint8_t reg, uint8_t &value) {
+    char r = (char)reg;
+    // Request the register, then read the response
+    if (_i2c.write(LSM6DSL_ADDR, &r, 1, true) != 0) return false;
+    if (_i2c.read(LSM6DSL_ADDR, &r, 1) != 0) return false;
+
+    value = (uint8_t)r;
+    return true;
+}
+
+// Write a single-byte register
+bool Lsm6dslSource::write_reg(uint8_t reg, uint8_t val) {
+    char buf[2] = { (char)reg, (char)val };
+    return _i2c.write(LSM6DSL_ADDR, buf, 2) == 0;
+}
+
+// Read a 16-bit signed integer from two consecutive registers
+bool Lsm6dslSource::read_int16(uint8_t reg_low, int16_t &val) {
+    uint8_t lo, hi;
+    if (!read_reg(reg_low + 0, lo)) return false;
+    if (!read_reg(reg_low + 1, hi)) return false;
+
+    val = (int16_t)((hi << 8) | lo);
+    return true;
+}
+
+// Read consecutive registers in one transfer (needs auto-increment, set in init())
+bool Lsm6dslSource::read_regs(uint8_t reg, uint8_t *dest, int size) {
+    char r = (char)reg;
+    if (_i2c.write(LSM6DSL_ADDR, &r, 1, true) != 0) return false;
+    return _i2c.read(LSM6DSL_ADDR, (char *)dest, size) == 0;
+}
+
+//MARK: Sampling
+
+#define OUTX_L_G   0x22 // Gyroscope X-axis low byte start address
+#define OUTX_L_XL  0x28 // Accelerometer X-axis low byte start address
+
+#define FIFO_STATUS1    0x3A // Unread FIFO words, low byte
+#define FIFO_STATUS3    0x3C // Which axis the next FIFO word is (0 = gyro x)
+#define FIFO_DATA_OUT_L 0x3E // FIFO output; reads past FIFO_DATA_OUT_H roll back here
+
+void Lsm6dslSource::data_ready_isr() {
+    _ready_us = _clock.elapsed_time().count();
+    _events.set(EVT_FRAME_READY);
+}
+
+bool Lsm6dslSource::read(RawImuSample &sample) {
+    #if IMU_OVERSAMPLING > 1
+    return read_block(&sample, 1) == 1;
+    #else
+    _events.wait_any(EVT_FRAME_READY);
+    PROFILE_SCOPE(PROFILE_ACQUISITION);
+    // If an interrupt was missed, the registers hold the latest sample, and this is when it was ready
+    {
+        CriticalSectionLock lock;
+        _sample_us = _ready_us;
+    }
+    // A failed transfer leaves the previous reading in place; the sensor itself never runs out of samples
+    for (int axis = 0; axis < 3; axis++) {
+        read_int16(OUTX_L_XL + 2*axis, sample.accel[axis]);
+        read_int16(OUTX_L_G  + 2*axis, sample.gyro[axis]);
+    }
+    return true;
+    #endif
+}
+
+int Lsm6dslSource::read_block(RawImuSample *samples, int max) {
+    return read_timed(samples, nullptr, max);
+}
+
+int Lsm6dslSource::read_timed(RawImuSample *samples, uint64_t *times_us, int max) {
+    #if IMU_OVERSAMPLING > 1
+    while (_decimated_next == _decimated_count) {
+        // The threshold interrupt only fires on the way up, so look at the level before waiting for it
+        if (fifo_samples() < fifo_block()) {
+            _events.wait_any(EVT_FRAME_READY);
+            continue;
+        }
+        _decimated_count = _decimated_next = 0;
+        if (!read_fifo(fifo_block())) continue;
+        #if IMU_ADAPTIVE_RATE
+        ImuRate rate = _rate_control.update(_decimated, _decimated_count);
+        if (rate != _rate) switch_rate(rate);
+        #endif
+    }
+    int n = _decimated_count - _decimated_next;
+    if (n > max) n = max;
+    memcpy(samples, &_decimated[_decimated_next], n * sizeof(RawImuSample));
+    if (times_us) memcpy(times_us, &_decimated_us[_decimated_next], n * sizeof(uint64_t));
+    _decimated_next += n;
+    return n;
+    #else
+    if (max < 1 || !read(samples[0])) return 0;
+    if (times_us) times_us[0] = _sample_us;
+    return 1;
+    #endif
+}
+
+#if IMU_OVERSAMPLING > 1
+int Lsm6dslSource::fifo_samples() {
+    uint8_t status[2];
+    if (!read_regs(FIFO_STATUS1, status, 2)) return -1;
+    _level_us = _clock.elapsed_time().count();
+    _level = ((status[1] & 0x07) << 8 | status[0]) / 6;
+    return _level;
+}
+
+int Lsm6dslSource::fifo_block() const {
+    #if IMU_ADAPTIVE_RATE
+    if (_rate == IMU_RATE_LOW) return LSM6DSL_LOW_FIFO_SAMPLES;
+    #endif
+    return LSM6DSL_FIFO_SAMPLES;
+}
+
+bool Lsm6dslSource::read_fifo(int n) {
+    PROFILE_SCOPE(PROFILE_ACQUISITION);
+    // After an overrun the oldest sample was overwritten word by word, so the next word may be mid-sample
+    uint8_t pattern[2];
+    if (!read_regs(FIFO_STATUS3, pattern, 2)) return false;
+    int position = (pattern[1] & 0x03) << 8 | pattern[0];
+    if (position != 0) read_regs(FIFO_DATA_OUT_L, _fifo[0], 2 * (6 - position));
+
+    if (!read_regs(FIFO_DATA_OUT_L, _fifo[0], n * sizeof(_fifo[0]))) return false;
+    for (int i = 0; i < n; i++) {
+        for (int axis = 0; axis < 3; axis++) {
+            _raw[i].gyro[axis] = (int16_t)get_u16(&_fifo[i][2 * axis]);
+            _raw[i].accel[axis] = (int16_t)get_u16(&_fifo[i][6 + 2 * axis]);
+        }
+    }
+    const int first = _decimated_count;
+    uint64_t input_period_us = 1000000 / (IMU_OVERSAMPLING * POLL_RATE);
+    #if IMU_ADAPTIVE_RATE
+    if (_rate == IMU_RATE_LOW) {
+        _decimated_count += _interpolator.process(_raw, n, &_decimated[first]);
+        input_period_us = 1000000 / RATE_LOW_HZ;
+    } else
+    #endif
+    {
+        _decimated_count += _decimator.process(_raw, n, &_decimated[first]);
+    }
+
+    // The newest sample in the FIFO arrived about when its level was read, and the last one of this block
+    // (level - n) samples before that. Blocks follow on from each other at POLL_RATE, eased toward that
+    // measurement (the sensor's clock isn't quite the MCU's), unless it's way off: an overrun lost samples,
+    // or the rate just changed.
+    const int outputs = _decimated_count - first;
+    const uint64_t measured_us = _level_us - (uint64_t)(_level > n ? _level - n : 0) * input_period_us;
+    const uint64_t predicted_us = _last_output_us + (uint64_t)outputs * 1000000 / POLL_RATE;
+    const int64_t error_us = (int64_t)(measured_us - predicted_us);
+    if (!_stamped || error_us > 2 * 1000000 / POLL_RATE || error_us < -2 * 1000000 / POLL_RATE) {
+        _last_output_us = measured_us;
+    } else {
+        _last_output_us = predicted_us + error_us / 8;
+    }
+    _stamped = true;
+    for (int i = 0; i < outputs; i++) {
+        _decimated_us[first + i] = _last_output_us - (uint64_t)(outputs - 1 - i) * 1000000 / POLL_RATE;
+    }
+    return true;
+}
+#endif
+
+#if IMU_OVERSAMPLING > 1 && IMU_ADAPTIVE_RATE
+void Lsm6dslSource::switch_rate(ImuRate rate) {
+    // What the FIFO gathered at the old rate while the block was being read (a few samples: the read takes
+    // about 20 ms) still goes through the old converter, as far as it fits
+    int n = fifo_samples();
+    const int room = LSM6DSL_OUTPUT_SAMPLES - _decimated_count;
+    if (_rate == IMU_RATE_LOW) {
+        if (n > room / RATE_LOW_INTERPOLATION) n = room / RATE_LOW_INTERPOLATION;
+    } else {
+        if (n > room * IMU_OVERSAMPLING) n = room * IMU_OVERSAMPLING;
+        if (n > LSM6DSL_FIFO_SAMPLES) n = LSM6DSL_FIFO_SAMPLES;
+        n -= n % IMU_OVERSAMPLING;
+    }
+    if (n > 0) read_fifo(n);
+
+    // The new converter picks up from the last output as if it had been running all along
+    _rate = rate;
+    if (_decimated_count > 0) {
+        const RawImuSample &last = _decimated[_decimated_count - 1];
+        if (rate == IMU_RATE_LOW) {
+            _interpolator.prime(last);
+        } else {
+            _decimator.prime(last);
+        }
+    }
+    configure();
+}
+#endif
+
+//MARK: Setup
+
+#define WHO_AM_I  0x0F // Device identification register
+
+#define DRDY_PULSE_CFG  0x0B // Data-ready pulse configuration
+#define INT1_CTRL       0x0D // INT1 pin routing control
+#define CTRL1_XL        0x10 // Accelerometer control register
+#define CTRL2_G         0x11 // Gyroscope control register
+#define CTRL3_C         0x12 // Common control register
+#define FIFO_CTRL1      0x06 // FIFO threshold in words, low byte
+#define FIFO_CTRL2      0x07 // FIFO threshold, high bits
+#define FIFO_CTRL3      0x08 // FIFO decimation of gyro and accelerometer
+#define FIFO_CTRL5      0x0A // FIFO rate and mode
+
+// Output data rate codes for CTRL1_XL, CTRL2_G and FIFO_CTRL5: the sensor runs at IMU_OVERSAMPLING x POLL_RATE
+#if IMU_OVERSAMPLING == 8
+#define ODR_CODE 0x6 // 416 Hz
+#elif IMU_OVERSAMPLING == 4
+#define ODR_CODE 0x5 // 208 Hz
+#elif IMU_OVERSAMPLING == 2
+#define ODR_CODE 0x4 // 104 Hz
+#else
+#define ODR_CODE 0x3 // 52 Hz
+#endif
+// At the low adaptive rate
+#define ODR_CODE_LOW 0x2 // 26 Hz
+
+#define STATUS_REG 0x1E // Status register (data ready flags)
+
+#if IMU_OVERSAMPLING > 1
+void Lsm6dslSource::configure() {
+    uint8_t odr = ODR_CODE;
+    #if IMU_ADAPTIVE_RATE
+    if (_rate == IMU_RATE_LOW) odr = ODR_CODE_LOW;
+    #endif
+    // Both sensors into the FIFO undecimated, continuous (the oldest sample goes when it's full),
+    // interrupt once a converter block is waiting
+    const int threshold_words = fifo_block() * 6;
+    write_reg(FIFO_CTRL5, 0x00); // Bypass, which also empties it
+    write_reg(CTRL2_G,   odr << 4); // Gyroscope:     ODR, ±250 dps, low pass: [ODR / 2]
+    write_reg(CTRL1_XL,  odr << 4); // Accelerometer: ODR, ±2 g, low pass: [ODR / 2]
+    write_reg(FIFO_CTRL1, threshold_words & 0xFF);
+    write_reg(FIFO_CTRL2, (threshold_words >> 8) & 0x07);
+    write_reg(FIFO_CTRL3, 0x09); // Gyroscope and accelerometer, no decimation
+    write_reg(FIFO_CTRL5, (odr << 3) | 0x06); // FIFO at the ODR, continuous mode
+}
+#endif
+
+bool Lsm6dslSource::init() {
+    _i2c.frequency(400000);
+    _clock.start();
+
+    // Verify that the sensor is present
+    {
+        uint8_t who;
+        if (!read_reg(WHO_AM_I, who) || who != 0x6A) return false;
+    }
+    // polling_rate / 4 = 13Hz
+    
+    write_reg(CTRL3_C,   0x44); // Block updates, auto-increment address
+    #if IMU_OVERSAMPLING > 1
+    configure();
+    write_reg(INT1_CTRL, 0x08); // Route FIFO threshold to INT1 pin
+    #else
+    write_reg(CTRL2_G,   ODR_CODE << 4); // Gyroscope:     ODR, ±250 dps, low pass: [ODR / 2]
+    write_reg(CTRL1_XL,  ODR_CODE << 4); // Accelerometer: ODR, ±2 g, low pass: [ODR / 2]
+    write_reg(INT1_CTRL, 0x03); // Route data-ready signal to INT1 pin
+    write_reg(DRDY_PULSE_CFG, 0x80); // Enable pulsed data-ready mode (50μs pulses)
+    #endif
+
+    // Wait for sensor to stabilize
+    ThisThread::sleep_for(100ms);
+    uint8_t dummy;
+    read_reg(STATUS_REG, dummy);
+    // Clear old data by reading all output registers
+    int16_t temp;
+    for (int i = 0; i < 6; i++) {
+        read_int16(OUTX_L_XL + 2*i, temp);
+    }
+
+    _int1.rise(callback(this, &Lsm6dslSource::data_ready_isr));
+
+    return true;
+}
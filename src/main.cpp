@@ -1,21 +1,163 @@
 #include <mbed.h>
+#if COMPONENT_FLASHIAP
+#include "FlashIAPBlockDevice.h"
+#include "TDBStore.h"
+#endif
 
 #include "globals.hpp"
 #include "ingest.hpp"
+#include "lsm6dsl.hpp"
 #include "conditioning.hpp"
+#include "detectors.hpp"
 #include "output_handler.hpp"
+#include "profiling.hpp"
+#include "deferred_log.hpp"
+#include "telemetry.hpp"
+#include "stream_packer.hpp"
+#include "symptom_log.hpp"
+#include "episodes.hpp"
+#include "symptom_stats.hpp"
+#include "calibration.hpp"
 
 // Output handler - works with or without BLE
 #if USE_BLE_OUTPUT
-static events::EventQueue ble_event_queue(16 * EVENTS_EVENT_SIZE);
+// Room for the stack's own events plus the telemetry, episode and statistics updates posted to the BLE thread
+static events::EventQueue ble_event_queue(32 * EVENTS_EVENT_SIZE);
 static Thread ble_thread;
 static OutputHandler output_handler(ble_event_queue);
 #else
 static OutputHandler output_handler;
 #endif
 
+static Lsm6dslSource imu;
+static PipelineAnalyzer analyzer;
+#if ANALYSIS_PRECISION == ANALYSIS_Q15
+// The Q15 analyzer's spectra widened back to float, for the stream packer and episode extractor
+static float accelerometer_spectra[3][BATCH_SIZE / 2 + 1], gyroscope_spectra[3][BATCH_SIZE / 2 + 1];
+#elif ANALYSIS_PRECISION == ANALYSIS_F16
+// Kept in float16; the stream packer and episode extractor widen them as they go
+static half_t (&accelerometer_spectra)[3][BATCH_SIZE / 2 + 1] = analyzer.accelerometer_frequency_magnitudes;
+static half_t (&gyroscope_spectra)[3][BATCH_SIZE / 2 + 1] = analyzer.gyroscope_frequency_magnitudes;
+#else
+static float (&accelerometer_spectra)[3][BATCH_SIZE / 2 + 1] = analyzer.accelerometer_frequency_magnitudes;
+static float (&gyroscope_spectra)[3][BATCH_SIZE / 2 + 1] = analyzer.gyroscope_frequency_magnitudes;
+#endif
+// Every window, kept in the external flash (QSPI on the B-L475E-IOT01A) for download over BLE later
+static SymptomLog history(BlockDevice::get_default_instance());
+// Sensor calibration is kept in internal flash where the target has FLASHIAP (see open_calibration_store());
+// elsewhere every boot starts from the identity calibration
+#if COMPONENT_FLASHIAP && defined(MBED_ROM_START) && defined(MBED_ROM_SIZE)
+#define CALIBRATION_STORE 1
+#else
+#define CALIBRATION_STORE 0
+#endif
+static const EpisodeConfig episode_config = episode_default_config();
+static EpisodeExtractor episodes(episode_config); // Publisher thread only
+// Time above threshold counts from the same intensities that start an episode
+static const float stats_thresholds[STATS_SYMPTOMS] = {
+  episode_config.rules[EPISODE_TREMOR].onset,
+  episode_config.rules[EPISODE_DYSKINESIA].onset,
+  episode_config.rules[EPISODE_FOG].onset,
+};
+static SymptomStats symptom_stats(stats_thresholds); // Publisher thread only
+
+// Results of one batch, on their way from analysis to the publisher
+typedef struct {
+  SymptomIntensities intensities;
+  float total_energy;
+  float dominant_hz[EPISODE_KIND_COUNT]; // Per symptom band, for the episode extractor
+  uint32_t sequence;
+  uint64_t release_us;
+  DeadlineStats deadline_stats; // Snapshot taken right after this batch completed
+  uint32_t dropped_reports;     // Reports thrown away so far because the publisher was behind
+} SymptomReport;
+
+// Room for a few seconds of results, so a slow BLE link or serial port doesn't hold up analysis
+#define PUBLISH_QUEUE_DEPTH 8
+static Mail<SymptomReport, PUBLISH_QUEUE_DEPTH> publish_queue;
+static uint32_t dropped_reports; // Only touched by the analysis thread
+
+// Second stage: turns batches into symptom intensities, then hands them to the publisher without waiting
+static void analysis_task() {
+  while (1) {
+    IngestBatch *batch = wait_batch();
+    SymptomReport *report;
+    {
+      PROFILE_SCOPE(PROFILE_BATCH);
+      // Calculate Parkinson's symptom intensities
+      SymptomIntensities intensities = analyzer.analyze(batch->imu.accelerometer, batch->imu.gyroscope);
+      uint32_t sequence = batch->sequence;
+      uint64_t release_us = batch->release_us;
+      deadline_monitor.complete(release_us);
+      free_batch(batch);
+      #if ANALYSIS_PRECISION == ANALYSIS_Q15
+      analyzer.widen_spectra(accelerometer_spectra, gyroscope_spectra);
+      #endif
+
+      if (stream_packer.mode() == STREAM_SPECTRAL) {
+        stream_packer.add_spectra(sequence, accelerometer_spectra, gyroscope_spectra);
+      }
+
+      report = publish_queue.try_alloc();
+      if (!report) {
+        dropped_reports++;
+        continue;
+      }
+      report->intensities = intensities;
+      report->total_energy = analyzer.total_energy;
+      episode_window_frequencies(episode_config, accelerometer_spectra, report->dominant_hz);
+      report->sequence = sequence;
+      report->release_us = release_us;
+      report->deadline_stats = deadline_monitor.stats();
+      report->dropped_reports = dropped_reports;
+    }
+    publish_queue.put(report);
+  }
+}
+
+#if CALIBRATION_STORE
+/** Open the calibration store: the internal flash from the end of the firmware's ROM region (mbed_app.json
+ * shrinks mbed_rom_size to leave room) to the end of flash. The region has to start on a sector boundary
+ * and span at least two sectors, for TDBStore to swap between.
+ * @param err Set to why there's no store
+ * @return The store, or null
+ */
+static mbed::KVStore *open_calibration_store(int &err) {
+  const uint32_t address = MBED_ROM_START + MBED_ROM_SIZE;
+  FlashIAP flash;
+  err = flash.init();
+  if (err) return nullptr;
+  uint32_t flash_end = flash.get_flash_start() + flash.get_flash_size();
+  uint32_t sector = address < flash_end ? flash.get_sector_size(address) : 0;
+  flash.deinit();
+  if (sector == 0 || address % sector != 0 || flash_end - address < 2 * sector) {
+    err = MBED_ERROR_INVALID_SIZE;
+    return nullptr;
+  }
+  static FlashIAPBlockDevice block_device(address, flash_end - address);
+  static TDBStore store(&block_device);
+  err = store.init();
+  return err == MBED_SUCCESS ? &store : nullptr;
+}
+#endif
+
+static void write_serial(const char *text, int length) {
+  fwrite(text, 1, length, stdout);
+}
+
+// Lowest stage: formats and prints whatever the others logged, when nobody else needs the CPU
+static void log_task() {
+  while (1) {
+    deferred_log.drain(write_serial);
+    ThisThread::sleep_for(20ms);
+  }
+}
+
 int main() {
   static BufferedSerial pc(USBTX, USBRX, 115200);
+  #ifdef PROFILE
+  profile_init();
+  #endif
 
   // Initialize output (BLE or Serial)
 #if USE_BLE_OUTPUT
@@ -23,56 +165,138 @@ int main() {
 #endif
   output_handler.init();
 
+  int history_error = history.mount();
+  if (history_error == 0) {
+    output_handler.setHistory(&history);
+  }
   #ifdef DEBUG
-  if (!init_imu()) {
+  if (history_error) printf("Symptom history unavailable (error %d)\n", history_error);
+  else printf("Symptom history: pages %lu to %lu, boot %u\n",
+    (unsigned long)history.oldest_page(), (unsigned long)history.next_page(), history.boot());
+  #endif
+
+  // Start from the last calibration, so orientation is right from the first sample
+  Calibration calibration = calibration_identity();
+  int calibration_error = MBED_ERROR_UNSUPPORTED;
+  mbed::KVStore *calibration_store = nullptr;
+  #if CALIBRATION_STORE
+  calibration_store = open_calibration_store(calibration_error);
+  #endif
+  if (calibration_store && calibration_load(calibration_store, calibration) == MBED_SUCCESS) {
+    #ifdef DEBUG
+    printf("Calibration: gyro bias %.2f %.2f %.2f dps, flags %u\n",
+      calibration.gyro_bias[0], calibration.gyro_bias[1], calibration.gyro_bias[2], calibration.flags);
+    #endif
+  }
+  set_calibration(calibration);
+  #ifdef DEBUG
+  if (!calibration_store) printf("Calibration store unavailable (error %d)\n", calibration_error);
+  #endif
+
+  #ifdef DEBUG
+  if (!imu.init()) {
     printf("IMU not found; aborting!");
     while(1) { ThisThread::sleep_for(1s); }
   }
   #else
-  init_imu();
+  imu.init();
   #endif
 
-  Thread acq_thread;
-  acq_thread.start(acquisition_task);
-
-  // Holds an array of frequencies per axis [0, 26/128, ... , 26]Hz
-  float accelerometer_frequency_magnitudes[3][BATCH_SIZE / 2 + 1], gyroscope_frequency_magnitudes[3][BATCH_SIZE / 2 + 1];
   init_fft();
 
-  ingest_batch_mutex.lock();
+  // Acquisition must never miss a sample, and analysis has to keep up with acquisition;
+  // publishing gets whatever time is left over, and printing the log whatever is left after that
+  Thread acq_thread(osPriorityRealtime);
+  Thread analysis_thread(osPriorityAboveNormal);
+  Thread log_thread(osPriorityLow);
+  acq_thread.start(callback(acquisition_task, static_cast<ImuSource *>(&imu)));
+  analysis_thread.start(analysis_task);
+  log_thread.start(log_task);
+
+  // Third stage: this thread publishes the results
   while(1) {
-    ingest_batch_condition.wait(); // Wait for a new batch of IMU data
-    IMUBatch *imu_data = get_batch();
-    // Respond to the batch of data
+    SymptomReport *report = publish_queue.try_get_for(Kernel::wait_for_u32_forever);
 
-    for (int axis = 0; axis < 3; axis++) {
-      do_fft(imu_data->accelerometer[axis], accelerometer_frequency_magnitudes[axis]);
-      do_fft(imu_data->gyroscope[axis], gyroscope_frequency_magnitudes[axis]);
+    #ifdef PROFILE
+    // Serial commands: 'p' prints the profile, 'r' starts it over
+    while (pc.readable()) {
+      char command;
+      if (pc.read(&command, 1) != 1) break;
+      if (command == 'p') profile_dump();
+      if (command == 'r') profile_reset();
     }
+    #endif
 
-    float total_energy = calc_total_energy(accelerometer_frequency_magnitudes);
-
-    // Calculate Parkinson's symptom intensities
-    float tremor_intensity = detect_tremor(accelerometer_frequency_magnitudes) / total_energy;
-    //tremor_intensity = tremor_intensity / (1.0 + abs(tremor_intensity));
-    
-    float dyskinesia_intensity = detect_dyskinesia(accelerometer_frequency_magnitudes) / total_energy;
-    // FOG detection requires both time and frequency domain
-    float fog_intensity = detect_freezing(imu_data->accelerometer, accelerometer_frequency_magnitudes);
+    #ifdef DEBUG
+    static uint32_t last_dropped_reports, last_dropped_batches;
+    if (report->dropped_reports != last_dropped_reports || dropped_batches() != last_dropped_batches) {
+      last_dropped_reports = report->dropped_reports;
+      last_dropped_batches = dropped_batches();
+      DLOG(LOG_PIPELINE_BEHIND, (unsigned long)last_dropped_batches, (unsigned long)last_dropped_reports);
+    }
+    #endif
 
+    float tremor_intensity = report->intensities.tremor;
+    float dyskinesia_intensity = report->intensities.dyskinesia;
+    float fog_intensity = report->intensities.fog;
 
     // Send data via BLE and/or Serial
-    output_handler.sendTremor(tremor_intensity);
-    output_handler.sendDyskinesia(dyskinesia_intensity);
-    output_handler.sendFreezingGait(fog_intensity);
+    {
+      PROFILE_SCOPE(PROFILE_OUTPUT);
+      TelemetryFrame frame;
+      frame.sequence = 0; // Numbered by whoever sends it
+      frame.timestamp_ms = (uint32_t)((report->release_us - BATCH_PERIOD_US) / 1000); // Window start
+      frame.tremor = tremor_intensity;
+      frame.dyskinesia = dyskinesia_intensity;
+      frame.fog = fog_intensity;
+      frame.extras_mask = (1 << TELEMETRY_EXTRA_ENERGY) | (1 << TELEMETRY_EXTRA_SLACK_MS) | (1 << TELEMETRY_EXTRA_DROPPED_SAMPLES);
+      frame.extras[TELEMETRY_EXTRA_ENERGY] = report->total_energy;
+      frame.extras[TELEMETRY_EXTRA_SLACK_MS] = report->deadline_stats.window_min_slack_us / 1000.f;
+      frame.extras[TELEMETRY_EXTRA_DROPPED_SAMPLES] = (float)report->deadline_stats.dropped_samples;
+      output_handler.sendTelemetry(frame);
+
+      EpisodeEvent events[EPISODE_MAX_EVENTS];
+      int event_count = episodes.update(frame.timestamp_ms, report->intensities, report->dominant_hz, events);
+      for (int i = 0; i < event_count; i++) output_handler.sendEpisode(events[i]);
+
+      if (output_handler.takeStatisticsReset()) symptom_stats.reset(frame.timestamp_ms);
+      symptom_stats.update(report->intensities, BATCH_PERIOD_US / 1000);
+    }
+
+    if (history_error == 0) {
+      static uint32_t last_sequence, last_misses, last_dropped_samples;
+      SymptomLogEntry entry;
+      entry.time_ms = (uint32_t)((report->release_us - BATCH_PERIOD_US) / 1000);
+      entry.tremor = tremor_intensity;
+      entry.dyskinesia = dyskinesia_intensity;
+      entry.fog = fog_intensity;
+      entry.flags = 0;
+      if (report->deadline_stats.misses != last_misses) entry.flags |= LOG_FLAG_DEADLINE_MISS;
+      if (report->deadline_stats.dropped_samples != last_dropped_samples) entry.flags |= LOG_FLAG_DROPPED_SAMPLES;
+      if (report->sequence != last_sequence + 1 && report->sequence != 0) entry.flags |= LOG_FLAG_GAP;
+      last_sequence = report->sequence;
+      last_misses = report->deadline_stats.misses;
+      last_dropped_samples = report->deadline_stats.dropped_samples;
+      history.append(entry);
+    }
+
+    if (report->deadline_stats.batches % DEADLINE_REPORT_BATCHES == 0) {
+      output_handler.sendDeadlineStats(report->deadline_stats);
+      output_handler.sendStatistics(symptom_stats);
+
+      Calibration learned;
+      if (take_calibration(learned) && calibration_store) calibration_save(calibration_store, learned);
+    }
 
     #ifdef TELEPLOT
       // Print in Teleplot format (>name:value)
-      printf(">tremor_intensity:%.3f\n>dyskinesia_intensity:%.3f\n>fog_intensity:%.3f\n",
+      DLOG(LOG_TELEPLOT_INTENSITIES,
         tremor_intensity, dyskinesia_intensity, fog_intensity
       );
       #endif
+
+    publish_queue.free(report);
   }
 
   return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,59 @@
+#include "notify_policy.hpp"
+#include "byte_order.hpp"
+
+#include <math.h>
+
+NotifyPolicyConfig notify_default_config() {
+    NotifyPolicyConfig config;
+    for (int field = 0; field < NOTIFY_FIELD_COUNT; field++) {
+        config.rules[field].deadband = NOTIFY_DEFAULT_DEADBAND;
+        config.rules[field].min_interval_ms = NOTIFY_DEFAULT_MIN_INTERVAL_MS;
+        config.rules[field].max_staleness_ms = NOTIFY_DEFAULT_MAX_STALENESS_MS;
+    }
+    config.rules[2].deadband = NOTIFY_DEFAULT_FOG_DEADBAND;
+    return config;
+}
+
+int notify_config_encode(const NotifyPolicyConfig &config, uint8_t dest[NOTIFY_POLICY_SIZE]) {
+    uint8_t *p = dest;
+    for (int field = 0; field < NOTIFY_FIELD_COUNT; field++) {
+        p = put_f32(p, config.rules[field].deadband);
+        p = put_u32(p, config.rules[field].min_interval_ms);
+        p = put_u32(p, config.rules[field].max_staleness_ms);
+    }
+    return (int)(p - dest);
+}
+
+bool notify_config_decode(const uint8_t *data, int size, NotifyPolicyConfig &config) {
+    if (size < NOTIFY_POLICY_SIZE) return false;
+    NotifyPolicyConfig decoded;
+    for (int field = 0; field < NOTIFY_FIELD_COUNT; field++) {
+        const uint8_t *p = data + 12 * field;
+        decoded.rules[field].deadband = get_f32(p);
+        decoded.rules[field].min_interval_ms = get_u32(p + 4);
+        decoded.rules[field].max_staleness_ms = get_u32(p + 8);
+        // NaN would never compare as a change
+        if (!(decoded.rules[field].deadband >= 0.f)) return false;
+    }
+    config = decoded;
+    return true;
+}
+
+bool NotifyPolicy::should_send(const TelemetryFrame &frame) {
+    const float values[NOTIFY_FIELD_COUNT] = { frame.tremor, frame.dyskinesia, frame.fog };
+    uint32_t since_sent = frame.timestamp_ms - _sent_ms;
+
+    bool send = !_have_sent;
+    for (int field = 0; field < NOTIFY_FIELD_COUNT && !send; field++) {
+        const NotifyRule &rule = _config.rules[field];
+        bool changed = !(fabsf(values[field] - _sent_value[field]) <= rule.deadband); // NaN counts as a change
+        if (changed && since_sent >= rule.min_interval_ms) send = true;
+        if (rule.max_staleness_ms > 0 && since_sent >= rule.max_staleness_ms) send = true;
+    }
+    if (!send) return false;
+
+    for (int field = 0; field < NOTIFY_FIELD_COUNT; field++) _sent_value[field] = values[field];
+    _sent_ms = frame.timestamp_ms;
+    _have_sent = true;
+    return true;
+}
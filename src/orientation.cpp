@@ -0,0 +1,208 @@
+#include "orientation.hpp"
+#include "conditioning.hpp"
+
+#include "arm_math.h"
+
+// MARK: Math functions
+
+/** Produce rotational derivatives that move the quaternion's local axis towards the given vector.
+ * Assumes acceleration and rot are both normalized.
+ */
+void accel_right(float accel_norm[3], float rot[4], float dest[3]) {
+    // Get the global down vector in local space
+    float local_z[3] = {
+        2.f * (rot[3] * rot[1] + rot[0] * -rot[2]),
+        2.f * (rot[3] * rot[2] + rot[0] * rot[1]),
+        2.f * rot[3] * rot[3] + rot[0] * rot[0] - (rot[1] * rot[1] + rot[2] * rot[2] + rot[3] * rot[3])
+    };
+    // Generate a local-space rotational derivative that brings the two closer
+    // Since ||cross(a, b)|| = sin(theta) and sin(theta) < theta let's just use that!
+    cross(accel_norm, local_z, dest);
+}
+
+/** Approximately apply a rotational derivative to a quaternion. Dest may be rot.
+ * @cite https://www.st.com/resource/en/design_tip/dt0060-exploiting-the-gyroscope-to-update-tilt-measurement-and-ecompass-stmicroelectronics.pdf
+ * @param deriv Rotational derivative
+*/
+void rotate_quaternion(float deriv[3], float rot[4], float dest[4]) {
+    float rot_prime[4] = {
+        rot[0] + (- rot[1] * deriv[0] - rot[2] * deriv[1] - rot[3] * deriv[2]) / 2.f,
+        rot[1] + (+ rot[0] * deriv[0] - rot[3] * deriv[1] + rot[2] * deriv[2]) / 2.f,
+        rot[2] + (+ rot[3] * deriv[0] + rot[0] * deriv[1] - rot[1] * deriv[2]) / 2.f,
+        rot[3] + (- rot[2] * deriv[0] + rot[1] * deriv[1] + rot[0] * deriv[2]) / 2.f
+    };
+    float len;
+    arm_sqrt_f32(rot_prime[0] * rot_prime[0] + rot_prime[1] * rot_prime[1] + rot_prime[2] * rot_prime[2] + rot_prime[3] * rot_prime[3], &len);
+    for (int axis = 0; axis < 4; axis++) {
+        dest[axis] = rot_prime[axis] / len;
+    }
+}
+
+
+/** Rotate a vector using a quaternion. Dest may be vec.
+ *  @cite: https://gamedev.stackexchange.com/questions/28395/rotating-vector3-by-a-quaternion
+ */
+void rotate_vector(const float vec[3], float rot[4], float dest[3]) {
+    float u_fac, v_fac, ortho_fac, rot_ortho[3];
+
+    u_fac = 2.f * (vec[0] * rot[1] + vec[1] * rot[2] + vec[2] * rot[3]);
+
+    v_fac = rot[0] * rot[0] - (rot[1] * rot[1] + rot[2] * rot[2] + rot[3] * rot[3]);
+
+    ortho_fac = 2.f * rot[0];
+    cross(&rot[1], vec, rot_ortho);
+
+    for (int axis = 0; axis < 3; axis++) {
+        dest[axis] = (
+            u_fac * rot[axis + 1]
+            + v_fac * vec[axis]
+            + ortho_fac * rot_ortho[axis]
+        );
+    }
+}
+
+// One quaternion per vector; rotates by the t = 2 (u x v) form, then takes gravity off z
+static inline void rotate_one(const float rot[4], float vx, float vy, float vz, float gravity, float dest[3]) {
+    float w = rot[0], x = rot[1], y = rot[2], z = rot[3];
+    float tx = 2.f * (y * vz - z * vy);
+    float ty = 2.f * (z * vx - x * vz);
+    float tz = 2.f * (x * vy - y * vx);
+    dest[0] = vx + w * tx + (y * tz - z * ty);
+    dest[1] = vy + w * ty + (z * tx - x * tz);
+    dest[2] = vz + w * tz + (x * ty - y * tx) - gravity;
+}
+
+void rotate_vectors(const float (*rots)[4], const float (*vecs)[3], float (*dest)[3], int n) {
+    rotate_minus_gravity(rots, vecs, 0.f, dest, n);
+}
+
+void rotate_vectors_soa(const float (*rots)[4], const float *x, const float *y, const float *z,
+    float *dest_x, float *dest_y, float *dest_z, int n) {
+    rotate_minus_gravity_soa(rots, x, y, z, 0.f, dest_x, dest_y, dest_z, n);
+}
+
+void rotate_minus_gravity(const float (*rots)[4], const float (*accel)[3], float gravity, float (*dest)[3], int n) {
+    for (int i = 0; i < n; i++) {
+        rotate_one(rots[i], accel[i][0], accel[i][1], accel[i][2], gravity, dest[i]);
+    }
+}
+
+void rotate_minus_gravity_soa(const float (*rots)[4], const float *x, const float *y, const float *z, float gravity,
+    float *dest_x, float *dest_y, float *dest_z, int n) {
+    for (int i = 0; i < n; i++) {
+        float out[3];
+        rotate_one(rots[i], x[i], y[i], z[i], gravity, out);
+        dest_x[i] = out[0];
+        dest_y[i] = out[1];
+        dest_z[i] = out[2];
+    }
+}
+
+void tilt_quaternion(const float accel[3], float rot[4]) {
+    float len;
+    arm_sqrt_f32(accel[0] * accel[0] + accel[1] * accel[1] + accel[2] * accel[2], &len);
+    if (len == 0.f) {
+        rot[0] = 1;
+        rot[1] = rot[2] = rot[3] = 0;
+        return;
+    }
+    // Half-way quaternion [1 + a.z, a x z] for unit a, normalized; scaled by len to skip the divisions
+    float w = len + accel[2];
+    if (w < 1e-6f * len) {
+        // Upside down: any half turn about a horizontal axis will do
+        rot[0] = 0;
+        rot[1] = 1;
+        rot[2] = rot[3] = 0;
+        return;
+    }
+    float norm;
+    arm_sqrt_f32(w * w + accel[0] * accel[0] + accel[1] * accel[1], &norm);
+    rot[0] = w / norm;
+    rot[1] = accel[1] / norm;
+    rot[2] = -accel[0] / norm;
+    rot[3] = 0;
+}
+
+void update_rot(float accel[3], float gyro[3], float rot[4]) {
+    float
+        accel_len, accel_norm[3], righting_deriv[3],
+        rot_deriv[3] = {
+            gyro[0] * (PI / (180 * POLL_RATE)),
+            gyro[1] * (PI / (180 * POLL_RATE)),
+            gyro[2] * (PI / (180 * POLL_RATE))};
+
+    arm_sqrt_f32(accel[0] * accel[0] + accel[1] * accel[1] + accel[2] * accel[2], &accel_len);
+    for (int axis = 0; axis < 3; axis++) { accel_norm[axis] = accel[axis] / accel_len; }
+
+    accel_right(accel_norm, rot, righting_deriv);
+
+    // Perform less correction when we know we're moving
+    float accel_confidence = (accel_len - 1);
+    accel_confidence = GRAVITY_UPDATE_RATE / (1 + MOTION_SENSITIVITY * accel_confidence * accel_confidence);
+    for (int axis = 0; axis < 3; axis++) {
+        rot_deriv[axis] += righting_deriv[axis] * accel_confidence;
+    }
+
+    rotate_quaternion(rot_deriv, rot, rot);
+}
+
+// MARK: Mahony filter
+
+void MahonyFilter::reset() {
+    _rot[0] = 1;
+    _rot[1] = _rot[2] = _rot[3] = 0;
+    _bias[0] = _bias[1] = _bias[2] = 0;
+}
+
+void MahonyFilter::set_orientation(const float rot[4]) {
+    for (int i = 0; i < 4; i++) _rot[i] = rot[i];
+}
+
+void MahonyFilter::gyro_bias(float dest[3]) const {
+    for (int axis = 0; axis < 3; axis++) dest[axis] = _bias[axis] * (180.f / PI);
+}
+
+void MahonyFilter::update(const float (*accel)[3], const float (*gyro)[3], int n, float (*rots)[4]) {
+    const float dt = 1.f / POLL_RATE;
+    float *q = _rot;
+    for (int i = 0; i < n; i++) {
+        const float *a = accel[i];
+        // Global down in local space: the bottom row of the rotation matrix
+        float down[3] = {
+            2.f * (q[1] * q[3] - q[0] * q[2]),
+            2.f * (q[2] * q[3] + q[0] * q[1]),
+            q[0] * q[0] - q[1] * q[1] - q[2] * q[2] + q[3] * q[3]
+        };
+        float len_sq = a[0] * a[0] + a[1] * a[1] + a[2] * a[2], len;
+        arm_sqrt_f32(len_sq, &len);
+
+        // Tilt error, trusted less the further the acceleration is from 1 g (as in update_rot())
+        float error[3];
+        cross(a, down, error);
+        float confidence = (len - 1.f);
+        confidence = 1.f / ((1.f + MOTION_SENSITIVITY * confidence * confidence) * (len > 0.f ? len : 1.f));
+        float omega[4] = { 0.f, 0.f, 0.f, 0.f };
+        for (int axis = 0; axis < 3; axis++) {
+            float e = error[axis] * confidence;
+            float bias = _bias[axis] - MAHONY_KI * e * dt;
+            _bias[axis] = bias > MAHONY_MAX_BIAS ? MAHONY_MAX_BIAS : bias < -MAHONY_MAX_BIAS ? -MAHONY_MAX_BIAS : bias;
+            omega[axis + 1] = (gyro[i][axis] * (PI / 180.f) - _bias[axis] + MAHONY_KP * e) * (dt / 2.f);
+        }
+
+        // q += q * (0, omega) dt / 2
+        float dq[4] = {
+            - q[1] * omega[1] - q[2] * omega[2] - q[3] * omega[3],
+            + q[0] * omega[1] + q[2] * omega[3] - q[3] * omega[2],
+            + q[0] * omega[2] - q[1] * omega[3] + q[3] * omega[1],
+            + q[0] * omega[3] + q[1] * omega[2] - q[2] * omega[1]
+        };
+        for (int k = 0; k < 4; k++) q[k] += dq[k];
+        // The step barely changes the length, so one Newton step of 1/sqrt renormalizes it; no sqrt, no division
+        float k = 1.5f - 0.5f * (q[0] * q[0] + q[1] * q[1] + q[2] * q[2] + q[3] * q[3]);
+        for (int j = 0; j < 4; j++) q[j] *= k;
+
+        if (rots) {
+            for (int j = 0; j < 4; j++) rots[i][j] = q[j];
+        }
+    }
+}
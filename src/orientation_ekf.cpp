@@ -0,0 +1,136 @@
+#include "orientation_ekf.hpp"
+#include "conditioning.hpp"
+#include "small_matrix.hpp"
+
+#include <string.h>
+
+/** Multiply a quaternion by the small rotation [1, v / 2] on its right and renormalize, in place */
+static void rotate_by_small(float q[4], const float v[3]) {
+    float h[3] = { v[0] / 2.f, v[1] / 2.f, v[2] / 2.f };
+    float r[4] = {
+        q[0] - q[1] * h[0] - q[2] * h[1] - q[3] * h[2],
+        q[1] + q[0] * h[0] + q[2] * h[2] - q[3] * h[1],
+        q[2] + q[0] * h[1] - q[1] * h[2] + q[3] * h[0],
+        q[3] + q[0] * h[2] + q[1] * h[1] - q[2] * h[0]
+    };
+    float len_sq = r[0] * r[0] + r[1] * r[1] + r[2] * r[2] + r[3] * r[3];
+    float inverse = 1.f / sqrtf(len_sq);
+    for (int i = 0; i < 4; i++) q[i] = r[i] * inverse;
+}
+
+void OrientationEkf::reset() {
+    _rot[0] = 1;
+    _rot[1] = _rot[2] = _rot[3] = 0;
+    _bias[0] = _bias[1] = _bias[2] = 0;
+    memset(_p, 0, sizeof(_p));
+    for (int i = 0; i < 3; i++) {
+        _p[i * 6 + i] = EKF_INITIAL_TILT * EKF_INITIAL_TILT;
+        _p[(i + 3) * 6 + i + 3] = EKF_INITIAL_BIAS * EKF_INITIAL_BIAS;
+    }
+}
+
+void OrientationEkf::set_orientation(const float rot[4]) {
+    for (int i = 0; i < 4; i++) _rot[i] = rot[i];
+}
+
+void OrientationEkf::gyro_bias(float dest[3]) const {
+    for (int axis = 0; axis < 3; axis++) dest[axis] = _bias[axis] * (180.f / PI);
+}
+
+float OrientationEkf::tilt_sigma() const {
+    // Rotation about down is heading, which gravity can't correct; tilt is the rest of the error
+    const float *q = _rot;
+    float down[3] = {
+        2.f * (q[1] * q[3] - q[0] * q[2]),
+        2.f * (q[2] * q[3] + q[0] * q[1]),
+        q[0] * q[0] - q[1] * q[1] - q[2] * q[2] + q[3] * q[3]
+    };
+    float heading = 0.f, total = 0.f;
+    for (int i = 0; i < 3; i++) {
+        total += _p[i * 6 + i];
+        for (int j = 0; j < 3; j++) heading += down[i] * _p[i * 6 + j] * down[j];
+    }
+    float variance = (total - heading) / 2.f;
+    return sqrtf(variance > 0.f ? variance : 0.f) * (180.f / PI);
+}
+
+void OrientationEkf::update(const float (*accel)[3], const float (*gyro)[3], int n, float (*rots)[4]) {
+    for (int i = 0; i < n; i++) {
+        predict(gyro[i]);
+        correct(accel[i]);
+        if (rots) memcpy(rots[i], _rot, sizeof(_rot));
+    }
+}
+
+void OrientationEkf::predict(const float gyro[3]) {
+    const float dt = 1.f / POLL_RATE;
+    float w[3];
+    for (int axis = 0; axis < 3; axis++) w[axis] = gyro[axis] * (PI / 180.f) - _bias[axis];
+    float step[3] = { w[0] * dt, w[1] * dt, w[2] * dt };
+    rotate_by_small(_rot, step);
+
+    // The error rotates against the motion and picks up the bias error:
+    //   F = I + dt [[-[w x], -I], [0, 0]]
+    float f[6 * 6] = {
+        1.f,        step[2],   -step[1],   -dt,  0.f,  0.f,
+        -step[2],   1.f,        step[0],    0.f, -dt,  0.f,
+        step[1],   -step[0],    1.f,        0.f,  0.f, -dt,
+        0.f,        0.f,        0.f,        1.f,  0.f,  0.f,
+        0.f,        0.f,        0.f,        0.f,  1.f,  0.f,
+        0.f,        0.f,        0.f,        0.f,  0.f,  1.f,
+    };
+    float fp[6 * 6];
+    mat_mul<6, 6, 6>(f, _p, fp);
+    mat_mul_transposed<6, 6, 6>(fp, f, _p);
+    const float angle_noise = EKF_GYRO_NOISE * dt, bias_noise = EKF_BIAS_WALK * EKF_BIAS_WALK * dt;
+    for (int i = 0; i < 3; i++) {
+        _p[i * 6 + i] += angle_noise * angle_noise;
+        _p[(i + 3) * 6 + i + 3] += bias_noise;
+    }
+}
+
+void OrientationEkf::correct(const float accel[3]) {
+    float len = sqrtf(accel[0] * accel[0] + accel[1] * accel[1] + accel[2] * accel[2]);
+    if (!(len > 0.f)) return;
+    float measured[3] = { accel[0] / len, accel[1] / len, accel[2] / len };
+
+    // Predicted measurement: global down in local space, the bottom row of the rotation matrix.
+    // A small rotation error e turns it into down + down x e, so H = [[down x], 0].
+    const float *q = _rot;
+    float down[3] = {
+        2.f * (q[1] * q[3] - q[0] * q[2]),
+        2.f * (q[2] * q[3] + q[0] * q[1]),
+        q[0] * q[0] - q[1] * q[1] - q[2] * q[2] + q[3] * q[3]
+    };
+    float h[3 * 6] = {
+        0.f,      -down[2],  down[1],  0.f, 0.f, 0.f,
+        down[2],   0.f,     -down[0],  0.f, 0.f, 0.f,
+        -down[1],  down[0],  0.f,      0.f, 0.f, 0.f,
+    };
+    float innovation[3] = { measured[0] - down[0], measured[1] - down[1], measured[2] - down[2] };
+
+    // S = H P H^T + R
+    float hp[3 * 6], s[3 * 3];
+    mat_mul<3, 6, 6>(h, _p, hp);
+    mat_mul_transposed<3, 6, 3>(hp, h, s);
+    float motion = len - 1.f;
+    float noise = EKF_ACCEL_NOISE * EKF_ACCEL_NOISE * (1.f + EKF_ACCEL_MOTION_NOISE * MOTION_SENSITIVITY * motion * motion);
+    for (int i = 0; i < 3; i++) s[i * 3 + i] += noise;
+
+    // K^T = S^-1 H P, since P (and so S) is symmetric
+    float l[3 * 3], gain_t[3 * 6], gain[6 * 3];
+    if (!mat_cholesky<3>(s, l)) return;
+    mat_cholesky_solve<3, 6>(l, hp, gain_t);
+    mat_transpose<3, 6>(gain_t, gain);
+
+    float correction[6];
+    mat_mul<6, 3, 1>(gain, innovation, correction);
+    rotate_by_small(_rot, correction);
+    for (int axis = 0; axis < 3; axis++) _bias[axis] += correction[3 + axis];
+
+    // P -= K H P
+    float khp[6 * 6];
+    mat_mul<6, 3, 6>(gain, hp, khp);
+    mat_sub<6, 6>(_p, khp, _p);
+    mat_symmetrize<6>(_p);
+}
@@ -0,0 +1,181 @@
+#include "profiling.hpp"
+
+#include <atomic>
+#include <stdio.h>
+#include <string.h>
+
+#if defined(__MBED__)
+#include "cmsis.h"
+#elif defined(__x86_64__) || defined(__i386__)
+#include <chrono>
+#include <x86intrin.h>
+#else
+#include <chrono>
+#endif
+
+//MARK: Tick counter
+
+#if defined(__MBED__)
+
+void profile_init() {
+    // DWT cycle counter: enable tracing, then the counter itself
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CYCCNT = 0;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+}
+
+uint32_t profile_ticks() { return DWT->CYCCNT; }
+
+float profile_ticks_per_us() { return SystemCoreClock / 1e6f; }
+
+#elif defined(__x86_64__) || defined(__i386__)
+
+static float tsc_ticks_per_us = 1.f;
+
+void profile_init() {
+    // The TSC rate isn't reported anywhere portable, so measure it against steady_clock
+    auto start = std::chrono::steady_clock::now();
+    uint64_t tsc_start = __rdtsc();
+    while (std::chrono::steady_clock::now() - start < std::chrono::milliseconds(20)) {}
+    uint64_t tsc_ticks = __rdtsc() - tsc_start;
+    double us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+    tsc_ticks_per_us = (float)(tsc_ticks / us);
+}
+
+uint32_t profile_ticks() { return (uint32_t)__rdtsc(); }
+
+float profile_ticks_per_us() { return tsc_ticks_per_us; }
+
+#else
+
+void profile_init() {}
+
+uint32_t profile_ticks() {
+    return (uint32_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+float profile_ticks_per_us() { return 1000.f; }
+
+#endif
+
+//MARK: Table
+
+typedef struct {
+    std::atomic<uint32_t> sequence; // Odd while the owner is updating stats
+    uint32_t generation;            // Last profile_reset() this stage has applied
+    ProfileStats stats;
+} ProfileSlot;
+
+static ProfileSlot slots[PROFILE_STAGE_COUNT];
+static std::atomic<uint32_t> reset_generation(0);
+
+static const char *stage_names[PROFILE_STAGE_COUNT] = {
+    "acquisition",
+    "orientation",
+    "filter",
+    "fft_accel_x",
+    "fft_accel_y",
+    "fft_accel_z",
+    "fft_gyro_x",
+    "fft_gyro_y",
+    "fft_gyro_z",
+    "magnitude",
+    "tremor",
+    "dyskinesia",
+    "freezing",
+    "output",
+    "batch",
+};
+
+const char *profile_stage_name(ProfileStage stage) { return stage_names[stage]; }
+
+/** Two buckets per power of two: [2^n, 1.5 * 2^n) and [1.5 * 2^n, 2^(n+1)) */
+static int histogram_bucket(uint32_t ticks) {
+    if (ticks < 2) return 0;
+    int octave = 31 - __builtin_clz(ticks);
+    int bucket = 2 * octave + ((ticks >> (octave - 1)) & 1);
+    return bucket < PROFILE_HISTOGRAM_BUCKETS ? bucket : PROFILE_HISTOGRAM_BUCKETS - 1;
+}
+
+static uint32_t bucket_upper_bound(int bucket) {
+    int octave = bucket / 2;
+    if (octave == 0) return 1;
+    uint32_t base = 1u << octave;
+    return base + ((bucket & 1) + 1) * (base >> 1) - 1;
+}
+
+void profile_record(ProfileStage stage, uint32_t ticks) {
+    ProfileSlot &slot = slots[stage];
+    uint32_t sequence = slot.sequence.load(std::memory_order_relaxed);
+    slot.sequence.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    uint32_t generation = reset_generation.load(std::memory_order_relaxed);
+    ProfileStats &stats = slot.stats;
+    if (slot.generation != generation) {
+        memset(&stats, 0, sizeof(stats));
+        slot.generation = generation;
+    }
+    if (stats.count == 0 || ticks < stats.min) stats.min = ticks;
+    if (ticks > stats.max) stats.max = ticks;
+    stats.count++;
+    stats.sum += ticks;
+    stats.histogram[histogram_bucket(ticks)]++;
+
+    slot.sequence.store(sequence + 2, std::memory_order_release);
+}
+
+void profile_snapshot(ProfileStage stage, ProfileStats &stats) {
+    ProfileSlot &slot = slots[stage];
+    uint32_t before, after;
+    do {
+        before = slot.sequence.load(std::memory_order_acquire);
+        memcpy(&stats, &slot.stats, sizeof(stats));
+        std::atomic_thread_fence(std::memory_order_acquire);
+        after = slot.sequence.load(std::memory_order_relaxed);
+    } while ((before & 1) || before != after);
+
+    // A reset the owner hasn't applied yet still counts
+    if (slot.generation != reset_generation.load(std::memory_order_relaxed)) {
+        memset(&stats, 0, sizeof(stats));
+    }
+}
+
+uint32_t profile_percentile(const ProfileStats &stats, float percentile) {
+    if (stats.count == 0) return 0;
+    uint32_t target = (uint32_t)(stats.count * percentile / 100.f);
+    uint32_t seen = 0;
+    for (int bucket = 0; bucket < PROFILE_HISTOGRAM_BUCKETS; bucket++) {
+        seen += stats.histogram[bucket];
+        if (seen > target || seen == stats.count) {
+            uint32_t bound = bucket_upper_bound(bucket);
+            // Never report more than was actually seen
+            return bound < stats.max ? bound : stats.max;
+        }
+    }
+    return stats.max;
+}
+
+void profile_reset() {
+    reset_generation.fetch_add(1, std::memory_order_relaxed);
+}
+
+//MARK: Report
+
+void profile_dump() {
+    float per_us = profile_ticks_per_us();
+    printf("%-12s %8s %10s %10s %10s %10s\n", "stage", "count", "min_us", "mean_us", "max_us", "p99_us");
+    for (int stage = 0; stage < PROFILE_STAGE_COUNT; stage++) {
+        ProfileStats stats;
+        profile_snapshot((ProfileStage)stage, stats);
+        if (stats.count == 0) continue;
+        printf("%-12s %8lu %10.1f %10.1f %10.1f %10.1f\n",
+            stage_names[stage],
+            (unsigned long)stats.count,
+            stats.min / per_us,
+            (float)stats.sum / stats.count / per_us,
+            stats.max / per_us,
+            profile_percentile(stats, 99.f) / per_us
+        );
+    }
+}
@@ -0,0 +1,151 @@
+#include "quantile_sketch.hpp"
+
+#include <algorithm>
+#include <math.h>
+#include <string.h>
+
+void QuantileSketch::reset() {
+    _level_count = 1;
+    _levels[0] = _levels[1] = QUANTILE_SKETCH_ITEMS;
+    _capacity = quantile_sketch_capacity(1);
+    _count = 0;
+    _min = INFINITY;
+    _max = -INFINITY;
+}
+
+bool QuantileSketch::coin() {
+    // xorshift32
+    _random ^= _random << 13;
+    _random ^= _random >> 17;
+    _random ^= _random << 5;
+    return _random & 1;
+}
+
+//MARK: Adding values
+
+void QuantileSketch::update(float value) {
+    if (value != value) return;
+    while (size() >= _capacity) compress();
+    _items[--_levels[0]] = value;
+    _count++;
+    if (value < _min) _min = value;
+    if (value > _max) _max = value;
+}
+
+void QuantileSketch::insert(float value, int h) {
+    while (h >= _level_count && _level_count < QUANTILE_SKETCH_MAX_LEVELS) add_level();
+    if (h >= _level_count) h = _level_count - 1;
+    while (size() >= _capacity) compress();
+
+    // Shift everything from the front of the array up to the item's sorted place down by one
+    int position = h == 0 ? _levels[0] : (int)(std::upper_bound(&_items[_levels[h]], &_items[_levels[h + 1]], value) - _items);
+    memmove(&_items[_levels[0] - 1], &_items[_levels[0]], (position - _levels[0]) * sizeof(float));
+    _items[position - 1] = value;
+    for (int level = 0; level <= h; level++) _levels[level]--;
+}
+
+void QuantileSketch::merge(const QuantileSketch &other) {
+    // Top level first, so there are enough levels (and room) before the lower ones go in
+    for (int h = other._level_count - 1; h >= 0; h--) {
+        for (int i = other._levels[h]; i < other._levels[h + 1]; i++) insert(other._items[i], h);
+    }
+    _count += other._count;
+    if (other._min < _min) _min = other._min;
+    if (other._max > _max) _max = other._max;
+}
+
+//MARK: Compaction
+
+void QuantileSketch::add_level() {
+    // The new top level starts out empty at the end of the array
+    _level_count++;
+    _levels[_level_count] = QUANTILE_SKETCH_ITEMS;
+    _capacity = quantile_sketch_capacity(_level_count);
+}
+
+void QuantileSketch::compress() {
+    int h = 0;
+    while (h < _level_count - 1 && level_size(h) < quantile_sketch_level_capacity(h, _level_count)) h++;
+    if (h == _level_count - 1 && _level_count < QUANTILE_SKETCH_MAX_LEVELS) add_level();
+    compact_level(h);
+}
+
+void QuantileSketch::compact_level(int h) {
+    int start = _levels[h], end = _levels[h + 1];
+    int n = end - start;
+    if (n < 2) return;
+    if (h == 0) std::sort(&_items[start], &_items[end]);
+
+    // An odd item out (the smallest) stays behind; every other one of the rest moves up
+    int odd = n & 1;
+    int moved = (n - odd) / 2;
+    int first = start + odd + (coin() ? 1 : 0);
+
+    // Gather the moved items at the front of the level. That leaves a gap of the same size between them
+    // and level h + 1, so a forward merge into [end - moved, ...) never overwrites anything unread.
+    int gathered = start + odd;
+    for (int i = 0; i < moved; i++) _items[gathered + i] = _items[first + 2 * i];
+    if (h + 1 < _level_count) {
+        int write = end - moved;
+        int above = end, above_end = _levels[h + 2];
+        for (int i = 0; i < moved; i++) {
+            float item = _items[gathered + i];
+            while (above < above_end && _items[above] < item) _items[write++] = _items[above++];
+            _items[write++] = item;
+        }
+        // The rest of level h + 1 is already in place
+        _levels[h + 1] = end - moved;
+    } else {
+        // Nowhere to go: keep the moved items in level h, losing the weight of the others
+        memmove(&_items[end - moved], &_items[gathered], moved * sizeof(float));
+    }
+
+    // Level h is now just the odd item, right below what moved; everything under it shifts up
+    if (odd) _items[end - moved - 1] = _items[start];
+    memmove(&_items[_levels[0] + moved], &_items[_levels[0]], (start - _levels[0]) * sizeof(float));
+    for (int level = 0; level < h; level++) _levels[level] += moved;
+    _levels[h] = end - moved - odd;
+}
+
+//MARK: Queries
+
+void QuantileSketch::quantiles(const float *qs, int n, float *values) {
+    if (_count == 0) {
+        for (int i = 0; i < n; i++) values[i] = 0.f;
+        return;
+    }
+    std::sort(&_items[_levels[0]], &_items[_levels[1]]);
+
+    uint64_t total = 0;
+    for (int h = 0; h < _level_count; h++) total += (uint64_t)level_size(h) << h;
+
+    // Walk all levels in ascending order at once, like a merge
+    int cursor[QUANTILE_SKETCH_MAX_LEVELS];
+    for (int h = 0; h < _level_count; h++) cursor[h] = _levels[h];
+    uint64_t weight = 0;
+    int i = 0;
+    while (i < n && qs[i] <= 0.f) values[i++] = _min;
+    while (i < n) {
+        int lowest = -1;
+        for (int h = 0; h < _level_count; h++) {
+            if (cursor[h] < _levels[h + 1] && (lowest < 0 || _items[cursor[h]] < _items[cursor[lowest]])) lowest = h;
+        }
+        if (lowest < 0) break;
+        float item = _items[cursor[lowest]++];
+        weight += (uint64_t)1 << lowest;
+        while (i < n && qs[i] < 1.f && weight >= qs[i] * total) values[i++] = item;
+    }
+    while (i < n) values[i++] = _max;
+}
+
+float QuantileSketch::rank(float value) const {
+    if (_count == 0) return 0.f;
+    uint64_t below = 0, total = 0;
+    for (int h = 0; h < _level_count; h++) {
+        for (int i = _levels[h]; i < _levels[h + 1]; i++) {
+            if (_items[i] <= value) below += (uint64_t)1 << h;
+        }
+        total += (uint64_t)level_size(h) << h;
+    }
+    return (float)below / total;
+}
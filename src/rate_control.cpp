@@ -0,0 +1,52 @@
+#include "rate_control.hpp"
+#include "conditioning.hpp"
+
+ImuRate RateController::update(const RawImuSample *samples, int n) {
+    for (int i = 0; i < n; i++) {
+        const RawImuSample &sample = samples[i];
+        if (_block_samples == 0) {
+            for (int axis = 0; axis < 3; axis++) {
+                _first[axis] = sample.accel[axis];
+                _first[3 + axis] = sample.gyro[axis];
+            }
+            for (int channel = 0; channel < 6; channel++) _sum[channel] = _sum_sq[channel] = 0;
+        }
+        for (int axis = 0; axis < 3; axis++) {
+            int32_t a = sample.accel[axis] - _first[axis];
+            int32_t g = sample.gyro[axis] - _first[3 + axis];
+            _sum[axis] += a;
+            _sum_sq[axis] += (int64_t)a * a;
+            _sum[3 + axis] += g;
+            _sum_sq[3 + axis] += (int64_t)g * g;
+        }
+        if (++_block_samples == RATE_BLOCK_SAMPLES) {
+            finish_block();
+            _block_samples = 0;
+        }
+    }
+    return _rate;
+}
+
+void RateController::finish_block() {
+    const float n = RATE_BLOCK_SAMPLES;
+    // Thresholds as variances in counts
+    const float accel_counts = RATE_ACTIVE_ACCEL_G / ACCEL_SCALE;
+    const float gyro_counts = RATE_ACTIVE_GYRO_DPS / GYRO_SCALE;
+    bool active = false;
+    for (int channel = 0; channel < 6; channel++) {
+        float mean = _sum[channel] / n;
+        float variance = _sum_sq[channel] / n - mean * mean;
+        float threshold = channel < 3 ? accel_counts : gyro_counts;
+        active = active || variance > threshold * threshold;
+    }
+
+    ImuRate rate = _rate;
+    if (active) {
+        _still_blocks = 0;
+        rate = IMU_RATE_HIGH;
+    } else if (++_still_blocks >= RATE_LOW_AFTER_S * POLL_RATE / RATE_BLOCK_SAMPLES) {
+        rate = IMU_RATE_LOW;
+    }
+    if (rate != _rate) _switches++;
+    _rate = rate;
+}
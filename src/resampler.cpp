@@ -0,0 +1,58 @@
+#include "resampler.hpp"
+
+#include <math.h>
+
+// Closer than this to the previous sample is the same sample again
+#define DUPLICATE_US (1000000 / POLL_RATE / 4)
+
+/** a + (b - a) * fraction, per axis, rounded back to counts */
+static void interpolate(const RawImuSample &a, const RawImuSample &b, float fraction, RawImuSample &dest) {
+    for (int axis = 0; axis < 3; axis++) {
+        dest.accel[axis] = (int16_t)lrintf(a.accel[axis] + (b.accel[axis] - a.accel[axis]) * fraction);
+        dest.gyro[axis] = (int16_t)lrintf(a.gyro[axis] + (b.gyro[axis] - a.gyro[axis]) * fraction);
+    }
+}
+
+int ImuResampler::push(const RawImuSample &sample, uint64_t time_us, RawImuSample *out) {
+    if (_started && time_us < _previous_us + DUPLICATE_US) {
+        _stats.duplicates++;
+        return 0;
+    }
+    // More than RESAMPLER_MAX_FILL grid samples would come before this one
+    if (_started && time_us >= grid_us(_next + RESAMPLER_MAX_FILL) + DUPLICATE_US) {
+        _stats.breaks++;
+        _break = true;
+        _started = false;
+    }
+    if (_started) {
+        // Whole periods since the previous sample; jitter alone doesn't count as a gap
+        uint64_t periods = ((time_us - _previous_us) * POLL_RATE + 500000) / 1000000;
+        if (periods > 1) _stats.filled += (uint32_t)(periods - 1);
+    }
+    if (!_started) {
+        _origin_us = time_us;
+        _next = 0;
+        _started = true;
+    }
+
+    // Every grid time up to this sample, interpolated from the samples either side of it. The grid starts
+    // on a sample, so as long as the clocks agree, grid times land on samples and these are just copies.
+    int emitted = 0;
+    for (uint64_t grid = grid_us(_next); grid <= time_us; grid = grid_us(++_next)) {
+        if (grid == time_us) {
+            out[emitted++] = sample;
+        } else {
+            float fraction = (float)(grid - _previous_us) / (float)(time_us - _previous_us);
+            interpolate(_previous, sample, fraction, out[emitted++]);
+        }
+    }
+    _previous = sample;
+    _previous_us = time_us;
+    return emitted;
+}
+
+bool ImuResampler::take_break() {
+    bool taken = _break;
+    _break = false;
+    return taken;
+}
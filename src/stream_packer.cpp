@@ -0,0 +1,216 @@
+#include "stream_packer.hpp"
+#include "byte_order.hpp"
+
+StreamPacker stream_packer;
+
+int stream_status_encode(const StreamStatus &status, uint8_t dest[STREAM_STATUS_SIZE]) {
+    uint8_t *p = dest;
+    *p++ = status.mode;
+    p = put_u32(p, status.packets_sent);
+    p = put_u32(p, status.packets_dropped);
+    p = put_u32(p, status.values_dropped);
+    return (int)(p - dest);
+}
+
+StreamPacker::StreamPacker() :
+    _head(0), _tail(0), _mode(STREAM_SUMMARY), _packet_size(STREAM_PACKET_MIN), _packet_sequence(0),
+    _packets_sent(0), _packets_dropped(0), _values_dropped(0), _spectra_state(SPECTRA_EMPTY)
+{
+    // Slot i is free for whoever claims position i
+    for (uint32_t i = 0; i < STREAM_RING_PACKETS; i++) {
+        _slots[i].sequence.store(i, std::memory_order_relaxed);
+    }
+}
+
+void StreamPacker::set_mode(StreamMode mode) {
+    if (mode >= STREAM_MODE_COUNT) return;
+    _mode.store(mode, std::memory_order_relaxed);
+    // The rest of a staged window isn't wanted any more
+    uint8_t ready = SPECTRA_READY;
+    if (mode != STREAM_SPECTRAL) _spectra_state.compare_exchange_strong(ready, SPECTRA_EMPTY, std::memory_order_relaxed);
+}
+
+void StreamPacker::set_packet_size(int size) {
+    if (size > STREAM_PACKET_MAX) size = STREAM_PACKET_MAX;
+    if (size < STREAM_PACKET_MIN) size = STREAM_PACKET_MIN;
+    _packet_size.store(size, std::memory_order_relaxed);
+}
+
+StreamStatus StreamPacker::status() const {
+    StreamStatus status;
+    status.mode = _mode.load(std::memory_order_relaxed);
+    status.packets_sent = _packets_sent.load(std::memory_order_relaxed);
+    status.packets_dropped = _packets_dropped.load(std::memory_order_relaxed);
+    status.values_dropped = _values_dropped.load(std::memory_order_relaxed);
+    return status;
+}
+
+//MARK: Ring
+
+bool StreamPacker::push(const uint8_t *data, int size, int values) {
+    uint32_t position = _head.load(std::memory_order_relaxed);
+    Slot *slot;
+    while (1) {
+        slot = &_slots[position & (STREAM_RING_PACKETS - 1)];
+        int32_t lag = (int32_t)(slot->sequence.load(std::memory_order_acquire) - position);
+        if (lag == 0) {
+            if (_head.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) break;
+        } else if (lag < 0) {
+            // Full: the link is behind. Drop this one and keep what's queued.
+            _packets_dropped.fetch_add(1, std::memory_order_relaxed);
+            _values_dropped.fetch_add(values, std::memory_order_relaxed);
+            return false;
+        } else {
+            position = _head.load(std::memory_order_relaxed);
+        }
+    }
+
+    memcpy(slot->data, data, size);
+    slot->size = (uint16_t)size;
+    slot->sequence.store(position + 1, std::memory_order_release);
+    return true;
+}
+
+uint32_t StreamPacker::free_slots() const {
+    uint32_t used = _head.load(std::memory_order_relaxed) - _tail.load(std::memory_order_relaxed);
+    return used < STREAM_RING_PACKETS ? STREAM_RING_PACKETS - used : 0;
+}
+
+const uint8_t *StreamPacker::peek(int &size) {
+    if (_spectra_state.load(std::memory_order_acquire) == SPECTRA_READY) pack_spectra();
+    uint32_t tail = _tail.load(std::memory_order_relaxed);
+    Slot &slot = _slots[tail & (STREAM_RING_PACKETS - 1)];
+    if (slot.sequence.load(std::memory_order_acquire) != tail + 1) return nullptr;
+    size = slot.size;
+    return slot.data;
+}
+
+void StreamPacker::pop() {
+    uint32_t tail = _tail.load(std::memory_order_relaxed);
+    Slot &slot = _slots[tail & (STREAM_RING_PACKETS - 1)];
+    // Free for the producer that claims this slot on the next lap
+    slot.sequence.store(tail + STREAM_RING_PACKETS, std::memory_order_release);
+    _tail.store(tail + 1, std::memory_order_relaxed);
+    _packets_sent.fetch_add(1, std::memory_order_relaxed);
+}
+
+//MARK: Producers
+
+static uint8_t *put_header(uint8_t *dest, uint8_t type, uint8_t count, uint16_t sequence, uint32_t position) {
+    *dest++ = type;
+    *dest++ = count;
+    dest = put_u16(dest, sequence);
+    return put_u32(dest, position);
+}
+
+void StreamPacker::flush_raw() {
+    if (_raw_count == 0) return;
+    uint32_t first = _raw_next_index - _raw_count;
+    put_header(_raw, STREAM_PACKET_RAW, (uint8_t)_raw_count, _packet_sequence.fetch_add(1, std::memory_order_relaxed), first);
+    push(_raw, STREAM_HEADER_SIZE + 12 * _raw_count, _raw_count);
+    _raw_count = 0;
+}
+
+void StreamPacker::add_raw(const RawImuSample &sample, uint32_t index) {
+    if (_raw_count > 0 && index != _raw_next_index) flush_raw();
+    if (_raw_count == 0) {
+        _raw_capacity = (_packet_size.load(std::memory_order_relaxed) - STREAM_HEADER_SIZE) / 12;
+    }
+
+    uint8_t *p = _raw + STREAM_HEADER_SIZE + 12 * _raw_count;
+    for (int axis = 0; axis < 3; axis++) p = put_u16(p, (uint16_t)sample.accel[axis]);
+    for (int axis = 0; axis < 3; axis++) p = put_u16(p, (uint16_t)sample.gyro[axis]);
+    _raw_count++;
+    _raw_next_index = index + 1;
+
+    if (_raw_count >= _raw_capacity) flush_raw();
+}
+
+bool StreamPacker::stage_spectra(uint32_t window) {
+    int size = _packet_size.load(std::memory_order_relaxed);
+    int bins_per_packet = (size - STREAM_HEADER_SIZE - 4) / 2;
+    int packets = 6 * ((STREAM_SPECTRUM_BINS + bins_per_packet - 1) / bins_per_packet);
+
+    // The link hasn't taken all of the last window yet; a partial spectrum isn't worth much, so this one goes
+    uint8_t empty = SPECTRA_EMPTY;
+    if (!_spectra_state.compare_exchange_strong(empty, SPECTRA_FILLING, std::memory_order_acquire)) {
+        _packet_sequence.fetch_add(packets, std::memory_order_relaxed);
+        _packets_dropped.fetch_add(packets, std::memory_order_relaxed);
+        _values_dropped.fetch_add(6 * STREAM_SPECTRUM_BINS, std::memory_order_relaxed);
+        return false;
+    }
+    _spectra_window = window;
+    _spectra_bins_per_packet = bins_per_packet;
+    _spectra_packets = packets;
+    _spectra_next = 0;
+    return true;
+}
+
+void StreamPacker::pack_spectra() {
+    int bins_per_packet = _spectra_bins_per_packet;
+    int packets_per_axis = _spectra_packets / 6;
+    uint8_t packet[STREAM_PACKET_MAX];
+    for (; _spectra_next < _spectra_packets && free_slots() > 0; _spectra_next++) {
+        int axis = _spectra_next / packets_per_axis;
+        int first = _spectra_next % packets_per_axis * bins_per_packet;
+        int count = STREAM_SPECTRUM_BINS - first < bins_per_packet ? STREAM_SPECTRUM_BINS - first : bins_per_packet;
+        const float *mags = _spectra[axis];
+
+        // Scale each packet to its own largest bin
+        float scale = 0.f;
+        for (int bin = first; bin < first + count; bin++) {
+            if (mags[bin] > scale) scale = mags[bin];
+        }
+        float to_u16 = scale > 0.f ? 65535.f / scale : 0.f;
+
+        uint8_t *p = put_header(packet, STREAM_PACKET_SPECTRAL, (uint8_t)count,
+            _packet_sequence.fetch_add(1, std::memory_order_relaxed), _spectra_window << 11 | axis << 8 | first);
+        p = put_f32(p, scale);
+        for (int bin = first; bin < first + count; bin++) {
+            p = put_u16(p, (uint16_t)(mags[bin] * to_u16 + 0.5f));
+        }
+        push(packet, (int)(p - packet), count);
+    }
+    if (_spectra_next == _spectra_packets) _spectra_state.store(SPECTRA_EMPTY, std::memory_order_release);
+}
+
+void StreamPacker::add_spectra(uint32_t window, const float accel_mags[3][STREAM_SPECTRUM_BINS], const float gyro_mags[3][STREAM_SPECTRUM_BINS]) {
+    if (!stage_spectra(window)) return;
+    for (int axis = 0; axis < 3; axis++) {
+        memcpy(_spectra[axis], accel_mags[axis], sizeof(_spectra[axis]));
+        memcpy(_spectra[3 + axis], gyro_mags[axis], sizeof(_spectra[axis]));
+    }
+    _spectra_state.store(SPECTRA_READY, std::memory_order_release);
+}
+
+void StreamPacker::add_spectra(uint32_t window, const half_t accel_mags[3][STREAM_SPECTRUM_BINS], const half_t gyro_mags[3][STREAM_SPECTRUM_BINS]) {
+    if (!stage_spectra(window)) return;
+    for (int axis = 0; axis < 3; axis++) {
+        half_widen(accel_mags[axis], _spectra[axis], STREAM_SPECTRUM_BINS);
+        half_widen(gyro_mags[axis], _spectra[3 + axis], STREAM_SPECTRUM_BINS);
+    }
+    _spectra_state.store(SPECTRA_READY, std::memory_order_release);
+}
+
+bool StreamPacker::add_history_page(uint32_t page_sequence, const uint8_t *page, int size) {
+    int bytes_per_packet = _packet_size.load(std::memory_order_relaxed) - STREAM_HEADER_SIZE;
+    int packets = (size + bytes_per_packet - 1) / bytes_per_packet;
+    if (free_slots() < (uint32_t)packets) return false;
+
+    uint8_t packet[STREAM_PACKET_MAX];
+    for (int offset = 0; offset < size; offset += bytes_per_packet) {
+        int count = size - offset < bytes_per_packet ? size - offset : bytes_per_packet;
+        put_header(packet, STREAM_PACKET_HISTORY, (uint8_t)count,
+            _packet_sequence.fetch_add(1, std::memory_order_relaxed), page_sequence << 8 | offset);
+        memcpy(packet + STREAM_HEADER_SIZE, page + offset, count);
+        push(packet, STREAM_HEADER_SIZE + count, count);
+    }
+    return true;
+}
+
+bool StreamPacker::add_history_end(uint32_t next_page) {
+    if (free_slots() < 1) return false;
+    uint8_t packet[STREAM_HEADER_SIZE];
+    put_header(packet, STREAM_PACKET_HISTORY, 0, _packet_sequence.fetch_add(1, std::memory_order_relaxed), next_page << 8);
+    return push(packet, STREAM_HEADER_SIZE, 0);
+}
@@ -0,0 +1,194 @@
+#include "symptom_log.hpp"
+#include "byte_order.hpp"
+
+#include <string.h>
+
+using mbed::bd_addr_t;
+
+//MARK: Page format
+
+static uint16_t crc16(const uint8_t *data, int size, uint16_t crc = 0xFFFF) {
+    for (int i = 0; i < size; i++) {
+        crc ^= (uint16_t)data[i] << 8;
+        for (int bit = 0; bit < 8; bit++) {
+            crc = crc & 0x8000 ? (uint16_t)((crc << 1) ^ 0x1021) : (uint16_t)(crc << 1);
+        }
+    }
+    return crc;
+}
+
+/** CRC of everything but the crc field itself */
+static uint16_t page_crc(const uint8_t page[LOG_PAGE_SIZE]) {
+    uint16_t crc = crc16(page, 10);
+    return crc16(page + LOG_PAGE_HEADER_SIZE, LOG_PAGE_SIZE - LOG_PAGE_HEADER_SIZE, crc);
+}
+
+static bool page_valid(const uint8_t page[LOG_PAGE_SIZE]) {
+    return get_u32(page) != 0xFFFFFFFF && get_u16(page + 10) == page_crc(page);
+}
+
+static bool page_blank(const uint8_t page[LOG_PAGE_SIZE]) {
+    for (int i = 0; i < LOG_PAGE_SIZE; i++) {
+        if (page[i] != 0xFF) return false;
+    }
+    return true;
+}
+
+static uint16_t quantize16(float value) {
+    if (!(value > 0.f)) return 0;
+    return value >= 1.f ? 65535 : (uint16_t)(value * 65535.f + 0.5f);
+}
+
+static uint8_t quantize8(float value) {
+    if (!(value > 0.f)) return 0;
+    return value >= 1.f ? 255 : (uint8_t)(value * 255.f + 0.5f);
+}
+
+bool symptom_log_decode_page(const uint8_t page[LOG_PAGE_SIZE], SymptomLogPage &decoded) {
+    if (!page_valid(page)) return false;
+    decoded.sequence = get_u32(page);
+    decoded.boot = get_u16(page + 8);
+    decoded.count = 0;
+
+    uint32_t time_ms = get_u32(page + 4);
+    const uint8_t *record = page + LOG_PAGE_HEADER_SIZE;
+    for (int i = 0; i < LOG_RECORDS_PER_PAGE; i++, record += LOG_RECORD_SIZE) {
+        if (record[7] == LOG_FLAG_PADDING) continue;
+        time_ms += get_u16(record) * 100u;
+        SymptomLogEntry &entry = decoded.entries[decoded.count++];
+        entry.time_ms = time_ms;
+        entry.tremor = get_u16(record + 2) / 65535.f;
+        entry.dyskinesia = get_u16(record + 4) / 65535.f;
+        entry.fog = record[6] / 255.f;
+        entry.flags = record[7];
+    }
+    return true;
+}
+
+//MARK: Mounting
+
+int SymptomLog::mount() {
+    if (!_bd) return SYMPTOM_LOG_ERROR_NO_DEVICE;
+    int err = _bd->init();
+    if (err) return err;
+
+    mbed::bd_size_t erase_size = _bd->get_erase_size();
+    if (erase_size % LOG_PAGE_SIZE || LOG_PAGE_SIZE % _bd->get_program_size()) return SYMPTOM_LOG_ERROR_GEOMETRY;
+    _pages_per_block = (uint32_t)(erase_size / LOG_PAGE_SIZE);
+    _pages = (uint32_t)(_bd->size() / erase_size) * _pages_per_block;
+    if (_pages < 2 * _pages_per_block) return SYMPTOM_LOG_ERROR_GEOMETRY;
+
+    // Blocks are always started from their first page, so those tell which block is newest and oldest
+    uint8_t page[LOG_PAGE_SIZE];
+    bool found = false;
+    uint32_t newest = 0, oldest = 0;
+    for (uint32_t block = 0; block < _pages / _pages_per_block; block++) {
+        err = _bd->read(page, (bd_addr_t)block * erase_size, LOG_PAGE_SIZE);
+        if (err) return err;
+        if (!page_valid(page)) continue;
+        uint32_t sequence = get_u32(page);
+        if (!found || sequence > newest) newest = sequence;
+        if (!found || sequence < oldest) oldest = sequence;
+        found = true;
+    }
+
+    _count = 0;
+    if (!found) {
+        _boot = 0;
+        _oldest.store(0, std::memory_order_release);
+        _next.store(0, std::memory_order_release);
+        return 0;
+    }
+
+    // Walk the newest block to its last page
+    uint32_t last = newest;
+    uint16_t last_boot = 0;
+    for (uint32_t sequence = newest; sequence < newest + _pages_per_block; sequence++) {
+        err = _bd->read(page, page_address(sequence), LOG_PAGE_SIZE);
+        if (err) return err;
+        if (!page_valid(page) || get_u32(page) != sequence) break;
+        last = sequence;
+        last_boot = get_u16(page + 8);
+    }
+    _boot = last_boot + 1;
+
+    uint32_t next = last + 1;
+    if (next % _pages_per_block) {
+        // A page cut short by a reset can't be programmed again; carry on from the next block instead
+        err = _bd->read(page, page_address(next), LOG_PAGE_SIZE);
+        if (err) return err;
+        if (!page_blank(page)) next += _pages_per_block - next % _pages_per_block;
+    }
+    _oldest.store(oldest, std::memory_order_release);
+    _next.store(next, std::memory_order_release);
+    return 0;
+}
+
+//MARK: Writing
+
+int SymptomLog::append(const SymptomLogEntry &entry) {
+    uint32_t delta_ds = _count ? (entry.time_ms - _last_time_ms + 50) / 100 : 0;
+    if (delta_ds > 0xFFFF) {
+        // Too long since the previous entry to store as a delta; start a page of its own
+        int err = write_page();
+        if (err) return err;
+        delta_ds = 0;
+    }
+    if (_count == 0) {
+        _base_time_ms = entry.time_ms;
+        _last_time_ms = entry.time_ms;
+        memset(_page, 0xFF, sizeof(_page));
+    }
+    // Follow the stored (rounded) times so rounding errors don't add up
+    _last_time_ms += delta_ds * 100;
+
+    uint8_t *record = _page + LOG_PAGE_HEADER_SIZE + _count * LOG_RECORD_SIZE;
+    record = put_u16(record, (uint16_t)delta_ds);
+    record = put_u16(record, quantize16(entry.tremor));
+    record = put_u16(record, quantize16(entry.dyskinesia));
+    *record++ = quantize8(entry.fog);
+    *record = entry.flags == LOG_FLAG_PADDING ? 0 : entry.flags;
+    _count++;
+
+    return _count == LOG_RECORDS_PER_PAGE ? write_page() : 0;
+}
+
+int SymptomLog::flush() {
+    return write_page();
+}
+
+int SymptomLog::write_page() {
+    if (_count == 0) return 0;
+    uint32_t next = _next.load(std::memory_order_relaxed);
+
+    if (next % _pages_per_block == 0) {
+        // Wrapping into a block: whatever it held is gone from now on
+        if (next + _pages_per_block > _pages) {
+            uint32_t oldest = next + _pages_per_block - _pages;
+            if (oldest > _oldest.load(std::memory_order_relaxed)) _oldest.store(oldest, std::memory_order_release);
+        }
+        int err = _bd->erase(page_address(next), (mbed::bd_size_t)_pages_per_block * LOG_PAGE_SIZE);
+        if (err) return err;
+    }
+
+    put_u32(_page, next);
+    put_u32(_page + 4, _base_time_ms);
+    put_u16(_page + 8, _boot);
+    put_u16(_page + 10, page_crc(_page));
+    int err = _bd->program(_page, page_address(next), LOG_PAGE_SIZE);
+    // Move on even if programming failed; that page can't be programmed again without an erase
+    _count = 0;
+    _next.store(next + 1, std::memory_order_release);
+    return err;
+}
+
+//MARK: Reading
+
+int SymptomLog::read_page(uint32_t sequence, uint8_t page[LOG_PAGE_SIZE]) {
+    if (sequence < oldest_page() || sequence >= next_page()) return SYMPTOM_LOG_ERROR_NOT_FOUND;
+    int err = _bd->read(page, page_address(sequence), LOG_PAGE_SIZE);
+    if (err) return err;
+    // The writer may have erased it for the next lap since the check above
+    if (!page_valid(page) || get_u32(page) != sequence) return SYMPTOM_LOG_ERROR_NOT_FOUND;
+    return 0;
+}
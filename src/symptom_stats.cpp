@@ -0,0 +1,142 @@
+#include "symptom_stats.hpp"
+#include "byte_order.hpp"
+
+// Intensities travel as 1/10000 units
+#define STATS_SCALE 10000.f
+
+//MARK: Summary
+
+int stats_summary_encode(const StatsSummary &summary, uint8_t dest[STATS_SUMMARY_SIZE]) {
+    uint8_t *p = dest;
+    *p++ = STATS_VERSION;
+    *p++ = 0;
+    p = put_u32(p, summary.since_ms);
+    p = put_u32(p, summary.windows);
+    for (int symptom = 0; symptom < STATS_SYMPTOMS; symptom++) {
+        const SymptomSummary &s = summary.symptoms[symptom];
+        p = put_ufixed16(p, s.threshold, STATS_SCALE);
+        p = put_ufixed16(p, s.p50, STATS_SCALE);
+        p = put_ufixed16(p, s.p90, STATS_SCALE);
+        p = put_ufixed16(p, s.p99, STATS_SCALE);
+        p = put_ufixed16(p, s.max, STATS_SCALE);
+        p = put_u32(p, s.above_ms);
+    }
+    return (int)(p - dest);
+}
+
+bool stats_summary_decode(const uint8_t *data, int size, StatsSummary &summary) {
+    if (size < STATS_SUMMARY_SIZE || data[0] != STATS_VERSION) return false;
+    summary.since_ms = get_u32(data + 2);
+    summary.windows = get_u32(data + 6);
+    const uint8_t *p = data + 10;
+    for (int symptom = 0; symptom < STATS_SYMPTOMS; symptom++, p += 14) {
+        SymptomSummary &s = summary.symptoms[symptom];
+        s.threshold = get_ufixed16(p, STATS_SCALE);
+        s.p50 = get_ufixed16(p + 2, STATS_SCALE);
+        s.p90 = get_ufixed16(p + 4, STATS_SCALE);
+        s.p99 = get_ufixed16(p + 6, STATS_SCALE);
+        s.max = get_ufixed16(p + 8, STATS_SCALE);
+        s.above_ms = get_u32(p + 10);
+    }
+    return true;
+}
+
+//MARK: Statistics
+
+SymptomStats::SymptomStats(const float thresholds[STATS_SYMPTOMS]) {
+    for (int symptom = 0; symptom < STATS_SYMPTOMS; symptom++) _thresholds[symptom] = thresholds[symptom];
+    reset(0);
+}
+
+void SymptomStats::reset(uint32_t now_ms) {
+    for (int symptom = 0; symptom < STATS_SYMPTOMS; symptom++) {
+        _sketches[symptom].reset();
+        _above_ms[symptom] = 0;
+    }
+    _since_ms = now_ms;
+    _windows = 0;
+}
+
+void SymptomStats::update(const SymptomIntensities &intensities, uint32_t window_ms) {
+    const float values[STATS_SYMPTOMS] = { intensities.tremor, intensities.dyskinesia, intensities.fog };
+    for (int symptom = 0; symptom < STATS_SYMPTOMS; symptom++) {
+        _sketches[symptom].update(values[symptom]);
+        if (values[symptom] >= _thresholds[symptom]) _above_ms[symptom] += window_ms;
+    }
+    _windows++;
+}
+
+void SymptomStats::merge(const SymptomStats &other) {
+    for (int symptom = 0; symptom < STATS_SYMPTOMS; symptom++) {
+        _sketches[symptom].merge(other._sketches[symptom]);
+        _above_ms[symptom] += other._above_ms[symptom];
+    }
+    if (other._since_ms < _since_ms) _since_ms = other._since_ms;
+    _windows += other._windows;
+}
+
+StatsSummary SymptomStats::summary() {
+    static const float qs[3] = { 0.5f, 0.9f, 0.99f };
+    StatsSummary summary;
+    summary.since_ms = _since_ms;
+    summary.windows = _windows;
+    for (int symptom = 0; symptom < STATS_SYMPTOMS; symptom++) {
+        SymptomSummary &s = summary.symptoms[symptom];
+        float values[3];
+        _sketches[symptom].quantiles(qs, 3, values);
+        s.threshold = _thresholds[symptom];
+        s.p50 = values[0];
+        s.p90 = values[1];
+        s.p99 = values[2];
+        s.max = _sketches[symptom].count() ? _sketches[symptom].max() : 0.f;
+        s.above_ms = _above_ms[symptom];
+    }
+    return summary;
+}
+
+void SymptomStats::set_counts(uint32_t since_ms, uint32_t windows, const uint32_t above_ms[STATS_SYMPTOMS]) {
+    _since_ms = since_ms;
+    _windows = windows;
+    for (int symptom = 0; symptom < STATS_SYMPTOMS; symptom++) _above_ms[symptom] = above_ms[symptom];
+}
+
+//MARK: Sketches
+
+int SymptomStats::encode_sketch(int symptom, uint8_t dest[STATS_SKETCH_MAX_SIZE]) {
+    QuantileSketch &sketch = _sketches[symptom];
+    uint8_t *p = dest;
+    *p++ = STATS_VERSION;
+    *p++ = (uint8_t)symptom;
+    *p++ = (uint8_t)sketch.levels();
+    *p++ = 0;
+    p = put_u32(p, sketch.count());
+    p = put_ufixed16(p, sketch.count() ? sketch.min() : 0.f, STATS_SCALE);
+    p = put_ufixed16(p, sketch.count() ? sketch.max() : 0.f, STATS_SCALE);
+    for (int h = 0; h < sketch.levels(); h++) *p++ = (uint8_t)sketch.level_size(h);
+    for (int h = 0; h < sketch.levels(); h++) {
+        const float *items = sketch.level_items(h);
+        for (int i = 0; i < sketch.level_size(h); i++) p = put_ufixed16(p, items[i], STATS_SCALE);
+    }
+    return (int)(p - dest);
+}
+
+bool SymptomStats::decode_sketch(const uint8_t *data, int size) {
+    if (size < STATS_SKETCH_HEADER_SIZE || data[0] != STATS_VERSION || data[1] >= STATS_SYMPTOMS) return false;
+    int levels = data[2];
+    if (levels < 1 || levels > QUANTILE_SKETCH_MAX_LEVELS || size < STATS_SKETCH_HEADER_SIZE + levels) return false;
+    const uint8_t *sizes = data + STATS_SKETCH_HEADER_SIZE;
+    int items = 0;
+    for (int h = 0; h < levels; h++) items += sizes[h];
+    if (items > QUANTILE_SKETCH_ITEMS || size < STATS_SKETCH_HEADER_SIZE + levels + 2 * items) return false;
+
+    QuantileSketch &sketch = _sketches[data[1]];
+    sketch.reset();
+    // Top level first, so the sketch has all its levels (and room) before the lower ones go in
+    const uint8_t *p = sizes + levels + 2 * items;
+    for (int h = levels - 1; h >= 0; h--) {
+        p -= 2 * sizes[h];
+        for (int i = 0; i < sizes[h]; i++) sketch.insert(get_ufixed16(p + 2 * i, STATS_SCALE), h);
+    }
+    sketch.set_summary(get_u32(data + 4), get_ufixed16(data + 8, STATS_SCALE), get_ufixed16(data + 10, STATS_SCALE));
+    return true;
+}
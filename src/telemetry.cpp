@@ -0,0 +1,54 @@
+#include "telemetry.hpp"
+#include "byte_order.hpp"
+
+//MARK: Frames
+
+int telemetry_encode(const TelemetryFrame &frame, uint8_t *dest, int max_size) {
+    if (max_size < TELEMETRY_CORE_SIZE) return 0;
+
+    // Keep the extras that fit, in bit order
+    uint8_t mask = 0;
+    int size = TELEMETRY_CORE_SIZE;
+    for (int extra = 0; extra < TELEMETRY_EXTRA_COUNT; extra++) {
+        if (!(frame.extras_mask & (1 << extra)) || size + 4 > max_size) continue;
+        mask |= 1 << extra;
+        size += 4;
+    }
+
+    uint8_t *p = dest;
+    *p++ = TELEMETRY_VERSION;
+    *p++ = mask;
+    p = put_u16(p, frame.sequence);
+    p = put_u32(p, frame.timestamp_ms);
+    p = put_f32(p, frame.tremor);
+    p = put_f32(p, frame.dyskinesia);
+    p = put_f32(p, frame.fog);
+    for (int extra = 0; extra < TELEMETRY_EXTRA_COUNT; extra++) {
+        if (mask & (1 << extra)) p = put_f32(p, frame.extras[extra]);
+    }
+    return size;
+}
+
+bool telemetry_decode(const uint8_t *data, int size, TelemetryFrame &frame) {
+    if (size < TELEMETRY_CORE_SIZE || data[0] > TELEMETRY_VERSION) return false;
+
+    uint8_t mask = data[1];
+    frame.sequence = get_u16(data + 2);
+    frame.timestamp_ms = get_u32(data + 4);
+    frame.tremor = get_f32(data + 8);
+    frame.dyskinesia = get_f32(data + 12);
+    frame.fog = get_f32(data + 16);
+    frame.extras_mask = 0;
+
+    const uint8_t *p = data + TELEMETRY_CORE_SIZE;
+    for (int extra = 0; extra < 8; extra++) {
+        if (!(mask & (1 << extra))) continue;
+        if (p + 4 > data + size) return false;
+        if (extra < TELEMETRY_EXTRA_COUNT) {
+            frame.extras[extra] = get_f32(p);
+            frame.extras_mask |= 1 << extra;
+        }
+        p += 4;
+    }
+    return true;
+}
@@ -0,0 +1,204 @@
+#include "trace_replay.hpp"
+#include "byte_order.hpp"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define RECORD_SIZE 12
+
+//MARK: Decoding
+
+/** Parse one CSV line. Returns false for lines that aren't samples. */
+static bool parse_csv_sample(const char *line, RawImuSample &sample) {
+    int16_t raw[6];
+    char *end;
+    for (int i = 0; i < 6; i++) {
+        long value = strtol(line, &end, 10);
+        if (end == line) return false;
+        raw[i] = (int16_t)value;
+        line = end;
+        while (*line == ',' || *line == ' ' || *line == '\t') line++;
+    }
+    for (int axis = 0; axis < 3; axis++) {
+        sample.accel[axis] = raw[axis];
+        sample.gyro[axis] = raw[3 + axis];
+    }
+    return true;
+}
+
+//MARK: Opening
+
+bool TraceReplaySource::open(const char *path) {
+    close();
+    _file = fopen(path, "rb");
+    if (!_file) return false;
+
+    uint8_t header[sizeof(TraceHeader)];
+    size_t got = fread(header, 1, sizeof(header), _file);
+    _binary = got == sizeof(header) && memcmp(header, TRACE_MAGIC, 4) == 0;
+
+    if (_binary) {
+        if (get_u16(header + 4) != TRACE_VERSION) {
+            close();
+            return false;
+        }
+        _sample_rate = get_u16(header + 6);
+        _data_start = sizeof(TraceHeader);
+
+        // Trust the file size over the header, in case recording was cut short
+        fseek(_file, 0, SEEK_END);
+        long from_size = (ftell(_file) - _data_start) / RECORD_SIZE;
+        long from_header = get_u32(header + 8);
+        _count = from_header != 0 && from_header < from_size ? from_header : from_size;
+    } else {
+        _sample_rate = POLL_RATE;
+        _data_start = 0;
+        _count = -1;
+    }
+    fseek(_file, _data_start, SEEK_SET);
+    _position = 0;
+    return true;
+}
+
+void TraceReplaySource::close() {
+    if (_file) fclose(_file);
+    _file = nullptr;
+    _index.clear();
+    _index_stride = 0;
+    _count = -1;
+}
+
+//MARK: Reading
+
+bool TraceReplaySource::read_csv(RawImuSample &sample) {
+    char line[256];
+    while (fgets(line, sizeof(line), _file)) {
+        if (parse_csv_sample(line, sample)) return true;
+    }
+    return false;
+}
+
+bool TraceReplaySource::read(RawImuSample &sample) {
+    if (!_file) return false;
+
+    if (_binary) {
+        if (_position >= _count) return false;
+        uint8_t record[RECORD_SIZE];
+        if (fread(record, 1, RECORD_SIZE, _file) != RECORD_SIZE) return false;
+        for (int axis = 0; axis < 3; axis++) {
+            sample.accel[axis] = (int16_t)get_u16(record + 2 * axis);
+            sample.gyro[axis] = (int16_t)get_u16(record + 6 + 2 * axis);
+        }
+    } else if (!read_csv(sample)) {
+        return false;
+    }
+    _position++;
+    return true;
+}
+
+//MARK: Seeking
+
+bool TraceReplaySource::index(long stride) {
+    if (!_file || stride < 1) return false;
+    if (_binary) return true;
+
+    _index.clear();
+    _index_stride = stride;
+    fseek(_file, _data_start, SEEK_SET);
+
+    char line[256];
+    RawImuSample sample;
+    long samples = 0;
+    long offset = ftell(_file);
+    while (fgets(line, sizeof(line), _file)) {
+        if (parse_csv_sample(line, sample)) {
+            if (samples % stride == 0) _index.push_back(offset);
+            samples++;
+        }
+        offset = ftell(_file);
+    }
+    _count = samples;
+
+    fseek(_file, _data_start, SEEK_SET);
+    _position = 0;
+    return true;
+}
+
+bool TraceReplaySource::seek(long sample) {
+    if (!_file || sample < 0) return false;
+
+    if (_binary) {
+        if (sample > _count) return false;
+        fseek(_file, _data_start + sample * RECORD_SIZE, SEEK_SET);
+        _position = sample;
+        return true;
+    }
+
+    // CSV: hop to the closest indexed sample at or before the target, then read forward
+    long start = 0;
+    long offset = _data_start;
+    if (_index_stride > 0 && !_index.empty()) {
+        size_t slot = sample / _index_stride;
+        if (slot >= _index.size()) slot = _index.size() - 1;
+        start = slot * _index_stride;
+        offset = _index[slot];
+    }
+    fseek(_file, offset, SEEK_SET);
+    _position = start;
+
+    RawImuSample skipped;
+    while (_position < sample) {
+        if (!read(skipped)) return false;
+    }
+    return true;
+}
+
+//MARK: Writing
+
+bool TraceWriter::open(const char *path, int sample_rate) {
+    close();
+    _file = fopen(path, "wb");
+    if (!_file) return false;
+    _count = 0;
+
+    uint8_t header[sizeof(TraceHeader)] = {};
+    memcpy(header, TRACE_MAGIC, 4);
+    put_u16(header + 4, TRACE_VERSION);
+    put_u16(header + 6, (uint16_t)sample_rate);
+    // The sample count stays 0 ("unknown") until close()
+    return fwrite(header, 1, sizeof(header), _file) == sizeof(header);
+}
+
+bool TraceWriter::write(const RawImuSample &sample) {
+    return write(&sample, 1);
+}
+
+bool TraceWriter::write(const RawImuSample *samples, long n) {
+    if (!_file) return false;
+    uint8_t records[64 * RECORD_SIZE];
+    while (n > 0) {
+        long chunk = n < 64 ? n : 64;
+        for (long i = 0; i < chunk; i++) {
+            uint8_t *record = records + i * RECORD_SIZE;
+            for (int axis = 0; axis < 3; axis++) {
+                put_u16(record + 2 * axis, (uint16_t)samples[i].accel[axis]);
+                put_u16(record + 6 + 2 * axis, (uint16_t)samples[i].gyro[axis]);
+            }
+        }
+        if (fwrite(records, RECORD_SIZE, chunk, _file) != (size_t)chunk) return false;
+        _count += chunk;
+        samples += chunk;
+        n -= chunk;
+    }
+    return true;
+}
+
+bool TraceWriter::close() {
+    if (!_file) return false;
+    uint8_t count[4];
+    put_u32(count, (uint32_t)_count);
+    bool ok = fseek(_file, 8, SEEK_SET) == 0 && fwrite(count, 1, 4, _file) == 4;
+    ok = fclose(_file) == 0 && ok;
+    _file = nullptr;
+    return ok;
+}
@@ -0,0 +1,168 @@
+//! Offline analyzer: re-runs the on-device pipeline over recorded IMU sessions.
+//! Recordings are traces of raw LSM6DSL samples sampled at POLL_RATE, as CSV or binary (see trace_replay.hpp).
+//! Each recording gets a <name>.timeline.csv with one row of symptom intensities per batch window.
+//!
+//! Build & run with: platformio run -e native_analyzer && .pio/build/native_analyzer/program [options] recordings...
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <string>
+#include <vector>
+
+#include "globals.hpp"
+#include "conditioning.hpp"
+#include "detectors.hpp"
+#include "ingest_pipeline.hpp"
+#include "trace_replay.hpp"
+
+#include "work_stealing_pool.hpp"
+
+// Samples per batch window, as acquisition_task() hands them over
+#define WINDOW_SAMPLES (BATCH_SIZE_FILLED + 1)
+
+typedef struct {
+    std::string path;
+    TraceReplaySource source;
+    std::vector<SymptomIntensities> timeline;
+    bool failed = false; // A read failed before the end of the trace, so the timeline is cut short
+} Recording;
+
+//MARK: Analysis
+
+/** Analyzes each window of a recording as the ingest pipeline fills it */
+class TimelineSink : public BatchSink {
+public:
+    explicit TimelineSink(std::vector<SymptomIntensities> &timeline) : _timeline(timeline) {}
+
+    AnalysisBatch *fill_batch() override { return &_batch; }
+
+    // Only complete windows get analyzed, like on the device
+    void batch_full(AnalysisBatch *batch) override {
+        _timeline.push_back(_analyzer.analyze(batch->accelerometer, batch->gyroscope));
+    }
+
+private:
+    std::vector<SymptomIntensities> &_timeline;
+    PipelineAnalyzer _analyzer;
+    AnalysisBatch _batch;
+};
+
+/** Analyze a whole recording in order, through the same ingest pipeline as acquisition_task(). Resampler,
+ * calibration, conditioner and detector state carries from each window to the next, so recordings aren't
+ * split between workers: a part started mid-way can't rebuild that state, and its windows would differ
+ * from a single pass.
+ * @return false if a binary trace stopped reading before its sample count
+ */
+static bool analyze_recording(Recording &recording) {
+    TimelineSink sink(recording.timeline);
+    IngestPipeline pipeline(sink);
+    long samples = pipeline.run(recording.source);
+    return recording.source.count() < 0 || samples == recording.source.count();
+}
+
+//MARK: Output
+
+static bool write_timeline(const Recording &recording, const char *out_dir) {
+    std::string name = recording.path;
+    size_t slash = name.find_last_of('/');
+    if (slash != std::string::npos) name = name.substr(slash + 1);
+    size_t dot = name.find_last_of('.');
+    if (dot != std::string::npos) name = name.substr(0, dot);
+    std::string path = std::string(out_dir) + "/" + name + ".timeline.csv";
+
+    FILE *file = fopen(path.c_str(), "w");
+    if (!file) return false;
+    fprintf(file, "window,start_s,tremor,dyskinesia,fog\n");
+    for (size_t window = 0; window < recording.timeline.size(); window++) {
+        const SymptomIntensities &result = recording.timeline[window];
+        fprintf(file, "%zu,%.2f,%.4f,%.4f,%.4f\n",
+            window, (double)window * WINDOW_SAMPLES / POLL_RATE, result.tremor, result.dyskinesia, result.fog);
+    }
+    fclose(file);
+    return true;
+}
+
+//MARK: Entry point
+
+static void usage(const char *program) {
+    fprintf(stderr,
+        "usage: %s [-j threads] [-o out_dir] recording.csv...\n"
+        "  -j  worker threads, each analyzing one recording at a time (default: all cores)\n"
+        "  -o  directory for the .timeline.csv files (default: .)\n",
+        program);
+}
+
+int main(int argc, char **argv) {
+    int threads = (int)std::thread::hardware_concurrency();
+    const char *out_dir = ".";
+    std::deque<Recording> recordings; // Never moved, since the sources hold open files
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+            threads = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+            out_dir = argv[++i];
+        } else if (argv[i][0] == '-') {
+            usage(argv[0]);
+            return 1;
+        } else {
+            recordings.emplace_back();
+            recordings.back().path = argv[i];
+        }
+    }
+    if (recordings.empty()) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+
+    for (Recording &recording : recordings) {
+        if (!recording.source.open(recording.path.c_str())) {
+            fprintf(stderr, "Couldn't read %s\n", recording.path.c_str());
+            return 1;
+        }
+        if (recording.source.sample_rate() != POLL_RATE) {
+            fprintf(stderr, "%s was recorded at %d Hz, expected %d Hz\n", recording.path.c_str(), recording.source.sample_rate(), POLL_RATE);
+            return 1;
+        }
+    }
+
+    init_fft();
+
+    WorkStealingPool pool(threads);
+    for (Recording &recording : recordings) {
+        pool.submit([&recording] {
+            if (!analyze_recording(recording)) recording.failed = true;
+        });
+    }
+    pool.run();
+
+    long total_samples = 0;
+    for (const Recording &recording : recordings) total_samples += recording.timeline.size() * WINDOW_SAMPLES;
+
+    // A recording that was cut short gets no timeline at all rather than a partial one
+    int failures = 0;
+    for (const Recording &recording : recordings) {
+        if (recording.failed) {
+            fprintf(stderr, "Couldn't read all of %s; no timeline written\n", recording.path.c_str());
+            failures++;
+        } else if (!write_timeline(recording, out_dir)) {
+            fprintf(stderr, "Couldn't write the timeline for %s\n", recording.path.c_str());
+            return 1;
+        }
+    }
+
+    double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    double busy = 0.0;
+    for (int id = 0; id < pool.threads(); id++) busy += pool.busy_seconds(id);
+
+    fprintf(stderr, "%zu recordings, %ld samples (%.1f h of data) in %.2f s on %d threads\n",
+        recordings.size(), total_samples, total_samples / (3600.0 * POLL_RATE), wall, pool.threads());
+    fprintf(stderr, "  %.0f samples/s total, %.0f samples/s/core (%.0fx real time per core)\n",
+        total_samples / wall, total_samples / busy, total_samples / busy / POLL_RATE);
+    return failures ? 1 : 0;
+}
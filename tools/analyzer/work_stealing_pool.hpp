@@ -0,0 +1,83 @@
+#pragma once
+
+//! A small work-stealing thread pool for the host tools.
+//! Each worker owns a deque: it takes work from the back of its own and steals from the front of the others'.
+//! Tasks are submitted up front and may not submit more tasks; run() returns once every task is done.
+
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class WorkStealingPool {
+public:
+    typedef std::function<void()> Task;
+
+    explicit WorkStealingPool(int threads) : _queues(threads < 1 ? 1 : threads), _busy_seconds(_queues.size(), 0.0) {}
+
+    int threads() const { return (int)_queues.size(); }
+
+    /** Queue a task. Tasks are dealt round-robin, so neighbouring tasks start on different workers. */
+    void submit(Task task) {
+        WorkerQueue &queue = _queues[_next_queue++ % _queues.size()];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        queue.tasks.push_back(std::move(task));
+    }
+
+    /** Run every submitted task to completion. */
+    void run() {
+        std::vector<std::thread> workers;
+        for (int id = 0; id < threads(); id++) {
+            workers.emplace_back(&WorkStealingPool::worker, this, id);
+        }
+        for (auto &worker : workers) worker.join();
+    }
+
+    /** Time a worker spent running tasks during run() */
+    double busy_seconds(int id) const { return _busy_seconds[id]; }
+
+private:
+    struct WorkerQueue {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+
+    bool take(int id, Task &task) {
+        // Own queue first (LIFO keeps the shard we just touched warm)...
+        {
+            WorkerQueue &own = _queues[id];
+            std::lock_guard<std::mutex> lock(own.mutex);
+            if (!own.tasks.empty()) {
+                task = std::move(own.tasks.back());
+                own.tasks.pop_back();
+                return true;
+            }
+        }
+        // ...then steal the oldest task from whoever still has work
+        for (size_t offset = 1; offset < _queues.size(); offset++) {
+            WorkerQueue &victim = _queues[(id + offset) % _queues.size()];
+            std::lock_guard<std::mutex> lock(victim.mutex);
+            if (!victim.tasks.empty()) {
+                task = std::move(victim.tasks.front());
+                victim.tasks.pop_front();
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void worker(int id) {
+        Task task;
+        while (take(id, task)) {
+            auto start = std::chrono::steady_clock::now();
+            task();
+            _busy_seconds[id] += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        }
+    }
+
+    std::vector<WorkerQueue> _queues;
+    std::vector<double> _busy_seconds;
+    size_t _next_queue = 0;
+};
@@ -0,0 +1,2699 @@
+//! Host-side benchmarks for the analysis pipeline.
+//! Build & run with: platformio run -e native_bench && .pio/build/native_bench/program streams
+
+#include <algorithm>
+#include <chrono>
+#include <climits>
+#include <cmath>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "globals.hpp"
+#include "conditioning.hpp"
+#include "orientation.hpp"
+#include "detectors.hpp"
+#include "trace_replay.hpp"
+#include "imu_synth.hpp"
+#include "profiling.hpp"
+#include "deadline.hpp"
+#include "deferred_log.hpp"
+#include "telemetry.hpp"
+#include "stream_packer.hpp"
+#include "notify_policy.hpp"
+#include "symptom_log.hpp"
+#include "imu_codec.hpp"
+#include "episodes.hpp"
+#include "symptom_stats.hpp"
+#include "calibration.hpp"
+#include "orientation_ekf.hpp"
+#include "small_matrix.hpp"
+#include "decimator.hpp"
+#include "rate_control.hpp"
+#include "resampler.hpp"
+#include "ingest_pipeline.hpp"
+#include "mock_gatt.hpp"
+
+typedef std::chrono::steady_clock bench_clock;
+
+static double seconds_since(bench_clock::time_point start) {
+    return std::chrono::duration<double>(bench_clock::now() - start).count();
+}
+
+//MARK: ingest
+
+/** Analyzes each window an IngestPipeline fills, as the analysis thread would, and hands the result to
+ * on_window. on_sample sees every resampled sample on its way in.
+ */
+class AnalyzingSink : public BatchSink {
+public:
+    AnalysisBatch *fill_batch() override { return &_batch; }
+
+    void batch_full(AnalysisBatch *batch) override {
+        SymptomIntensities result = analyzer.analyze(batch->accelerometer, batch->gyroscope);
+        windows++;
+        if (on_window) on_window(result);
+    }
+
+    void resampled(const RawImuSample &sample, uint32_t index) override {
+        if (on_sample) on_sample(sample, index);
+    }
+
+    PipelineAnalyzer analyzer;
+    long windows = 0;
+    std::function<void(const SymptomIntensities &)> on_window;
+    std::function<void(const RawImuSample &, uint32_t)> on_sample;
+
+private:
+    AnalysisBatch _batch;
+};
+
+/** The analyzer's last spectra in the form main.cpp hands to the stream packer and episode extractor */
+class PipelineSpectra {
+public:
+    #if ANALYSIS_PRECISION == ANALYSIS_Q15
+    void update(const PipelineAnalyzer &analyzer) { analyzer.widen_spectra(accelerometer, gyroscope); }
+    float accelerometer[3][BATCH_SIZE / 2 + 1], gyroscope[3][BATCH_SIZE / 2 + 1];
+    #elif ANALYSIS_PRECISION == ANALYSIS_F16
+    void update(const PipelineAnalyzer &analyzer) {
+        accelerometer = analyzer.accelerometer_frequency_magnitudes;
+        gyroscope = analyzer.gyroscope_frequency_magnitudes;
+    }
+    const half_t (*accelerometer)[BATCH_SIZE / 2 + 1] = nullptr;
+    const half_t (*gyroscope)[BATCH_SIZE / 2 + 1] = nullptr;
+    #else
+    void update(const PipelineAnalyzer &analyzer) {
+        accelerometer = analyzer.accelerometer_frequency_magnitudes;
+        gyroscope = analyzer.gyroscope_frequency_magnitudes;
+    }
+    const float (*accelerometer)[BATCH_SIZE / 2 + 1] = nullptr;
+    const float (*gyroscope)[BATCH_SIZE / 2 + 1] = nullptr;
+    #endif
+};
+
+//MARK: streams
+
+/** Fill a batch with a tremor-ish 4 Hz sine plus some noise. The phase differs per stream and batch. */
+static void fill_batch(float accelerometer[3][BATCH_SIZE], float gyroscope[3][BATCH_SIZE], unsigned seed) {
+    for (int axis = 0; axis < 3; axis++) {
+        for (int t = 0; t < BATCH_SIZE; t++) {
+            seed = seed * 1664525u + 1013904223u;
+            float noise = ((seed >> 8) * (1.f / 16777216.f) - 0.5f) * 0.02f;
+            float value = t <= BATCH_SIZE_FILLED ? 0.1f * sinf(2.f * PI * 4.f * (t + seed % 7) / POLL_RATE) + noise : 0.f;
+            accelerometer[axis][t] = value;
+            gyroscope[axis][t] = 10.f * value;
+        }
+    }
+}
+
+/** Run many independent streams on each thread and report how many real-time streams one core can keep up with. */
+static int bench_streams(int argc, char **argv) {
+    int streams_per_thread = argc > 0 ? atoi(argv[0]) : 1000;
+    int batches_per_stream = argc > 1 ? atoi(argv[1]) : 20;
+    int threads = argc > 2 ? atoi(argv[2]) : (int)std::thread::hardware_concurrency();
+    if (threads < 1) threads = 1;
+
+    init_fft();
+
+    std::vector<double> thread_seconds(threads);
+    std::vector<float> checksums(threads);
+    auto worker = [&](int id) {
+        std::vector<SymptomAnalyzer> analyzers(streams_per_thread);
+        float accelerometer[3][BATCH_SIZE], gyroscope[3][BATCH_SIZE];
+        float checksum = 0.f;
+        auto start = bench_clock::now();
+        for (int b = 0; b < batches_per_stream; b++) {
+            for (int s = 0; s < streams_per_thread; s++) {
+                fill_batch(accelerometer, gyroscope, (unsigned)(id * 7919 + s * 31 + b));
+                SymptomIntensities result = analyzers[s].analyze(accelerometer, gyroscope);
+                checksum += result.tremor + result.dyskinesia + result.fog;
+            }
+        }
+        thread_seconds[id] = seconds_since(start);
+        checksums[id] = checksum;
+    };
+
+    std::vector<std::thread> pool;
+    auto start = bench_clock::now();
+    for (int id = 0; id < threads; id++) pool.emplace_back(worker, id);
+    for (auto &thread : pool) thread.join();
+    double wall = seconds_since(start);
+
+    double busy = 0.0, checksum = 0.0;
+    for (int id = 0; id < threads; id++) {
+        busy += thread_seconds[id];
+        checksum += checksums[id];
+    }
+
+    double batches = (double)streams_per_thread * batches_per_stream * threads;
+    double batches_per_core_second = batches / busy;
+    // A real-time stream produces one batch every BATCH_SIZE_FILLED / POLL_RATE seconds
+    double realtime_streams_per_core = batches_per_core_second * BATCH_SIZE_FILLED / POLL_RATE;
+
+    printf("streams: %d threads x %d streams x %d batches in %.3f s (checksum %g)\n",
+        threads, streams_per_thread, batches_per_stream, wall, checksum);
+    printf("  %.0f batches/s total, %.0f batches/s/core\n", batches / wall, batches_per_core_second);
+    printf("  %.0f real-time streams/core\n", realtime_streams_per_core);
+    return 0;
+}
+
+//MARK: replay
+
+/** Push a recorded trace through the whole ingest path (raw samples -> IngestPipeline -> batches -> detectors)
+ * as fast as it will go, and compare that to the rate the sensor produces samples at.
+ * Built with -DPROFILE, this also prints the per-stage timing table.
+ */
+static int bench_replay(int argc, char **argv) {
+    if (argc < 1) return 1;
+    int passes = argc > 1 ? atoi(argv[1]) : 1;
+
+    init_fft();
+    #ifdef PROFILE
+    profile_init();
+    #endif
+
+    AnalyzingSink sink;
+    long samples = 0;
+    float checksum = 0.f;
+    sink.on_window = [&](const SymptomIntensities &result) { checksum += result.tremor + result.dyskinesia + result.fog; };
+
+    double seconds = 0.0;
+    for (int pass = 0; pass < passes; pass++) {
+        TraceReplaySource source;
+        if (!source.open(argv[0])) {
+            fprintf(stderr, "Couldn't read %s\n", argv[0]);
+            return 1;
+        }
+        // Each pass starts over, as the device would after a reboot
+        IngestPipeline pipeline(sink);
+        auto start = bench_clock::now();
+        samples += pipeline.run(source);
+        seconds += seconds_since(start);
+    }
+    long batches = sink.windows;
+
+    printf("replay: %ld samples, %ld batches in %.3f s (checksum %g)\n", samples, batches, seconds, checksum);
+    printf("  %.0f samples/s, %.0fx real time\n", samples / seconds, samples / seconds / POLL_RATE);
+    #ifdef PROFILE
+    profile_dump();
+    #endif
+    return 0;
+}
+
+//MARK: accuracy
+
+/** Run the pipeline over synthetic data and compare each window's intensities to its ground truth.
+ * A window counts as showing a symptom if the symptom covers most of its samples.
+ */
+static int bench_accuracy(int argc, char **argv) {
+    double hours = argc > 0 ? atof(argv[0]) : 24.0;
+    SynthConfig config = synth_default_config();
+    if (argc > 1) config.seed = (uint32_t)atoi(argv[1]);
+
+    init_fft();
+
+    ImuSynth synth(config);
+    AnalyzingSink sink;
+    IngestPipeline pipeline(sink);
+    RawImuSample samples[BATCH_SIZE_FILLED + 1];
+    uint8_t labels[BATCH_SIZE_FILLED + 1];
+
+    // [symptom][window has it] -> sum of intensities and window count
+    const char *names[3] = { "tremor", "dyskinesia", "fog" };
+    const uint8_t truth_flags[3] = { SYNTH_LABEL_TREMOR, SYNTH_LABEL_DYSKINESIA, SYNTH_LABEL_FREEZE };
+    double sums[3][2] = {};
+    long counts[3][2] = {};
+    int labelled[3];
+    sink.on_window = [&](const SymptomIntensities &result) {
+        float values[3] = { result.tremor, result.dyskinesia, result.fog };
+        for (int symptom = 0; symptom < 3; symptom++) {
+            int present = labelled[symptom] * 2 > BATCH_SIZE_FILLED ? 1 : 0;
+            sums[symptom][present] += values[symptom];
+            counts[symptom][present]++;
+        }
+    };
+
+    long windows = (long)(hours * 3600.0 * POLL_RATE / (BATCH_SIZE_FILLED + 1));
+    auto start = bench_clock::now();
+    for (long window = 0; window < windows; window++) {
+        // Synthetic samples are never missed or repeated, so each window's worth fills exactly one batch
+        synth.generate(samples, labels, BATCH_SIZE_FILLED + 1);
+        for (int symptom = 0; symptom < 3; symptom++) {
+            labelled[symptom] = 0;
+            for (int t = 0; t <= BATCH_SIZE_FILLED; t++) {
+                if (labels[t] & truth_flags[symptom]) labelled[symptom]++;
+            }
+        }
+        pipeline.push(samples, BATCH_SIZE_FILLED + 1);
+    }
+    double seconds = seconds_since(start);
+
+    printf("accuracy: %ld windows (%.1f h) in %.3f s\n", windows, hours, seconds);
+    printf("  %-10s  %8s  %8s  %8s  %8s\n", "symptom", "windows", "mean", "windows", "mean");
+    printf("  %-10s  %18s  %18s\n", "", "(absent)", "(present)");
+    for (int symptom = 0; symptom < 3; symptom++) {
+        printf("  %-10s  %8ld  %8.4f  %8ld  %8.4f\n", names[symptom],
+            counts[symptom][0], counts[symptom][0] ? sums[symptom][0] / counts[symptom][0] : 0.0,
+            counts[symptom][1], counts[symptom][1] ? sums[symptom][1] / counts[symptom][1] : 0.0);
+    }
+    return 0;
+}
+
+//MARK: deadline
+
+/** Simulate a serialized producer/consumer handoff on a SimulatedClock with an injected processing time
+ * per batch: the producer can't hand over a batch while the consumer is still busy, and samples that
+ * would have arrived while it waits are lost. See `pipeline` for the queued handoff the board uses.
+ */
+static int bench_deadline(int argc, char **argv) {
+    double processing_ms = argc > 0 ? atof(argv[0]) : 100.0;
+    double jitter_ms = argc > 1 ? atof(argv[1]) : 0.0;
+    long batches = argc > 2 ? atol(argv[2]) : 1000;
+
+    SimulatedClock clock;
+    DeadlineMonitor monitor(clock);
+    unsigned seed = 12345;
+
+    uint64_t next_sample = 0;   // When the sensor delivers its next sample
+    uint64_t consumer_free = 0; // When the consumer finishes the previous batch
+    // What the monitor should report, counted as the simulation goes
+    uint32_t expected_misses = 0, expected_dropped = 0;
+    int64_t expected_worst_us = 0;
+    for (long batch = 0; batch < batches; batch++) {
+        for (int t = 0; t <= BATCH_SIZE_FILLED; t++) {
+            clock.set(next_sample);
+            monitor.sample();
+            next_sample += SAMPLE_PERIOD_US;
+        }
+
+        // The producer blocks until the consumer is done; the sensor keeps going meanwhile
+        uint64_t release = clock.now_us() > consumer_free ? clock.now_us() : consumer_free;
+        uint32_t skipped = 0;
+        while (next_sample <= release) {
+            next_sample += SAMPLE_PERIOD_US;
+            skipped++;
+        }
+        // The monitor only sees the gap when the next batch's first sample arrives
+        if (batch + 1 < batches) expected_dropped += skipped;
+        clock.set(release);
+        monitor.release();
+
+        seed = seed * 1664525u + 1013904223u;
+        double jitter = ((seed >> 8) * (1.0 / 16777216.0) * 2.0 - 1.0) * jitter_ms;
+        double delay_ms = processing_ms + jitter > 0.0 ? processing_ms + jitter : 0.0;
+        consumer_free = release + (uint64_t)(delay_ms * 1000.0);
+        clock.set(consumer_free);
+        monitor.complete(release);
+
+        int64_t slack_us = (int64_t)BATCH_PERIOD_US - (int64_t)(consumer_free - release);
+        if (slack_us < 0) expected_misses++;
+        if (batch == 0 || slack_us < expected_worst_us) expected_worst_us = slack_us;
+    }
+
+    DeadlineStats stats = monitor.stats();
+    printf("deadline: %lu batches, %.1f ms +- %.1f ms processing, %.1f ms period\n",
+        (unsigned long)stats.batches, processing_ms, jitter_ms, BATCH_PERIOD_US / 1000.0);
+    printf("  misses %lu, worst slack %.1f ms, last %d: min %.1f ms mean %.1f ms\n",
+        (unsigned long)stats.misses, stats.worst_slack_us / 1000.0, DEADLINE_WINDOW,
+        stats.window_min_slack_us / 1000.0, stats.window_mean_slack_us / 1000.0);
+    printf("  dropped samples %lu, late samples %lu\n", (unsigned long)stats.dropped_samples, (unsigned long)stats.late_samples);
+
+    // The simulated sensor only ever skips whole periods, so nothing should count as late
+    bool exact = stats.misses == expected_misses && stats.worst_slack_us == expected_worst_us &&
+        stats.dropped_samples == expected_dropped && stats.late_samples == 0;
+    printf("  expected misses %lu, worst slack %.1f ms, dropped samples %lu (%s)\n", (unsigned long)expected_misses,
+        expected_worst_us / 1000.0, (unsigned long)expected_dropped, exact ? "ok" : "FAIL");
+    return exact ? 0 : 1;
+}
+
+//MARK: pipeline
+
+/** Bounded FIFO standing in for an mbed Mail queue */
+template <typename T>
+class BoundedQueue {
+public:
+    explicit BoundedQueue(size_t capacity) : _capacity(capacity) {}
+
+    /** Add an item, or return false straight away if the queue is full */
+    bool try_push(const T &item) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (_items.size() >= _capacity) return false;
+        _items.push_back(item);
+        _ready.notify_one();
+        return true;
+    }
+
+    /** Add an item, waiting for room */
+    void push(const T &item) {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _room.wait(lock, [&] { return _items.size() < _capacity; });
+        _items.push_back(item);
+        _ready.notify_one();
+    }
+
+    T pop() {
+        T item = peek();
+        drop();
+        return item;
+    }
+
+    /** Wait for the oldest item without removing it, so it keeps its slot while being worked on */
+    T peek() {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _ready.wait(lock, [&] { return !_items.empty(); });
+        return _items.front();
+    }
+
+    /** Remove the oldest item */
+    void drop() {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _items.pop_front();
+        _room.notify_one();
+    }
+
+private:
+    std::mutex _mutex;
+    std::condition_variable _ready, _room;
+    std::deque<T> _items;
+    size_t _capacity;
+};
+
+typedef struct {
+    long sequence;         // -1 ends the run
+    bench_clock::time_point release;
+} PipelineBatch;
+
+typedef struct {
+    double mean_latency_ms, p99_latency_ms, max_latency_ms;
+    double interval_jitter_ms; // Standard deviation of the time between publications
+    double stalled_ms;         // Time the producer spent blocked, when the sensor kept going without it
+    long published, dropped_batches, dropped_reports;
+} PipelineResult;
+
+/** Run batches through acquire -> analyze -> publish with real threads and a simulated slow sink.
+ * Serialized: one consumer analyzes and publishes, holding the only batch slot until it's done, and
+ * the producer waits for that slot like it used to wait for the batch mutex.
+ * Pipelined: analysis and publishing have their own threads and queues, and nobody upstream ever waits.
+ */
+static PipelineResult run_pipeline(bool pipelined, double period_ms, double sink_ms, double sink_jitter_ms, long batches) {
+    BoundedQueue<PipelineBatch> batches_queue(pipelined ? 2 : 1);
+    BoundedQueue<PipelineBatch> reports_queue(8);
+    std::vector<double> latencies_ms;
+    std::vector<bench_clock::time_point> published;
+    PipelineResult result = {};
+    auto period = std::chrono::duration_cast<bench_clock::duration>(std::chrono::duration<double, std::milli>(period_ms));
+
+    unsigned seed = 12345;
+    auto publish = [&](const PipelineBatch &batch) {
+        seed = seed * 1664525u + 1013904223u;
+        double jitter = ((seed >> 8) * (1.0 / 16777216.0) * 2.0 - 1.0) * sink_jitter_ms;
+        std::this_thread::sleep_for(std::chrono::duration<double, std::milli>(std::max(0.0, sink_ms + jitter)));
+        auto now = bench_clock::now();
+        latencies_ms.push_back(std::chrono::duration<double, std::milli>(now - batch.release).count());
+        published.push_back(now);
+    };
+
+    SymptomAnalyzer analyzer;
+    float accelerometer[3][BATCH_SIZE], gyroscope[3][BATCH_SIZE];
+    auto analyze = [&](const PipelineBatch &batch) {
+        fill_batch(accelerometer, gyroscope, (unsigned)batch.sequence);
+        analyzer.analyze(accelerometer, gyroscope);
+    };
+
+    std::thread analysis([&] {
+        while (1) {
+            PipelineBatch batch = batches_queue.peek();
+            if (batch.sequence < 0) {
+                if (pipelined) reports_queue.push(batch);
+                return;
+            }
+            if (pipelined) batches_queue.drop();
+            analyze(batch);
+            if (!pipelined) {
+                publish(batch);
+                batches_queue.drop();
+            } else if (!reports_queue.try_push(batch)) {
+                result.dropped_reports++;
+            }
+        }
+    });
+    std::thread publisher([&] {
+        if (!pipelined) return;
+        while (1) {
+            PipelineBatch batch = reports_queue.pop();
+            if (batch.sequence < 0) return;
+            publish(batch);
+        }
+    });
+
+    // The sensor's clock: batch n is full at start + (n + 1) * period, whether or not anyone is listening
+    auto start = bench_clock::now();
+    auto next_release = start + period;
+    for (long n = 0; n < batches; n++) {
+        std::this_thread::sleep_until(next_release);
+        PipelineBatch batch = { n, bench_clock::now() };
+        if (pipelined) {
+            if (!batches_queue.try_push(batch)) result.dropped_batches++;
+        } else {
+            batches_queue.push(batch);
+            auto done = bench_clock::now();
+            double stalled = std::chrono::duration<double, std::milli>(done - batch.release).count();
+            result.stalled_ms += stalled;
+            // Whole batch periods that went by while blocked were never collected
+            while (next_release + period <= done) {
+                next_release += period;
+                result.dropped_batches++;
+            }
+        }
+        next_release += period;
+    }
+    batches_queue.push({ -1, bench_clock::now() });
+    analysis.join();
+    publisher.join();
+
+    result.published = (long)latencies_ms.size();
+    if (result.published == 0) return result;
+    std::sort(latencies_ms.begin(), latencies_ms.end());
+    double sum = 0.0;
+    for (double latency : latencies_ms) sum += latency;
+    result.mean_latency_ms = sum / result.published;
+    result.p99_latency_ms = latencies_ms[(size_t)(0.99 * (result.published - 1))];
+    result.max_latency_ms = latencies_ms.back();
+
+    double interval_sum = 0.0, interval_sq = 0.0;
+    for (size_t i = 1; i < published.size(); i++) {
+        double interval = std::chrono::duration<double, std::milli>(published[i] - published[i - 1]).count();
+        interval_sum += interval;
+        interval_sq += interval * interval;
+    }
+    if (published.size() > 2) {
+        double mean = interval_sum / (published.size() - 1);
+        result.interval_jitter_ms = sqrt(std::max(0.0, interval_sq / (published.size() - 1) - mean * mean));
+    }
+    return result;
+}
+
+/** Compare the serialized handoff with the three-stage pipeline against a sink that is slow now and then.
+ * Times are scaled down from the board's ~3 s batch period so a run takes seconds.
+ */
+static int bench_pipeline(int argc, char **argv) {
+    double period_ms = argc > 0 ? atof(argv[0]) : 30.0;
+    double sink_ms = argc > 1 ? atof(argv[1]) : 15.0;
+    double sink_jitter_ms = argc > 2 ? atof(argv[2]) : 20.0;
+    long batches = argc > 3 ? atol(argv[3]) : 200;
+
+    init_fft();
+    printf("pipeline: %ld batches, %.1f ms period, sink %.1f ms +- %.1f ms\n", batches, period_ms, sink_ms, sink_jitter_ms);
+    printf("  %-10s %9s %9s %9s %9s %10s %9s %9s %9s\n",
+        "mode", "mean ms", "p99 ms", "max ms", "jitter ms", "stalled ms", "published", "lost in", "lost out");
+    for (int pipelined = 0; pipelined <= 1; pipelined++) {
+        PipelineResult r = run_pipeline(pipelined, period_ms, sink_ms, sink_jitter_ms, batches);
+        printf("  %-10s %9.2f %9.2f %9.2f %9.2f %10.1f %9ld %9ld %9ld\n",
+            pipelined ? "pipelined" : "serialized", r.mean_latency_ms, r.p99_latency_ms, r.max_latency_ms,
+            r.interval_jitter_ms, r.stalled_ms, r.published, r.dropped_batches, r.dropped_reports);
+    }
+    return 0;
+}
+
+//MARK: log
+
+static FILE *log_sink;
+
+static void write_log_sink(const char *text, int length) {
+    fwrite(text, 1, length, log_sink);
+}
+
+/** Cost of one log call on the caller's thread: printf-style formatting and writing, against DLOG().
+ * Deferred messages are drained in chunks that fit the ring, and the drain's cost is reported on its own.
+ */
+static int bench_log(int argc, char **argv) {
+    long calls = argc > 0 ? atol(argv[0]) : 1000000;
+    const int chunk = DEFERRED_LOG_CAPACITY / 2;
+    log_sink = fopen("/dev/null", "w");
+    if (!log_sink) {
+        fprintf(stderr, "can't open /dev/null\n");
+        return 1;
+    }
+
+    float value = 0.123f;
+    auto start = bench_clock::now();
+    for (long i = 0; i < calls; i++) {
+        fprintf(log_sink, ">Tremor:%.3f\n", value);
+        value += 0.001f;
+    }
+    fflush(log_sink);
+    double printf_s = seconds_since(start);
+
+    DeferredLog log;
+    double push_s = 0.0, drain_s = 0.0;
+    long drained = 0;
+    value = 0.123f;
+    for (long i = 0; i < calls; i += chunk) {
+        auto push_start = bench_clock::now();
+        for (int j = 0; j < chunk; j++) {
+            log.log(LOG_TREMOR, value);
+            value += 0.001f;
+        }
+        push_s += seconds_since(push_start);
+        auto drain_start = bench_clock::now();
+        drained += log.drain(write_log_sink);
+        drain_s += seconds_since(drain_start);
+    }
+    fflush(log_sink);
+    fclose(log_sink);
+    long pushed = (calls + chunk - 1) / chunk * chunk;
+
+    printf("log: %ld calls of \">Tremor:%%.3f\\n\"\n", calls);
+    printf("  printf          %8.1f ns/call on the caller\n", printf_s * 1e9 / calls);
+    printf("  deferred        %8.1f ns/call on the caller\n", push_s * 1e9 / pushed);
+    printf("  deferred drain  %8.1f ns/message on the drain thread (%ld drained, %lu dropped)\n",
+        drain_s * 1e9 / (drained ? drained : 1), drained, (unsigned long)log.dropped());
+    return 0;
+}
+
+//MARK: telemetry
+
+/** Encode and decode packed telemetry frames: throughput, and what a window costs on air at a few MTUs */
+static int bench_telemetry(int argc, char **argv) {
+    long frames = argc > 0 ? atol(argv[0]) : 10000000;
+
+    TelemetryFrame frame = {};
+    frame.extras_mask = (1 << TELEMETRY_EXTRA_COUNT) - 1;
+    uint8_t buffer[TELEMETRY_MAX_SIZE];
+    long bytes = 0, mismatches = 0;
+    float checksum = 0.f;
+
+    auto start = bench_clock::now();
+    for (long i = 0; i < frames; i++) {
+        frame.sequence = (uint16_t)i;
+        frame.timestamp_ms = (uint32_t)(i * (BATCH_PERIOD_US / 1000));
+        frame.tremor = (float)(i & 1023) * 0.001f;
+        bytes += telemetry_encode(frame, buffer, sizeof(buffer));
+    }
+    double encode_s = seconds_since(start);
+
+    TelemetryFrame decoded;
+    telemetry_encode(frame, buffer, sizeof(buffer));
+    start = bench_clock::now();
+    for (long i = 0; i < frames; i++) {
+        buffer[2] = (uint8_t)i; // Vary the input so the loop can't be hoisted
+        if (!telemetry_decode(buffer, sizeof(buffer), decoded)) mismatches++;
+        checksum += decoded.sequence;
+    }
+    double decode_s = seconds_since(start);
+
+    // Round trip at every payload size a connection can have
+    for (int size = TELEMETRY_CORE_SIZE; size <= TELEMETRY_MAX_SIZE; size++) {
+        frame.extras[TELEMETRY_EXTRA_ENERGY] = 12.5f;
+        int written = telemetry_encode(frame, buffer, size);
+        if (written > size || !telemetry_decode(buffer, written, decoded) || decoded.sequence != frame.sequence ||
+            decoded.tremor != frame.tremor || decoded.extras_mask != (1 << (written - TELEMETRY_CORE_SIZE) / 4) - 1) {
+            mismatches++;
+        }
+    }
+
+    printf("telemetry: %ld frames of %d bytes (checksum %g)\n", frames, TELEMETRY_MAX_SIZE, checksum);
+    printf("  encode %.1f Mframes/s (%.0f MB/s), decode %.1f Mframes/s, %ld mismatches\n",
+        frames / encode_s / 1e6, bytes / encode_s / 1e6, frames / decode_s / 1e6, mismatches);
+    // Separate characteristics: three notifications of 4 bytes, each with 3 bytes of ATT header
+    printf("  per window: separate floats 3 notifications, %d bytes on ATT\n", 3 * (4 + TELEMETRY_ATT_OVERHEAD));
+    const int mtus[] = { TELEMETRY_DEFAULT_ATT_MTU, 27, 185, 247 };
+    for (int mtu : mtus) {
+        int size = telemetry_encode(frame, buffer, telemetry_payload_size(mtu));
+        printf("  per window: packed at MTU %3d  1 notification, %d bytes on ATT (%d extras)\n",
+            mtu, size + TELEMETRY_ATT_OVERHEAD, (size - TELEMETRY_CORE_SIZE) / 4);
+    }
+    return mismatches != 0;
+}
+
+//MARK: stream
+
+/** Offer queued packets to the link until it refuses one, like ParkinsonBLE::pump_stream() */
+static void pump_stream(StreamPacker &packer, MockGattServer &server) {
+    int size;
+    const uint8_t *packet;
+    while ((packet = packer.peek(size)) != nullptr && server.notify(packet, size)) packer.pop();
+}
+
+/** Stream synthetic data through a StreamPacker and a simulated link, and check what the central gets.
+ * A connection event sends at most packets_per_event notifications; the stack holds 6 more.
+ */
+static int bench_stream(int argc, char **argv) {
+    const char *mode_name = argc > 0 ? argv[0] : "raw";
+    int att_mtu = argc > 1 ? atoi(argv[1]) : 247;
+    double interval_ms = argc > 2 ? atof(argv[2]) : 30.0;
+    int packets_per_event = argc > 3 ? atoi(argv[3]) : 4;
+    double seconds = argc > 4 ? atof(argv[4]) : 600.0;
+    StreamMode mode = strcmp(mode_name, "spectral") == 0 ? STREAM_SPECTRAL : STREAM_RAW;
+
+    init_fft();
+    StreamPacker packer;
+    packer.set_mode(mode);
+    packer.set_packet_size(att_mtu - 3);
+    MockGattServer server(att_mtu, packets_per_event, 6);
+
+    SynthSource source(synth_default_config(), (long)(seconds * POLL_RATE));
+    AnalyzingSink sink;
+    PipelineSpectra spectra;
+    uint32_t index = 0, window = 0;
+
+    uint64_t interval_us = (uint64_t)(interval_ms * 1000.0);
+    uint64_t next_event_us = interval_us;
+    sink.on_sample = [&](const RawImuSample &sample, uint32_t sample_index) {
+        uint64_t now_us = (uint64_t)sample_index * 1000000 / POLL_RATE;
+        for (; next_event_us <= now_us; next_event_us += interval_us) {
+            if (server.connection_event() > 0) pump_stream(packer, server);
+        }
+        if (mode == STREAM_RAW) packer.add_raw(sample, sample_index);
+        index = sample_index + 1;
+        pump_stream(packer, server);
+    };
+    sink.on_window = [&](const SymptomIntensities &) {
+        if (mode == STREAM_SPECTRAL) {
+            spectra.update(sink.analyzer);
+            packer.add_spectra(window, spectra.accelerometer, spectra.gyroscope);
+        }
+        window++;
+    };
+    IngestPipeline pipeline(sink);
+    auto start = bench_clock::now();
+    pipeline.run(source);
+    double run_s = seconds_since(start);
+    // Let the link drain what's left
+    int size;
+    while (server.connection_event() > 0 || packer.peek(size)) pump_stream(packer, server);
+
+    StreamStatus status = packer.status();
+    double link_capacity = packets_per_event * (att_mtu - 3) * 1000.0 / interval_ms;
+    printf("stream: %s, %.0f s of data, MTU %d, %d packets per %.1f ms event (link %.0f B/s), ran in %.2f s\n",
+        mode == STREAM_RAW ? "raw" : "spectral", seconds, att_mtu, packets_per_event, interval_ms, link_capacity, run_s);
+    printf("  device:  %lu packets sent, %lu dropped (%lu %s)\n",
+        (unsigned long)status.packets_sent, (unsigned long)status.packets_dropped, (unsigned long)status.values_dropped,
+        mode == STREAM_RAW ? "samples" : "bins");
+    printf("  central: %ld packets, %.0f B/s, %ld lost by sequence number\n",
+        server.packets, server.bytes / seconds, server.lost_packets);
+    if (mode == STREAM_RAW) {
+        printf("  central: %ld of %lu samples, %ld missing by position\n", server.raw_samples, (unsigned long)index, server.raw_gap_samples);
+    } else {
+        printf("  central: %ld of %ld bins\n", server.spectral_bins, (long)window * 6 * STREAM_SPECTRUM_BINS);
+    }
+    return 0;
+}
+
+//MARK: notify
+
+/** Intensities of every window of a trace, or of synthetic data if path is null */
+static std::vector<SymptomIntensities> analyze_windows(const char *path, double synth_hours) {
+    std::vector<SymptomIntensities> windows;
+    TraceReplaySource trace;
+    SynthSource synth(synth_default_config(), (long)(synth_hours * 3600 * POLL_RATE));
+    ImuSource *source = &synth;
+    if (path) {
+        if (!trace.open(path)) {
+            fprintf(stderr, "Couldn't read %s\n", path);
+            return windows;
+        }
+        source = &trace;
+    }
+
+    init_fft();
+    AnalyzingSink sink;
+    sink.on_window = [&](const SymptomIntensities &result) { windows.push_back(result); };
+    IngestPipeline pipeline(sink);
+    pipeline.run(*source);
+    return windows;
+}
+
+/** Replay windows through the notify policy at a range of deadbands. The central keeps the last values
+ * it was sent; the error is how far those are from the real values of every window.
+ */
+static int bench_notify(int argc, char **argv) {
+    const char *path = argc > 0 && strcmp(argv[0], "synth") != 0 ? argv[0] : nullptr;
+    uint32_t min_interval_ms = argc > 1 ? (uint32_t)(atof(argv[1]) * 1000) : NOTIFY_DEFAULT_MIN_INTERVAL_MS;
+    uint32_t max_staleness_ms = argc > 2 ? (uint32_t)(atof(argv[2]) * 1000) : NOTIFY_DEFAULT_MAX_STALENESS_MS;
+
+    std::vector<SymptomIntensities> windows = analyze_windows(path, 24.0);
+    if (windows.empty()) return 1;
+
+    printf("notify: %zu windows from %s, min interval %.1f s, max staleness %.1f s\n",
+        windows.size(), path ? path : "24 h of synthetic data", min_interval_ms / 1000.0, max_staleness_ms / 1000.0);
+    printf("  %8s %8s %7s   %-23s %-23s %-23s %s\n", "deadband", "notified", "share", "tremor err mean/max",
+        "dyskinesia err mean/max", "fog err mean/max", "bounds");
+
+    const float deadbands[] = { 0.f, 0.005f, 0.01f, 0.02f, 0.05f, 0.1f };
+    bool failed = false;
+    for (float deadband : deadbands) {
+        NotifyPolicyConfig config = notify_default_config();
+        for (int field = 0; field < NOTIFY_FIELD_COUNT; field++) {
+            config.rules[field].deadband = deadband;
+            config.rules[field].min_interval_ms = min_interval_ms;
+            config.rules[field].max_staleness_ms = max_staleness_ms;
+        }
+        // FOG only takes a few values; any change is worth sending
+        config.rules[2].deadband = deadband > 0.f ? NOTIFY_DEFAULT_FOG_DEADBAND : 0.f;
+        NotifyPolicy policy;
+        policy.configure(config);
+
+        long notified = 0;
+        double error_sum[3] = {}, error_max[3] = {};
+        float held[3] = {};
+        uint32_t sent_ms = 0;
+        // What the policy promises: with no minimum interval the central is never off by more than the
+        // deadband, and with a staleness limit it hears something at least that often (to the next window)
+        bool within_bounds = true;
+        for (size_t window = 0; window < windows.size(); window++) {
+            TelemetryFrame frame = {};
+            frame.timestamp_ms = (uint32_t)(window * BATCH_PERIOD_US / 1000);
+            frame.tremor = windows[window].tremor;
+            frame.dyskinesia = windows[window].dyskinesia;
+            frame.fog = windows[window].fog;
+            if (policy.should_send(frame)) {
+                notified++;
+                held[0] = frame.tremor;
+                held[1] = frame.dyskinesia;
+                held[2] = frame.fog;
+                sent_ms = frame.timestamp_ms;
+            }
+            if (max_staleness_ms > 0 && frame.timestamp_ms - sent_ms >= max_staleness_ms + BATCH_PERIOD_US / 1000 + 1) {
+                within_bounds = false;
+            }
+            const float actual[3] = { frame.tremor, frame.dyskinesia, frame.fog };
+            for (int field = 0; field < 3; field++) {
+                double error = fabs(actual[field] - held[field]);
+                error_sum[field] += error;
+                if (error > error_max[field]) error_max[field] = error;
+                if (min_interval_ms == 0 && error > config.rules[field].deadband) within_bounds = false;
+            }
+        }
+        if (!within_bounds) failed = true;
+
+        char columns[3][32];
+        for (int field = 0; field < 3; field++) {
+            snprintf(columns[field], sizeof(columns[field]), "%.4f / %.4f", error_sum[field] / windows.size(), error_max[field]);
+        }
+        printf("  %8.3f %8ld %6.1f%%   %-23s %-23s %-23s %s\n", deadband, notified, 100.0 * notified / windows.size(),
+            columns[0], columns[1], columns[2], within_bounds ? "ok" : "FAIL");
+    }
+    return failed ? 1 : 0;
+}
+
+//MARK: history
+
+// Board flash the endurance numbers are projected to: MX25R6435F, 8 MB, 100k erase cycles
+#define HISTORY_BOARD_FLASH_BYTES (8ull << 20)
+#define HISTORY_ERASE_CYCLES 100000
+
+static SymptomLogEntry history_entry(uint32_t window) {
+    uint32_t seed = window * 2654435761u;
+    SymptomLogEntry entry;
+    entry.time_ms = (uint32_t)(window * BATCH_PERIOD_US / 1000);
+    entry.tremor = (seed >> 16) / 65536.f;
+    entry.dyskinesia = (seed & 0xFFFF) / 65536.f;
+    entry.fog = (window % 7) / 6.f;
+    entry.flags = window % 100 == 0 ? LOG_FLAG_DROPPED_SAMPLES : 0;
+    return entry;
+}
+
+/** Write days of windows into a SymptomLog on a simulated NOR device, rebooting once a day, then read it all
+ * back. Reports write throughput, write amplification and wear, projected onto the board's QSPI flash.
+ */
+static int bench_history(int argc, char **argv) {
+    long device_kb = argc > 0 ? atol(argv[0]) : 256;
+    double days = argc > 1 ? atof(argv[1]) : 30.0;
+    const char *path = argc > 2 ? argv[2] : nullptr;
+
+    FileBlockDevice device(path, (mbed::bd_size_t)device_kb * 1024);
+    uint32_t windows = (uint32_t)(days * 86400e6 / BATCH_PERIOD_US);
+    uint32_t windows_per_day = (uint32_t)(86400e6 / BATCH_PERIOD_US);
+    long lost_on_reboot = 0;
+
+    auto start = bench_clock::now();
+    SymptomLog *log = new SymptomLog(&device);
+    if (int err = log->mount()) {
+        fprintf(stderr, "mount failed: %d\n", err);
+        return 1;
+    }
+    uint32_t first_page = log->next_page();
+    for (uint32_t window = 0; window < windows; window++) {
+        if (window > 0 && window % windows_per_day == 0) {
+            // Reboot without flushing, like a reset would
+            lost_on_reboot += log->entries_buffered();
+            delete log;
+            log = new SymptomLog(&device);
+            if (int err = log->mount()) {
+                fprintf(stderr, "remount failed: %d\n", err);
+                return 1;
+            }
+        }
+        log->append(history_entry(window));
+    }
+    log->flush();
+    double write_s = seconds_since(start);
+
+    // Read back everything still on flash; the newest windows must come back as written
+    uint8_t page[LOG_PAGE_SIZE];
+    SymptomLogPage decoded;
+    long entries = 0, mismatches = 0, bad_pages = 0;
+    uint32_t expected = 0;
+    bool have_expected = false;
+    uint16_t boot = 0;
+    start = bench_clock::now();
+    for (uint32_t sequence = log->oldest_page(); sequence < log->next_page(); sequence++) {
+        if (log->read_page(sequence, page) != 0) continue;
+        if (!symptom_log_decode_page(page, decoded)) {
+            bad_pages++;
+            continue;
+        }
+        // A backing file left by an earlier run starts over at time 0 in a later boot
+        if (have_expected && decoded.boot != boot && decoded.entries[0].time_ms == 0) have_expected = false;
+        boot = decoded.boot;
+        for (int i = 0; i < decoded.count; i++) {
+            const SymptomLogEntry &entry = decoded.entries[i];
+            uint32_t window = (uint32_t)(((uint64_t)entry.time_ms * 1000 + BATCH_PERIOD_US / 2) / BATCH_PERIOD_US);
+            // Windows lost in reboots show up as jumps; anything else out of order is a bug
+            if (have_expected && window < expected) mismatches++;
+            SymptomLogEntry original = history_entry(window);
+            if (fabsf(entry.tremor - original.tremor) > 1.f / 65535 || fabsf(entry.fog - original.fog) > 1.f / 255 ||
+                entry.flags != original.flags) {
+                mismatches++;
+            }
+            expected = window + 1;
+            have_expected = true;
+            entries++;
+        }
+    }
+    double read_s = seconds_since(start);
+
+    const std::vector<uint32_t> &erases = device.erase_counts();
+    uint32_t erase_min = erases[0], erase_max = erases[0];
+    double erase_sum = 0.0;
+    for (uint32_t count : erases) {
+        erase_min = count < erase_min ? count : erase_min;
+        erase_max = count > erase_max ? count : erase_max;
+        erase_sum += count;
+    }
+    double erase_mean = erase_sum / erases.size();
+    // Wear scales with how many blocks the same data is spread over
+    double board_erases_per_year = erase_mean / days * 365.0 * device.size() / HISTORY_BOARD_FLASH_BYTES;
+    uint32_t pages_written = log->next_page() - first_page;
+
+    printf("history: %u windows (%.1f days) into %ld KB%s, rebooting daily\n", windows, days, device_kb, path ? " (file)" : "");
+    printf("  write: %.2f M entries/s, %u pages, %.2f bytes programmed per 8 byte entry, %ld entries lost to reboots\n",
+        windows / write_s / 1e6, pages_written, (double)device.bytes_programmed() / (windows - lost_on_reboot), lost_on_reboot);
+    printf("  read:  %ld entries on flash (%.1f days) in %.3f s, %ld mismatches, %ld bad pages, %lu program violations\n",
+        entries, entries * (BATCH_PERIOD_US / 1e6) / 86400.0, read_s, mismatches, bad_pages, (unsigned long)device.program_violations());
+    printf("  wear:  erases per block min %u mean %.1f max %u\n", erase_min, erase_mean, erase_max);
+    printf("  board: 8 MB holds %.0f days; %.1f erases per block per year, %.0f years to %d cycles\n",
+        HISTORY_BOARD_FLASH_BYTES / LOG_PAGE_SIZE * LOG_RECORDS_PER_PAGE * (BATCH_PERIOD_US / 1e6) / 86400.0,
+        board_erases_per_year, HISTORY_ERASE_CYCLES / board_erases_per_year, HISTORY_ERASE_CYCLES);
+    delete log;
+    return mismatches || bad_pages || device.program_violations() ? 1 : 0;
+}
+
+//MARK: codec
+
+/** Compress a trace (or synthetic data) with the IMU codec, decode it again and check it round-trips.
+ * Reports the compression ratio, coding speed, and that blocks decode on their own from any offset.
+ */
+static int bench_codec(int argc, char **argv) {
+    const char *path = argc > 0 && strcmp(argv[0], "synth") != 0 ? argv[0] : nullptr;
+    double synth_hours = argc > 1 ? atof(argv[1]) : 1.0;
+
+    std::vector<RawImuSample> samples;
+    TraceReplaySource trace;
+    SynthSource synth(synth_default_config(), (long)(synth_hours * 3600 * POLL_RATE));
+    ImuSource *source = &synth;
+    if (path) {
+        if (!trace.open(path)) {
+            fprintf(stderr, "Couldn't read %s\n", path);
+            return 1;
+        }
+        source = &trace;
+    }
+    RawImuSample sample;
+    while (source->read(sample)) samples.push_back(sample);
+    if (samples.empty()) return 1;
+
+    std::vector<uint8_t> stream;
+    std::vector<size_t> offsets; // Where each block starts, as a seek index would record
+    long order_counts[IMU_CODEC_AXES][IMU_CODEC_MAX_ORDER + 1] = {};
+    ImuEncoder encoder;
+    auto start = bench_clock::now();
+    for (const RawImuSample &s : samples) {
+        int size = encoder.add(s);
+        if (size) {
+            offsets.push_back(stream.size());
+            stream.insert(stream.end(), encoder.block(), encoder.block() + size);
+        }
+    }
+    if (int size = encoder.finish()) {
+        offsets.push_back(stream.size());
+        stream.insert(stream.end(), encoder.block(), encoder.block() + size);
+    }
+    double encode_s = seconds_since(start);
+
+    for (size_t offset : offsets) {
+        uint16_t orders = get_u16(&stream[offset + 8]);
+        for (int axis = 0; axis < IMU_CODEC_AXES; axis++) order_counts[axis][(orders >> (2 * axis)) & 3]++;
+    }
+
+    // Decode the stream front to back, walking it by the block headers alone
+    std::vector<RawImuSample> decoded(samples.size());
+    RawImuSample block[IMU_CODEC_BLOCK_SAMPLES];
+    long errors = 0;
+    size_t offset = 0, decoded_count = 0;
+    start = bench_clock::now();
+    while (offset < stream.size()) {
+        int count = imu_codec_decode_block(&stream[offset], (int)(stream.size() - offset), block);
+        int block_size = get_u16(&stream[offset + 2]);
+        if (count < 0 || decoded_count + count > decoded.size()) {
+            errors++;
+            break;
+        }
+        memcpy(&decoded[decoded_count], block, count * sizeof(RawImuSample));
+        decoded_count += count;
+        offset += block_size;
+    }
+    double decode_s = seconds_since(start);
+    if (decoded_count != samples.size() || memcmp(decoded.data(), samples.data(), samples.size() * sizeof(RawImuSample))) {
+        errors++;
+    }
+
+    // Seek: any block decodes on its own and says where it belongs
+    srand(1);
+    for (int i = 0; i < 1000; i++) {
+        size_t index = rand() % offsets.size();
+        int count, block_size;
+        uint32_t first_sample;
+        if (!imu_codec_block_info(&stream[offsets[index]], (int)(stream.size() - offsets[index]), count, block_size, first_sample) ||
+            imu_codec_decode_block(&stream[offsets[index]], block_size, block) != count ||
+            memcmp(block, &samples[first_sample], count * sizeof(RawImuSample))) {
+            errors++;
+        }
+    }
+
+    double raw_bytes = (double)samples.size() * sizeof(RawImuSample);
+    double day_samples = 86400.0 * POLL_RATE;
+    printf("codec: %zu samples (%.1f h) from %s, %zu blocks of %d\n",
+        samples.size(), samples.size() / (3600.0 * POLL_RATE), path ? path : "synth", offsets.size(), IMU_CODEC_BLOCK_SAMPLES);
+    printf("  %.0f -> %zu bytes, ratio %.2f, %.2f bits per axis sample, %.2f MB per day (raw %.2f)\n",
+        raw_bytes, stream.size(), raw_bytes / stream.size(), stream.size() * 8.0 / samples.size() / IMU_CODEC_AXES,
+        stream.size() / (double)samples.size() * day_samples / 1e6, sizeof(RawImuSample) * day_samples / 1e6);
+    printf("  encode %.0f ns/sample (%.1f M samples/s), decode %.0f ns/sample (%.1f M samples/s)\n",
+        encode_s * 1e9 / samples.size(), samples.size() / encode_s / 1e6,
+        decode_s * 1e9 / samples.size(), samples.size() / decode_s / 1e6);
+    printf("  predictor orders per axis (0/1/2/3):");
+    for (int axis = 0; axis < IMU_CODEC_AXES; axis++) {
+        printf(" %ld/%ld/%ld/%ld", order_counts[axis][0], order_counts[axis][1], order_counts[axis][2], order_counts[axis][3]);
+    }
+    printf("\n  %s, %ld errors\n", errors ? "ROUND TRIP FAILED" : "round trip and 1000 random seeks exact", errors);
+    return errors ? 1 : 0;
+}
+
+//MARK: episodes
+
+/** Run a day of synthetic data (or a trace) through the analysis and the episode extractor, and compare
+ * what each way of publishing the results would send: every window, windows the default notify policy
+ * lets through, or episode events. On synthetic data, episodes are also checked against the ground truth.
+ */
+static int bench_episodes(int argc, char **argv) {
+    const char *path = argc > 0 && strcmp(argv[0], "synth") != 0 ? argv[0] : nullptr;
+    double hours = argc > 1 ? atof(argv[1]) : 24.0;
+
+    TraceReplaySource trace;
+    if (path && !trace.open(path)) {
+        fprintf(stderr, "Couldn't read %s\n", path);
+        return 1;
+    }
+    ImuSynth synth(synth_default_config());
+
+    init_fft();
+    AnalyzingSink sink;
+    PipelineSpectra spectra;
+    EpisodeExtractor extractor;
+    NotifyPolicy policy;
+    EpisodeConfig config = episode_default_config();
+    RawImuSample samples[BATCH_SIZE_FILLED + 1];
+    uint8_t labels[BATCH_SIZE_FILLED + 1] = {};
+    const uint8_t truth_flags[EPISODE_KIND_COUNT] = { SYNTH_LABEL_TREMOR, SYNTH_LABEL_DYSKINESIA, SYNTH_LABEL_FREEZE };
+    const char *names[EPISODE_KIND_COUNT] = { "tremor", "dyskinesia", "fog" };
+
+    // Ground truth episodes are runs of windows mostly covered by a label
+    struct Span { uint32_t start_ms, end_ms; };
+    std::vector<Span> truth[EPISODE_KIND_COUNT], found[EPISODE_KIND_COUNT];
+    bool in_truth[EPISODE_KIND_COUNT] = {};
+
+    long window = 0, notified = 0, events = 0;
+    int labelled[EPISODE_KIND_COUNT] = {};
+    EpisodeEvent window_events[EPISODE_MAX_EVENTS];
+    sink.on_window = [&](const SymptomIntensities &result) {
+        spectra.update(sink.analyzer);
+        float dominant_hz[EPISODE_KIND_COUNT];
+        episode_window_frequencies(config, spectra.accelerometer, dominant_hz);
+
+        uint32_t time_ms = (uint32_t)(window * BATCH_PERIOD_US / 1000);
+        TelemetryFrame frame = {};
+        frame.timestamp_ms = time_ms;
+        frame.tremor = result.tremor;
+        frame.dyskinesia = result.dyskinesia;
+        frame.fog = result.fog;
+        if (policy.should_send(frame)) notified++;
+
+        int n = extractor.update(time_ms, result, dominant_hz, window_events);
+        events += n;
+        for (int i = 0; i < n; i++) {
+            const EpisodeEvent &event = window_events[i];
+            if (event.type == EPISODE_END) found[event.kind].push_back({ event.onset_ms, event.onset_ms + event.duration_ms });
+        }
+
+        for (int kind = 0; kind < EPISODE_KIND_COUNT; kind++) {
+            bool present = labelled[kind] * 2 > BATCH_SIZE_FILLED;
+            if (present && !in_truth[kind]) truth[kind].push_back({ time_ms, 0 });
+            if (present) truth[kind].back().end_ms = time_ms + EPISODE_WINDOW_MS;
+            in_truth[kind] = present;
+        }
+        window++;
+    };
+
+    IngestPipeline pipeline(sink);
+    auto start = bench_clock::now();
+    if (path) {
+        pipeline.run(trace);
+    } else {
+        long windows = (long)(hours * 3600.0 * POLL_RATE / (BATCH_SIZE_FILLED + 1));
+        for (long w = 0; w < windows; w++) {
+            // Synthetic samples are never missed or repeated, so each window's worth fills exactly one batch
+            synth.generate(samples, labels, BATCH_SIZE_FILLED + 1);
+            for (int kind = 0; kind < EPISODE_KIND_COUNT; kind++) {
+                labelled[kind] = 0;
+                for (int t = 0; t <= BATCH_SIZE_FILLED; t++) {
+                    if (labels[t] & truth_flags[kind]) labelled[kind]++;
+                }
+            }
+            pipeline.push(samples, BATCH_SIZE_FILLED + 1);
+        }
+    }
+    int n = extractor.flush(window_events);
+    events += n;
+    for (int i = 0; i < n; i++) {
+        const EpisodeEvent &event = window_events[i];
+        found[event.kind].push_back({ event.onset_ms, event.onset_ms + event.duration_ms });
+    }
+    double seconds = seconds_since(start);
+    hours = window * (BATCH_PERIOD_US / 1e6) / 3600.0;
+
+    // Everything main() puts in a frame: the core and three extras
+    long frame_size = TELEMETRY_CORE_SIZE + 4 * TELEMETRY_EXTRA_COUNT;
+    printf("episodes: %ld windows (%.1f h) from %s in %.3f s\n", window, hours, path ? path : "synth", seconds);
+    printf("  every window:   %8ld bytes (%ld notifications)\n", window * frame_size, window);
+    printf("  notify policy:  %8ld bytes (%ld notifications)\n", notified * frame_size, notified);
+    printf("  episode events: %8ld bytes (%ld notifications), %.0fx less than every window\n",
+        events * EPISODE_EVENT_SIZE, events, events ? (double)window * frame_size / (events * EPISODE_EVENT_SIZE) : 0.0);
+
+    printf("  %-10s  %8s  %8s  %10s  %10s  %8s\n", "symptom", "episodes", "truth", "precision", "recall", "mean s");
+    for (int kind = 0; kind < EPISODE_KIND_COUNT; kind++) {
+        // An episode is right if it overlaps a true one, and a true one is found if any episode overlaps it
+        auto overlaps = [](const Span &a, const std::vector<Span> &spans) {
+            for (const Span &b : spans) {
+                if (a.start_ms < b.end_ms && b.start_ms < a.end_ms) return true;
+            }
+            return false;
+        };
+        long right = 0, hit = 0;
+        double total_s = 0.0;
+        for (const Span &span : found[kind]) {
+            if (overlaps(span, truth[kind])) right++;
+            total_s += (span.end_ms - span.start_ms) / 1000.0;
+        }
+        for (const Span &span : truth[kind]) {
+            if (overlaps(span, found[kind])) hit++;
+        }
+        printf("  %-10s  %8zu  %8s  %10s  %10s  %8.1f\n", names[kind], found[kind].size(),
+            path ? "-" : std::to_string(truth[kind].size()).c_str(),
+            path || found[kind].empty() ? "-" : std::to_string(100 * right / (long)found[kind].size()).append("%").c_str(),
+            path || truth[kind].empty() ? "-" : std::to_string(100 * hit / (long)truth[kind].size()).append("%").c_str(),
+            found[kind].empty() ? 0.0 : total_s / found[kind].size());
+    }
+    return 0;
+}
+
+//MARK: quantiles
+
+/** How far q is from the exact rank of value among sorted values. With ties, any rank the value spans counts. */
+static double rank_error(const std::vector<float> &sorted, float value, float q) {
+    double below = (double)(std::lower_bound(sorted.begin(), sorted.end(), value) - sorted.begin()) / sorted.size();
+    double at_or_below = (double)(std::upper_bound(sorted.begin(), sorted.end(), value) - sorted.begin()) / sorted.size();
+    return q < below ? below - q : q > at_or_below ? q - at_or_below : 0.0;
+}
+
+/** Feed days of windows into SymptomStats, one per day, and compare their percentiles to exact ones.
+ * Each day then goes through the BLE wire format and all of them are merged, as a host would across days.
+ */
+static int bench_quantiles(int argc, char **argv) {
+    const char *path = argc > 0 && strcmp(argv[0], "synth") != 0 ? argv[0] : nullptr;
+    double days = argc > 1 ? atof(argv[1]) : 3.0;
+    std::vector<SymptomIntensities> windows = analyze_windows(path, days * 24.0);
+    if (windows.empty()) return 1;
+
+    EpisodeConfig episodes = episode_default_config();
+    float thresholds[STATS_SYMPTOMS];
+    for (int symptom = 0; symptom < STATS_SYMPTOMS; symptom++) thresholds[symptom] = episodes.rules[symptom].onset;
+    const char *names[STATS_SYMPTOMS] = { "tremor", "dyskinesia", "fog" };
+    const float qs[3] = { 0.5f, 0.9f, 0.99f };
+    uint32_t window_ms = (uint32_t)(BATCH_PERIOD_US / 1000);
+    size_t per_day = (size_t)(86400e6 / BATCH_PERIOD_US);
+
+    // Update cost, over all windows a few times
+    SymptomStats timing(thresholds);
+    int passes = 20;
+    auto start = bench_clock::now();
+    for (int pass = 0; pass < passes; pass++) {
+        timing.reset(0);
+        for (const SymptomIntensities &w : windows) timing.update(w, window_ms);
+    }
+    double update_ns = seconds_since(start) * 1e9 / (passes * windows.size());
+    start = bench_clock::now();
+    float checksum = 0.f;
+    for (int pass = 0; pass < 1000; pass++) checksum += timing.summary().symptoms[0].p90;
+    double summary_us = seconds_since(start) * 1e6 / 1000;
+
+    printf("quantiles: %zu windows (%.1f days) from %s, k=%d, %zu bytes per SymptomStats\n", windows.size(),
+        windows.size() / (double)per_day, path ? path : "synth", QUANTILE_SKETCH_K, sizeof(SymptomStats));
+    printf("  update %.0f ns/window (3 sketches), summary %.1f us (checksum %g)\n", update_ns, summary_us, checksum);
+    printf("  %-10s  %5s  %9s  %9s  %9s  %9s\n", "symptom", "day", "p50", "p90", "p99", "rank err");
+
+    // One SymptomStats per day, sent through the wire format and merged
+    SymptomStats merged(thresholds);
+    bool have_merged = false;
+    double worst_day_error = 0.0;
+    long sketch_bytes = 0, sketches = 0;
+    uint8_t buffer[STATS_SKETCH_MAX_SIZE];
+    for (size_t day_start = 0, day = 0, day_end; day_start < windows.size(); day_start = day_end, day++) {
+        // A short day at the end goes with the one before
+        day_end = windows.size() - day_start < per_day * 3 / 2 ? windows.size() : day_start + per_day;
+        SymptomStats stats(thresholds);
+        for (size_t i = day_start; i < day_end; i++) stats.update(windows[i], window_ms);
+
+        StatsSummary summary = stats.summary();
+        uint8_t summary_bytes[STATS_SUMMARY_SIZE];
+        stats_summary_encode(summary, summary_bytes);
+        SymptomStats received(thresholds);
+        StatsSummary received_summary;
+        stats_summary_decode(summary_bytes, STATS_SUMMARY_SIZE, received_summary);
+        uint32_t above_ms[STATS_SYMPTOMS];
+        for (int symptom = 0; symptom < STATS_SYMPTOMS; symptom++) {
+            int size = stats.encode_sketch(symptom, buffer);
+            sketch_bytes += size;
+            sketches++;
+            if (!received.decode_sketch(buffer, size)) {
+                fprintf(stderr, "Sketch didn't decode\n");
+                return 1;
+            }
+            above_ms[symptom] = received_summary.symptoms[symptom].above_ms;
+        }
+        received.set_counts(received_summary.since_ms, received_summary.windows, above_ms);
+        if (have_merged) merged.merge(received);
+        else merged = received;
+        have_merged = true;
+
+        for (int symptom = 0; symptom < STATS_SYMPTOMS; symptom++) {
+            std::vector<float> exact;
+            for (size_t i = day_start; i < day_end; i++) {
+                const SymptomIntensities &w = windows[i];
+                exact.push_back(symptom == 0 ? w.tremor : symptom == 1 ? w.dyskinesia : w.fog);
+            }
+            std::sort(exact.begin(), exact.end());
+            const SymptomSummary &s = summary.symptoms[symptom];
+            float values[3] = { s.p50, s.p90, s.p99 };
+            double error = 0.0;
+            for (int q = 0; q < 3; q++) error = std::max(error, rank_error(exact, values[q], qs[q]));
+            worst_day_error = std::max(worst_day_error, error);
+            printf("  %-10s  %5zu  %9.4f  %9.4f  %9.4f  %8.2f%%\n", names[symptom], day, s.p50, s.p90, s.p99, error * 100);
+            printf("  %-10s  %5s  %9.4f  %9.4f  %9.4f  (exact; %.1f min above %.2f)\n", "", "",
+                exact[(size_t)(0.5 * (exact.size() - 1))], exact[(size_t)(0.9 * (exact.size() - 1))],
+                exact[(size_t)(0.99 * (exact.size() - 1))], s.above_ms / 60000.0, thresholds[symptom]);
+        }
+    }
+
+    // The merged days against the exact quantiles of everything
+    StatsSummary all = merged.summary();
+    double merged_error = 0.0;
+    for (int symptom = 0; symptom < STATS_SYMPTOMS; symptom++) {
+        std::vector<float> exact;
+        for (const SymptomIntensities &w : windows) exact.push_back(symptom == 0 ? w.tremor : symptom == 1 ? w.dyskinesia : w.fog);
+        std::sort(exact.begin(), exact.end());
+        const SymptomSummary &s = all.symptoms[symptom];
+        float values[3] = { s.p50, s.p90, s.p99 };
+        for (int q = 0; q < 3; q++) merged_error = std::max(merged_error, rank_error(exact, values[q], qs[q]));
+    }
+    printf("  sketches on the wire: %.0f bytes on average (max %d)\n", (double)sketch_bytes / sketches, STATS_SKETCH_MAX_SIZE);
+    printf("  worst rank error: %.2f%% per day, %.2f%% merged over %u windows\n", worst_day_error * 100, merged_error * 100,
+        (unsigned)all.windows);
+    return 0;
+}
+
+//MARK: boot
+
+// A boot's orientation counts as converged once it stays this close to the warmed-up one
+#define BOOT_TOLERANCE_DEG 2.f
+#define BOOT_SECONDS 60
+
+/** Down in the sensor's frame, by an orientation */
+static void local_down(const float rot[4], float dest[3]) {
+    float conj[4] = { rot[0], -rot[1], -rot[2], -rot[3] };
+    const float z[3] = { 0.f, 0.f, 1.f };
+    rotate_vector(z, conj, dest);
+}
+
+static float angle_deg(const float a[3], const float b[3]) {
+    float dot = a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+    return acosf(std::min(1.f, std::max(-1.f, dot))) * (180.f / PI);
+}
+
+typedef struct {
+    std::vector<double> converge_s;  // Per boot; BOOT_SECONDS if it never did
+    std::vector<int> first_valid;    // Per boot, 1-based batch; 0 if none was
+    double first_leak_g = 0.0;       // Gravity left in the first batch's mean, summed over boots
+} BootStats;
+
+/** Boot the orientation at several points of a trace, once from the identity (as before) and once with
+ * the averaged-tilt start, and compare both to an orientation that has been tracking all along.
+ * Time to converge: until the boot stays within BOOT_TOLERANCE_DEG of it. First valid batch: the first
+ * with every sample within tolerance, i.e. under about 0.035 g of gravity leaking into the output.
+ * "flat" is synthetic data that never leaves the identity orientation, where both starts are right.
+ */
+static int bench_boot(int argc, char **argv) {
+    bool flat = argc > 0 && strcmp(argv[0], "flat") == 0;
+    const char *path = argc > 0 && strcmp(argv[0], "synth") != 0 && !flat ? argv[0] : nullptr;
+    int boots = argc > 1 ? atoi(argv[1]) : 20;
+
+    std::vector<RawImuSample> samples;
+    TraceReplaySource trace;
+    SynthConfig config = synth_default_config();
+    if (flat) config.orientation_change_s = 1e9f;
+    SynthSource synth(config, (long)(3600 * POLL_RATE));
+    ImuSource *source = &synth;
+    if (path) {
+        if (!trace.open(path)) {
+            fprintf(stderr, "Couldn't read %s\n", path);
+            return 1;
+        }
+        source = &trace;
+    }
+    RawImuSample sample;
+    while (source->read(sample)) samples.push_back(sample);
+
+    // Boots start after two minutes of warm-up and leave BOOT_SECONDS to watch them
+    long boot_samples = BOOT_SECONDS * POLL_RATE;
+    long first = 120 * POLL_RATE;
+    if (boots < 1 || (long)samples.size() < first + boot_samples) {
+        fprintf(stderr, "Need at least %d s of samples\n", 120 + BOOT_SECONDS);
+        return 1;
+    }
+
+    // The reference: down as seen by a conditioner that has been running since the start
+    std::vector<float> reference(3 * samples.size());
+    SampleConditioner warm;
+    IMUBatch batch;
+    for (size_t i = 0; i < samples.size(); i++) {
+        float acc_f[3], gyro_f[3];
+        for (int axis = 0; axis < 3; axis++) {
+            acc_f[axis] = samples[i].accel[axis] * ACCEL_SCALE;
+            gyro_f[axis] = samples[i].gyro[axis] * GYRO_SCALE;
+        }
+        warm.condition(acc_f, gyro_f, &batch, i % (BATCH_SIZE_FILLED + 1));
+        local_down(warm.orientation(), &reference[3 * i]);
+    }
+
+    BootStats stats[2]; // Identity start, averaged-tilt start
+    long span = (long)samples.size() - boot_samples - first;
+    for (int boot = 0; boot < boots; boot++) {
+        long start = first + (boots > 1 ? span * boot / (boots - 1) : 0);
+        for (int mode = 0; mode < 2; mode++) {
+            float rot[4] = { 1.f, 0.f, 0.f, 0.f };
+            SampleConditioner conditioner;
+            long last_bad = -1;
+            int first_valid = 0;
+            bool batch_valid = true;
+            double leak[3] = {};
+            for (long t = 0; t < boot_samples; t++) {
+                const RawImuSample &s = samples[start + t];
+                float acc_f[3], gyro_f[3], down[3];
+                for (int axis = 0; axis < 3; axis++) {
+                    acc_f[axis] = s.accel[axis] * ACCEL_SCALE;
+                    gyro_f[axis] = s.gyro[axis] * GYRO_SCALE;
+                }
+                // Either way acc_f ends up with gravity removed, before the low pass
+                const float *orientation = rot;
+                if (mode == 0) {
+                    update_rot(acc_f, gyro_f, rot);
+                    rotate_vector(acc_f, rot, acc_f);
+                    acc_f[2] -= 1;
+                } else {
+                    conditioner.condition(acc_f, gyro_f, &batch, t % (BATCH_SIZE_FILLED + 1));
+                    orientation = conditioner.orientation();
+                }
+                local_down(orientation, down);
+                bool bad = angle_deg(down, &reference[3 * (start + t)]) >= BOOT_TOLERANCE_DEG;
+                if (bad) {
+                    last_bad = t;
+                    batch_valid = false;
+                }
+                if (t < BATCH_SIZE_FILLED + 1) {
+                    for (int axis = 0; axis < 3; axis++) leak[axis] += acc_f[axis];
+                }
+                if (t % (BATCH_SIZE_FILLED + 1) == BATCH_SIZE_FILLED) {
+                    if (batch_valid && !first_valid) first_valid = (int)(t / (BATCH_SIZE_FILLED + 1)) + 1;
+                    batch_valid = true;
+                }
+            }
+            stats[mode].converge_s.push_back((double)(last_bad + 1) / POLL_RATE);
+            stats[mode].first_valid.push_back(first_valid);
+            double n = BATCH_SIZE_FILLED + 1;
+            stats[mode].first_leak_g += sqrt(leak[0] * leak[0] + leak[1] * leak[1] + leak[2] * leak[2]) / n;
+        }
+    }
+
+    printf("boot: %d boots over %.1f min of %s, %d s each, within %.0f deg of a warmed-up orientation\n",
+        boots, samples.size() / (60.0 * POLL_RATE), path ? path : flat ? "flat synth" : "synth", BOOT_SECONDS,
+        BOOT_TOLERANCE_DEG);
+    printf("  %-16s  %12s  %12s  %12s  %12s  %14s\n", "start", "converge p50", "converge max",
+        "1st valid p50", "1st valid max", "batch 1 leak");
+    const char *names[2] = { "identity", "averaged tilt" };
+    for (int mode = 0; mode < 2; mode++) {
+        std::vector<double> converge = stats[mode].converge_s;
+        std::vector<int> valid = stats[mode].first_valid;
+        std::sort(converge.begin(), converge.end());
+        // Boots that never had a valid batch sort last
+        for (int &v : valid) if (v == 0) v = INT_MAX;
+        std::sort(valid.begin(), valid.end());
+        auto batch_text = [](int v) { return v == INT_MAX ? std::string("never") : std::to_string(v); };
+        printf("  %-16s  %10.2f s  %10.2f s  %12s  %12s  %12.3f g\n", names[mode],
+            converge[converge.size() / 2], converge.back(),
+            batch_text(valid[valid.size() / 2]).c_str(), batch_text(valid.back()).c_str(),
+            stats[mode].first_leak_g / boots);
+    }
+    printf("  (a batch is %.2f s; averaged tilt uses the first %d samples)\n",
+        (BATCH_SIZE_FILLED + 1) / (double)POLL_RATE, ORIENTATION_INIT_SAMPLES);
+    return 0;
+}
+
+//MARK: orientation
+
+typedef struct {
+    std::vector<float> moving, still; // Tilt error per sample, deg
+} TiltErrors;
+
+static double mean_of(const std::vector<float> &v) {
+    double sum = 0.0;
+    for (float x : v) sum += x;
+    return v.empty() ? 0.0 : sum / v.size();
+}
+
+/** Print one estimator's row
+ * @return Its 95th percentile error
+ */
+static float print_tilt(const char *name, TiltErrors &errors, double ns_per_sample) {
+    std::vector<float> all = errors.moving;
+    all.insert(all.end(), errors.still.begin(), errors.still.end());
+    std::sort(all.begin(), all.end());
+    float p95 = all[all.size() * 95 / 100];
+    printf("  %-22s  %8.1f ns  %8.2f deg  %8.2f deg  %8.2f deg  %8.2f deg\n", name, ns_per_sample,
+        mean_of(errors.still), mean_of(errors.moving), p95, all.back());
+    return p95;
+}
+
+// What the filters must reach on bench_orientation's data: tilt error (deg) and gyro bias error (dps)
+#define ORIENTATION_MAX_STILL_DEG 0.5
+#define ORIENTATION_MAX_P95_DEG 1.5
+#define ORIENTATION_MAX_BIAS_ERROR_DPS 0.1
+
+/** Track orientation on synthetic data with a biased gyro, and compare it to the synthesizer's ground truth:
+ * update_rot(), the Mahony filter fed one sample at a time and a FIFO block at a time, and the EKF.
+ * Fails if a filter misses the ORIENTATION_MAX_* tolerances, or blocks don't match single samples exactly.
+ */
+static int bench_orientation(int argc, char **argv) {
+    double hours = argc > 0 ? atof(argv[0]) : 2.0;
+    int block = argc > 1 ? atoi(argv[1]) : 32;
+    if (block < 1) block = 1;
+
+    SynthConfig config = synth_default_config();
+    const float bias[3] = { 1.5f, -2.f, 0.8f };
+    for (int axis = 0; axis < 3; axis++) config.gyro_bias_dps[axis] = bias[axis];
+    ImuSynth synth(config);
+    long samples = (long)(hours * 3600 * POLL_RATE);
+    std::vector<float> accel(3 * samples), gyro(3 * samples), truth(3 * samples);
+    std::vector<uint8_t> labels(samples);
+    for (long t = 0; t < samples; t++) {
+        memcpy(&truth[3 * t], synth.gravity(), 3 * sizeof(float));
+        RawImuSample sample;
+        synth.generate(&sample, &labels[t], 1);
+        for (int axis = 0; axis < 3; axis++) {
+            accel[3 * t + axis] = sample.accel[axis] * ACCEL_SCALE;
+            gyro[3 * t + axis] = sample.gyro[axis] * GYRO_SCALE;
+        }
+    }
+    const float (*acc3)[3] = (const float (*)[3])accel.data();
+    const float (*gyro3)[3] = (const float (*)[3])gyro.data();
+    const uint8_t moving_labels = SYNTH_LABEL_TREMOR | SYNTH_LABEL_DYSKINESIA | SYNTH_LABEL_WALKING | SYNTH_LABEL_TURNING;
+
+    // Orientation after every sample, per estimator
+    std::vector<float> rots(4 * samples), single_rots;
+    float (*rots4)[4] = (float (*)[4])rots.data();
+    bool blocks_match = true;
+    TiltErrors errors[4];
+    double ns[4];
+    float estimated_bias[3][3];
+    for (int mode = 0; mode < 4; mode++) {
+        auto start = bench_clock::now();
+        if (mode == 0) {
+            float rot[4] = { 1.f, 0.f, 0.f, 0.f };
+            for (long t = 0; t < samples; t++) {
+                float a[3] = { acc3[t][0], acc3[t][1], acc3[t][2] }, g[3] = { gyro3[t][0], gyro3[t][1], gyro3[t][2] };
+                update_rot(a, g, rot);
+                memcpy(rots4[t], rot, sizeof(rot));
+            }
+        } else if (mode == 3) {
+            OrientationEkf filter;
+            filter.update(acc3, gyro3, (int)samples, rots4);
+            filter.gyro_bias(estimated_bias[2]);
+        } else {
+            MahonyFilter filter;
+            int n = mode == 1 ? 1 : block;
+            for (long t = 0; t < samples; t += n) {
+                int count = (int)std::min((long)n, samples - t);
+                filter.update(&acc3[t], &gyro3[t], count, &rots4[t]);
+            }
+            filter.gyro_bias(estimated_bias[mode - 1]);
+        }
+        ns[mode] = seconds_since(start) * 1e9 / samples;
+        // Blocks go through the filter a sample at a time, so they must give exactly the same orientations
+        if (mode == 1) single_rots = rots;
+        if (mode == 2) blocks_match = rots == single_rots;
+
+        for (long t = 0; t < samples; t++) {
+            float down[3];
+            local_down(rots4[t], down);
+            float error = angle_deg(down, &truth[3 * t]);
+            (labels[t] & moving_labels ? errors[mode].moving : errors[mode].still).push_back(error);
+        }
+    }
+
+    printf("orientation: %.1f h of synthetic data, gyro bias %.2f %.2f %.2f dps, tilt error against ground truth\n",
+        hours, bias[0], bias[1], bias[2]);
+    printf("  %-22s  %11s  %12s  %12s  %12s  %12s\n", "", "per sample", "still mean", "moving mean", "p95", "max");
+    float p95[4];
+    p95[0] = print_tilt("update_rot()", errors[0], ns[0]);
+    p95[1] = print_tilt("Mahony, 1 sample", errors[1], ns[1]);
+    p95[2] = print_tilt(("Mahony, " + std::to_string(block) + " samples").c_str(), errors[2], ns[2]);
+    p95[3] = print_tilt("EKF", errors[3], ns[3]);
+    const char *bias_names[3] = { "Mahony, 1 sample", "Mahony, blocks", "EKF" };
+    bool bias_ok = true;
+    for (int i = 0; i < 3; i++) {
+        printf("  bias estimate, %s: %.2f %.2f %.2f dps\n", bias_names[i],
+            estimated_bias[i][0], estimated_bias[i][1], estimated_bias[i][2]);
+        for (int axis = 0; axis < 3; axis++) {
+            if (!(fabsf(estimated_bias[i][axis] - bias[axis]) <= ORIENTATION_MAX_BIAS_ERROR_DPS)) bias_ok = false;
+        }
+    }
+
+    // The filters (not update_rot(), which they replace) have to stay within the tolerances
+    bool tilt_ok = true;
+    for (int mode = 1; mode < 4; mode++) {
+        if (!(mean_of(errors[mode].still) <= ORIENTATION_MAX_STILL_DEG && p95[mode] <= ORIENTATION_MAX_P95_DEG)) tilt_ok = false;
+    }
+    printf("  tilt within %.1f deg still and %.1f deg p95: %s; bias within %.2f dps: %s; blocks match single samples: %s\n",
+        ORIENTATION_MAX_STILL_DEG, ORIENTATION_MAX_P95_DEG, tilt_ok ? "ok" : "FAIL",
+        ORIENTATION_MAX_BIAS_ERROR_DPS, bias_ok ? "ok" : "FAIL", blocks_match ? "ok" : "FAIL");
+    return tilt_ok && bias_ok && blocks_match ? 0 : 1;
+}
+
+//MARK: calibration
+
+/** Learn a calibration from a synthetic stream with known sensor errors, save it to a simulated KVStore,
+ * then "reboot" and compare orientation and gravity removal with it, without it, and without the errors.
+ */
+static int bench_calibration(int argc, char **argv) {
+    double hours = argc > 0 ? atof(argv[0]) : 6.0;
+    const char *store_path = argc > 1 ? argv[1] : nullptr;
+
+    SynthConfig clean_config = synth_default_config();
+    SynthConfig biased_config = clean_config;
+    const float bias[3] = { 1.5f, -2.f, 0.8f }, offset[3] = { 0.03f, -0.02f, 0.04f }, gain[3] = { 1.02f, 0.98f, 1.01f };
+    for (int axis = 0; axis < 3; axis++) {
+        biased_config.gyro_bias_dps[axis] = bias[axis];
+        biased_config.accel_offset_g[axis] = offset[axis];
+        biased_config.accel_gain[axis] = gain[axis];
+    }
+    // Same seed, so both streams move the same way; the errors don't draw random numbers
+    ImuSynth clean(clean_config), biased(biased_config);
+
+    auto to_units = [](const RawImuSample &sample, float acc_f[3], float gyro_f[3]) {
+        for (int axis = 0; axis < 3; axis++) {
+            acc_f[axis] = sample.accel[axis] * ACCEL_SCALE;
+            gyro_f[axis] = sample.gyro[axis] * GYRO_SCALE;
+        }
+    };
+    auto errors = [&](const Calibration &c, float &bias_error, float &offset_error, float &scale_error) {
+        bias_error = offset_error = scale_error = 0.f;
+        for (int axis = 0; axis < 3; axis++) {
+            bias_error = std::max(bias_error, fabsf(c.gyro_bias[axis] - bias[axis]));
+            offset_error = std::max(offset_error, fabsf(c.accel_offset[axis] - offset[axis]));
+            scale_error = std::max(scale_error, fabsf(c.accel_scale[axis] * gain[axis] - 1.f));
+        }
+    };
+
+    // First boot: nothing stored, learn from scratch
+    FileKVStore store(store_path);
+    store.init();
+    Calibration initial;
+    int err = calibration_load(&store, initial);
+    printf("calibration: gyro bias %.2f %.2f %.2f dps, accel offset %.3f %.3f %.3f g, gain %.3f %.3f %.3f\n",
+        bias[0], bias[1], bias[2], offset[0], offset[1], offset[2], gain[0], gain[1], gain[2]);
+    printf("  first boot: %s\n", err == MBED_SUCCESS ? "calibration found in the store" : "nothing stored");
+
+    Calibrator learner(initial);
+    long samples = (long)(hours * 3600 * POLL_RATE);
+    long gyro_at = -1, accel_at = -1;
+    double update_s = 0.0;
+    for (long t = 0; t < samples; t++) {
+        RawImuSample sample, unused;
+        biased.generate(&sample, nullptr, 1);
+        clean.generate(&unused, nullptr, 1);
+        float acc_f[3], gyro_f[3];
+        to_units(sample, acc_f, gyro_f);
+        auto start = bench_clock::now();
+        learner.update(acc_f, gyro_f);
+        update_s += seconds_since(start);
+        if (learner.take_changed()) calibration_save(&store, learner.calibration());
+
+        float bias_error, offset_error, scale_error;
+        errors(learner.calibration(), bias_error, offset_error, scale_error);
+        if (gyro_at < 0 && (learner.calibration().flags & CALIBRATION_GYRO) && bias_error < 0.1f) gyro_at = t;
+        if (accel_at < 0 && (learner.calibration().flags & CALIBRATION_ACCEL)) accel_at = t;
+    }
+    float bias_error, offset_error, scale_error;
+    errors(learner.calibration(), bias_error, offset_error, scale_error);
+    printf("  learned over %.1f h: %u rests in %d orientations, %.0f ns/sample\n",
+        hours, (unsigned)learner.rests(), learner.orientations(), update_s * 1e9 / samples);
+    printf("    gyro bias within 0.1 dps after %s s, accel fit after %s s\n",
+        gyro_at < 0 ? "never" : std::to_string((gyro_at + 1) / POLL_RATE).c_str(),
+        accel_at < 0 ? "never" : std::to_string(accel_at / POLL_RATE).c_str());
+    printf("    worst error: bias %.3f dps, offset %.4f g, scale %.4f; %u writes to the store\n",
+        bias_error, offset_error, scale_error, (unsigned)store.writes());
+
+    // A slow, steady turn about the vertical is as still as a rest, but its rate isn't bias
+    Calibrator turning(calibration_identity());
+    const float turn_dps = 8.f, level[3] = { 0.f, 0.f, 1.f }, turn[3] = { 0.f, 0.f, turn_dps };
+    for (long t = 0; t < 60L * POLL_RATE; t++) turning.update(level, turn);
+    bool turn_rejected = turning.rests() == 0 && turning.calibration().gyro_bias[2] == 0.f;
+    printf("  60 s turning at %.0f dps: %u rests, bias %.2f dps (%s)\n", turn_dps, (unsigned)turning.rests(),
+        turning.calibration().gyro_bias[2], turn_rejected ? "ok" : "FAIL");
+
+    // Reboot: load what was stored and compare against the same motion without sensor errors
+    FileKVStore rebooted(store_path);
+    if (store_path) rebooted.init();
+    mbed::KVStore *reload = store_path ? (mbed::KVStore *)&rebooted : &store;
+    Calibration stored;
+    err = calibration_load(reload, stored);
+    printf("  reboot: %s (flags %u)\n", err == MBED_SUCCESS ? "calibration loaded" : "nothing stored", stored.flags);
+
+    const char *names[3] = { "no errors", "uncalibrated", "stored calibration" };
+    SampleConditioner conditioners[3];
+    Calibrator warm(stored);
+    IMUBatch batch;
+    const long after_boot = BOOT_SECONDS * POLL_RATE;
+    const long run = 3600L * POLL_RATE;
+    std::vector<float> tilt[3][2]; // Per mode: first BOOT_SECONDS, then the rest of the hour
+    double residual[3] = {};
+    double leak[3][3] = {};
+    long batches = 0;
+    for (long t = 0; t < run; t++) {
+        RawImuSample clean_sample, biased_sample;
+        clean.generate(&clean_sample, nullptr, 1);
+        biased.generate(&biased_sample, nullptr, 1);
+        float down[3][3];
+        int i_time = (int)(t % (BATCH_SIZE_FILLED + 1));
+        for (int mode = 0; mode < 3; mode++) {
+            float acc_f[3], gyro_f[3];
+            to_units(mode == 0 ? clean_sample : biased_sample, acc_f, gyro_f);
+            if (mode == 2) {
+                warm.update(acc_f, gyro_f);
+                warm.apply(acc_f, gyro_f);
+            }
+            conditioners[mode].condition(acc_f, gyro_f, &batch, i_time);
+            local_down(conditioners[mode].orientation(), down[mode]);
+            for (int axis = 0; axis < 3; axis++) leak[mode][axis] += acc_f[axis];
+            if (mode > 0) tilt[mode][t < after_boot ? 0 : 1].push_back(angle_deg(down[mode], down[0]));
+        }
+        if (i_time == BATCH_SIZE_FILLED) {
+            // Gravity left in each batch's mean, beyond what the error-free stream has
+            for (int mode = 0; mode < 3; mode++) {
+                float n = BATCH_SIZE_FILLED + 1, diff[3];
+                for (int axis = 0; axis < 3; axis++) diff[axis] = (leak[mode][axis] - leak[0][axis]) / n;
+                residual[mode] += sqrtf(diff[0] * diff[0] + diff[1] * diff[1] + diff[2] * diff[2]);
+            }
+            memset(leak, 0, sizeof(leak));
+            batches++;
+        }
+    }
+
+    printf("  after reboot, vs. the same motion without sensor errors (1 h):\n");
+    printf("  %-20s  %16s  %16s  %16s  %14s\n", "", "tilt, first 60 s", "tilt, mean", "tilt, p95", "batch residual");
+    for (int mode = 1; mode < 3; mode++) {
+        std::vector<float> &first = tilt[mode][0], &rest = tilt[mode][1];
+        double first_mean = 0.0, rest_mean = 0.0;
+        for (float v : first) first_mean += v;
+        for (float v : rest) rest_mean += v;
+        std::sort(rest.begin(), rest.end());
+        printf("  %-20s  %12.2f deg  %12.2f deg  %12.2f deg  %12.4f g\n", names[mode], first_mean / first.size(),
+            rest_mean / rest.size(), rest[rest.size() * 95 / 100], residual[mode] / batches);
+    }
+    return turn_rejected ? 0 : 1;
+}
+
+//MARK: matrix
+
+// Generic kernels the way arm_matrix_instance_f32 routines work: sizes at run time, loops the compiler
+// can't unroll. Kept out of line so they aren't specialized for the constant sizes below.
+
+__attribute__((noinline)) static void generic_mul(const float *a, const float *b, float *dest, int rows, int inner, int cols) {
+    for (int i = 0; i < rows; i++) {
+        for (int j = 0; j < cols; j++) {
+            float sum = 0.f;
+            for (int k = 0; k < inner; k++) sum += a[i * inner + k] * b[k * cols + j];
+            dest[i * cols + j] = sum;
+        }
+    }
+}
+
+__attribute__((noinline)) static bool generic_inverse_spd(const float *a, float *dest, int n) {
+    float l[6 * 6];
+    for (int j = 0; j < n; j++) {
+        float diagonal = a[j * n + j];
+        for (int k = 0; k < j; k++) diagonal -= l[j * n + k] * l[j * n + k];
+        if (!(diagonal > 0.f)) return false;
+        l[j * n + j] = sqrtf(diagonal);
+        for (int i = j + 1; i < n; i++) {
+            float sum = a[i * n + j];
+            for (int k = 0; k < j; k++) sum -= l[i * n + k] * l[j * n + k];
+            l[i * n + j] = sum / l[j * n + j];
+        }
+    }
+    for (int c = 0; c < n; c++) {
+        for (int i = 0; i < n; i++) {
+            float sum = i == c ? 1.f : 0.f;
+            for (int k = 0; k < i; k++) sum -= l[i * n + k] * dest[k * n + c];
+            dest[i * n + c] = sum / l[i * n + i];
+        }
+        for (int i = n - 1; i >= 0; i--) {
+            float sum = dest[i * n + c];
+            for (int k = i + 1; k < n; k++) sum -= l[k * n + i] * dest[k * n + c];
+            dest[i * n + c] = sum / l[i * n + i];
+        }
+    }
+    return true;
+}
+
+template <int N>
+__attribute__((noinline)) static void fixed_mul(const float *a, const float *b, float *dest) {
+    mat_mul<N, N, N>(a, b, dest);
+}
+
+template <int N>
+__attribute__((noinline)) static bool fixed_inverse_spd(const float *a, float *dest) {
+    return mat_inverse_spd<N>(a, dest);
+}
+
+/** Time one kernel over a rotating set of inputs; returns ns per call, and adds its outputs to checksum */
+template <typename Kernel>
+static double time_kernel(int n, long calls, const std::vector<float> &inputs, double &checksum, Kernel kernel) {
+    const int sets = (int)(inputs.size() / (n * n)) - 1;
+    float out[6 * 6];
+    auto start = bench_clock::now();
+    for (long call = 0; call < calls; call++) {
+        int set = (int)(call % sets);
+        kernel(&inputs[set * n * n], &inputs[(set + 1) * n * n], out);
+        checksum += out[call % (n * n)];
+    }
+    return seconds_since(start) * 1e9 / calls;
+}
+
+/** Fixed-size kernels (small_matrix.hpp) against generic run-time-sized ones, at the sizes the filters use,
+ * and the whole EKF step they add up to. Also checks that both give the same answer.
+ */
+static int bench_matrix(int argc, char **argv) {
+    long calls = argc > 0 ? atol(argv[0]) : 2000000;
+
+    // Symmetric positive definite inputs (covariance-like), so the inverse is defined for all of them
+    const int sets = 64;
+    srand(7);
+    std::vector<float> inputs[7];
+    for (int n = 3; n <= 6; n++) {
+        inputs[n].resize((sets + 1) * n * n);
+        for (int set = 0; set <= sets; set++) {
+            // M M^T plus a diagonal; the top-left n x n of a Gram matrix is one too
+            float m[6 * 6], gram[6 * 6];
+            for (int i = 0; i < 6 * 6; i++) m[i] = 2.f * rand() / RAND_MAX - 1.f;
+            mat_mul_transposed<6, 6, 6>(m, m, gram);
+            float *spd = &inputs[n][set * n * n];
+            for (int i = 0; i < n; i++) {
+                for (int j = 0; j < n; j++) spd[i * n + j] = gram[i * 6 + j] + (i == j ? 1.f : 0.f);
+            }
+        }
+    }
+
+    double checksum = 0.0, max_error = 0.0;
+    printf("matrix: %ld calls per kernel\n", calls);
+    printf("  %-14s  %12s  %12s  %8s\n", "", "generic", "fixed", "speedup");
+    auto row = [&](const char *name, double generic, double fixed) {
+        printf("  %-14s  %9.1f ns  %9.1f ns  %7.1fx\n", name, generic, fixed, generic / fixed);
+    };
+    auto compare = [&](int n, const float *a, const float *b) {
+        for (int i = 0; i < n * n; i++) max_error = std::max(max_error, (double)fabsf(a[i] - b[i]) / (1.0 + fabsf(b[i])));
+    };
+
+    for (int n : { 3, 4, 6 }) {
+        double generic = time_kernel(n, calls, inputs[n], checksum,
+            [n](const float *a, const float *b, float *dest) { generic_mul(a, b, dest, n, n, n); });
+        double fixed = n == 3 ? time_kernel(n, calls, inputs[n], checksum, fixed_mul<3>)
+            : n == 4 ? time_kernel(n, calls, inputs[n], checksum, fixed_mul<4>)
+            : time_kernel(n, calls, inputs[n], checksum, fixed_mul<6>);
+        float expected[6 * 6], actual[6 * 6];
+        generic_mul(inputs[n].data(), inputs[n].data() + n * n, expected, n, n, n);
+        if (n == 3) fixed_mul<3>(inputs[n].data(), inputs[n].data() + n * n, actual);
+        if (n == 4) fixed_mul<4>(inputs[n].data(), inputs[n].data() + n * n, actual);
+        if (n == 6) fixed_mul<6>(inputs[n].data(), inputs[n].data() + n * n, actual);
+        compare(n, actual, expected);
+        row(("mul " + std::to_string(n) + "x" + std::to_string(n)).c_str(), generic, fixed);
+    }
+    for (int n : { 3, 6 }) {
+        double generic = time_kernel(n, calls, inputs[n], checksum,
+            [n](const float *a, const float *, float *dest) { generic_inverse_spd(a, dest, n); });
+        double fixed = n == 3
+            ? time_kernel(n, calls, inputs[n], checksum, [](const float *a, const float *, float *dest) { fixed_inverse_spd<3>(a, dest); })
+            : time_kernel(n, calls, inputs[n], checksum, [](const float *a, const float *, float *dest) { fixed_inverse_spd<6>(a, dest); });
+        float expected[6 * 6], actual[6 * 6];
+        generic_inverse_spd(inputs[n].data(), expected, n);
+        if (n == 3) fixed_inverse_spd<3>(inputs[n].data(), actual);
+        if (n == 6) fixed_inverse_spd<6>(inputs[n].data(), actual);
+        compare(n, actual, expected);
+        row(("inverse " + std::to_string(n) + "x" + std::to_string(n)).c_str(), generic, fixed);
+    }
+
+    // The whole filter step: predict and correct with one sample
+    ImuSynth synth(synth_default_config());
+    std::vector<float> accel(3 * 4096), gyro(3 * 4096);
+    for (int t = 0; t < 4096; t++) {
+        RawImuSample sample;
+        uint8_t label;
+        synth.generate(&sample, &label, 1);
+        for (int axis = 0; axis < 3; axis++) {
+            accel[3 * t + axis] = sample.accel[axis] * ACCEL_SCALE;
+            gyro[3 * t + axis] = sample.gyro[axis] * GYRO_SCALE;
+        }
+    }
+    OrientationEkf ekf;
+    auto start = bench_clock::now();
+    for (long call = 0; call < calls; call++) {
+        int t = (int)(call % 4096);
+        ekf.update(&accel[3 * t], &gyro[3 * t]);
+    }
+    double ekf_ns = seconds_since(start) * 1e9 / calls;
+    checksum += ekf.orientation()[0];
+
+    printf("  EKF step (predict + correct): %.1f ns, %.0f us per second of data at %d Hz\n",
+        ekf_ns, ekf_ns * POLL_RATE / 1000.0, POLL_RATE);
+    printf("  max relative difference, fixed vs generic: %.2g (checksum %.3g)\n", max_error, checksum);
+    return 0;
+}
+
+//MARK: rotate
+
+// Most the batch kernels, and the conditioner fed in blocks, may differ from rotate_vector() one sample at a time
+#define ROTATE_MAX_ERROR_G 1e-5
+
+/** Batch gravity removal (rotate_minus_gravity() and friends) against rotate_vector() and a
+ * subtraction per sample: agreement on random rotations, speed per block size, and SampleConditioner fed
+ * one sample at a time against FIFO-sized blocks. Fails if any of them differ by more than ROTATE_MAX_ERROR_G.
+ */
+static int bench_rotate(int argc, char **argv) {
+    long vectors = argc > 0 ? atol(argv[0]) : 4000000;
+
+    // Random unit quaternions and accelerations up to 2 g
+    const int count = 4096;
+    srand(3);
+    auto uniform = []() { return 2.f * rand() / RAND_MAX - 1.f; };
+    std::vector<float> quats(4 * count), vecs(3 * count), xs(count), ys(count), zs(count);
+    for (int i = 0; i < count; i++) {
+        float q[4], len_sq = 0.f;
+        for (int k = 0; k < 4; k++) {
+            q[k] = uniform();
+            len_sq += q[k] * q[k];
+        }
+        for (int k = 0; k < 4; k++) quats[4 * i + k] = q[k] / sqrtf(len_sq);
+        for (int axis = 0; axis < 3; axis++) vecs[3 * i + axis] = 2.f * uniform();
+        xs[i] = vecs[3 * i];
+        ys[i] = vecs[3 * i + 1];
+        zs[i] = vecs[3 * i + 2];
+    }
+
+    // Reference: what condition() did per sample
+    std::vector<float> expected(3 * count), rotated(3 * count), removed(3 * count), ox(count), oy(count), oz(count);
+    for (int i = 0; i < count; i++) {
+        rotate_vector(&vecs[3 * i], &quats[4 * i], &expected[3 * i]);
+    }
+    // The kernels take blocks of [w, x, y, z] and [x, y, z]
+    auto rots = [](std::vector<float> &data, int i) { return reinterpret_cast<float (*)[4]>(&data[4 * i]); };
+    auto vec3s = [](std::vector<float> &data, int i) { return reinterpret_cast<float (*)[3]>(&data[3 * i]); };
+    rotate_vectors(rots(quats, 0), vec3s(vecs, 0), vec3s(rotated, 0), count);
+    rotate_minus_gravity(rots(quats, 0), vec3s(vecs, 0), 1.f, vec3s(removed, 0), count);
+    double error_aos = 0.0, error_gravity = 0.0, error_soa = 0.0;
+    for (int i = 0; i < count; i++) {
+        for (int axis = 0; axis < 3; axis++) {
+            float e = expected[3 * i + axis];
+            error_aos = std::max(error_aos, (double)fabsf(rotated[3 * i + axis] - e));
+            error_gravity = std::max(error_gravity, (double)fabsf(removed[3 * i + axis] - (axis == 2 ? e - 1.f : e)));
+        }
+    }
+    rotate_minus_gravity_soa(rots(quats, 0), xs.data(), ys.data(), zs.data(), 1.f, ox.data(), oy.data(), oz.data(), count);
+    for (int i = 0; i < count; i++) {
+        error_soa = std::max(error_soa, (double)fabsf(ox[i] - expected[3 * i]));
+        error_soa = std::max(error_soa, (double)fabsf(oy[i] - expected[3 * i + 1]));
+        error_soa = std::max(error_soa, (double)fabsf(oz[i] - (expected[3 * i + 2] - 1.f)));
+    }
+    printf("rotate: max difference from rotate_vector() over %d random rotations of vectors up to 2 g\n", count);
+    printf("  rotate (interleaved) %.2g g, remove gravity (interleaved) %.2g g, remove gravity (separate) %.2g g\n",
+        error_aos, error_gravity, error_soa);
+
+    // Speed, in place as condition() uses them
+    printf("  %-40s  %10s\n", "", "per vector");
+    double checksum = 0.0;
+    auto report = [&](const char *name, std::chrono::steady_clock::time_point start) {
+        printf("  %-40s  %7.2f ns\n", name, seconds_since(start) * 1e9 / vectors);
+    };
+    std::vector<float> work = vecs;
+    auto start = bench_clock::now();
+    for (long done = 0; done < vectors; done++) {
+        int i = (int)(done % count);
+        float *v = &work[3 * i];
+        rotate_vector(v, &quats[4 * i], v);
+        v[2] -= 1.f;
+        if (i == count - 1) {
+            checksum += work[0];
+            work = vecs;
+        }
+    }
+    report("rotate_vector() + subtract", start);
+    for (int block : { 1, 16, BATCH_SIZE_FILLED + 1 }) {
+        for (int soa = 0; soa < 2; soa++) {
+            work = vecs;
+            std::vector<float> wx = xs, wy = ys, wz = zs;
+            start = bench_clock::now();
+            for (long done = 0; done < vectors; done += block) {
+                int i = (int)(done % count);
+                int n = std::min(block, count - i);
+                if (soa) {
+                    rotate_minus_gravity_soa(rots(quats, i), &wx[i], &wy[i], &wz[i], 1.f, &wx[i], &wy[i], &wz[i], n);
+                } else {
+                    rotate_minus_gravity(rots(quats, i), vec3s(work, i), 1.f, vec3s(work, i), n);
+                }
+                if (i + n == count) {
+                    checksum += work[0] + wx[0];
+                    work = vecs;
+                    wx = xs;
+                    wy = ys;
+                    wz = zs;
+                }
+            }
+            std::string name = std::string("rotate_minus_gravity") + (soa ? "_soa" : "") + ", blocks of " + std::to_string(block);
+            report(name.c_str(), start);
+        }
+    }
+
+    // The conditioner, per sample and per FIFO block: same batches, and the cost per sample
+    ImuSynth synth(synth_default_config());
+    const long samples = 60L * POLL_RATE;
+    std::vector<float> acc_in(3 * samples), gyro_in(3 * samples);
+    for (long t = 0; t < samples; t++) {
+        RawImuSample sample;
+        uint8_t label;
+        synth.generate(&sample, &label, 1);
+        for (int axis = 0; axis < 3; axis++) {
+            acc_in[3 * t + axis] = sample.accel[axis] * ACCEL_SCALE;
+            gyro_in[3 * t + axis] = sample.gyro[axis] * GYRO_SCALE;
+        }
+    }
+    const int passes = 200;
+    double batch_difference = 0.0;
+    std::vector<IMUBatch> reference;
+    printf("  SampleConditioner, %.0f s of synthetic data x %d:\n", samples / (double)POLL_RATE, passes);
+    for (int block : { 1, 4, 16, 32 }) {
+        SampleConditioner conditioner;
+        IMUBatch batch;
+        std::vector<IMUBatch> batches;
+        std::vector<float> acc_work(acc_in);
+        double seconds = 0.0;
+        for (int pass = 0; pass < passes; pass++) {
+            acc_work = acc_in;
+            int slot = 0;
+            auto pass_start = bench_clock::now();
+            for (long t = 0; t < samples;) {
+                // A block never crosses the end of a batch
+                int n = (int)std::min<long>({ (long)block, samples - t, (long)(BATCH_SIZE_FILLED + 1 - slot) });
+                conditioner.condition((float (*)[3])&acc_work[3 * t], (const float (*)[3])&gyro_in[3 * t], n, &batch, slot);
+                t += n;
+                slot += n;
+                if (slot == BATCH_SIZE_FILLED + 1) {
+                    if (pass == 0) batches.push_back(batch);
+                    slot = 0;
+                }
+            }
+            seconds += seconds_since(pass_start);
+        }
+        if (block == 1) reference = batches;
+        for (size_t b = 0; b < batches.size() && b < reference.size(); b++) {
+            for (int axis = 0; axis < 3; axis++) {
+                for (int i = 0; i <= BATCH_SIZE_FILLED; i++) {
+                    batch_difference = std::max(batch_difference,
+                        (double)fabsf(batches[b].accelerometer[axis][i] - reference[b].accelerometer[axis][i]));
+                }
+            }
+        }
+        checksum += batch.accelerometer[0][0];
+        printf("    blocks of %-3d  %7.1f ns per sample\n", block, seconds * 1e9 / (samples * passes));
+    }
+    printf("  max batch difference, blocks vs. one sample at a time: %.2g g (checksum %.3g)\n", batch_difference, checksum);
+
+    double worst = std::max({ error_aos, error_gravity, error_soa, batch_difference });
+    printf("  all within %.0e g: %s\n", ROTATE_MAX_ERROR_G, worst <= ROTATE_MAX_ERROR_G ? "ok" : "FAIL");
+    return worst <= ROTATE_MAX_ERROR_G ? 0 : 1;
+}
+
+//MARK: decimate
+
+/** Amplitude of a decimated tone, relative to what went in, in dB.
+ * @param factor Oversampling; the tone is generated at factor * POLL_RATE
+ * @param fir Through ImuDecimator, or just every factor'th sample (a sensor running at POLL_RATE with no anti-aliasing)
+ */
+static double decimated_tone_db(float hz, int factor, bool fir) {
+    const float amplitude = 8000.f;
+    const int outputs = 40 * POLL_RATE, settle = POLL_RATE;
+    ImuDecimator decimator(factor);
+    RawImuSample in[DECIMATOR_MAX_BLOCK], out[DECIMATOR_MAX_BLOCK];
+    const int block = DECIMATOR_MAX_BLOCK - DECIMATOR_MAX_BLOCK % factor;
+    double sum_sq = 0.0;
+    long input = 0, output = 0;
+    while (output < outputs) {
+        for (int i = 0; i < block; i++, input++) {
+            memset(&in[i], 0, sizeof(in[i]));
+            in[i].accel[0] = (int16_t)lrintf(amplitude * sinf(2.f * PI * hz * input / (factor * POLL_RATE)));
+        }
+        int n;
+        if (fir) {
+            n = decimator.process(in, block, out);
+        } else {
+            n = block / factor;
+            for (int i = 0; i < n; i++) out[i] = in[i * factor];
+        }
+        for (int i = 0; i < n; i++, output++) {
+            if (output >= settle) sum_sq += (double)out[i].accel[0] * out[i].accel[0];
+        }
+    }
+    double rms = sqrt(sum_sq / (outputs - settle));
+    return 20.0 * log10(std::max(rms * sqrt(2.0), 0.5) / amplitude);
+}
+
+// What the FIR has to do: tones up to DECIMATOR_PASS_HZ within this much of their input level, and tones
+// above POLL_RATE / 2 that would fold into 0-DECIMATOR_PASS_HZ at least this far down
+#define DECIMATE_MAX_PASS_LOSS_DB 0.5
+#define DECIMATE_MAX_ALIAS_DB -60.0
+
+/** Decimation from an oversampled sensor to POLL_RATE: how much of each tone survives (and where it lands),
+ * without and with the FIR, and what the FIR costs per output sample. Fails if the FIR misses
+ * DECIMATE_MAX_PASS_LOSS_DB or DECIMATE_MAX_ALIAS_DB.
+ */
+static int bench_decimate(int argc, char **argv) {
+    long outputs = argc > 0 ? atol(argv[0]) : 2000000;
+
+    printf("decimate: tone in, amplitude out at %d Hz (dB; -96 is below one count)\n", POLL_RATE);
+    printf("  %8s  %10s  %14s  %10s  %10s\n", "tone", "lands at", "every 4th", "FIR x4", "FIR x8");
+    const float tones[] = { 1.f, 3.f, 5.f, 7.f, 8.f, 12.f, 20.f, 30.f, 44.f, 47.f, 50.f, 55.f, 60.f, 75.f, 100.f, 150.f, 200.f };
+    bool within = true;
+    for (float hz : tones) {
+        // Where it folds to after sampling at POLL_RATE
+        float folded = fmodf(hz, (float)POLL_RATE);
+        if (folded > POLL_RATE / 2.f) folded = POLL_RATE - folded;
+        double fir4 = hz >= 4 * POLL_RATE / 2.f ? NAN : decimated_tone_db(hz, 4, true);
+        double fir8 = decimated_tone_db(hz, 8, true);
+        if (hz >= 4 * POLL_RATE / 2.f) {
+            printf("  %5.0f Hz  %7.1f Hz  %14s  %10s  %7.1f dB\n", hz, folded, "-", "-", fir8);
+        } else {
+            printf("  %5.0f Hz  %7.1f Hz  %11.1f dB  %7.1f dB  %7.1f dB\n", hz, folded,
+                decimated_tone_db(hz, 4, false), fir4, fir8);
+        }
+        for (double db : { fir4, fir8 }) {
+            if (std::isnan(db)) continue;
+            if (hz <= DECIMATOR_PASS_HZ && !(db >= -DECIMATE_MAX_PASS_LOSS_DB)) within = false;
+            if (hz > POLL_RATE / 2.f && folded <= DECIMATOR_PASS_HZ && !(db <= DECIMATE_MAX_ALIAS_DB)) within = false;
+        }
+    }
+    printf("  FIR passband within %.1f dB, aliases into it below %.0f dB: %s\n",
+        DECIMATE_MAX_PASS_LOSS_DB, DECIMATE_MAX_ALIAS_DB, within ? "ok" : "FAIL");
+
+    // Cost, on noise so nothing is special about the data
+    srand(5);
+    for (int factor : { 4, 8 }) {
+        ImuDecimator decimator(factor);
+        const int block = DECIMATOR_MAX_BLOCK - DECIMATOR_MAX_BLOCK % factor;
+        std::vector<RawImuSample> in(block * 64);
+        for (RawImuSample &sample : in) {
+            for (int axis = 0; axis < 3; axis++) {
+                sample.accel[axis] = (int16_t)(rand() % 4000 - 2000);
+                sample.gyro[axis] = (int16_t)(rand() % 4000 - 2000);
+            }
+        }
+        RawImuSample out[DECIMATOR_MAX_BLOCK];
+        long checksum = 0, done = 0;
+        auto start = bench_clock::now();
+        for (long block_index = 0; done < outputs; block_index++) {
+            done += decimator.process(&in[(block_index % 64) * block], block, out);
+            checksum += out[0].accel[0];
+        }
+        double ns = seconds_since(start) * 1e9 / done;
+        printf("  x%d (%d taps, %d Hz in): %.1f ns per output sample (6 axes), %.1f us per second of data (checksum %ld)\n",
+            factor, DECIMATOR_TAPS_PER_PHASE * factor, factor * POLL_RATE, ns, ns * POLL_RATE / 1000.0, checksum);
+    }
+    return within ? 0 : 1;
+}
+
+//MARK: adaptive
+
+/** The ingest pipeline and analysis of one POLL_RATE stream, scored window by window against the synthesizer's labels */
+class WindowScorer {
+public:
+    WindowScorer() {
+        _sink.on_window = [this](const SymptomIntensities &result) {
+            float values[3] = { result.tremor, result.dyskinesia, result.fog };
+            for (int symptom = 0; symptom < 3; symptom++) {
+                int present = _labelled[symptom] * 2 > BATCH_SIZE_FILLED ? 1 : 0;
+                sums[symptom][present] += values[symptom];
+                counts[symptom][present]++;
+                _labelled[symptom] = 0;
+            }
+            intensities.push_back(result);
+        };
+    }
+
+    void add(const RawImuSample &sample, uint8_t label) {
+        for (int symptom = 0; symptom < 3; symptom++) {
+            if (label & truth_flags[symptom]) _labelled[symptom]++;
+        }
+        _pipeline.push(&sample, 1);
+    }
+
+    static constexpr uint8_t truth_flags[3] = { SYNTH_LABEL_TREMOR, SYNTH_LABEL_DYSKINESIA, SYNTH_LABEL_FREEZE };
+    double sums[3][2] = {};
+    long counts[3][2] = {};
+    std::vector<SymptomIntensities> intensities;
+
+private:
+    AnalyzingSink _sink;
+    IngestPipeline _pipeline { _sink };
+    int _labelled[3] = { 0, 0, 0 };
+};
+
+constexpr uint8_t WindowScorer::truth_flags[3];
+
+/** A day of synthetic data through a sensor at a fixed IMU_OVERSAMPLING rate and through one whose rate a
+ * RateController adapts, both converted to POLL_RATE and analyzed. Reports the energy proxies (time at the
+ * low rate, mean ODR, bytes read, converter time) and how far the adaptive results are from the fixed ones.
+ * The world is generated at 4 x POLL_RATE; the sensor's own filtering at the low rate is modelled by an
+ * ImuDecimator(8).
+ */
+static int bench_adaptive(int argc, char **argv) {
+    double hours = argc > 0 ? atof(argv[0]) : 24.0;
+    SynthConfig config = synth_default_config();
+    if (argc > 1) config.rest_s = (float)atof(argv[1]);
+    const int world_factor = 4;
+    config.sample_rate = world_factor * POLL_RATE;
+
+    init_fft();
+
+    // One chunk is a FIFO block at either rate: 64 inputs at 208 Hz or 32 at 26 Hz, 64 outputs either way
+    const int chunk = INTERPOLATOR_MAX_BLOCK * world_factor;
+    const int outputs = INTERPOLATOR_MAX_BLOCK;
+    ImuSynth synth(config);
+    std::vector<RawImuSample> world(chunk);
+    std::vector<uint8_t> labels(chunk);
+
+    ImuDecimator fixed_decimator(world_factor), high_decimator(world_factor);
+    ImuDecimator low_sensor(world_factor * RATE_LOW_INTERPOLATION);
+    ImuInterpolator interpolator(RATE_LOW_INTERPOLATION);
+    RateController controller;
+    WindowScorer fixed, adaptive;
+    RawImuSample fixed_out[outputs], adaptive_out[outputs], low_in[outputs / RATE_LOW_INTERPOLATION];
+
+    long chunks = (long)(hours * 3600.0 * POLL_RATE / outputs), low_chunks = 0;
+    double fixed_seconds = 0.0, adaptive_seconds = 0.0;
+    ImuRate rate = IMU_RATE_HIGH;
+    auto start = bench_clock::now();
+    for (long c = 0; c < chunks; c++) {
+        synth.generate(world.data(), labels.data(), chunk);
+        // The sensor at the low rate, whether or not it's being read
+        for (int i = 0; i < chunk; i += DECIMATOR_MAX_BLOCK) {
+            low_sensor.process(&world[i], DECIMATOR_MAX_BLOCK, &low_in[i / (world_factor * RATE_LOW_INTERPOLATION)]);
+        }
+
+        auto converter_start = bench_clock::now();
+        for (int i = 0; i < chunk; i += DECIMATOR_MAX_BLOCK) {
+            fixed_decimator.process(&world[i], DECIMATOR_MAX_BLOCK, &fixed_out[i / world_factor]);
+        }
+        fixed_seconds += seconds_since(converter_start);
+
+        converter_start = bench_clock::now();
+        if (rate == IMU_RATE_LOW) {
+            interpolator.process(low_in, outputs / RATE_LOW_INTERPOLATION, adaptive_out);
+            low_chunks++;
+        } else {
+            for (int i = 0; i < chunk; i += DECIMATOR_MAX_BLOCK) {
+                high_decimator.process(&world[i], DECIMATOR_MAX_BLOCK, &adaptive_out[i / world_factor]);
+            }
+        }
+        ImuRate next = controller.update(adaptive_out, outputs);
+        if (next != rate) {
+            if (next == IMU_RATE_LOW) {
+                interpolator.prime(adaptive_out[outputs - 1]);
+            } else {
+                high_decimator.prime(adaptive_out[outputs - 1]);
+            }
+            rate = next;
+        }
+        adaptive_seconds += seconds_since(converter_start);
+
+        for (int i = 0; i < outputs; i++) {
+            fixed.add(fixed_out[i], labels[i * world_factor]);
+            adaptive.add(adaptive_out[i], labels[i * world_factor]);
+        }
+    }
+    double seconds = seconds_since(start);
+
+    double low_fraction = (double)low_chunks / chunks;
+    double data_seconds = (double)chunks * outputs / POLL_RATE;
+    // Chunks last the same at either rate, so time at each rate goes by chunks
+    double mean_odr = low_fraction * RATE_LOW_HZ + (1.0 - low_fraction) * world_factor * POLL_RATE;
+    printf("adaptive: %.1f h of synthetic data (rest %.0f s mean) in %.1f s\n", hours, config.rest_s, seconds);
+    printf("  %-9s  %10s  %9s  %10s  %12s  %14s\n", "sensor", "at low", "switches", "mean ODR", "bytes read/s",
+        "converter/s");
+    printf("  %-9s  %9.1f%%  %9d  %7.1f Hz  %12.0f  %11.1f us\n", "fixed", 0.0, 0,
+        (double)world_factor * POLL_RATE, 12.0 * world_factor * POLL_RATE, fixed_seconds * 1e6 / data_seconds);
+    printf("  %-9s  %9.1f%%  %9u  %7.1f Hz  %12.0f  %11.1f us\n", "adaptive", 100.0 * low_fraction,
+        controller.switches(), mean_odr, 12.0 * mean_odr, adaptive_seconds * 1e6 / data_seconds);
+
+    const char *names[3] = { "tremor", "dyskinesia", "fog" };
+    printf("  mean intensity    %18s  %18s  %16s\n", "fixed", "adaptive", "|adaptive-fixed|");
+    printf("  %-10s  %9s  %8s  %8s  %8s  %8s  %8s  %8s\n", "symptom", "windows", "absent", "present", "absent",
+        "present", "mean", "max");
+    for (int symptom = 0; symptom < 3; symptom++) {
+        auto mean = [](const WindowScorer &scorer, int symptom, int present) {
+            long n = scorer.counts[symptom][present];
+            return n ? scorer.sums[symptom][present] / n : 0.0;
+        };
+        double diff_sum = 0.0, diff_max = 0.0;
+        for (size_t w = 0; w < fixed.intensities.size(); w++) {
+            const SymptomIntensities &a = fixed.intensities[w], &b = adaptive.intensities[w];
+            float values[2] = { symptom == 0 ? a.tremor : symptom == 1 ? a.dyskinesia : a.fog,
+                                symptom == 0 ? b.tremor : symptom == 1 ? b.dyskinesia : b.fog };
+            double diff = fabs(values[1] - values[0]);
+            diff_sum += diff;
+            diff_max = std::max(diff_max, diff);
+        }
+        printf("  %-10s  %9ld  %8.4f  %8.4f  %8.4f  %8.4f  %8.4f  %8.4f\n", names[symptom],
+            fixed.counts[symptom][0] + fixed.counts[symptom][1], mean(fixed, symptom, 0), mean(fixed, symptom, 1),
+            mean(adaptive, symptom, 0), mean(adaptive, symptom, 1),
+            fixed.intensities.empty() ? 0.0 : diff_sum / fixed.intensities.size(), diff_max);
+    }
+    return 0;
+}
+
+//MARK: resample
+
+/** What the sensor would read at time t (seconds): 1.2 Hz and 4.5 Hz (tremor) on accel x, 6 Hz on gyro x */
+static RawImuSample resample_truth(double t) {
+    RawImuSample sample;
+    memset(&sample, 0, sizeof(sample));
+    sample.accel[0] = (int16_t)lrint(4000.0 * sin(2.0 * M_PI * 4.5 * t) + 2000.0 * sin(2.0 * M_PI * 1.2 * t));
+    sample.gyro[0] = (int16_t)lrint(3000.0 * sin(2.0 * M_PI * 6.0 * t));
+    return sample;
+}
+
+// What bench_resample() accepts: the share of dropped samples it may fail to fill (drops next to an outage
+// aren't filled), and the rms error of its output as a share of the signal's
+#define RESAMPLE_MAX_UNFILLED 0.01
+#define RESAMPLE_MAX_ERROR 0.1
+
+/** Feed the ImuResampler a stream with dropped and repeated samples, timestamp jitter, a sensor clock that's
+ * off, and the odd outage too long to fill. Checks that it finds them, compares its output with the true
+ * signal at each grid time (and with taking the samples as they come), and times it. Fails if a repeat or
+ * outage is missed, or RESAMPLE_MAX_UNFILLED or RESAMPLE_MAX_ERROR is exceeded.
+ */
+static int bench_resample(int argc, char **argv) {
+    double seconds = argc > 0 ? atof(argv[0]) : 3600.0;
+    double drop = argc > 1 ? atof(argv[1]) / 100.0 : 0.02;
+    double jitter_us = argc > 2 ? atof(argv[2]) : 500.0;
+    double drift_ppm = argc > 3 ? atof(argv[3]) : 2000.0;
+    const double duplicate = 0.005, outage_every_s = 120.0, outage_s = 0.5;
+
+    // The stream as read: samples, when they were stamped, and when they were really taken
+    srand(11);
+    auto uniform = []() { return rand() / (RAND_MAX + 1.0); };
+    std::vector<RawImuSample> samples;
+    std::vector<uint64_t> times_us;
+    long sensor_samples = (long)(seconds * POLL_RATE);
+    long dropped = 0, duplicated = 0, outages = 0;
+    double period_s = (1.0 + drift_ppm * 1e-6) / POLL_RATE, next_outage_s = outage_every_s;
+    for (long i = 0; i < sensor_samples; i++) {
+        double t = i * period_s;
+        if (t >= next_outage_s) {
+            // Skip a stretch the resampler shouldn't fill
+            long skip = (long)(outage_s / period_s);
+            i += skip - 1;
+            next_outage_s += outage_every_s;
+            outages++;
+            continue;
+        }
+        if (uniform() < drop) {
+            dropped++;
+            continue;
+        }
+        RawImuSample sample = resample_truth(t);
+        uint64_t stamp = (uint64_t)llrint(1e6 + t * 1e6 + (2.0 * uniform() - 1.0) * jitter_us);
+        samples.push_back(sample);
+        times_us.push_back(stamp);
+        if (uniform() < duplicate) {
+            // Read twice before the next sample was ready
+            samples.push_back(sample);
+            times_us.push_back(stamp);
+            duplicated++;
+        }
+    }
+
+    // Error against the true signal at the time each output is meant to stand for
+    double naive_sq = 0.0, resampled_sq = 0.0, signal_sq = 0.0;
+    long naive_n = 0, resampled_n = 0;
+    uint64_t origin_us = times_us[0];
+    for (size_t i = 0; i < samples.size(); i++) {
+        double t = (origin_us + i * 1e6 / POLL_RATE) * 1e-6 - 1.0;
+        double error = samples[i].accel[0] - resample_truth(t).accel[0];
+        naive_sq += error * error;
+        naive_n++;
+    }
+
+    ImuResampler resampler;
+    RawImuSample out[RESAMPLER_MAX_OUTPUT];
+    uint64_t k = 0;
+    for (size_t i = 0; i < samples.size(); i++) {
+        int n = resampler.push(samples[i], times_us[i], out);
+        if (resampler.take_break() || i == 0) {
+            origin_us = times_us[i];
+            k = 0;
+        }
+        for (int j = 0; j < n; j++, k++) {
+            double t = (origin_us + k * 1000000 / POLL_RATE) * 1e-6 - 1.0;
+            RawImuSample truth = resample_truth(t);
+            double error = out[j].accel[0] - truth.accel[0];
+            resampled_sq += error * error;
+            signal_sq += (double)truth.accel[0] * truth.accel[0];
+            resampled_n++;
+        }
+    }
+    const ResamplerStats &stats = resampler.stats();
+
+    // Cost
+    long passes = std::max(1L, 4000000L / (long)samples.size()), checksum = 0;
+    auto start = bench_clock::now();
+    for (long pass = 0; pass < passes; pass++) {
+        ImuResampler timed;
+        for (size_t i = 0; i < samples.size(); i++) {
+            int n = timed.push(samples[i], times_us[i], out);
+            checksum += n ? out[n - 1].accel[0] : 0;
+        }
+    }
+    double ns = seconds_since(start) * 1e9 / ((double)passes * samples.size());
+
+    printf("resample: %.0f s at %d Hz, %.1f%% dropped, %.1f%% repeated, +-%.0f us jitter, clock off by %.0f ppm\n",
+        seconds, POLL_RATE, 100.0 * drop, 100.0 * duplicate, jitter_us, drift_ppm);
+    printf("  %-12s  %10s  %10s\n", "", "injected", "found");
+    printf("  %-12s  %10ld  %10u\n", "dropped", dropped, stats.filled);
+    printf("  %-12s  %10ld  %10u\n", "repeated", duplicated, stats.duplicates);
+    printf("  %-12s  %10ld  %10u\n", "outages", outages, stats.breaks);
+    double signal_rms = sqrt(signal_sq / resampled_n);
+    printf("  accel x error vs. the true signal (rms %.0f counts):\n", signal_rms);
+    printf("    as read:    %8.1f counts (%.1f%%)\n", sqrt(naive_sq / naive_n), 100.0 * sqrt(naive_sq / naive_n) / signal_rms);
+    printf("    resampled:  %8.1f counts (%.1f%%)\n", sqrt(resampled_sq / resampled_n),
+        100.0 * sqrt(resampled_sq / resampled_n) / signal_rms);
+    printf("  %.1f ns per input sample, %.1f us per second of data (checksum %ld)\n", ns, ns * POLL_RATE / 1000.0,
+        checksum);
+
+    bool found = stats.duplicates == (uint32_t)duplicated && stats.breaks == (uint32_t)outages &&
+        fabs((double)stats.filled - dropped) <= RESAMPLE_MAX_UNFILLED * dropped;
+    bool accurate = sqrt(resampled_sq / resampled_n) <= RESAMPLE_MAX_ERROR * signal_rms;
+    printf("  every repeat and outage found, drops filled within %.0f%%: %s; error within %.0f%%: %s\n",
+        100.0 * RESAMPLE_MAX_UNFILLED, found ? "ok" : "FAIL", 100.0 * RESAMPLE_MAX_ERROR, accurate ? "ok" : "FAIL");
+    return found && accurate ? 0 : 1;
+}
+
+//MARK: q15
+
+/** A day of synthetic data through the float pipeline and the Q15 one (ANALYSIS_Q15) side by side, from the
+ * same samples. Reports how far the Q15 intensities and spectra are from the float ones, what each path
+ * costs per window, and what each keeps in RAM.
+ */
+static int bench_q15(int argc, char **argv) {
+    double hours = argc > 0 ? atof(argv[0]) : 24.0;
+    SynthConfig config = synth_default_config();
+    if (argc > 1) config.seed = (uint32_t)atoi(argv[1]);
+
+    init_fft();
+
+    const int n = BATCH_SIZE_FILLED + 1;
+    ImuSynth synth(config);
+    SampleConditioner float_conditioner, q15_conditioner;
+    SymptomAnalyzer float_analyzer;
+    SymptomAnalyzerQ15 q15_analyzer;
+    static IMUBatch float_batch;
+    static IMUBatchQ15 q15_batch;
+    static float widened[2][3][BATCH_SIZE / 2 + 1];
+    RawImuSample samples[n];
+    uint8_t labels[n];
+    float acc[2][n][3], gyro[n][3];
+
+    const char *names[3] = { "tremor", "dyskinesia", "fog" };
+    const uint8_t truth_flags[3] = { SYNTH_LABEL_TREMOR, SYNTH_LABEL_DYSKINESIA, SYNTH_LABEL_FREEZE };
+    double sums[2][3][2] = {}, diff_sums[3] = {}, diff_max[3] = {};
+    long counts[3][2] = {};
+    double spectrum_error[2] = {}, spectrum_error_max[2] = {};
+    double condition_seconds[2] = {}, analyze_seconds[2] = {};
+
+    long windows = (long)(hours * 3600.0 * POLL_RATE / n);
+    auto start = bench_clock::now();
+    for (long window = 0; window < windows; window++) {
+        synth.generate(samples, labels, n);
+        int labelled[3] = { 0, 0, 0 };
+        for (int t = 0; t < n; t++) {
+            for (int axis = 0; axis < 3; axis++) {
+                acc[0][t][axis] = acc[1][t][axis] = samples[t].accel[axis] * ACCEL_SCALE;
+                gyro[t][axis] = samples[t].gyro[axis] * GYRO_SCALE;
+            }
+            for (int symptom = 0; symptom < 3; symptom++) {
+                if (labels[t] & truth_flags[symptom]) labelled[symptom]++;
+            }
+        }
+
+        auto stage_start = bench_clock::now();
+        float_conditioner.condition(acc[0], gyro, n, &float_batch, 0);
+        SampleConditioner::finish_batch(&float_batch);
+        condition_seconds[0] += seconds_since(stage_start);
+        stage_start = bench_clock::now();
+        q15_conditioner.condition(acc[1], gyro, n, &q15_batch, 0);
+        SampleConditioner::finish_batch(&q15_batch);
+        condition_seconds[1] += seconds_since(stage_start);
+
+        stage_start = bench_clock::now();
+        SymptomIntensities a = float_analyzer.analyze(float_batch.accelerometer, float_batch.gyroscope);
+        analyze_seconds[0] += seconds_since(stage_start);
+        stage_start = bench_clock::now();
+        SymptomIntensities b = q15_analyzer.analyze(q15_batch.accelerometer, q15_batch.gyroscope);
+        analyze_seconds[1] += seconds_since(stage_start);
+
+        float values[2][3] = { { a.tremor, a.dyskinesia, a.fog }, { b.tremor, b.dyskinesia, b.fog } };
+        for (int symptom = 0; symptom < 3; symptom++) {
+            int present = labelled[symptom] * 2 > BATCH_SIZE_FILLED ? 1 : 0;
+            sums[0][symptom][present] += values[0][symptom];
+            sums[1][symptom][present] += values[1][symptom];
+            counts[symptom][present]++;
+            double diff = fabs(values[1][symptom] - values[0][symptom]);
+            diff_sums[symptom] += diff;
+            diff_max[symptom] = std::max(diff_max[symptom], diff);
+        }
+
+        // Spectra: total absolute error relative to the float spectrum's total, accelerometer then gyroscope
+        q15_analyzer.widen_spectra(widened[0], widened[1]);
+        for (int sensor = 0; sensor < 2; sensor++) {
+            const float (*reference)[BATCH_SIZE / 2 + 1] = sensor == 0 ? float_analyzer.accelerometer_frequency_magnitudes
+                                                                       : float_analyzer.gyroscope_frequency_magnitudes;
+            double error = 0.0, total = 0.0;
+            for (int axis = 0; axis < 3; axis++) {
+                for (int bin = 0; bin < BATCH_SIZE / 2 + 1; bin++) {
+                    error += fabs(widened[sensor][axis][bin] - reference[axis][bin]);
+                    total += reference[axis][bin];
+                }
+            }
+            double relative = total > 0.0 ? error / total : 0.0;
+            spectrum_error[sensor] += relative;
+            spectrum_error_max[sensor] = std::max(spectrum_error_max[sensor], relative);
+        }
+    }
+    double seconds = seconds_since(start);
+
+    printf("q15: %ld windows (%.1f h) in %.3f s\n", windows, hours, seconds);
+    printf("  %-6s  %14s  %14s  %14s  %14s\n", "path", "condition/win", "analyze/win", "batch bytes", "analyzer bytes");
+    printf("  %-6s  %11.1f us  %11.1f us  %14zu  %14zu\n", "float", condition_seconds[0] * 1e6 / windows,
+        analyze_seconds[0] * 1e6 / windows, sizeof(IMUBatch), sizeof(SymptomAnalyzer));
+    printf("  %-6s  %11.1f us  %11.1f us  %14zu  %14zu\n", "q15", condition_seconds[1] * 1e6 / windows,
+        analyze_seconds[1] * 1e6 / windows, sizeof(IMUBatchQ15), sizeof(SymptomAnalyzerQ15));
+    printf("  spectrum error (|q15-float| / float): accel mean %.2f%% max %.2f%%, gyro mean %.2f%% max %.2f%%\n",
+        100.0 * spectrum_error[0] / windows, 100.0 * spectrum_error_max[0],
+        100.0 * spectrum_error[1] / windows, 100.0 * spectrum_error_max[1]);
+
+    printf("  mean intensity    %18s  %18s  %16s\n", "float", "q15", "|q15-float|");
+    printf("  %-10s  %9s  %8s  %8s  %8s  %8s  %8s  %8s\n", "symptom", "windows", "absent", "present", "absent",
+        "present", "mean", "max");
+    for (int symptom = 0; symptom < 3; symptom++) {
+        auto mean = [&](int path, int present) {
+            long count = counts[symptom][present];
+            return count ? sums[path][symptom][present] / count : 0.0;
+        };
+        printf("  %-10s  %9ld  %8.4f  %8.4f  %8.4f  %8.4f  %8.4f  %8.4f\n", names[symptom], windows,
+            mean(0, 0), mean(0, 1), mean(1, 0), mean(1, 1), diff_sums[symptom] / windows, diff_max[symptom]);
+    }
+    return 0;
+}
+
+//MARK: f16
+
+// How far the float16 path may drift from float: spectrum L1 error as a share of float's, and any intensity
+#define F16_MAX_SPECTRUM_ERROR 0.001
+#define F16_MAX_INTENSITY_DIFF 0.001
+
+/** Float16 storage (ANALYSIS_F16). First the conversions on their own: every half must come back unchanged
+ * through float, and random floats must narrow to the nearest half. Then a day of synthetic data through
+ * the float pipeline and the float16 one side by side, as the q15 command does, and the RAM each
+ * precision keeps in batches, analyzer and spectra. Fails if a conversion is off, or the float16 path
+ * drifts past F16_MAX_SPECTRUM_ERROR or F16_MAX_INTENSITY_DIFF in any window.
+ */
+static int bench_f16(int argc, char **argv) {
+    double hours = argc > 0 ? atof(argv[0]) : 24.0;
+    SynthConfig config = synth_default_config();
+    if (argc > 1) config.seed = (uint32_t)atoi(argv[1]);
+
+    long round_trip_errors = 0;
+    for (uint32_t bits = 0; bits < 0x10000; bits++) {
+        half_t half = { (uint16_t)bits };
+        bool nan = (bits & 0x7C00) == 0x7C00 && (bits & 0x3FF);
+        if (!nan && half_from_float(half_to_float(half)).bits != bits) round_trip_errors++;
+    }
+    // Within half a step of 2^-10 (relative) for normal halves; the compiler's own conversion where there is one
+    long narrow_errors = 0, reference_mismatches = 0, narrowed = 2000000;
+    double worst_relative = 0.0;
+    srand(1);
+    for (long i = 0; i < narrowed; i++) {
+        float value = ldexpf((float)rand() / RAND_MAX - 0.5f, rand() % 30 - 14);
+        float back = half_to_float(half_from_float(value));
+        if (fabsf(value) >= 6.103515625e-05f) {
+            double relative = fabs(back - value) / fabs(value);
+            worst_relative = std::max(worst_relative, relative);
+            if (relative > 1.0 / 2048.0) narrow_errors++;
+        }
+        #ifdef __FLT16_MAX__
+        if ((float)(_Float16)value != back) reference_mismatches++;
+        #endif
+    }
+    printf("f16 conversions: %ld of 65536 halves changed by a round trip, %ld of %ld floats off by more than "
+        "half a step (worst %.2e relative)", round_trip_errors, narrow_errors, narrowed, worst_relative);
+    #ifdef __FLT16_MAX__
+    printf(", %ld different from _Float16", reference_mismatches);
+    #endif
+    printf("\n");
+
+    init_fft();
+
+    const int n = BATCH_SIZE_FILLED + 1;
+    ImuSynth synth(config);
+    SampleConditioner float_conditioner, f16_conditioner;
+    SymptomAnalyzer float_analyzer;
+    SymptomAnalyzerF16 f16_analyzer;
+    static IMUBatch float_batch;
+    static IMUBatchF16 f16_batch;
+    RawImuSample samples[n];
+    uint8_t labels[n];
+    float acc[2][n][3], gyro[n][3];
+
+    const char *names[3] = { "tremor", "dyskinesia", "fog" };
+    const uint8_t truth_flags[3] = { SYNTH_LABEL_TREMOR, SYNTH_LABEL_DYSKINESIA, SYNTH_LABEL_FREEZE };
+    double sums[2][3][2] = {}, diff_sums[3] = {}, diff_max[3] = {};
+    long counts[3][2] = {};
+    double spectrum_error[2] = {}, spectrum_error_max[2] = {};
+    double condition_seconds[2] = {}, analyze_seconds[2] = {};
+
+    long windows = (long)(hours * 3600.0 * POLL_RATE / n);
+    auto start = bench_clock::now();
+    for (long window = 0; window < windows; window++) {
+        synth.generate(samples, labels, n);
+        int labelled[3] = { 0, 0, 0 };
+        for (int t = 0; t < n; t++) {
+            for (int axis = 0; axis < 3; axis++) {
+                acc[0][t][axis] = acc[1][t][axis] = samples[t].accel[axis] * ACCEL_SCALE;
+                gyro[t][axis] = samples[t].gyro[axis] * GYRO_SCALE;
+            }
+            for (int symptom = 0; symptom < 3; symptom++) {
+                if (labels[t] & truth_flags[symptom]) labelled[symptom]++;
+            }
+        }
+
+        auto stage_start = bench_clock::now();
+        float_conditioner.condition(acc[0], gyro, n, &float_batch, 0);
+        SampleConditioner::finish_batch(&float_batch);
+        condition_seconds[0] += seconds_since(stage_start);
+        stage_start = bench_clock::now();
+        f16_conditioner.condition(acc[1], gyro, n, &f16_batch, 0);
+        SampleConditioner::finish_batch(&f16_batch);
+        condition_seconds[1] += seconds_since(stage_start);
+
+        stage_start = bench_clock::now();
+        SymptomIntensities a = float_analyzer.analyze(float_batch.accelerometer, float_batch.gyroscope);
+        analyze_seconds[0] += seconds_since(stage_start);
+        stage_start = bench_clock::now();
+        SymptomIntensities b = f16_analyzer.analyze(f16_batch.accelerometer, f16_batch.gyroscope);
+        analyze_seconds[1] += seconds_since(stage_start);
+
+        float values[2][3] = { { a.tremor, a.dyskinesia, a.fog }, { b.tremor, b.dyskinesia, b.fog } };
+        for (int symptom = 0; symptom < 3; symptom++) {
+            int present = labelled[symptom] * 2 > BATCH_SIZE_FILLED ? 1 : 0;
+            sums[0][symptom][present] += values[0][symptom];
+            sums[1][symptom][present] += values[1][symptom];
+            counts[symptom][present]++;
+            double diff = fabs(values[1][symptom] - values[0][symptom]);
+            diff_sums[symptom] += diff;
+            diff_max[symptom] = std::max(diff_max[symptom], diff);
+        }
+
+        for (int sensor = 0; sensor < 2; sensor++) {
+            const float (*reference)[BATCH_SIZE / 2 + 1] = sensor == 0 ? float_analyzer.accelerometer_frequency_magnitudes
+                                                                       : float_analyzer.gyroscope_frequency_magnitudes;
+            const half_t (*stored)[BATCH_SIZE / 2 + 1] = sensor == 0 ? f16_analyzer.accelerometer_frequency_magnitudes
+                                                                     : f16_analyzer.gyroscope_frequency_magnitudes;
+            double error = 0.0, total = 0.0;
+            for (int axis = 0; axis < 3; axis++) {
+                for (int bin = 0; bin < BATCH_SIZE / 2 + 1; bin++) {
+                    error += fabs(half_to_float(stored[axis][bin]) - reference[axis][bin]);
+                    total += reference[axis][bin];
+                }
+            }
+            double relative = total > 0.0 ? error / total : 0.0;
+            spectrum_error[sensor] += relative;
+            spectrum_error_max[sensor] = std::max(spectrum_error_max[sensor], relative);
+        }
+    }
+    double seconds = seconds_since(start);
+
+    printf("f16: %ld windows (%.1f h) in %.3f s\n", windows, hours, seconds);
+    printf("  %-6s  %14s  %14s\n", "path", "condition/win", "analyze/win");
+    printf("  %-6s  %11.1f us  %11.1f us\n", "float", condition_seconds[0] * 1e6 / windows, analyze_seconds[0] * 1e6 / windows);
+    printf("  %-6s  %11.1f us  %11.1f us\n", "f16", condition_seconds[1] * 1e6 / windows, analyze_seconds[1] * 1e6 / windows);
+    printf("  spectrum error (|f16-float| / float): accel mean %.3f%% max %.3f%%, gyro mean %.3f%% max %.3f%%\n",
+        100.0 * spectrum_error[0] / windows, 100.0 * spectrum_error_max[0],
+        100.0 * spectrum_error[1] / windows, 100.0 * spectrum_error_max[1]);
+
+    printf("  mean intensity    %18s  %18s  %16s\n", "float", "f16", "|f16-float|");
+    printf("  %-10s  %9s  %8s  %8s  %8s  %8s  %8s  %8s\n", "symptom", "windows", "absent", "present", "absent",
+        "present", "mean", "max");
+    for (int symptom = 0; symptom < 3; symptom++) {
+        auto mean = [&](int path, int present) {
+            long count = counts[symptom][present];
+            return count ? sums[path][symptom][present] / count : 0.0;
+        };
+        printf("  %-10s  %9ld  %8.4f  %8.4f  %8.4f  %8.4f  %8.5f  %8.5f\n", names[symptom], windows,
+            mean(0, 0), mean(0, 1), mean(1, 0), mean(1, 1), diff_sums[symptom] / windows, diff_max[symptom]);
+    }
+
+    // Spectra are the analyzer's own, except the Q15 path's float copies for the stream packer and episodes
+    const size_t float_spectra = 2 * sizeof(float[3][BATCH_SIZE / 2 + 1]);
+    printf("  %-18s  %8s  %8s  %8s\n", "memory (bytes)", "float", "q15", "f16");
+    printf("  %-18s  %8zu  %8zu  %8zu\n", "batch", sizeof(IMUBatch), sizeof(IMUBatchQ15), sizeof(IMUBatchF16));
+    printf("  %-18s  %8zu  %8zu  %8zu\n", "analyzer", sizeof(SymptomAnalyzer), sizeof(SymptomAnalyzerQ15),
+        sizeof(SymptomAnalyzerF16));
+    printf("  %-18s  %8zu  %8zu  %8zu\n", "  of which spectra", float_spectra,
+        2 * sizeof(SymptomAnalyzerQ15::accelerometer_frequency_magnitudes),
+        2 * sizeof(SymptomAnalyzerF16::accelerometer_frequency_magnitudes));
+    printf("  %-18s  %8d  %8zu  %8d\n", "widened copies", 0, float_spectra, 0);
+
+    bool conversions_exact = round_trip_errors == 0 && narrow_errors == 0 && reference_mismatches == 0;
+    bool close = std::max(spectrum_error_max[0], spectrum_error_max[1]) <= F16_MAX_SPECTRUM_ERROR &&
+        *std::max_element(diff_max, diff_max + 3) <= F16_MAX_INTENSITY_DIFF;
+    printf("  conversions exact: %s; spectra within %.1f%% and intensities within %.3f of float: %s\n",
+        conversions_exact ? "ok" : "FAIL", 100.0 * F16_MAX_SPECTRUM_ERROR, F16_MAX_INTENSITY_DIFF, close ? "ok" : "FAIL");
+    return conversions_exact && close ? 0 : 1;
+}
+
+typedef struct {
+    const char *name;
+    const char *usage;
+    int (*run)(int argc, char **argv);
+} Benchmark;
+
+static const Benchmark benchmarks[] = {
+    { "streams", "[streams_per_thread] [batches_per_stream] [threads]", bench_streams },
+    { "replay", "<trace> [passes]", bench_replay },
+    { "accuracy", "[hours] [seed]", bench_accuracy },
+    { "deadline", "[processing_ms] [jitter_ms] [batches]", bench_deadline },
+    { "pipeline", "[period_ms] [sink_ms] [sink_jitter_ms] [batches]", bench_pipeline },
+    { "log", "[calls]", bench_log },
+    { "telemetry", "[frames]", bench_telemetry },
+    { "stream", "[raw|spectral] [att_mtu] [interval_ms] [packets_per_event] [seconds]", bench_stream },
+    { "notify", "[trace|synth] [min_interval_s] [max_staleness_s]", bench_notify },
+    { "history", "[device_kb] [days] [backing_file]", bench_history },
+    { "codec", "[trace|synth] [synth_hours]", bench_codec },
+    { "episodes", "[trace|synth] [synth_hours]", bench_episodes },
+    { "quantiles", "[trace|synth] [synth_days]", bench_quantiles },
+    { "boot", "[trace|synth|flat] [boots]", bench_boot },
+    { "calibration", "[hours] [store_file]", bench_calibration },
+    { "orientation", "[hours] [block]", bench_orientation },
+    { "matrix", "[calls]", bench_matrix },
+    { "rotate", "[vectors]", bench_rotate },
+    { "decimate", "[output_samples]", bench_decimate },
+    { "adaptive", "[hours] [rest_s]", bench_adaptive },
+    { "resample", "[seconds] [drop_percent] [jitter_us] [drift_ppm]", bench_resample },
+    { "q15", "[hours] [seed]", bench_q15 },
+    { "f16", "[hours] [seed]", bench_f16 },
+};
+
+int main(int argc, char **argv) {
+    for (const Benchmark &benchmark : benchmarks) {
+        if (argc > 1 && strcmp(argv[1], benchmark.name) == 0) {
+            return benchmark.run(argc - 2, argv + 2);
+        }
+    }
+    fprintf(stderr, "usage: %s <benchmark> [args]\n", argv[0]);
+    for (const Benchmark &benchmark : benchmarks) {
+        fprintf(stderr, "  %s %s\n", benchmark.name, benchmark.usage);
+    }
+    return 1;
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+//! A stand-in for the GATT server and the radio link behind it, for testing BLE streaming on a host.
+//! Time is simulated: the caller advances it one connection event at a time, so runs are fast and repeatable.
+//!
+//! Like the real stack, notify() copies the packet into one of a few transmit buffers and fails when
+//! they're all taken. Each connection event sends up to packets_per_event of them to the central,
+//! which checks sequence numbers and positions the way a real client would.
+
+#include <deque>
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+
+#include "byte_order.hpp"
+#include "stream_packer.hpp"
+
+class MockGattServer {
+public:
+    MockGattServer(int att_mtu, int packets_per_event, int tx_buffers) :
+        _payload_max(att_mtu - 3), _packets_per_event(packets_per_event), _tx_buffers(tx_buffers) {}
+
+    /** Queue a notification. False if it's too big for the MTU or every transmit buffer is in use. */
+    bool notify(const uint8_t *data, int size) {
+        if (size > _payload_max || (int)_queued.size() >= _tx_buffers) return false;
+        _queued.emplace_back(data, data + size);
+        return true;
+    }
+
+    /** Run one connection event: deliver what fits to the central.
+     * @return The number of packets sent, i.e. transmit buffers freed
+     */
+    int connection_event() {
+        int sent = 0;
+        while (sent < _packets_per_event && !_queued.empty()) {
+            receive(_queued.front());
+            _queued.pop_front();
+            sent++;
+        }
+        return sent;
+    }
+
+    // What the central saw
+    long packets = 0;
+    long bytes = 0;
+    long lost_packets = 0;    // From gaps in the sequence numbers
+    long raw_samples = 0;
+    long raw_gap_samples = 0; // Samples missing between consecutive raw packets
+    long spectral_bins = 0;
+
+private:
+    void receive(const std::vector<uint8_t> &packet) {
+        packets++;
+        bytes += (long)packet.size();
+        uint8_t type = packet[0];
+        uint8_t count = packet[1];
+        uint16_t sequence = get_u16(&packet[2]);
+        uint32_t position = get_u32(&packet[4]);
+
+        if (_have_sequence) lost_packets += (uint16_t)(sequence - _last_sequence - 1);
+        _last_sequence = sequence;
+        _have_sequence = true;
+
+        if (type == STREAM_PACKET_RAW) {
+            if (_have_raw && position > _next_raw) raw_gap_samples += position - _next_raw;
+            _next_raw = position + count;
+            _have_raw = true;
+            raw_samples += count;
+        } else if (type == STREAM_PACKET_SPECTRAL) {
+            spectral_bins += count;
+        }
+    }
+
+    int _payload_max;
+    int _packets_per_event;
+    int _tx_buffers;
+    std::deque<std::vector<uint8_t>> _queued;
+
+    bool _have_sequence = false;
+    uint16_t _last_sequence = 0;
+    bool _have_raw = false;
+    uint32_t _next_raw = 0;
+};
@@ -0,0 +1,184 @@
+//! Generates synthetic IMU traces with ground-truth labels (see imu_synth.hpp).
+//! The trace is binary unless the output name ends in .csv; the labels are written as
+//! "start_sample,end_sample,labels" segments, where labels is a '+' separated list.
+//!
+//! Build & run with: platformio run -e native_synth && .pio/build/native_synth/program -d 86400 -o day.bin -l day.labels.csv
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include "imu_synth.hpp"
+#include "trace_replay.hpp"
+
+#define CHUNK_SAMPLES 4096
+
+typedef struct {
+    const char *flag;
+    float SynthConfig::*field;
+    const char *help;
+} FloatOption;
+
+static const FloatOption float_options[] = {
+    { "--tremor-hz",       &SynthConfig::tremor_hz,            "tremor frequency" },
+    { "--tremor-g",        &SynthConfig::tremor_g,             "tremor amplitude" },
+    { "--dyskinesia-g",    &SynthConfig::dyskinesia_g,         "dyskinesia amplitude" },
+    { "--cadence-hz",      &SynthConfig::cadence_hz,           "steps per second" },
+    { "--gait-g",          &SynthConfig::gait_g,               "gait bounce amplitude" },
+    { "--rest-s",          &SynthConfig::rest_s,               "mean rest duration" },
+    { "--tremor-s",        &SynthConfig::tremor_s,             "mean tremor episode duration" },
+    { "--dyskinesia-s",    &SynthConfig::dyskinesia_s,         "mean dyskinesia burst duration" },
+    { "--walking-s",       &SynthConfig::walking_s,            "mean walking duration" },
+    { "--freeze-s",        &SynthConfig::freeze_s,             "mean freeze duration" },
+    { "--p-freeze",        &SynthConfig::p_freeze,             "chance that walking ends in a freeze" },
+    { "--turn-every-s",    &SynthConfig::orientation_change_s, "mean time between orientation changes" },
+    { "--accel-noise-g",   &SynthConfig::accel_noise_g,        "accelerometer noise" },
+    { "--gyro-noise-dps",  &SynthConfig::gyro_noise_dps,       "gyroscope noise" },
+};
+
+static void usage(const char *program) {
+    fprintf(stderr, "usage: %s [-d seconds] [-s seed] [-o trace.bin|trace.csv] [-l labels.csv] [--bench] [options]\n", program);
+    for (const FloatOption &option : float_options) {
+        fprintf(stderr, "  %-16s <value>  %s\n", option.flag, option.help);
+    }
+}
+
+/** Write the labels as segments of identical flags */
+class LabelWriter {
+public:
+    bool open(const char *path) {
+        _file = fopen(path, "w");
+        if (_file) fprintf(_file, "start_sample,end_sample,labels\n");
+        return _file != nullptr;
+    }
+
+    void write(const uint8_t *labels, long n) {
+        for (long i = 0; i < n; i++, _position++) {
+            if (labels[i] != _label) {
+                flush();
+                _label = labels[i];
+                _start = _position;
+            }
+        }
+    }
+
+    void close() {
+        if (!_file) return;
+        flush();
+        fclose(_file);
+        _file = nullptr;
+    }
+
+private:
+    void flush() {
+        if (!_file || _position == _start) return;
+        static const char *names[] = { "tremor", "dyskinesia", "walking", "freeze", "turning" };
+        fprintf(_file, "%ld,%ld,", _start, _position);
+        bool first = true;
+        for (int bit = 0; bit < 5; bit++) {
+            if (_label & (1 << bit)) {
+                fprintf(_file, "%s%s", first ? "" : "+", names[bit]);
+                first = false;
+            }
+        }
+        fprintf(_file, "%s\n", first ? "rest" : "");
+    }
+
+    FILE *_file = nullptr;
+    uint8_t _label = 0;
+    long _start = 0, _position = 0;
+};
+
+int main(int argc, char **argv) {
+    SynthConfig config = synth_default_config();
+    double duration_s = 3600.0;
+    const char *trace_path = nullptr;
+    const char *labels_path = nullptr;
+    bool bench = false;
+
+    for (int i = 1; i < argc; i++) {
+        bool has_value = i + 1 < argc;
+        bool matched = false;
+        for (const FloatOption &option : float_options) {
+            if (strcmp(argv[i], option.flag) == 0 && has_value) {
+                config.*option.field = (float)atof(argv[++i]);
+                matched = true;
+            }
+        }
+        if (matched) continue;
+
+        if (strcmp(argv[i], "-d") == 0 && has_value) {
+            duration_s = atof(argv[++i]);
+        } else if (strcmp(argv[i], "-s") == 0 && has_value) {
+            config.seed = (uint32_t)strtoul(argv[++i], nullptr, 10);
+        } else if (strcmp(argv[i], "-o") == 0 && has_value) {
+            trace_path = argv[++i];
+        } else if (strcmp(argv[i], "-l") == 0 && has_value) {
+            labels_path = argv[++i];
+        } else if (strcmp(argv[i], "--bench") == 0) {
+            bench = true;
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (!trace_path && !bench) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    TraceWriter binary;
+    FILE *csv = nullptr;
+    LabelWriter labels;
+    if (trace_path) {
+        size_t len = strlen(trace_path);
+        if (len > 4 && strcmp(trace_path + len - 4, ".csv") == 0) {
+            csv = fopen(trace_path, "w");
+            if (csv) fprintf(csv, "ax,ay,az,gx,gy,gz\n");
+        }
+        if (!csv && !binary.open(trace_path, (int)config.sample_rate)) {
+            fprintf(stderr, "Couldn't write %s\n", trace_path);
+            return 1;
+        }
+    }
+    if (labels_path && !labels.open(labels_path)) {
+        fprintf(stderr, "Couldn't write %s\n", labels_path);
+        return 1;
+    }
+
+    ImuSynth synth(config);
+    std::vector<RawImuSample> samples(CHUNK_SAMPLES);
+    std::vector<uint8_t> sample_labels(CHUNK_SAMPLES);
+    long total = (long)(duration_s * config.sample_rate);
+    double generate_seconds = 0.0;
+
+    for (long done = 0; done < total; done += CHUNK_SAMPLES) {
+        long n = total - done < CHUNK_SAMPLES ? total - done : CHUNK_SAMPLES;
+
+        auto start = std::chrono::steady_clock::now();
+        synth.generate(samples.data(), sample_labels.data(), n);
+        generate_seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        if (csv) {
+            for (long i = 0; i < n; i++) {
+                const RawImuSample &s = samples[i];
+                fprintf(csv, "%d,%d,%d,%d,%d,%d\n", s.accel[0], s.accel[1], s.accel[2], s.gyro[0], s.gyro[1], s.gyro[2]);
+            }
+        } else if (trace_path) {
+            binary.write(samples.data(), n);
+        }
+        labels.write(sample_labels.data(), n);
+    }
+
+    if (csv) fclose(csv);
+    if (trace_path && !csv) binary.close();
+    labels.close();
+
+    if (bench) {
+        fprintf(stderr, "generated %ld samples (%.1f h) in %.3f s: %.1f M samples/s\n",
+            total, total / (3600.0 * config.sample_rate), generate_seconds, total / generate_seconds / 1e6);
+    }
+    return 0;
+}